@@ -100,6 +100,10 @@ public IUnknown {
 
     STDMETHOD_(bool, GetInverseAlpha)() const PURE;
     STDMETHOD_(void, SetInverseAlpha)(bool bInverted) PURE;
+
+    // Whether the bits still hold the 32-bit ARGB picture drawn before the last Unlock,
+    // so that an IIncrementalSubPicProvider can update them instead of drawing anew.
+    STDMETHOD_(bool, IsUpdatable)() const PURE;
 };
 
 //
@@ -148,6 +152,33 @@ public IUnknown {
     STDMETHOD(GetRelativeTo)(POSITION pos, RelativeTo & relativeTo) PURE;
 };
 
+//
+// IIncrementalSubPicProvider
+//
+
+interface __declspec(uuid("A32DA0A0-5A45-43D1-8917-330DDAC1B6C6"))
+IIncrementalSubPicProvider :
+public IUnknown {
+    // Same as ISubPicProvider::Render, except that if bUpdate is set spd still holds what the
+    // previous call drew and was not cleared, see ISubPic::IsUpdatable. Only the parts which changed are then erased
+    // with clearColor and painted again, dirty receives them. bbox covers the whole picture.
+    STDMETHOD(RenderUpdate)(SubPicDesc & spd, REFERENCE_TIME rt, double fps, bool bUpdate, DWORD clearColor,
+                            RECT & bbox, RECT & dirty) PURE;
+};
+
+//
+// IUnchangedSubPicProvider
+//
+
+interface __declspec(uuid("F29EF222-E40E-4E04-B903-86E0D42407A5"))
+IUnchangedSubPicProvider :
+public IUnknown {
+    // The time until which rendering an animated subtitle again would draw exactly what the last
+    // call to Render drew at rt, so that the queue can keep showing that picture instead. Returns
+    // rt when it can't tell or when rt and fps aren't those of the last call.
+    STDMETHOD_(REFERENCE_TIME, GetUnchangedUntil)(REFERENCE_TIME rt, double fps) PURE;
+};
+
 //
 // ISubPicQueue
 //
@@ -170,6 +201,22 @@ public IUnknown {
     STDMETHOD_(bool, LookupSubPic)(REFERENCE_TIME rtNow /*[in]*/, bool bAdviseBlocking, CComPtr<ISubPic>& pSubPic /*[out]*/) PURE;
 };
 
+//
+// ISubPicQueueFrameStats
+//
+
+struct SubPicQueueFrameStats {
+    ULONGLONG nRendered;  // Pictures drawn by the provider
+    ULONGLONG nReused;    // Animation frames covered by a picture drawn for an earlier frame
+    ULONGLONG nDisplayed; // Pictures returned by LookupSubPic
+};
+
+interface __declspec(uuid("493CBF9A-7732-4535-B172-75E2D828A94B"))
+ISubPicQueueFrameStats :
+public IUnknown {
+    STDMETHOD(GetFrameStats)(SubPicQueueFrameStats* pStats /*[out]*/) PURE;
+};
+
 //
 // ISubPicAllocatorPresenter
 //
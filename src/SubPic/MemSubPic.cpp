@@ -305,6 +305,12 @@ STDMETHODIMP CMemSubPic::Unlock(RECT* pDirtyRect)
     return S_OK;
 }
 
+STDMETHODIMP_(bool) CMemSubPic::IsUpdatable() const
+{
+    // Unlock converts the dirty part in place to the other types
+    return m_spd.type == MSP_RGB32 || m_spd.type == MSP_RGB24 || m_spd.type == MSP_RGBA;
+}
+
 #ifdef _WIN64
 void AlphaBlt_YUY2_SSE2(int w, int h, BYTE* d, int dstpitch, BYTE* s, int srcpitch)
 {
@@ -60,6 +60,7 @@ public:
     STDMETHODIMP Lock(SubPicDesc& spd);
     STDMETHODIMP Unlock(RECT* pDirtyRect);
     STDMETHODIMP AlphaBlt(RECT* pSrc, RECT* pDst, SubPicDesc* pTarget);
+    STDMETHODIMP_(bool) IsUpdatable() const;
 };
 
 // CMemSubPicAllocator
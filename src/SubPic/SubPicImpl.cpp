@@ -249,6 +249,11 @@ STDMETHODIMP_(void) CSubPicImpl::SetInverseAlpha(bool bInverted)
     m_bInvAlpha = bInverted;
 }
 
+STDMETHODIMP_(bool) CSubPicImpl::IsUpdatable() const
+{
+    return true;
+}
+
 STDMETHODIMP CSubPicImpl::GetRelativeTo(RelativeTo* pRelativeTo) const
 {
     CheckPointer(pRelativeTo, E_POINTER);
@@ -108,6 +108,7 @@ public:
     STDMETHODIMP_(void) SetSegmentStop(REFERENCE_TIME rtStop);
     STDMETHODIMP_(bool) GetInverseAlpha() const;
     STDMETHODIMP_(void) SetInverseAlpha(bool bInverted);
+    STDMETHODIMP_(bool) IsUpdatable() const;
 };
 
 
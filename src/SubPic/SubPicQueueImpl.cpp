@@ -42,6 +42,9 @@ CSubPicQueueImpl::CSubPicQueueImpl(SubPicQueueSettings settings, ISubPicAllocato
     , m_rtNow(0)
     , m_settings(settings)
     , m_pAllocator(pAllocator)
+    , m_nRendered(0)
+    , m_nReused(0)
+    , m_nDisplayed(0)
 {
     if (phr) {
         *phr = S_OK;
@@ -63,6 +66,7 @@ STDMETHODIMP CSubPicQueueImpl::NonDelegatingQueryInterface(REFIID riid, void** p
 {
     return
         QI(ISubPicQueue)
+        QI(ISubPicQueueFrameStats)
         __super::NonDelegatingQueryInterface(riid, ppv);
 }
 
@@ -107,22 +111,53 @@ STDMETHODIMP CSubPicQueueImpl::SetTime(REFERENCE_TIME rtNow)
     return S_OK;
 }
 
+// ISubPicQueueFrameStats
+
+STDMETHODIMP CSubPicQueueImpl::GetFrameStats(SubPicQueueFrameStats* pStats)
+{
+    CheckPointer(pStats, E_POINTER);
+
+    pStats->nRendered = m_nRendered;
+    pStats->nReused = m_nReused;
+    pStats->nDisplayed = m_nDisplayed;
+
+    return S_OK;
+}
+
 // private
 
-HRESULT CSubPicQueueImpl::RenderTo(ISubPic* pSubPic, REFERENCE_TIME rtStart, REFERENCE_TIME rtStop, double fps, BOOL bIsAnimated)
+HRESULT CSubPicQueueImpl::RenderTo(ISubPic* pSubPic, REFERENCE_TIME rtStart, REFERENCE_TIME rtStop, double fps, BOOL bIsAnimated,
+                                   REFERENCE_TIME* prtUnchangedUntil /*= nullptr*/)
 {
     CheckPointer(pSubPic, E_POINTER);
 
+    if (prtUnchangedUntil) {
+        *prtUnchangedUntil = rtStart;
+    }
+
     HRESULT hr = E_FAIL;
-    CComPtr<ISubPicProvider> pSubPicProvider;
-    if (FAILED(GetSubPicProvider(&pSubPicProvider)) || !pSubPicProvider) {
+    auto pSubPicProviderWithSharedLock = GetSubPicProviderWithSharedLock();
+    if (!pSubPicProviderWithSharedLock || !pSubPicProviderWithSharedLock->pSubPicProvider) {
         return hr;
     }
+    CComPtr<ISubPicProvider> pSubPicProvider = pSubPicProviderWithSharedLock->pSubPicProvider;
+
+    DWORD clearColor = pSubPic->GetInverseAlpha() ? 0x00000000 : 0xFF000000;
+
+    // Providers which can update their previous picture don't need it to be cleared
+    // as long as nothing else was drawn on the subpic since. A new provider always
+    // comes with a new SubPicProviderWithSharedLock.
+    CComQIPtr<IIncrementalSubPicProvider> pIncrementalProvider = pSubPicProvider;
+    bool bUpdate = pIncrementalProvider && m_pLastUpdatedSubPic == pSubPic
+                   && m_pLastUpdatedProvider.lock() == pSubPicProviderWithSharedLock
+                   && pSubPic->IsUpdatable();
+    m_pLastUpdatedSubPic.Release();
+    m_pLastUpdatedProvider.reset();
 
-    if (pSubPic->GetInverseAlpha()) {
-        hr = pSubPic->ClearDirtyRect(0x00000000);
+    if (bUpdate) {
+        hr = S_OK;
     } else {
-        hr = pSubPic->ClearDirtyRect(0xFF000000);
+        hr = pSubPic->ClearDirtyRect(clearColor);
     }
 
     SubPicDesc spd;
@@ -139,12 +174,34 @@ HRESULT CSubPicQueueImpl::RenderTo(ISubPic* pSubPic, REFERENCE_TIME rtStart, REF
         } else {
             rtRender = rtStart + std::llround((rtStop - rtStart - 1) * m_settings.nRenderAtWhenAnimationIsDisabled / 100.0);
         }
-        hr = pSubPicProvider->Render(spd, rtRender, fps, r);
+        if (pIncrementalProvider) {
+            CRect rDirty;
+            hr = pIncrementalProvider->RenderUpdate(spd, rtRender, fps, bUpdate, clearColor, r, rDirty);
+#if SUBPIC_TRACE_LEVEL > 1
+            TRACE(_T("RenderTo: %s %dx%d out of %dx%d\n"), bUpdate ? _T("updated") : _T("rendered"),
+                  rDirty.Width(), rDirty.Height(), r.Width(), r.Height());
+#endif
+        } else {
+            hr = pSubPicProvider->Render(spd, rtRender, fps, r);
+        }
+        m_nRendered++;
+
+        if (prtUnchangedUntil && SUCCEEDED(hr)) {
+            CComQIPtr<IUnchangedSubPicProvider> pUnchangedProvider = pSubPicProvider;
+            if (pUnchangedProvider) {
+                *prtUnchangedUntil = pUnchangedProvider->GetUnchangedUntil(rtRender, fps);
+            }
+        }
 
         pSubPic->SetStart(rtStart);
         pSubPic->SetStop(rtStop);
 
         pSubPic->Unlock(r);
+
+        if (pIncrementalProvider && SUCCEEDED(hr)) {
+            m_pLastUpdatedSubPic = pSubPic;
+            m_pLastUpdatedProvider = pSubPicProviderWithSharedLock;
+        }
     }
 
     return hr;
@@ -401,6 +458,8 @@ STDMETHODIMP_(bool) CSubPicQueue::LookupSubPic(REFERENCE_TIME rtNow, bool bAdvis
     }
 
     if (ppSubPic) {
+        m_nDisplayed++;
+
         // Save the subpic for later reuse
         std::lock_guard<std::mutex> lock(m_mutexSubpic);
         m_pSubPic = ppSubPic;
@@ -590,9 +649,10 @@ DWORD CSubPicQueue::ThreadProc()
 
                         HRESULT hr;
                         if (bIsAnimated) {
+                            REFERENCE_TIME rtUnchangedUntil;
                             // 3/4 is a magic number we use to avoid reusing the wrong frame due to slight
                             // misprediction of the frame end time
-                            hr = RenderTo(pStatic, rtCurrent, std::min(rtCurrent + rtTimePerSubFrame * 3 / 4, rtStopReal), fps, bIsAnimated);
+                            hr = RenderTo(pStatic, rtCurrent, std::min(rtCurrent + rtTimePerSubFrame * 3 / 4, rtStopReal), fps, bIsAnimated, &rtUnchangedUntil);
                             // Set the segment start and stop timings
                             pStatic->SetSegmentStart(rtStart);
                             // The stop timing can be moved so that the duration from the current start time
@@ -602,6 +662,17 @@ DWORD CSubPicQueue::ThreadProc()
                             // but it's much less annoying than having the subtitle disappearing for one frame
                             pStatic->SetSegmentStop(std::max(rtCurrent + rtTimePerFrame, rtStopReal));
                             rtCurrent = std::min(rtCurrent + rtTimePerSubFrame, rtStopReal);
+                            // The next frames would be rendered in the middle of their own 3/4 of a frame, as long
+                            // as the provider would draw the same picture there this one can be shown instead
+                            while (SUCCEEDED(hr) && rtCurrent < rtStopReal) {
+                                REFERENCE_TIME rtNextStop = std::min(rtCurrent + rtTimePerSubFrame * 3 / 4, rtStopReal);
+                                if ((rtCurrent + rtNextStop) / 2 >= rtUnchangedUntil) {
+                                    break;
+                                }
+                                pStatic->SetStop(rtNextStop);
+                                rtCurrent = std::min(rtCurrent + rtTimePerSubFrame, rtStopReal);
+                                m_nReused++;
+                            }
                         } else {
                             hr = RenderTo(pStatic, rtStart, rtStopReal, fps, bIsAnimated);
                             // Non-animated subtitles aren't part of a segment
@@ -762,6 +833,7 @@ STDMETHODIMP_(bool) CSubPicQueueNoThread::LookupSubPic(REFERENCE_TIME rtNow, boo
                     // Force a one frame duration
                     rtStop = rtNow + 1;
                 }
+                REFERENCE_TIME rtSegmentStop = rtStop;
 
                 if (bAnimated) {
                     rtStart = rtNow;
@@ -796,19 +868,28 @@ STDMETHODIMP_(bool) CSubPicQueueNoThread::LookupSubPic(REFERENCE_TIME rtNow, boo
                         pSubPic = m_pSubPic;
                     }
 
+                    REFERENCE_TIME rtUnchangedUntil;
                     if (m_pAllocator->IsDynamicWriteOnly()) {
                         CComPtr<ISubPic> pStatic;
                         if (SUCCEEDED(m_pAllocator->GetStatic(&pStatic))
-                                && SUCCEEDED(RenderTo(pStatic, rtStart, rtStop, fps, bAnimated))
+                                && SUCCEEDED(RenderTo(pStatic, rtStart, rtStop, fps, bAnimated, &rtUnchangedUntil))
                                 && SUCCEEDED(pStatic->CopyTo(pSubPic))) {
                             ppSubPic = pSubPic;
                         }
                     } else {
-                        if (SUCCEEDED(RenderTo(pSubPic, rtStart, rtStop, fps, bAnimated))) {
+                        if (SUCCEEDED(RenderTo(pSubPic, rtStart, rtStop, fps, bAnimated, &rtUnchangedUntil))) {
                             ppSubPic = pSubPic;
                         }
                     }
 
+                    if (ppSubPic && bAnimated) {
+                        // The next frames would be rendered half a frame after their start, see RenderTo
+                        REFERENCE_TIME rtUnchangedStop = std::min(rtUnchangedUntil - m_rtTimePerSubFrame / 2, rtSegmentStop);
+                        if (rtUnchangedStop > rtStop) {
+                            ppSubPic->SetStop(rtUnchangedStop);
+                        }
+                    }
+
                     if (ppSubPic) {
                         if (SUCCEEDED(hr)) {
                             ppSubPic->SetVirtualTextureSize(virtualSize, virtualTopLeft);
@@ -826,6 +907,10 @@ STDMETHODIMP_(bool) CSubPicQueueNoThread::LookupSubPic(REFERENCE_TIME rtNow, boo
         }
     }
 
+    if (ppSubPic) {
+        m_nDisplayed++;
+    }
+
     return !!ppSubPic;
 }
 
@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <condition_variable>
@@ -28,7 +29,7 @@
 #include "ISubPic.h"
 #include "SubPicQueueSettings.h"
 
-class CSubPicQueueImpl : public CUnknown, public ISubPicQueue
+class CSubPicQueueImpl : public CUnknown, public ISubPicQueue, public ISubPicQueueFrameStats
 {
     static const double DEFAULT_FPS;
 
@@ -96,12 +97,20 @@ protected:
 
     CComPtr<ISubPicAllocator> m_pAllocator;
 
+    // What RenderTo drew last, an incremental provider can then update it instead of drawing everything again
+    CComPtr<ISubPic> m_pLastUpdatedSubPic;
+    std::weak_ptr<SubPicProviderWithSharedLock> m_pLastUpdatedProvider;
+
+    std::atomic<ULONGLONG> m_nRendered, m_nReused, m_nDisplayed;
+
     std::shared_ptr<SubPicProviderWithSharedLock> GetSubPicProviderWithSharedLock() {
         CAutoLock cAutoLock(&m_csSubPicProvider);
         return m_pSubPicProviderWithSharedLock;
     }
 
-    HRESULT RenderTo(ISubPic* pSubPic, REFERENCE_TIME rtStart, REFERENCE_TIME rtStop, double fps, BOOL bIsAnimated);
+    // prtUnchangedUntil receives the time until which the provider would draw the same picture again
+    HRESULT RenderTo(ISubPic* pSubPic, REFERENCE_TIME rtStart, REFERENCE_TIME rtStop, double fps, BOOL bIsAnimated,
+                     REFERENCE_TIME* prtUnchangedUntil = nullptr);
 
 public:
     CSubPicQueueImpl(SubPicQueueSettings settings, ISubPicAllocator* pAllocator, HRESULT* phr);
@@ -125,6 +134,10 @@ public:
     STDMETHODIMP GetStats(int& nSubPics, REFERENCE_TIME& rtNow, REFERENCE_TIME& rtStart, REFERENCE_TIME& rtStop) PURE;
     STDMETHODIMP GetStats(int nSubPics, REFERENCE_TIME& rtStart, REFERENCE_TIME& rtStop) PURE;
     */
+
+    // ISubPicQueueFrameStats
+
+    STDMETHODIMP GetFrameStats(SubPicQueueFrameStats* pStats);
 };
 
 class CSubPicQueue : public CSubPicQueueImpl, protected CAMThread
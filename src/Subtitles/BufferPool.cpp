@@ -0,0 +1,154 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+#include "BufferPool.h"
+
+bool CBufferPool::s_bDestroyed = false;
+
+CBufferPool::CBufferPool()
+{
+    ZeroMemory(&m_stats, sizeof(m_stats));
+}
+
+CBufferPool::~CBufferPool()
+{
+    Trim();
+    // Buffers still alive past this point go straight back to the heap
+    s_bDestroyed = true;
+}
+
+CBufferPool& CBufferPool::GetInstance()
+{
+    static CBufferPool s_pool;
+    return s_pool;
+}
+
+size_t CBufferPool::GetClass(size_t size, size_t& blockSize)
+{
+    if (size <= (size_t(1) << MIN_BLOCK_SHIFT)) {
+        blockSize = size_t(1) << MIN_BLOCK_SHIFT;
+        return 0;
+    }
+
+    // Split each power of two in CLASSES_PER_SHIFT steps using the two bits after the leading one
+    size_t n = size - 1;
+    int shift = MIN_BLOCK_SHIFT;
+    while (n >> (shift + 1)) {
+        shift++;
+    }
+    size_t step = (n >> (shift - 2)) & (CLASSES_PER_SHIFT - 1);
+    blockSize = (CLASSES_PER_SHIFT + step + 1) << (shift - 2);
+
+    return (shift - MIN_BLOCK_SHIFT) * CLASSES_PER_SHIFT + step + 1;
+}
+
+void* CBufferPool::Alloc(size_t size)
+{
+    if (s_bDestroyed) {
+        return _aligned_malloc(size, ALIGNMENT);
+    }
+
+    CBufferPool& pool = GetInstance();
+    size_t blockSize;
+    size_t iClass = GetClass(size, blockSize);
+
+    {
+        std::lock_guard<std::mutex> lock(pool.m_mutex);
+
+        pool.m_stats.allocs++;
+        auto& freeList = pool.m_freeLists[iClass];
+        if (!freeList.empty()) {
+            void* p = freeList.back();
+            freeList.pop_back();
+            pool.m_stats.bytesFree -= blockSize;
+            pool.m_stats.bytesInUse += blockSize;
+            return p;
+        }
+    }
+
+    void* p = _aligned_malloc(blockSize, ALIGNMENT);
+
+    if (p) {
+        std::lock_guard<std::mutex> lock(pool.m_mutex);
+
+        pool.m_stats.heapAllocs++;
+        pool.m_stats.bytesInUse += blockSize;
+    }
+
+    return p;
+}
+
+void CBufferPool::Free(void* p, size_t size)
+{
+    if (!p) {
+        return;
+    }
+    if (s_bDestroyed) {
+        _aligned_free(p);
+        return;
+    }
+
+    CBufferPool& pool = GetInstance();
+    size_t blockSize;
+    size_t iClass = GetClass(size, blockSize);
+
+    {
+        std::lock_guard<std::mutex> lock(pool.m_mutex);
+
+        pool.m_stats.bytesInUse -= blockSize;
+        if (pool.m_stats.bytesFree + blockSize <= MAX_FREE_BYTES) {
+            try {
+                pool.m_freeLists[iClass].push_back(p);
+                pool.m_stats.bytesFree += blockSize;
+                return;
+            } catch (CMemoryException* e) {
+                e->Delete();
+            }
+        }
+        pool.m_stats.heapFrees++;
+    }
+
+    _aligned_free(p);
+}
+
+void CBufferPool::GetStats(CBufferPoolStats& stats)
+{
+    CBufferPool& pool = GetInstance();
+    std::lock_guard<std::mutex> lock(pool.m_mutex);
+
+    stats = pool.m_stats;
+}
+
+void CBufferPool::Trim()
+{
+    CBufferPool& pool = GetInstance();
+    std::lock_guard<std::mutex> lock(pool.m_mutex);
+
+    for (auto& freeList : pool.m_freeLists) {
+        for (void* p : freeList) {
+            _aligned_free(p);
+            pool.m_stats.heapFrees++;
+        }
+        freeList.clear();
+        freeList.shrink_to_fit();
+    }
+    pool.m_stats.bytesFree = 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+struct CBufferPoolStats {
+    ULONGLONG allocs;     // Buffers handed out
+    ULONGLONG heapAllocs; // Buffers which had to be taken from the heap
+    ULONGLONG heapFrees;  // Buffers given back to the heap
+    size_t bytesInUse, bytesFree;
+};
+
+// Recycles the large short-lived buffers of the subtitle renderer: overlays,
+// alpha masks, edge, scanline and blur buffers. Sizes are rounded up to one of
+// four classes per power of two, so a recycled buffer is at most 25% too big,
+// and each class keeps its own free list. Once the working set of a script is
+// reached, rendering does not need the heap for those buffers anymore.
+// The buffers are aligned on 64 bytes. Safe to use from any thread.
+class CBufferPool
+{
+public:
+    static void* Alloc(size_t size);
+    // size must be the size that was asked to Alloc
+    static void Free(void* p, size_t size);
+
+    static void GetStats(CBufferPoolStats& stats);
+    // Give the free buffers back to the heap
+    static void Trim();
+
+private:
+    enum {
+        ALIGNMENT = 64,
+        MIN_BLOCK_SHIFT = 8,
+        CLASSES_PER_SHIFT = 4,
+        CLASS_COUNT = (sizeof(size_t) * 8 - MIN_BLOCK_SHIFT) * CLASSES_PER_SHIFT + 1,
+    };
+    // The free buffers beyond this are given back to the heap
+    static const size_t MAX_FREE_BYTES = 64 * 1024 * 1024;
+
+    std::mutex m_mutex;
+    std::vector<void*> m_freeLists[CLASS_COUNT];
+    CBufferPoolStats m_stats;
+
+    static bool s_bDestroyed;
+
+    CBufferPool();
+    ~CBufferPool();
+
+    static CBufferPool& GetInstance();
+    static size_t GetClass(size_t size, size_t& blockSize);
+};
@@ -0,0 +1,285 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+#include "GlyphOutlineCache.h"
+
+namespace
+{
+    const size_t GLYPH_CACHE_SIZE = 8192;
+    const size_t GLYPH_CACHE_BYTES = 16 * 1024 * 1024;
+    // Animated font sizes can create many fonts, forget them past this point.
+    // The glyphs of forgotten fonts are evicted like any other unused entry.
+    const size_t MAX_FONTS = 1024;
+    const WORD MISSING_GLYPH = 0xffff;
+}
+
+CGlyphOutlineCache::FontKey::FontKey(const LOGFONTW& lf)
+    : height(lf.lfHeight)
+    , weight(lf.lfWeight)
+    , italic(lf.lfItalic)
+    , charSet(lf.lfCharSet)
+{
+    ZeroMemory(faceName, sizeof(faceName));
+    wcsncpy_s(faceName, lf.lfFaceName, _TRUNCATE);
+}
+
+bool CGlyphOutlineCache::FontKey::operator<(const FontKey& other) const
+{
+    if (height != other.height) {
+        return height < other.height;
+    }
+    if (weight != other.weight) {
+        return weight < other.weight;
+    }
+    if (italic != other.italic) {
+        return italic < other.italic;
+    }
+    if (charSet != other.charSet) {
+        return charSet < other.charSet;
+    }
+    return wcscmp(faceName, other.faceName) < 0;
+}
+
+CGlyphOutlineCache::CGlyphOutlineCache(size_t maxSize, size_t maxBytes)
+    : m_entries(maxSize, maxBytes)
+    , m_nextFontId(1)
+    , m_hDC(CreateCompatibleDC(nullptr))
+    , m_hFont(nullptr)
+    , m_selectedFontId(0)
+{
+    if (m_hDC) {
+        SetBkMode(m_hDC, TRANSPARENT);
+        SetTextColor(m_hDC, 0xffffff);
+        SetMapMode(m_hDC, MM_TEXT);
+    }
+}
+
+CGlyphOutlineCache::~CGlyphOutlineCache()
+{
+    if (m_hDC) {
+        DeleteDC(m_hDC);
+    }
+    if (m_hFont) {
+        DeleteObject(m_hFont);
+    }
+}
+
+std::shared_ptr<CGlyphOutlineCache> CGlyphOutlineCache::GetShared()
+{
+    static std::mutex s_mutex;
+    static std::weak_ptr<CGlyphOutlineCache> s_cache;
+
+    std::lock_guard<std::mutex> lock(s_mutex);
+    auto cache = s_cache.lock();
+    if (!cache) {
+        cache = std::make_shared<CGlyphOutlineCache>(GLYPH_CACHE_SIZE, GLYPH_CACHE_BYTES);
+        s_cache = cache;
+    }
+    return cache;
+}
+
+bool CGlyphOutlineCache::IsSimpleChar(WCHAR c)
+{
+    // Scripts which are drawn one glyph per character without any shaping or reordering.
+    // Everything else (combining marks, RTL and Indic scripts, surrogates, bidi controls
+    // and variation selectors) goes through GDI as a whole string.
+    return (c >= 0x0020 && c < 0x0300)     // Latin
+           || (c >= 0x0370 && c < 0x0483)  // Greek, Cyrillic
+           || (c >= 0x048a && c < 0x0530)  // Cyrillic
+           || (c >= 0x1e00 && c < 0x2000)  // Latin and Greek extended
+           || (c >= 0x2010 && c < 0x2028)  // Punctuation
+           || (c >= 0x2030 && c < 0x2060)  // Punctuation
+           || (c >= 0x2070 && c < 0x20d0)  // Super and subscripts, currency symbols
+           || (c >= 0x2100 && c < 0x2e00)  // Symbols
+           || (c >= 0x2e80 && c < 0x302a)  // CJK radicals and punctuation
+           || (c >= 0x3030 && c < 0x3099)  // Hiragana
+           || (c >= 0x309b && c < 0xa000)  // Katakana, CJK ideographs
+           || (c >= 0xac00 && c < 0xd7a4)  // Hangul syllables
+           || (c >= 0xf900 && c < 0xfb00)  // CJK compatibility ideographs
+           || (c >= 0xff01 && c < 0xfff0); // Halfwidth and fullwidth forms
+}
+
+UINT CGlyphOutlineCache::GetFontId(const LOGFONTW& lf)
+{
+    FontKey key(lf);
+    std::lock_guard<std::mutex> lock(m_fontsMutex);
+
+    auto it = m_fonts.find(key);
+    if (it != m_fonts.end()) {
+        return it->second;
+    }
+
+    if (m_fonts.size() >= MAX_FONTS) {
+        m_fonts.clear();
+    }
+    // The ids are never reused so that stale entries cannot be mistaken for a new font
+    UINT fontId = m_nextFontId++;
+    m_fonts.emplace(key, fontId);
+    return fontId;
+}
+
+bool CGlyphOutlineCache::SelectFont(UINT fontId, const LOGFONTW& lf)
+{
+    if (!m_hDC) {
+        return false;
+    }
+    if (m_hFont && m_selectedFontId == fontId) {
+        return true;
+    }
+
+    HFONT hFont = CreateFontIndirectW(&lf);
+    if (!hFont) {
+        return false;
+    }
+
+    SelectObject(m_hDC, hFont);
+    if (m_hFont) {
+        DeleteObject(m_hFont);
+    }
+    m_hFont = hFont;
+    m_selectedFontId = fontId;
+
+    return true;
+}
+
+CGlyphOutlineSharedPtr CGlyphOutlineCache::ExtractGlyph(WORD glyphIndex)
+{
+    auto outline = std::make_shared<CGlyphOutline>();
+
+    SIZE extent;
+    if (!GetTextExtentPointI(m_hDC, &glyphIndex, 1, &extent)) {
+        return nullptr;
+    }
+    outline->advance = extent.cx;
+
+    // Draw the glyph exactly like TextOut would have drawn it at the origin
+    if (!::BeginPath(m_hDC)) {
+        return nullptr;
+    }
+    ExtTextOutW(m_hDC, 0, 0, ETO_GLYPH_INDEX, nullptr, (LPCWSTR)&glyphIndex, 1, nullptr);
+    ::CloseFigure(m_hDC);
+    if (!::EndPath(m_hDC)) {
+        ::AbortPath(m_hDC);
+        return nullptr;
+    }
+
+    int nPoints = GetPath(m_hDC, nullptr, nullptr, 0);
+    if (nPoints < 0) {
+        return nullptr;
+    }
+    if (nPoints > 0) {
+        outline->types.resize(nPoints);
+        outline->points.resize(nPoints);
+        if (GetPath(m_hDC, outline->points.data(), outline->types.data(), nPoints) != nPoints) {
+            return nullptr;
+        }
+    }
+
+    return outline;
+}
+
+bool CGlyphOutlineCache::GetGlyphs(const LOGFONTW& lf, LPCWSTR str, int len, std::vector<CGlyphOutlineSharedPtr>& glyphs)
+{
+    // Vertical fonts rotate the glyphs while underline and strikeout
+    // span the whole string, leave those to GDI
+    if (lf.lfFaceName[0] == L'@' || lf.lfUnderline || lf.lfStrikeOut || lf.lfEscapement || lf.lfOrientation) {
+        return false;
+    }
+    for (int i = 0; i < len; i++) {
+        if (!IsSimpleChar(str[i])) {
+            return false;
+        }
+    }
+
+    glyphs.assign(len, nullptr);
+    std::vector<WORD> glyphIndices(len);
+    std::vector<int> missingChars, missingGlyphs;
+
+    UINT fontId = GetFontId(lf);
+    for (int i = 0; i < len; i++) {
+        Entry entry;
+        if (!m_entries.Lookup(CharKey(fontId, str[i]), entry)) {
+            missingChars.push_back(i);
+        } else if (entry.glyphIndex == MISSING_GLYPH) {
+            return false;
+        } else {
+            glyphIndices[i] = entry.glyphIndex;
+            if (m_entries.Lookup(GlyphKey(fontId, entry.glyphIndex), entry)) {
+                glyphs[i] = entry.outline;
+            } else {
+                missingGlyphs.push_back(i);
+            }
+        }
+    }
+
+    if (missingChars.empty() && missingGlyphs.empty()) {
+        return true;
+    }
+
+    bool bSuccess = true;
+
+    {
+        std::lock_guard<std::mutex> lock(m_dcMutex);
+
+        if (!SelectFont(fontId, lf)) {
+            return false;
+        }
+
+        for (int i : missingChars) {
+            WORD glyphIndex;
+            if (GetGlyphIndicesW(m_hDC, &str[i], 1, &glyphIndex, GGI_MARK_NONEXISTING_GLYPHS) != 1) {
+                return false;
+            }
+            // Remember the characters the font lacks so that the fallback is immediate next time
+            m_entries.SetAt(CharKey(fontId, str[i]), Entry{ glyphIndex, nullptr });
+            if (glyphIndex == MISSING_GLYPH) {
+                bSuccess = false;
+                break;
+            }
+            glyphIndices[i] = glyphIndex;
+            missingGlyphs.push_back(i);
+        }
+
+        std::unordered_map<WORD, CGlyphOutlineSharedPtr> extracted;
+        for (size_t j = 0; bSuccess && j < missingGlyphs.size(); j++) {
+            int i = missingGlyphs[j];
+            WORD glyphIndex = glyphIndices[i];
+
+            Entry entry;
+            auto it = extracted.find(glyphIndex);
+            if (it != extracted.end()) {
+                glyphs[i] = it->second;
+            } else if (m_entries.Lookup(GlyphKey(fontId, glyphIndex), entry)) {
+                // Extracted by another thread while we were waiting for the DC
+                glyphs[i] = entry.outline;
+            } else if (auto outline = ExtractGlyph(glyphIndex)) {
+                extracted.emplace(glyphIndex, outline);
+                m_entries.SetAt(GlyphKey(fontId, glyphIndex), Entry{ glyphIndex, outline });
+                glyphs[i] = outline;
+            } else {
+                TRACE(_T("CGlyphOutlineCache: failed to extract glyph %u\n"), glyphIndex);
+                bSuccess = false;
+            }
+        }
+    }
+
+    return bSuccess;
+}
@@ -0,0 +1,106 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "RenderingCache.h"
+
+struct CGlyphOutline {
+    int advance; // Horizontal distance to the next glyph
+    std::vector<BYTE> types;
+    std::vector<POINT> points;
+};
+
+typedef std::shared_ptr<const CGlyphOutline> CGlyphOutlineSharedPtr;
+
+// A process-wide cache of glyph outlines, keyed by font face, size, style and glyph index.
+// The outlines are unscaled, \fscx and \fscy are applied when the word is transformed,
+// so a glyph is only extracted from GDI once whatever the scale it is drawn at.
+// Lookups are safe from any thread. Missing glyphs are extracted on a private DC.
+class CGlyphOutlineCache
+{
+public:
+    CGlyphOutlineCache(size_t maxSize, size_t maxBytes);
+    ~CGlyphOutlineCache();
+
+    CGlyphOutlineCache(const CGlyphOutlineCache&) = delete;
+    CGlyphOutlineCache& operator=(const CGlyphOutlineCache&) = delete;
+
+    static std::shared_ptr<CGlyphOutlineCache> GetShared();
+
+    // Get the outlines of the glyphs of str drawn with the font lf, in order.
+    // Fails when str cannot be drawn glyph by glyph, i.e. when it needs complex
+    // shaping or font fallback, the caller must let GDI draw the whole string then.
+    bool GetGlyphs(const LOGFONTW& lf, LPCWSTR str, int len, std::vector<CGlyphOutlineSharedPtr>& glyphs);
+
+private:
+    struct FontKey {
+        WCHAR faceName[LF_FACESIZE];
+        LONG height;
+        LONG weight;
+        BYTE italic;
+        BYTE charSet;
+
+        explicit FontKey(const LOGFONTW& lf);
+        bool operator<(const FontKey& other) const;
+    };
+
+    // Characters map to their glyph index, glyphs to their outline
+    struct Entry {
+        WORD glyphIndex;
+        CGlyphOutlineSharedPtr outline;
+    };
+
+    struct EntrySizeTraits {
+        static size_t GetSize(uint64_t key, const Entry& entry) {
+            size_t size = sizeof(key) + sizeof(entry);
+            if (entry.outline) {
+                size += sizeof(CGlyphOutline) + entry.outline->points.size() * (sizeof(POINT) + sizeof(BYTE));
+            }
+            return size;
+        }
+    };
+
+    CConcurrentRenderingCache<uint64_t, Entry, CElementTraits<uint64_t>, CElementTraits<Entry>, EntrySizeTraits> m_entries;
+
+    std::mutex m_fontsMutex;
+    std::map<FontKey, UINT> m_fonts;
+    UINT m_nextFontId;
+
+    std::mutex m_dcMutex;
+    HDC m_hDC;
+    HFONT m_hFont;
+    UINT m_selectedFontId;
+
+    static bool IsSimpleChar(WCHAR c);
+    static uint64_t CharKey(UINT fontId, WCHAR c) { return (uint64_t(fontId) << 32) | c; }
+    static uint64_t GlyphKey(UINT fontId, WORD glyphIndex) { return (uint64_t(fontId) << 32) | 0x10000u | glyphIndex; }
+
+    UINT GetFontId(const LOGFONTW& lf);
+
+    bool SelectFont(UINT fontId, const LOGFONTW& lf);
+    CGlyphOutlineSharedPtr ExtractGlyph(WORD glyphIndex);
+};
@@ -20,6 +20,7 @@
  */
 
 #include "stdafx.h"
+#include <chrono>
 #include <cmath>
 #include <intrin.h>
 #include <algorithm>
@@ -27,8 +28,18 @@
 #include "RTS.h"
 #include "../DSUtil/PathUtils.h"
 
-// WARNING: this isn't very thread safe, use only one RTS a time. We should use TLS in future.
+// Borders (in 1/8 pixel) from which dense outlines are widened with a distance transform.
+// Below 8 pixels few ellipse centers are within reach of each other even on detailed
+// drawings, and CreateWidenedRegionFast stays the faster of the two.
+static const int WIDEN_EDT_MIN_BORDER = 64;
+
+// How far past the playback time subtitles are laid out in advance by default (ms)
+static const int LOOK_AHEAD_DEPTH = 3000;
+
+// Shared by all the instances, the look-ahead threads lay out subtitles while
+// other instances render theirs so any use of it must hold g_hDCMutex.
 static HDC g_hDC;
+static std::mutex g_hDCMutex;
 static int g_hDC_refcnt = 0;
 
 static long revcolor(long c)
@@ -38,13 +49,75 @@ static long revcolor(long c)
 
 //////////////////////////////////////////////////////////////////////////////////////////////
 
-void alpha_mask_deleter::operator()(CAlphaMask* ptr) const noexcept
+// RenderingCaches
+
+bool RenderingCaches::GetStats(int i, LPCWSTR& name, CRenderingCacheStats& stats) const
 {
-    m_alphaMaskPool.emplace_front(std::move(*ptr));
-    std::default_delete<CAlphaMask>()(ptr);
-    if (m_alphaMaskPool.size() > 10) {
-        m_alphaMaskPool.pop_back();
+    switch (i) {
+        case TEXT_DIMS_CACHE:
+            name = L"Text dimensions";
+            textDimsCache.GetStats(stats);
+            break;
+        case POLYGON_CACHE:
+            name = L"Polygons";
+            polygonCache.GetStats(stats);
+            break;
+        case SSA_TAGS_CACHE:
+            name = L"SSA tags";
+            SSATagsCache.GetStats(stats);
+            break;
+        case ELLIPSE_CACHE:
+            name = L"Ellipses";
+            ellipseCache.GetStats(stats);
+            break;
+        case OUTLINE_CACHE:
+            name = L"Outlines";
+            outlineCache.GetStats(stats);
+            break;
+        case OVERLAY_CACHE:
+            name = L"Overlays";
+            overlayCache.GetStats(stats);
+            break;
+        case ALPHA_MASK_CACHE:
+            name = L"Alpha masks";
+            alphaMaskCache.GetStats(stats);
+            break;
+        default:
+            return false;
     }
+
+    return true;
+}
+
+bool RenderingCaches::SetMaxBytes(int i, size_t maxBytes)
+{
+    switch (i) {
+        case TEXT_DIMS_CACHE:
+            textDimsCache.SetMaxBytes(maxBytes);
+            break;
+        case POLYGON_CACHE:
+            polygonCache.SetMaxBytes(maxBytes);
+            break;
+        case SSA_TAGS_CACHE:
+            SSATagsCache.SetMaxBytes(maxBytes);
+            break;
+        case ELLIPSE_CACHE:
+            ellipseCache.SetMaxBytes(maxBytes);
+            break;
+        case OUTLINE_CACHE:
+            outlineCache.SetMaxBytes(maxBytes);
+            break;
+        case OVERLAY_CACHE:
+            overlayCache.SetMaxBytes(maxBytes);
+            break;
+        case ALPHA_MASK_CACHE:
+            alphaMaskCache.SetMaxBytes(maxBytes);
+            break;
+        default:
+            return false;
+    }
+
+    return true;
 }
 
 // CMyFont
@@ -52,19 +125,14 @@ void alpha_mask_deleter::operator()(CAlphaMask* ptr) const noexcept
 CMyFont::CMyFont(const STSStyle& style)
 {
     LOGFONT lf;
-    ZeroMemory(&lf, sizeof(lf));
-    lf <<= style;
-    lf.lfHeight = (LONG)(style.fontSize + 0.5);
-    lf.lfOutPrecision = OUT_TT_PRECIS;
-    lf.lfClipPrecision = CLIP_DEFAULT_PRECIS;
-    lf.lfQuality = ANTIALIASED_QUALITY;
-    lf.lfPitchAndFamily = DEFAULT_PITCH | FF_DONTCARE;
+    GetLogFont(style, lf);
 
     if (!CreateFontIndirect(&lf)) {
         _tcscpy_s(lf.lfFaceName, _T("Arial"));
         VERIFY(CreateFontIndirect(&lf));
     }
 
+    std::lock_guard<std::mutex> lock(g_hDCMutex);
     HFONT hOldFont = SelectFont(g_hDC, *this);
     TEXTMETRIC tm;
     GetTextMetrics(g_hDC, &tm);
@@ -73,6 +141,17 @@ CMyFont::CMyFont(const STSStyle& style)
     SelectFont(g_hDC, hOldFont);
 }
 
+void CMyFont::GetLogFont(const STSStyle& style, LOGFONT& lf)
+{
+    ZeroMemory(&lf, sizeof(lf));
+    lf <<= style;
+    lf.lfHeight = (LONG)(style.fontSize + 0.5);
+    lf.lfOutPrecision = OUT_TT_PRECIS;
+    lf.lfClipPrecision = CLIP_DEFAULT_PRECIS;
+    lf.lfQuality = ANTIALIASED_QUALITY;
+    lf.lfPitchAndFamily = DEFAULT_PITCH | FF_DONTCARE;
+}
+
 // CWord
 
 CWord::CWord(const STSStyle& style, CStringW str, int ktype, int kstart, int kend, double scalex, double scaley,
@@ -156,16 +235,32 @@ void CWord::Paint(const CPoint& p, const CPoint& org)
                     int rx = std::max<int>(0, std::lround(m_style.outlineWidthX));
                     int ry = std::max<int>(0, std::lround(m_style.outlineWidthY));
 
-                    if (!m_pEllipse || m_pEllipse->GetXRadius() != rx || m_pEllipse->GetYRadius() != ry) {
-                        CEllipseKey ellipseKey(rx, ry);
-                        if (!m_renderingCaches.ellipseCache.Lookup(ellipseKey, m_pEllipse)) {
-                            m_pEllipse = std::make_shared<CEllipse>(rx, ry);
+                    auto createWidenedRegion = [&]() {
+                        if (!m_pEllipse || m_pEllipse->GetXRadius() != rx || m_pEllipse->GetYRadius() != ry) {
+                            CEllipseKey ellipseKey(rx, ry);
+                            if (!m_renderingCaches.ellipseCache.Lookup(ellipseKey, m_pEllipse)) {
+                                m_pEllipse = std::make_shared<CEllipse>(rx, ry);
 
-                            m_renderingCaches.ellipseCache.SetAt(ellipseKey, m_pEllipse);
+                                m_renderingCaches.ellipseCache.SetAt(ellipseKey, m_pEllipse);
+                            }
                         }
-                    }
 
-                    if (!CreateWidenedRegion(rx, ry)) {
+                        return CreateWidenedRegion(rx, ry);
+                    };
+
+                    if (std::max(rx, ry) >= WIDEN_EDT_MIN_BORDER && PreferWidenedRegionEDT(rx, ry)) {
+                        if (!CreateWidenedRegionEDT(rx, ry)) {
+                            return;
+                        }
+#ifdef _DEBUG
+                        // Both ways of widening the outline must give exactly the same spans
+                        tSpanBuffer wideOutlineEDT;
+                        wideOutlineEDT.swap(m_pOutlineData->mWideOutline);
+                        VERIFY(createWidenedRegion());
+                        ASSERT(m_pOutlineData->mWideOutline == wideOutlineEDT);
+                        m_pOutlineData->mWideOutline.swap(wideOutlineEDT);
+#endif
+                    } else if (!createWidenedRegion()) {
                         return;
                     }
                 } else if (m_style.borderStyle == 1) {
@@ -198,11 +293,13 @@ void CWord::Transform(CPoint org)
 {
 #if defined(_M_IX86_FP) && _M_IX86_FP < 2
     if (!m_bUseSSE2) {
-        Transform_C(org);
+        TransformPoints_C(mpPathPoints, mPathPoints, m_style, m_scalex, m_scaley, org);
     } else
 #endif
-    {
-        Transform_SSE2(org);
+    if (m_bUseAVX2) {
+        TransformPoints_AVX2(mpPathPoints, mPathPoints, m_style, m_scalex, m_scaley, org);
+    } else {
+        TransformPoints_SSE2(mpPathPoints, mPathPoints, m_style, m_scalex, m_scaley, org);
     }
 }
 
@@ -241,31 +338,31 @@ bool CWord::CreateOpaqueBox()
     return !!m_pOpaqueBox;
 }
 
-void CWord::Transform_C(const CPoint& org)
+void TransformPoints_C(POINT* points, int count, const STSStyle& style, double scalex, double scaley, const CPoint& org)
 {
-    const double scalex = m_style.fontScaleX / 100.0;
-    const double scaley = m_style.fontScaleY / 100.0;
-    const double xzoomf = m_scalex * 20000.0;
-    const double yzoomf = m_scaley * 20000.0;
+    const double xscale = style.fontScaleX / 100.0;
+    const double yscale = style.fontScaleY / 100.0;
+    const double xzoomf = scalex * 20000.0;
+    const double yzoomf = scaley * 20000.0;
 
-    const double caz = cos((M_PI / 180.0) * m_style.fontAngleZ);
-    const double saz = sin((M_PI / 180.0) * m_style.fontAngleZ);
-    const double cax = cos((M_PI / 180.0) * m_style.fontAngleX);
-    const double sax = sin((M_PI / 180.0) * m_style.fontAngleX);
-    const double cay = cos((M_PI / 180.0) * m_style.fontAngleY);
-    const double say = sin((M_PI / 180.0) * m_style.fontAngleY);
+    const double caz = cos((M_PI / 180.0) * style.fontAngleZ);
+    const double saz = sin((M_PI / 180.0) * style.fontAngleZ);
+    const double cax = cos((M_PI / 180.0) * style.fontAngleX);
+    const double sax = sin((M_PI / 180.0) * style.fontAngleX);
+    const double cay = cos((M_PI / 180.0) * style.fontAngleY);
+    const double say = sin((M_PI / 180.0) * style.fontAngleY);
 
     double dOrgX = static_cast<double>(org.x), dOrgY = static_cast<double>(org.y);
-    for (ptrdiff_t i = 0; i < mPathPoints; i++) {
+    for (ptrdiff_t i = 0; i < count; i++) {
         double x, y, z, xx, yy, zz;
 
-        x = mpPathPoints[i].x;
-        y = mpPathPoints[i].y;
+        x = points[i].x;
+        y = points[i].y;
         z = 0;
 
-        const double dPPx = m_style.fontShiftX * y + x;
-        y = scaley * (m_style.fontShiftY * x + y) - dOrgY;
-        x = scalex * dPPx - dOrgX;
+        const double dPPx = style.fontShiftX * y + x;
+        y = yscale * (style.fontShiftY * x + y) - dOrgY;
+        x = xscale * dPPx - dOrgX;
 
         xx = x * caz + y * saz;
         yy = -(x * saz - y * caz);
@@ -283,149 +380,145 @@ void CWord::Transform_C(const CPoint& org)
         y = yy * yzoomf / std::max((zz + yzoomf), 1000.0);
 
         // round to integer
-        mpPathPoints[i].x = std::lround(x) + org.x;
-        mpPathPoints[i].y = std::lround(y) + org.y;
+        points[i].x = std::lround(x) + org.x;
+        points[i].y = std::lround(y) + org.y;
     }
 }
 
-void CWord::Transform_SSE2(const CPoint& org)
+namespace
 {
-    // SSE code
-    // speed up ~1.5-1.7x
-    const __m128 __xshift = _mm_set_ps1((float)m_style.fontShiftX);
-    const __m128 __yshift = _mm_set_ps1((float)m_style.fontShiftY);
-
-    const __m128 __xorg = _mm_set_ps1((float)org.x);
-    const __m128 __yorg = _mm_set_ps1((float)org.y);
+    // The transform of TransformPoints_C written as x' = X / max(Zx, 1000) and y' = Y / max(Zy, 1000),
+    // where X, Y, Zx and Zy are affine in the x and y of the point. The coefficients are computed
+    // in double, only the work done for every point is in float, so the results can differ from
+    // those of TransformPoints_C by one unit at rounding and by more only close to the perspective clamp.
+    struct PointTransform {
+        float x[3], y[3], zx[3], zy[3]; // Factors of x and y, then the constant term
+    };
 
-    const __m128 __xscale = _mm_set_ps1((float)(m_style.fontScaleX / 100.0));
-    const __m128 __yscale = _mm_set_ps1((float)(m_style.fontScaleY / 100.0));
-    const __m128 __xzoomf = _mm_set_ps1((float)(m_scalex * 20000.0));
-    const __m128 __yzoomf = _mm_set_ps1((float)(m_scaley * 20000.0));
+    PointTransform GetPointTransform(const STSStyle& style, double scalex, double scaley, const CPoint& org)
+    {
+        const double xscale = style.fontScaleX / 100.0;
+        const double yscale = style.fontScaleY / 100.0;
+        const double xzoomf = scalex * 20000.0;
+        const double yzoomf = scaley * 20000.0;
 
-    const __m128 __caz = _mm_set_ps1((float)cos((M_PI / 180.0) * m_style.fontAngleZ));
-    const __m128 __saz = _mm_set_ps1((float)sin((M_PI / 180.0) * m_style.fontAngleZ));
-    const __m128 __cax = _mm_set_ps1((float)cos((M_PI / 180.0) * m_style.fontAngleX));
-    const __m128 __sax = _mm_set_ps1((float)sin((M_PI / 180.0) * m_style.fontAngleX));
-    const __m128 __cay = _mm_set_ps1((float)cos((M_PI / 180.0) * m_style.fontAngleY));
-    const __m128 __say = _mm_set_ps1((float)sin((M_PI / 180.0) * m_style.fontAngleY));
+        const double caz = cos((M_PI / 180.0) * style.fontAngleZ);
+        const double saz = sin((M_PI / 180.0) * style.fontAngleZ);
+        const double cax = cos((M_PI / 180.0) * style.fontAngleX);
+        const double sax = sin((M_PI / 180.0) * style.fontAngleX);
+        const double cay = cos((M_PI / 180.0) * style.fontAngleY);
+        const double say = sin((M_PI / 180.0) * style.fontAngleY);
 
-    const __m128 __1000 = _mm_set_ps1(1000.0f);
+        // The rotations are linear, so they are applied to the shifted and scaled unit
+        // vectors and to the origin instead of to every point
+        const double xs[3] = { xscale, xscale * style.fontShiftX, -double(org.x) };
+        const double ys[3] = { yscale * style.fontShiftY, yscale, -double(org.y) };
 
-    int mPathPointsD4 = mPathPoints / 4;
-    int mPathPointsM4 = mPathPoints % 4;
+        PointTransform t;
+        for (int i = 0; i < 3; i++) {
+            double xx = xs[i] * caz + ys[i] * saz;
+            double yy = -(xs[i] * saz - ys[i] * caz);
 
-    for (ptrdiff_t i = 0; i < mPathPointsD4 + 1; i++) {
-        __m128 __pointx, __pointy, __tmpx, __tmpy;
-        // we can't use load .-.
-        if (i != mPathPointsD4) {
-            __pointx = _mm_set_ps((float)mpPathPoints[4 * i + 0].x, (float)mpPathPoints[4 * i + 1].x, (float)mpPathPoints[4 * i + 2].x, (float)mpPathPoints[4 * i + 3].x);
-            __pointy = _mm_set_ps((float)mpPathPoints[4 * i + 0].y, (float)mpPathPoints[4 * i + 1].y, (float)mpPathPoints[4 * i + 2].y, (float)mpPathPoints[4 * i + 3].y);
-        } else { // last cycle
-            switch (mPathPointsM4) {
-                default:
-                case 0:
-                    continue;
-                case 1:
-                    __pointx = _mm_set_ps((float)mpPathPoints[4 * i + 0].x, 0, 0, 0);
-                    __pointy = _mm_set_ps((float)mpPathPoints[4 * i + 0].y, 0, 0, 0);
-                    break;
-                case 2:
-                    __pointx = _mm_set_ps((float)mpPathPoints[4 * i + 0].x, (float)mpPathPoints[4 * i + 1].x, 0, 0);
-                    __pointy = _mm_set_ps((float)mpPathPoints[4 * i + 0].y, (float)mpPathPoints[4 * i + 1].y, 0, 0);
-                    break;
-                case 3:
-                    __pointx = _mm_set_ps((float)mpPathPoints[4 * i + 0].x, (float)mpPathPoints[4 * i + 1].x, (float)mpPathPoints[4 * i + 2].x, 0);
-                    __pointy = _mm_set_ps((float)mpPathPoints[4 * i + 0].y, (float)mpPathPoints[4 * i + 1].y, (float)mpPathPoints[4 * i + 2].y, 0);
-                    break;
-            }
-        }
+            double x = xx;
+            double y = yy * cax;
+            double z = yy * sax;
 
-        // scale and shift
-        __tmpy = __pointx; // save a copy for calculating __pointy later
-        if (m_style.fontShiftX != 0) {
-            __tmpx = _mm_mul_ps(__xshift, __pointy);
-            __pointx = _mm_add_ps(__pointx, __tmpx);
-        }
-        __pointx = _mm_mul_ps(__pointx, __xscale);
-        __pointx = _mm_sub_ps(__pointx, __xorg);
+            xx = x * cay + z * say;
+            yy = y;
+            double zz = x * say - z * cay;
 
-        if (m_style.fontShiftY != 0) {
-            __tmpy = _mm_mul_ps(__yshift, __tmpy);   // __tmpy is a copy of __pointx here, because it may otherwise be modified
-            __pointy = _mm_add_ps(__pointy, __tmpy);
+            t.x[i] = float(xx * xzoomf);
+            t.y[i] = float(yy * yzoomf);
+            t.zx[i] = float(i == 2 ? zz + xzoomf : zz);
+            t.zy[i] = float(i == 2 ? zz + yzoomf : zz);
         }
-        __pointy = _mm_mul_ps(__pointy, __yscale);
-        __pointy = _mm_sub_ps(__pointy, __yorg);
-
-        // rotate
 
-        __m128 __xx, __yy;
-        __m128 __zz = _mm_setzero_ps();
-
-        // xx = x * caz + y * saz
-        __tmpx   = _mm_mul_ps(__pointx, __caz);      // x * caz
-        __tmpy   = _mm_mul_ps(__pointy, __saz);      // y * saz
-        __xx     = _mm_add_ps(__tmpx, __tmpy);       // xx = x * caz + y * saz;
+        return t;
+    }
+}
 
-        // yy = -(x * saz - y * caz)
-        __tmpx   = _mm_mul_ps(__pointx, __saz);      // x * saz
-        __tmpy   = _mm_mul_ps(__pointy, __caz);      // y * caz
-        __yy     = _mm_sub_ps(__tmpy, __tmpx);       // yy = -(x * saz - y * caz) = y * caz - x * saz
+void TransformPoints_SSE2(POINT* points, int count, const STSStyle& style, double scalex, double scaley, const CPoint& org)
+{
+    const PointTransform t = GetPointTransform(style, scalex, scaley, org);
 
-        __pointx = __xx;                             // x = xx
+    const __m128 xx = _mm_set1_ps(t.x[0]), xy = _mm_set1_ps(t.x[1]), x1 = _mm_set1_ps(t.x[2]);
+    const __m128 yx = _mm_set1_ps(t.y[0]), yy = _mm_set1_ps(t.y[1]), y1 = _mm_set1_ps(t.y[2]);
+    const __m128 zxx = _mm_set1_ps(t.zx[0]), zxy = _mm_set1_ps(t.zx[1]), zx1 = _mm_set1_ps(t.zx[2]);
+    const __m128 zyx = _mm_set1_ps(t.zy[0]), zyy = _mm_set1_ps(t.zy[1]), zy1 = _mm_set1_ps(t.zy[2]);
+    const __m128 min = _mm_set1_ps(1000.0f);
+    const __m128i orgxy = _mm_set_epi32(org.y, org.x, org.y, org.x);
 
-        // y = yy * cax + zz * sax
-        __tmpx   = _mm_mul_ps(__zz, __sax);          // zz * sax
-        __tmpy   = _mm_mul_ps(__yy, __cax);          // yy * cax
-        __pointy = _mm_add_ps(__tmpy, __tmpx);       // y = yy * cax + zz * sax
+    // Four points at a time, split into their x and y
+    auto transform4 = [&](POINT * p) {
+        __m128 p01 = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+        __m128 p23 = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2)));
+        __m128 x = _mm_shuffle_ps(p01, p23, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 y = _mm_shuffle_ps(p01, p23, _MM_SHUFFLE(3, 1, 3, 1));
 
-        // z = yy * sax - zz * cax
-        __tmpx   = _mm_mul_ps(__zz, __cax);          // zz * cax
-        __tmpy   = _mm_mul_ps(__yy, __sax);          // yy * sax
-        __zz     = _mm_sub_ps(__tmpy, __tmpx);       // z = yy * sax - zz * cax
+        __m128 X = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, xx), _mm_mul_ps(y, xy)), x1);
+        __m128 Y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, yx), _mm_mul_ps(y, yy)), y1);
+        __m128 Zx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, zxx), _mm_mul_ps(y, zxy)), zx1);
+        __m128 Zy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, zyx), _mm_mul_ps(y, zyy)), zy1);
 
-        // xx = x * cay + z * say
-        __tmpx   = _mm_mul_ps(__pointx, __cay);      // x * cay
-        __tmpy   = _mm_mul_ps(__zz, __say);          // z * say
-        __xx     = _mm_add_ps(__tmpx, __tmpy);       // xx = x * cay + z * say
+        __m128i xi = _mm_cvtps_epi32(_mm_div_ps(X, _mm_max_ps(Zx, min)));
+        __m128i yi = _mm_cvtps_epi32(_mm_div_ps(Y, _mm_max_ps(Zy, min)));
 
-        __yy     = __pointy;                         // yy = y
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_add_epi32(_mm_unpacklo_epi32(xi, yi), orgxy));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 2), _mm_add_epi32(_mm_unpackhi_epi32(xi, yi), orgxy));
+    };
 
-        // zz = x * say - z * cay
-        __tmpx   = _mm_mul_ps(__pointx, __say);      // x * say
-        __zz     = _mm_mul_ps(__zz, __cay);          // z * cay
-        __zz     = _mm_sub_ps(__tmpx, __zz);         // zz = x * say - z * cay
+    ptrdiff_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        transform4(points + i);
+    }
+    if (i < count) {
+        POINT tail[4] = {};
+        std::copy(points + i, points + count, tail);
+        transform4(tail);
+        std::copy_n(tail, count - i, points + i);
+    }
+}
 
-        // x = xx * xzoomf / std::max((zz + xzoomf), 1000.0);
-        // y = yy * yzoomf / std::max((zz + yzoomf), 1000.0);
-        __m128 __tmpzz = _mm_add_ps(__zz, __xzoomf); // zz + xzoomf
+void TransformPoints_AVX2(POINT* points, int count, const STSStyle& style, double scalex, double scaley, const CPoint& org)
+{
+    const PointTransform t = GetPointTransform(style, scalex, scaley, org);
 
-        __xx     = _mm_mul_ps(__xx, __xzoomf);       // xx * xzoomf
-        __pointx = _mm_div_ps(__xx, _mm_max_ps(__tmpzz, __1000)); // x = (xx * xzoomf) / std::max((zz + xzoomf), 1000.0)
+    const __m256 xx = _mm256_set1_ps(t.x[0]), xy = _mm256_set1_ps(t.x[1]), x1 = _mm256_set1_ps(t.x[2]);
+    const __m256 yx = _mm256_set1_ps(t.y[0]), yy = _mm256_set1_ps(t.y[1]), y1 = _mm256_set1_ps(t.y[2]);
+    const __m256 zxx = _mm256_set1_ps(t.zx[0]), zxy = _mm256_set1_ps(t.zx[1]), zx1 = _mm256_set1_ps(t.zx[2]);
+    const __m256 zyx = _mm256_set1_ps(t.zy[0]), zyy = _mm256_set1_ps(t.zy[1]), zy1 = _mm256_set1_ps(t.zy[2]);
+    const __m256 min = _mm256_set1_ps(1000.0f);
+    const __m256i orgxy = _mm256_set_epi32(org.y, org.x, org.y, org.x, org.y, org.x, org.y, org.x);
 
-        __tmpzz  = _mm_add_ps(__zz, __yzoomf);       // zz + yzoomf
+    // Eight points at a time. The shuffles work within each 128-bit lane so x and y hold
+    // the points 0, 1, 4, 5, 2, 3, 6, 7, the unpacks put them back in order.
+    auto transform8 = [&](POINT * p) {
+        __m256 p0123 = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+        __m256 p4567 = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 4)));
+        __m256 x = _mm256_shuffle_ps(p0123, p4567, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 y = _mm256_shuffle_ps(p0123, p4567, _MM_SHUFFLE(3, 1, 3, 1));
 
-        __yy     = _mm_mul_ps(__yy, __yzoomf);       // yy * yzoomf
-        __pointy = _mm_div_ps(__yy, _mm_max_ps(__tmpzz, __1000)); // y = yy * yzoomf / std::max((zz + yzoomf), 1000.0);
+        __m256 X = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, xx), _mm256_mul_ps(y, xy)), x1);
+        __m256 Y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, yx), _mm256_mul_ps(y, yy)), y1);
+        __m256 Zx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, zxx), _mm256_mul_ps(y, zxy)), zx1);
+        __m256 Zy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, zyx), _mm256_mul_ps(y, zyy)), zy1);
 
-        __pointx = _mm_add_ps(__pointx, __xorg);     // x = x + org.x
-        __pointy = _mm_add_ps(__pointy, __yorg);     // y = y + org.y
+        __m256i xi = _mm256_cvtps_epi32(_mm256_div_ps(X, _mm256_max_ps(Zx, min)));
+        __m256i yi = _mm256_cvtps_epi32(_mm256_div_ps(Y, _mm256_max_ps(Zy, min)));
 
-        // round to integer
-        __m128i __pointxRounded = _mm_cvtps_epi32(__pointx);
-        __m128i __pointyRounded = _mm_cvtps_epi32(__pointy);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), _mm256_add_epi32(_mm256_unpacklo_epi32(xi, yi), orgxy));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p + 4), _mm256_add_epi32(_mm256_unpackhi_epi32(xi, yi), orgxy));
+    };
 
-        if (i == mPathPointsD4) { // last cycle
-            for (int k = 0; k < mPathPointsM4; k++) {
-                mpPathPoints[i * 4 + k].x = __pointxRounded.m128i_i32[3 - k];
-                mpPathPoints[i * 4 + k].y = __pointyRounded.m128i_i32[3 - k];
-            }
-        } else {
-            for (int k = 0; k < 4; k++) {
-                mpPathPoints[i * 4 + k].x = __pointxRounded.m128i_i32[3 - k];
-                mpPathPoints[i * 4 + k].y = __pointyRounded.m128i_i32[3 - k];
-            }
-        }
+    ptrdiff_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        transform8(points + i);
+    }
+    if (i < count) {
+        POINT tail[8] = {};
+        std::copy(points + i, points + count, tail);
+        transform8(tail);
+        std::copy_n(tail, count - i, points + i);
     }
 }
 
@@ -446,6 +539,7 @@ CText::CText(const STSStyle& style, CStringW str, int ktype, int kstart, int ken
         m_ascent  = font.m_ascent;
         m_descent = font.m_descent;
 
+        std::unique_lock<std::mutex> lock(g_hDCMutex);
         HFONT hOldFont = SelectFont(g_hDC, font);
 
         if (m_style.fontSpacing) {
@@ -470,6 +564,7 @@ CText::CText(const STSStyle& style, CStringW str, int ktype, int kstart, int ken
         }
 
         SelectFont(g_hDC, hOldFont);
+        lock.unlock();
 
         textDims.ascent  = m_ascent;
         textDims.descent = m_descent;
@@ -499,8 +594,33 @@ bool CText::Append(CWord* w)
 
 bool CText::CreatePath()
 {
+    // Assemble the word from cached glyphs when possible, the glyphs are placed
+    // exactly where TextOut would have drawn them so the result is the same
+    LOGFONT lf;
+    CMyFont::GetLogFont(m_style, lf);
+
+    std::vector<CGlyphOutlineSharedPtr> glyphs;
+    if (m_renderingCaches.glyphOutlineCache
+            && m_renderingCaches.glyphOutlineCache->GetGlyphs(lf, m_str, m_str.GetLength(), glyphs)) {
+        int width = 0;
+        bool bFirstPath = true;
+
+        for (const auto& glyph : glyphs) {
+            if (!AppendPath(glyph->types.data(), glyph->points.data(), (int)glyph->points.size(), width, 0, bFirstPath)) {
+                return false;
+            }
+            bFirstPath = false;
+
+            width += glyph->advance + (int)m_style.fontSpacing;
+        }
+
+        return true;
+    }
+
     CMyFont font(m_style);
 
+    // The path is read back from g_hDC by EndPath and PartialEndPath
+    std::lock_guard<std::mutex> lock(g_hDCMutex);
     HFONT hOldFont = SelectFont(g_hDC, font);
 
     if (m_style.fontSpacing) {
@@ -850,7 +970,7 @@ CAlphaMaskSharedPtr CClipper::GetAlphaMask(const std::shared_ptr<CClipper>& clip
     const size_t alphaMaskSize = size_t(m_size.cx) * m_size.cy;
 
     try {
-        m_pAlphaMask = CAlphaMask::Alloc(m_renderingCaches.alphaMaskPool, alphaMaskSize);
+        m_pAlphaMask = CAlphaMask::Alloc(alphaMaskSize);
     } catch (CMemoryException* e) {
         e->Delete();
         m_pAlphaMask = nullptr;
@@ -1048,7 +1168,37 @@ void CLine::Compact()
     }
 }
 
-CRect CLine::PaintShadow(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CPoint p, CPoint org, int time, int alpha)
+// Queue drawing the current overlay of pRasterizer, returns the part of the picture it will cover
+static CRect AddDrawCommand(CDrawCommands& commands, const Rasterizer* pRasterizer, const SubPicDesc& spd, const CRect& clipRect,
+                            const CAlphaMaskSharedPtr& pAlphaMask, int x, int y, const DWORD* switchpts, bool fBody, bool fBorder)
+{
+    const auto& pOverlayData = pRasterizer->GetOverlayData();
+    if (!pOverlayData || (!fBody && !fBorder)) {
+        return CRect(0, 0, 0, 0);
+    }
+
+    CRect rect = Rasterizer::GetDrawRect(*pOverlayData, spd, clipRect, x, y);
+    if (rect.IsRectEmpty()) {
+        return rect;
+    }
+
+    CDrawCommand command;
+    command.pRasterizer = pRasterizer;
+    command.pOverlayData = pOverlayData;
+    command.pAlphaMask = pAlphaMask;
+    command.clipRect = clipRect;
+    command.x = x;
+    command.y = y;
+    memcpy(command.switchpts, switchpts, sizeof(command.switchpts));
+    command.fBody = fBody;
+    command.fBorder = fBorder;
+    command.rect = rect;
+    commands.push_back(command);
+
+    return rect;
+}
+
+CRect CLine::PaintShadow(CDrawCommands& commands, const SubPicDesc& spd, const CRect& clipRect, const CAlphaMaskSharedPtr& pAlphaMask, CPoint p, CPoint org, int time, int alpha)
 {
     CRect bbox(0, 0, 0, 0);
 
@@ -1075,11 +1225,11 @@ CRect CLine::PaintShadow(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CPo
             w->Paint(CPoint(x, y), org);
 
             if (w->m_style.borderStyle == 0) {
-                bbox |= w->Draw(spd, clipRect, pAlphaMask, x, y, sw,
-                                w->m_ktype > 0 || w->m_style.alpha[0] < 0xff,
-                                (w->m_style.outlineWidthX + w->m_style.outlineWidthY > 0) && !(w->m_ktype == 2 && time < w->m_kstart));
+                bbox |= AddDrawCommand(commands, w, spd, clipRect, pAlphaMask, x, y, sw,
+                                       w->m_ktype > 0 || w->m_style.alpha[0] < 0xff,
+                                       (w->m_style.outlineWidthX + w->m_style.outlineWidthY > 0) && !(w->m_ktype == 2 && time < w->m_kstart));
             } else if (w->m_style.borderStyle == 1 && w->m_pOpaqueBox) {
-                bbox |= w->m_pOpaqueBox->Draw(spd, clipRect, pAlphaMask, x, y, sw, true, false);
+                bbox |= AddDrawCommand(commands, w->m_pOpaqueBox, spd, clipRect, pAlphaMask, x, y, sw, true, false);
             }
         }
 
@@ -1089,7 +1239,7 @@ CRect CLine::PaintShadow(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CPo
     return bbox;
 }
 
-CRect CLine::PaintOutline(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CPoint p, CPoint org, int time, int alpha)
+CRect CLine::PaintOutline(CDrawCommands& commands, const SubPicDesc& spd, const CRect& clipRect, const CAlphaMaskSharedPtr& pAlphaMask, CPoint p, CPoint org, int time, int alpha)
 {
     CRect bbox(0, 0, 0, 0);
 
@@ -1115,9 +1265,9 @@ CRect CLine::PaintOutline(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CP
             w->Paint(CPoint(x, y), org);
 
             if (w->m_style.borderStyle == 0) {
-                bbox |= w->Draw(spd, clipRect, pAlphaMask, x, y, sw, !w->m_style.alpha[0] && !w->m_style.alpha[1] && !alpha, true);
+                bbox |= AddDrawCommand(commands, w, spd, clipRect, pAlphaMask, x, y, sw, !w->m_style.alpha[0] && !w->m_style.alpha[1] && !alpha, true);
             } else if (w->m_style.borderStyle == 1 && w->m_pOpaqueBox) {
-                bbox |= w->m_pOpaqueBox->Draw(spd, clipRect, pAlphaMask, x, y, sw, true, false);
+                bbox |= AddDrawCommand(commands, w->m_pOpaqueBox, spd, clipRect, pAlphaMask, x, y, sw, true, false);
             }
         }
 
@@ -1127,7 +1277,7 @@ CRect CLine::PaintOutline(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CP
     return bbox;
 }
 
-CRect CLine::PaintBody(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CPoint p, CPoint org, int time, int alpha)
+CRect CLine::PaintBody(CDrawCommands& commands, const SubPicDesc& spd, const CRect& clipRect, const CAlphaMaskSharedPtr& pAlphaMask, CPoint p, CPoint org, int time, int alpha)
 {
     CRect bbox(0, 0, 0, 0);
 
@@ -1199,7 +1349,7 @@ CRect CLine::PaintBody(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CPoin
         sw[4] = sw[2];
         sw[5] = 0x00ffffff;
 
-        bbox |= w->Draw(spd, clipRect, pAlphaMask, x, y, sw, true, false);
+        bbox |= AddDrawCommand(commands, w, spd, clipRect, pAlphaMask, x, y, sw, true, false);
         p.x += w->m_width;
     }
 
@@ -1483,29 +1633,52 @@ void CSubtitle::MakeLines(CSize size, const CRect& marginRect)
 void CScreenLayoutAllocator::Empty()
 {
     m_subrects.RemoveAll();
+    m_layers.clear();
+    m_entries.RemoveAll();
+}
+
+void CScreenLayoutAllocator::Remove(POSITION pos)
+{
+    const SubRect& sr = m_subrects.GetAt(pos);
+
+    POSITION entryPos;
+    if (m_entries.Lookup(sr.entry, entryPos) && entryPos == pos) {
+        m_entries.RemoveKey(sr.entry);
+    }
+
+    if (sr.bIndexed) {
+        auto layer = m_layers.find(sr.layer);
+        Layer& l = layer->second;
+        l.rects.erase(sr.it);
+        if (l.rects.empty()) {
+            m_layers.erase(layer);
+        } else if (sr.r.Height() == l.maxHeight) {
+            l.maxHeight = 0;
+            for (const auto& rect : l.rects) {
+                l.maxHeight = std::max(l.maxHeight, m_subrects.GetAt(rect.second).r.Height());
+            }
+        }
+    }
+
+    m_subrects.RemoveAt(pos);
 }
 
 void CScreenLayoutAllocator::AdvanceToSegment(int segment, const CAtlArray<int>& sa)
 {
+    std::vector<int> entries(sa.GetData(), sa.GetData() + sa.GetCount());
+    std::sort(entries.begin(), entries.end());
+
     POSITION pos = m_subrects.GetHeadPosition();
     while (pos) {
         POSITION prev = pos;
 
         SubRect& sr = m_subrects.GetNext(pos);
 
-        bool fFound = false;
-
-        if (abs(sr.segment - segment) <= 1) { // using abs() makes it possible to play the subs backwards, too :)
-            for (size_t i = 0; i < sa.GetCount() && !fFound; i++) {
-                if (sa[i] == sr.entry) {
-                    sr.segment = segment;
-                    fFound = true;
-                }
-            }
-        }
-
-        if (!fFound) {
-            m_subrects.RemoveAt(prev);
+        if (abs(sr.segment - segment) <= 1 // using abs() makes it possible to play the subs backwards, too :)
+                && std::binary_search(entries.cbegin(), entries.cend(), sr.entry)) {
+            sr.segment = segment;
+        } else {
+            Remove(prev);
         }
     }
 }
@@ -1514,10 +1687,10 @@ CRect CScreenLayoutAllocator::AllocRect(const CSubtitle* s, int segment, int ent
 {
     // TODO: handle collisions == 1 (reversed collisions)
 
-    POSITION pos = m_subrects.GetHeadPosition();
-    while (pos) {
-        SubRect& sr = m_subrects.GetNext(pos);
-        if (sr.segment == segment && sr.entry == entry) {
+    POSITION pos;
+    if (m_entries.Lookup(entry, pos)) {
+        const SubRect& sr = m_subrects.GetAt(pos);
+        if (sr.segment == segment) {
             return (sr.r + CRect(0, -s->m_topborder, 0, -s->m_bottomborder));
         }
     }
@@ -1526,35 +1699,53 @@ CRect CScreenLayoutAllocator::AllocRect(const CSubtitle* s, int segment, int ent
 
     bool fSearchDown = s->m_scrAlignment > 3;
 
-    bool fOK;
-
-    do {
-        fOK = true;
-
-        pos = m_subrects.GetHeadPosition();
-        while (pos) {
-            SubRect& sr = m_subrects.GetNext(pos);
-
-            if (layer == sr.layer && !(r & sr.r).IsRectEmpty()) {
-                if (fSearchDown) {
-                    r.bottom = sr.r.bottom + r.Height();
-                    r.top = sr.r.bottom;
-                } else {
-                    r.top = sr.r.top - r.Height();
-                    r.bottom = sr.r.top;
+    auto it = m_layers.find(layer);
+    if (it != m_layers.end() && !r.IsRectEmpty()) {
+        const Layer& l = it->second;
+
+        // The rect only ever moves past a rect it overlaps, to its edge, so it ends at the
+        // first place where it overlaps nothing, as when it was moved one rect at a time.
+        // Walking the rects in the direction of the move, those already passed can't be
+        // overlapped again, so a single pass is enough even for a tall stack of lines.
+        // The rects starting more than maxHeight above r end before it.
+        LONG height = r.Height();
+        if (fSearchDown) {
+            for (auto rect = l.rects.upper_bound(r.top - l.maxHeight); rect != l.rects.end() && rect->first < r.bottom; ++rect) {
+                const CRect& r2 = m_subrects.GetAt(rect->second).r;
+                if (!(r & r2).IsRectEmpty()) {
+                    r.top = r2.bottom;
+                    r.bottom = r.top + height;
+                }
+            }
+        } else {
+            for (auto rect = l.rects.lower_bound(r.bottom); rect != l.rects.begin();) {
+                --rect;
+                if (rect->first <= r.top - l.maxHeight) {
+                    break;
+                }
+                const CRect& r2 = m_subrects.GetAt(rect->second).r;
+                if (!(r & r2).IsRectEmpty()) {
+                    r.bottom = r2.top;
+                    r.top = r.bottom - height;
                 }
-
-                fOK = false;
             }
         }
-    } while (!fOK);
+    }
 
     SubRect sr;
     sr.r = r;
     sr.segment = segment;
     sr.entry = entry;
     sr.layer = layer;
-    m_subrects.AddTail(sr);
+    sr.bIndexed = !r.IsRectEmpty();
+    pos = m_subrects.AddTail(sr);
+
+    if (sr.bIndexed) {
+        Layer& l = m_layers[layer];
+        m_subrects.GetAt(pos).it = l.rects.emplace(r.top, pos);
+        l.maxHeight = std::max(l.maxHeight, r.Height());
+    }
+    m_entries[entry] = pos;
 
     return (sr.r + CRect(0, -s->m_topborder, 0, -s->m_bottomborder));
 }
@@ -1565,11 +1756,16 @@ CAtlMap<CStringW, SSATagCmd, CStringElementTraits<CStringW>> CRenderedTextSubtit
 
 CRenderedTextSubtitle::CRenderedTextSubtitle(CCritSec* pLock)
     : CSubPicProviderImpl(pLock)
+    , m_pWorkerPool(CWorkStealingPool::GetShared())
+    , m_pLookAhead(std::make_shared<LookAheadState>())
+    , m_rtLastLayOut(0)
+    , m_rtUnchangedUntil(0)
+    , m_fpsLastLayOut(0.0)
     , m_time(0)
     , m_delay(0)
-    , m_animStart(0)
-    , m_animEnd(0)
-    , m_animAccel(0.0)
+    , m_animPhase(ANIM_AFTER)
+    , m_animProgress(1.0)
+    , m_animUnchangedUntil(INT_MAX)
     , m_ktype(0)
     , m_kstart(0)
     , m_kend(0)
@@ -1581,6 +1777,9 @@ CRenderedTextSubtitle::CRenderedTextSubtitle(CCritSec* pLock)
 {
     m_size = CSize(0, 0);
 
+    ZeroMemory(&m_lookAheadStats, sizeof(m_lookAheadStats));
+    m_lookAheadStats.depth = LOOK_AHEAD_DEPTH;
+
     if (g_hDC_refcnt == 0) {
         g_hDC = CreateCompatibleDC(nullptr);
         SetBkMode(g_hDC, TRANSPARENT);
@@ -1650,6 +1849,8 @@ CRenderedTextSubtitle::CRenderedTextSubtitle(CCritSec* pLock)
 
 CRenderedTextSubtitle::~CRenderedTextSubtitle()
 {
+    JoinLookAheadThread();
+
     Deinit();
 
     g_hDC_refcnt--;
@@ -1689,6 +1890,7 @@ void CRenderedTextSubtitle::OnChanged()
     }
 
     m_subtitleCache.RemoveAll();
+    m_lookAheadBuildTimes.RemoveAll();
 
     m_sla.Empty();
 }
@@ -1716,9 +1918,12 @@ void CRenderedTextSubtitle::Deinit()
     }
 
     m_subtitleCache.RemoveAll();
+    m_lookAheadBuildTimes.RemoveAll();
 
     m_sla.Empty();
 
+    m_lastDraw = LastDraw();
+
     m_size = CSize(0, 0);
     m_vidrect.SetRectEmpty();
 }
@@ -1848,14 +2053,38 @@ void CRenderedTextSubtitle::ParsePolygon(CSubtitle* sub, CStringW str, STSStyle&
     }
 }
 
-bool CRenderedTextSubtitle::ParseSSATag(SSATagsList& tagsList, const CStringW& str)
+namespace
 {
-    if (m_renderingCaches.SSATagsCache.Lookup(str, tagsList)) {
+    // A tag as it is parsed, before it is added to the program
+    struct SSATag {
+        SSATagCmd cmd;
+        CAtlArray<CStringW, CStringElementTraits<CStringW>> params;
+        CAtlArray<int> paramsInt;
+        CAtlArray<double> paramsReal;
+    };
+}
+
+bool CRenderedTextSubtitle::ParseSSATag(SSATagProgramSharedPtr& program, const CStringW& str)
+{
+    if (m_renderingCaches.SSATagsCache.Lookup(str, program)) {
         return true;
     }
 
+    auto compiled = std::make_shared<SSATagProgram>();
+    CompileSSATag(*compiled, str, compiled->begin, compiled->end);
+    program = compiled;
+
+    m_renderingCaches.SSATagsCache.SetAt(str, program);
+
+    //return (nUnrecognizedTags < nTags);
+    return true; // there are people keeping comments inside {}, lets make them happy now
+}
+
+void CRenderedTextSubtitle::CompileSSATag(SSATagProgram& program, const CStringW& str, UINT& begin, UINT& end)
+{
+    std::vector<SSATagInstr> instrs;
+
     int nTags = 0, nUnrecognizedTags = 0;
-    tagsList.reset(DEBUG_NEW CAtlList<SSATag>());
 
     for (int i = 0, j; (j = str.Find(L'\\', i)) >= 0; i = j) {
         int jOld;
@@ -1873,6 +2102,7 @@ bool CRenderedTextSubtitle::ParseSSATag(SSATagsList& tagsList, const CStringW& s
 
         SSATag tag;
         tag.cmd = SSA_unknown;
+        SSATagInstr instr = {};
         for (int cmdLength = std::min(SSA_CMD_MAX_LENGTH, cmd.GetLength()), cmdLengthMin = SSA_CMD_MIN_LENGTH; cmdLength >= cmdLengthMin; cmdLength--) {
             if (s_SSATagCmds.Lookup(cmd.Left(cmdLength), tag.cmd)) {
                 break;
@@ -2072,7 +2302,8 @@ bool CRenderedTextSubtitle::ParseSSATag(SSATagsList& tagsList, const CStringW& s
                         tag.paramsReal.Add(wcstod(tag.params[2], nullptr));
                     }
 
-                    ParseSSATag(tag.subTagsList, tag.params[nParams - 1]);
+                    CompileSSATag(program, tag.params[nParams - 1], instr.subBegin, instr.subEnd);
+                    instr.bAnimation = true;
                 }
                 tag.params.RemoveAll();
             }
@@ -2087,25 +2318,57 @@ bool CRenderedTextSubtitle::ParseSSATag(SSATagsList& tagsList, const CStringW& s
                 break;
         }
 
-        tagsList->AddTail(tag);
-    }
+        instr.cmd = tag.cmd;
+        instr.iInts = UINT(program.ints.size());
+        instr.nInts = UINT(tag.paramsInt.GetCount());
+        program.ints.insert(program.ints.end(), tag.paramsInt.GetData(), tag.paramsInt.GetData() + tag.paramsInt.GetCount());
+        instr.iReals = UINT(program.reals.size());
+        instr.nReals = UINT(tag.paramsReal.GetCount());
+        program.reals.insert(program.reals.end(), tag.paramsReal.GetData(), tag.paramsReal.GetData() + tag.paramsReal.GetCount());
+        instr.iStrs = UINT(program.strs.size());
+        instr.nStrs = 0;
+        switch (tag.cmd) {
+            case SSA_fn:
+                // Resolved here instead of every time the tag is applied
+                if (!tag.params.IsEmpty() && !tag.params[0].IsEmpty() && tag.params[0] != L"0") {
+                    program.strs.emplace_back(CStringW(tag.params[0]).Trim());
+                    instr.nStrs = 1;
+                }
+                break;
+            case SSA_fs:
+                instr.bRelative = !tag.params.IsEmpty() && (tag.params[0][0] == L'-' || tag.params[0][0] == L'+');
+                break;
+            case SSA_r:
+            case SSA_clip:
+            case SSA_iclip:
+                for (size_t k = 0; k < tag.params.GetCount(); k++) {
+                    program.strs.push_back(tag.params[k]);
+                }
+                instr.nStrs = UINT(tag.params.GetCount());
+                break;
+        }
 
-    m_renderingCaches.SSATagsCache.SetAt(str, tagsList);
+        instrs.push_back(instr);
+    }
 
-    //return (nUnrecognizedTags < nTags);
-    return true; // there are people keeping comments inside {}, lets make them happy now
+    // After the instructions animated by the \t of the block, which are already in the program
+    begin = UINT(program.instrs.size());
+    program.instrs.insert(program.instrs.end(), instrs.begin(), instrs.end());
+    end = UINT(program.instrs.size());
 }
 
-bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsList& tagsList,
+bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagProgram& program, UINT begin, UINT end,
                                                 STSStyle& style, STSStyle& org, bool fAnimate /*= false*/)
 {
-    if (!sub || !tagsList) {
+    if (!sub) {
         return false;
     }
 
-    POSITION pos = tagsList->GetHeadPosition();
-    while (pos) {
-        const SSATag& tag = tagsList->GetNext(pos);
+    for (UINT i = begin; i < end; i++) {
+        const SSATagInstr& tag = program.instrs[i];
+        const int* paramsInt = program.ints.data() + tag.iInts;
+        const double* paramsReal = program.reals.data() + tag.iReals;
+        const CStringW* params = program.strs.data() + tag.iStrs;
 
         // TODO: call ParseStyleModifier(cmd, params, ..) and move the rest there
 
@@ -2116,8 +2379,8 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
             case SSA_4c: {
                 int k = tag.cmd - SSA_1c;
 
-                if (!tag.paramsInt.IsEmpty()) {
-                    DWORD c = tag.paramsInt[0];
+                if (tag.nInts) {
+                    DWORD c = paramsInt[0];
                     style.colors[k] = (((int)CalcAnimation(c & 0xff, style.colors[k] & 0xff, fAnimate)) & 0xff
                                        | ((int)CalcAnimation(c & 0xff00, style.colors[k] & 0xff00, fAnimate)) & 0xff00
                                        | ((int)CalcAnimation(c & 0xff0000, style.colors[k] & 0xff0000, fAnimate)) & 0xff0000);
@@ -2132,45 +2395,45 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
             case SSA_4a: {
                 int k = tag.cmd - SSA_1a;
 
-                style.alpha[k] = !tag.paramsInt.IsEmpty()
-                                 ? (BYTE)CalcAnimation(tag.paramsInt[0] & 0xff, style.alpha[k], fAnimate)
+                style.alpha[k] = tag.nInts
+                                 ? (BYTE)CalcAnimation(paramsInt[0] & 0xff, style.alpha[k], fAnimate)
                                  : org.alpha[k];
             }
             break;
             case SSA_alpha:
                 for (ptrdiff_t k = 0; k < 4; k++) {
-                    style.alpha[k] = !tag.paramsInt.IsEmpty()
-                                     ? (BYTE)CalcAnimation(tag.paramsInt[0] & 0xff, style.alpha[k], fAnimate)
+                    style.alpha[k] = tag.nInts
+                                     ? (BYTE)CalcAnimation(paramsInt[0] & 0xff, style.alpha[k], fAnimate)
                                      : org.alpha[k];
                 }
                 break;
             case SSA_an: {
-                int n = !tag.paramsInt.IsEmpty() ? tag.paramsInt[0] : 0;
+                int n = tag.nInts ? paramsInt[0] : 0;
                 if (sub->m_scrAlignment < 0) {
                     sub->m_scrAlignment = (n > 0 && n < 10) ? n : org.scrAlignment;
                 }
             }
             break;
             case SSA_a: {
-                int n = !tag.paramsInt.IsEmpty() ? tag.paramsInt[0] : 0;
+                int n = tag.nInts ? paramsInt[0] : 0;
                 if (sub->m_scrAlignment < 0) {
                     sub->m_scrAlignment = (n > 0 && n < 12) ? ((((n - 1) & 3) + 1) + ((n & 4) ? 6 : 0) + ((n & 8) ? 3 : 0)) : org.scrAlignment;
                 }
             }
             break;
             case SSA_blur:
-                if (!tag.paramsReal.IsEmpty()) {
-                    double n = CalcAnimation(tag.paramsReal[0], style.fGaussianBlur, fAnimate);
+                if (tag.nReals) {
+                    double n = CalcAnimation(paramsReal[0], style.fGaussianBlur, fAnimate);
                     style.fGaussianBlur = (n < 0 ? 0 : n);
                 } else {
                     style.fGaussianBlur = org.fGaussianBlur;
                 }
                 break;
             case SSA_bord:
-                if (!tag.paramsReal.IsEmpty()) {
-                    double nx = CalcAnimation(tag.paramsReal[0], style.outlineWidthX, fAnimate);
+                if (tag.nReals) {
+                    double nx = CalcAnimation(paramsReal[0], style.outlineWidthX, fAnimate);
                     style.outlineWidthX = (nx < 0 ? 0 : nx);
-                    double ny = CalcAnimation(tag.paramsReal[0], style.outlineWidthY, fAnimate);
+                    double ny = CalcAnimation(paramsReal[0], style.outlineWidthY, fAnimate);
                     style.outlineWidthY = (ny < 0 ? 0 : ny);
                 } else {
                     style.outlineWidthX = org.outlineWidthX;
@@ -2178,41 +2441,41 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
                 }
                 break;
             case SSA_be:
-                style.fBlur = !tag.paramsInt.IsEmpty()
-                              ? (int)(CalcAnimation(tag.paramsInt[0], style.fBlur, fAnimate) + 0.5)
+                style.fBlur = tag.nInts
+                              ? (int)(CalcAnimation(paramsInt[0], style.fBlur, fAnimate) + 0.5)
                               : org.fBlur;
                 break;
             case SSA_b: {
-                int n = !tag.paramsInt.IsEmpty() ? tag.paramsInt[0] : -1;
+                int n = tag.nInts ? paramsInt[0] : -1;
                 style.fontWeight = (n == 0 ? FW_NORMAL : n == 1 ? FW_BOLD : n >= 100 ? n : org.fontWeight);
             }
             break;
             case SSA_clip:
             case SSA_iclip: {
                 bool invert = (tag.cmd == SSA_iclip);
-                size_t nParams = tag.params.GetCount();
-                size_t nParamsInt = tag.paramsInt.GetCount();
+                size_t nParams = tag.nStrs;
+                size_t nParamsInt = tag.nInts;
 
                 if (nParams == 1 && nParamsInt == 0 && !sub->m_pClipper) {
-                    sub->m_pClipper = std::make_shared<CClipper>(tag.params[0], CSize(m_size.cx >> 3, m_size.cy >> 3), sub->m_scalex, sub->m_scaley,
+                    sub->m_pClipper = std::make_shared<CClipper>(params[0], CSize(m_size.cx >> 3, m_size.cy >> 3), sub->m_scalex, sub->m_scaley,
                                                                  invert, (sub->m_relativeTo == STSStyle::VIDEO) ? CPoint(m_vidrect.left, m_vidrect.top) : CPoint(0, 0),
                                                                  m_renderingCaches);
                 } else if (nParams == 1 && nParamsInt == 1 && !sub->m_pClipper) {
-                    long scale = tag.paramsInt[0];
+                    long scale = paramsInt[0];
                     if (scale < 1) {
                         scale = 1;
                     }
-                    sub->m_pClipper = std::make_shared<CClipper>(tag.params[0], CSize(m_size.cx >> 3, m_size.cy >> 3),
+                    sub->m_pClipper = std::make_shared<CClipper>(params[0], CSize(m_size.cx >> 3, m_size.cy >> 3),
                                                                  sub->m_scalex / (1 << (scale - 1)), sub->m_scaley / (1 << (scale - 1)), invert,
                                                                  (sub->m_relativeTo == STSStyle::VIDEO) ? CPoint(m_vidrect.left, m_vidrect.top) : CPoint(0, 0),
                                                                  m_renderingCaches);
                 } else if (nParamsInt == 4) {
                     sub->m_clipInverse = invert;
 
-                    double dLeft   = sub->m_scalex * tag.paramsInt[0];
-                    double dTop    = sub->m_scaley * tag.paramsInt[1];
-                    double dRight  = sub->m_scalex * tag.paramsInt[2];
-                    double dBottom = sub->m_scaley * tag.paramsInt[3];
+                    double dLeft   = sub->m_scalex * paramsInt[0];
+                    double dTop    = sub->m_scaley * paramsInt[1];
+                    double dRight  = sub->m_scalex * paramsInt[2];
+                    double dBottom = sub->m_scaley * paramsInt[3];
 
                     if (sub->m_relativeTo == STSStyle::VIDEO) {
                         double dOffsetX = m_vidrect.left / 8.0;
@@ -2232,8 +2495,8 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
             }
             break;
             case SSA_c:
-                if (!tag.paramsInt.IsEmpty()) {
-                    DWORD c = tag.paramsInt[0];
+                if (tag.nInts) {
+                    DWORD c = paramsInt[0];
                     style.colors[0] = (((int)CalcAnimation(c & 0xff, style.colors[0] & 0xff, fAnimate)) & 0xff
                                        | ((int)CalcAnimation(c & 0xff00, style.colors[0] & 0xff00, fAnimate)) & 0xff00
                                        | ((int)CalcAnimation(c & 0xff0000, style.colors[0] & 0xff0000, fAnimate)) & 0xff0000);
@@ -2244,23 +2507,23 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
             case SSA_fade: {
                 sub->m_bIsAnimated = true;
 
-                if (tag.paramsInt.GetCount() == 7 && !sub->m_effects[EF_FADE]) { // {\fade(a1=param[0], a2=param[1], a3=param[2], t1=t[0], t2=t[1], t3=t[2], t4=t[3])
+                if (tag.nInts == 7 && !sub->m_effects[EF_FADE]) { // {\fade(a1=param[0], a2=param[1], a3=param[2], t1=t[0], t2=t[1], t3=t[2], t4=t[3])
                     if (Effect* e = DEBUG_NEW Effect) {
                         for (size_t k = 0; k < 3; k++) {
-                            e->param[k] = tag.paramsInt[k];
+                            e->param[k] = paramsInt[k];
                         }
                         for (size_t k = 0; k < 4; k++) {
-                            e->t[k] = tag.paramsInt[3 + k];
+                            e->t[k] = paramsInt[3 + k];
                         }
 
                         sub->m_effects[EF_FADE] = e;
                     }
-                } else if (tag.paramsInt.GetCount() == 2 && !sub->m_effects[EF_FADE]) { // {\fad(t1=t[1], t2=t[2])
+                } else if (tag.nInts == 2 && !sub->m_effects[EF_FADE]) { // {\fad(t1=t[1], t2=t[2])
                     if (Effect* e = DEBUG_NEW Effect) {
                         e->param[0] = e->param[2] = 0xff;
                         e->param[1] = 0x00;
                         for (size_t k = 1; k < 3; k++) {
-                            e->t[k] = tag.paramsInt[k - 1];
+                            e->t[k] = paramsInt[k - 1];
                         }
                         e->t[0] = e->t[3] = -1; // will be substituted with "start" and "end"
 
@@ -2270,52 +2533,50 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
             }
             break;
             case SSA_fax:
-                style.fontShiftX = !tag.paramsReal.IsEmpty()
-                                   ? CalcAnimation(tag.paramsReal[0], style.fontShiftX, fAnimate)
+                style.fontShiftX = tag.nReals
+                                   ? CalcAnimation(paramsReal[0], style.fontShiftX, fAnimate)
                                    : org.fontShiftX;
                 break;
             case SSA_fay:
-                style.fontShiftY = !tag.paramsReal.IsEmpty()
-                                   ? CalcAnimation(tag.paramsReal[0], style.fontShiftY, fAnimate)
+                style.fontShiftY = tag.nReals
+                                   ? CalcAnimation(paramsReal[0], style.fontShiftY, fAnimate)
                                    : org.fontShiftY;
                 break;
             case SSA_fe:
-                style.charSet = !tag.paramsInt.IsEmpty()
-                                ? tag.paramsInt[0]
+                style.charSet = tag.nInts
+                                ? paramsInt[0]
                                 : org.charSet;
                 break;
             case SSA_fn:
-                style.fontName = (!tag.params.IsEmpty() && !tag.params[0].IsEmpty() && tag.params[0] != L"0")
-                                 ? CString(tag.params[0]).Trim()
-                                 : org.fontName;
+                style.fontName = tag.nStrs ? CString(params[0]) : org.fontName;
                 break;
             case SSA_frx:
-                style.fontAngleX = !tag.paramsReal.IsEmpty()
-                                   ? CalcAnimation(tag.paramsReal[0], style.fontAngleX, fAnimate)
+                style.fontAngleX = tag.nReals
+                                   ? CalcAnimation(paramsReal[0], style.fontAngleX, fAnimate)
                                    : org.fontAngleX;
                 break;
             case SSA_fry:
-                style.fontAngleY = !tag.paramsReal.IsEmpty()
-                                   ? CalcAnimation(tag.paramsReal[0], style.fontAngleY, fAnimate)
+                style.fontAngleY = tag.nReals
+                                   ? CalcAnimation(paramsReal[0], style.fontAngleY, fAnimate)
                                    : org.fontAngleY;
                 break;
             case SSA_frz:
             case SSA_fr:
-                style.fontAngleZ = !tag.paramsReal.IsEmpty()
-                                   ? CalcAnimation(tag.paramsReal[0], style.fontAngleZ, fAnimate)
+                style.fontAngleZ = tag.nReals
+                                   ? CalcAnimation(paramsReal[0], style.fontAngleZ, fAnimate)
                                    : org.fontAngleZ;
                 break;
             case SSA_fscx:
-                if (!tag.paramsReal.IsEmpty()) {
-                    double n = CalcAnimation(tag.paramsReal[0], style.fontScaleX, fAnimate);
+                if (tag.nReals) {
+                    double n = CalcAnimation(paramsReal[0], style.fontScaleX, fAnimate);
                     style.fontScaleX = (n < 0 ? 0 : n);
                 } else {
                     style.fontScaleX = org.fontScaleX;
                 }
                 break;
             case SSA_fscy:
-                if (!tag.paramsReal.IsEmpty()) {
-                    double n = CalcAnimation(tag.paramsReal[0], style.fontScaleY, fAnimate);
+                if (tag.nReals) {
+                    double n = CalcAnimation(paramsReal[0], style.fontScaleY, fAnimate);
                     style.fontScaleY = (n < 0 ? 0 : n);
                 } else {
                     style.fontScaleY = org.fontScaleY;
@@ -2326,17 +2587,17 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
                 style.fontScaleY = org.fontScaleY;
                 break;
             case SSA_fsp:
-                style.fontSpacing = !tag.paramsReal.IsEmpty()
-                                    ? CalcAnimation(tag.paramsReal[0], style.fontSpacing, fAnimate)
+                style.fontSpacing = tag.nReals
+                                    ? CalcAnimation(paramsReal[0], style.fontSpacing, fAnimate)
                                     : org.fontSpacing;
                 break;
             case SSA_fs:
-                if (!tag.paramsInt.IsEmpty()) {
-                    if (!tag.params.IsEmpty() && (tag.params[0][0] == L'-' || tag.params[0][0] == L'+')) {
-                        double n = CalcAnimation(style.fontSize + style.fontSize * tag.paramsInt[0] / 10, style.fontSize, fAnimate);
+                if (tag.nInts) {
+                    if (tag.bRelative) {
+                        double n = CalcAnimation(style.fontSize + style.fontSize * paramsInt[0] / 10, style.fontSize, fAnimate);
                         style.fontSize = (n > 0) ? n : org.fontSize;
                     } else {
-                        double n = CalcAnimation(tag.paramsInt[0], style.fontSize, fAnimate);
+                        double n = CalcAnimation(paramsInt[0], style.fontSize, fAnimate);
                         style.fontSize = (n > 0) ? n : org.fontSize;
                     }
                 } else {
@@ -2344,15 +2605,15 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
                 }
                 break;
             case SSA_i: {
-                int n = !tag.paramsInt.IsEmpty() ? tag.paramsInt[0] : -1;
+                int n = tag.nInts ? paramsInt[0] : -1;
                 style.fItalic = (n == 0 ? false : n == 1 ? true : org.fItalic);
             }
             break;
             case SSA_kt:
                 sub->m_bIsAnimated = true;
 
-                m_kstart = !tag.paramsInt.IsEmpty()
-                           ? tag.paramsInt[0] * 10
+                m_kstart = tag.nInts
+                           ? paramsInt[0] * 10
                            : 0;
                 m_kend = m_kstart;
                 break;
@@ -2362,8 +2623,8 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 
                 m_ktype = 1;
                 m_kstart = m_kend;
-                m_kend += !tag.paramsInt.IsEmpty()
-                          ? tag.paramsInt[0] * 10
+                m_kend += tag.nInts
+                          ? paramsInt[0] * 10
                           : 1000;
                 break;
             case SSA_ko:
@@ -2371,8 +2632,8 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 
                 m_ktype = 2;
                 m_kstart = m_kend;
-                m_kend += !tag.paramsInt.IsEmpty()
-                          ? tag.paramsInt[0] * 10
+                m_kend += tag.nInts
+                          ? paramsInt[0] * 10
                           : 1000;
                 break;
             case SSA_k:
@@ -2380,24 +2641,24 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
 
                 m_ktype = 0;
                 m_kstart = m_kend;
-                m_kend += !tag.paramsInt.IsEmpty()
-                          ? tag.paramsInt[0] * 10
+                m_kend += tag.nInts
+                          ? paramsInt[0] * 10
                           : 1000;
                 break;
             case SSA_move: // {\move(x1=param[0], y1=param[1], x2=param[2], y2=param[3][, t1=t[0], t2=t[1]])}
                 sub->m_bIsAnimated = true;
 
-                if (tag.paramsReal.GetCount() == 4 && !sub->m_effects[EF_MOVE]) {
+                if (tag.nReals == 4 && !sub->m_effects[EF_MOVE]) {
                     if (Effect* e = DEBUG_NEW Effect) {
-                        e->param[0] = std::lround(sub->m_scalex * tag.paramsReal[0] * 8.0);
-                        e->param[1] = std::lround(sub->m_scaley * tag.paramsReal[1] * 8.0);
-                        e->param[2] = std::lround(sub->m_scalex * tag.paramsReal[2] * 8.0);
-                        e->param[3] = std::lround(sub->m_scaley * tag.paramsReal[3] * 8.0);
+                        e->param[0] = std::lround(sub->m_scalex * paramsReal[0] * 8.0);
+                        e->param[1] = std::lround(sub->m_scaley * paramsReal[1] * 8.0);
+                        e->param[2] = std::lround(sub->m_scalex * paramsReal[2] * 8.0);
+                        e->param[3] = std::lround(sub->m_scaley * paramsReal[3] * 8.0);
                         e->t[0] = e->t[1] = -1;
 
-                        if (tag.paramsInt.GetCount() == 2) {
+                        if (tag.nInts == 2) {
                             for (size_t k = 0; k < 2; k++) {
-                                e->t[k] = tag.paramsInt[k];
+                                e->t[k] = paramsInt[k];
                             }
                         }
 
@@ -2406,10 +2667,10 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
                 }
                 break;
             case SSA_org: // {\org(x=param[0], y=param[1])}
-                if (tag.paramsReal.GetCount() == 2 && !sub->m_effects[EF_ORG]) {
+                if (tag.nReals == 2 && !sub->m_effects[EF_ORG]) {
                     if (Effect* e = DEBUG_NEW Effect) {
-                        e->param[0] = std::lround(sub->m_scalex * tag.paramsReal[0] * 8.0);
-                        e->param[1] = std::lround(sub->m_scaley * tag.paramsReal[1] * 8.0);
+                        e->param[0] = std::lround(sub->m_scalex * paramsReal[0] * 8.0);
+                        e->param[1] = std::lround(sub->m_scaley * paramsReal[1] * 8.0);
 
                         if (sub->m_relativeTo == STSStyle::VIDEO) {
                             e->param[0] += m_vidrect.left;
@@ -2421,13 +2682,13 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
                 }
                 break;
             case SSA_pbo:
-                m_polygonBaselineOffset = !tag.paramsInt.IsEmpty() ? tag.paramsInt[0] : 0;
+                m_polygonBaselineOffset = tag.nInts ? paramsInt[0] : 0;
                 break;
             case SSA_pos:
-                if (tag.paramsReal.GetCount() == 2 && !sub->m_effects[EF_MOVE]) {
+                if (tag.nReals == 2 && !sub->m_effects[EF_MOVE]) {
                     if (Effect* e = DEBUG_NEW Effect) {
-                        e->param[0] = e->param[2] = std::lround(sub->m_scalex * tag.paramsReal[0] * 8.0);
-                        e->param[1] = e->param[3] = std::lround(sub->m_scaley * tag.paramsReal[1] * 8.0);
+                        e->param[0] = e->param[2] = std::lround(sub->m_scalex * paramsReal[0] * 8.0);
+                        e->param[1] = e->param[3] = std::lround(sub->m_scaley * paramsReal[1] * 8.0);
                         e->t[0] = e->t[1] = 0;
 
                         sub->m_effects[EF_MOVE] = e;
@@ -2435,27 +2696,27 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
                 }
                 break;
             case SSA_p: {
-                int n = !tag.paramsInt.IsEmpty() ? tag.paramsInt[0] : 0;
+                int n = tag.nInts ? paramsInt[0] : 0;
                 m_nPolygon = (n <= 0 ? 0 : n);
             }
             break;
             case SSA_q: {
-                int n = !tag.paramsInt.IsEmpty() ? tag.paramsInt[0] : -1;
+                int n = tag.nInts ? paramsInt[0] : -1;
                 sub->m_wrapStyle = (0 <= n && n <= 3)
                                    ? n
                                    : m_defaultWrapStyle;
             }
             break;
             case SSA_r:
-                if (tag.params[0].IsEmpty() || !GetStyle(tag.params[0], style)) {
+                if (params[0].IsEmpty() || !GetStyle(params[0], style)) {
                     style = org;
                 }
                 break;
             case SSA_shad:
-                if (!tag.paramsReal.IsEmpty()) {
-                    double nx = CalcAnimation(tag.paramsReal[0], style.shadowDepthX, fAnimate);
+                if (tag.nReals) {
+                    double nx = CalcAnimation(paramsReal[0], style.shadowDepthX, fAnimate);
                     style.shadowDepthX = (nx < 0 ? 0 : nx);
-                    double ny = CalcAnimation(tag.paramsReal[0], style.shadowDepthY, fAnimate);
+                    double ny = CalcAnimation(paramsReal[0], style.shadowDepthY, fAnimate);
                     style.shadowDepthY = (ny < 0 ? 0 : ny);
                 } else {
                     style.shadowDepthX = org.shadowDepthX;
@@ -2463,63 +2724,64 @@ bool CRenderedTextSubtitle::CreateSubFromSSATag(CSubtitle* sub, const SSATagsLis
                 }
                 break;
             case SSA_s: {
-                int n = !tag.paramsInt.IsEmpty() ? tag.paramsInt[0] : -1;
+                int n = tag.nInts ? paramsInt[0] : -1;
                 style.fStrikeOut = (n == 0 ? false : n == 1 ? true : org.fStrikeOut);
             }
             break;
             case SSA_t: // \t([<t1>,<t2>,][<accel>,]<style modifiers>)
-                if (tag.subTagsList) {
+                if (tag.bAnimation) {
                     sub->m_bIsAnimated = true;
 
-                    m_animStart = m_animEnd = 0;
-                    m_animAccel = 1;
+                    int animStart = 0, animEnd = 0;
+                    double animAccel = 1;
 
-                    size_t nParams = tag.paramsInt.GetCount() + tag.paramsReal.GetCount();
+                    size_t nParams = tag.nInts + tag.nReals;
                     if (nParams == 1) {
-                        m_animAccel = tag.paramsReal[0];
+                        animAccel = paramsReal[0];
                     } else if (nParams == 2) {
-                        m_animStart = (int)tag.paramsReal[0];
-                        m_animEnd = (int)tag.paramsReal[1];
+                        animStart = (int)paramsReal[0];
+                        animEnd = (int)paramsReal[1];
                     } else if (nParams == 3) {
-                        m_animStart = tag.paramsInt[0];
-                        m_animEnd = tag.paramsInt[1];
-                        m_animAccel = tag.paramsReal[0];
+                        animStart = paramsInt[0];
+                        animEnd = paramsInt[1];
+                        animAccel = paramsReal[0];
                     }
+                    SetAnimation(animStart, animEnd, animAccel);
 
-                    CreateSubFromSSATag(sub, tag.subTagsList, style, org, true);
+                    CreateSubFromSSATag(sub, program, tag.subBegin, tag.subEnd, style, org, true);
 
                     sub->m_fAnimated = true;
                 }
                 break;
             case SSA_u: {
-                int n = !tag.paramsInt.IsEmpty() ? tag.paramsInt[0] : -1;
+                int n = tag.nInts ? paramsInt[0] : -1;
                 style.fUnderline = (n == 0 ? false : n == 1 ? true : org.fUnderline);
             }
             break;
             case SSA_xbord:
-                if (!tag.paramsReal.IsEmpty()) {
-                    double nx = CalcAnimation(tag.paramsReal[0], style.outlineWidthX, fAnimate);
+                if (tag.nReals) {
+                    double nx = CalcAnimation(paramsReal[0], style.outlineWidthX, fAnimate);
                     style.outlineWidthX = (nx < 0 ? 0 : nx);
                 } else {
                     style.outlineWidthX = org.outlineWidthX;
                 }
                 break;
             case SSA_xshad:
-                style.shadowDepthX = !tag.paramsReal.IsEmpty()
-                                     ? CalcAnimation(tag.paramsReal[0], style.shadowDepthX, fAnimate)
+                style.shadowDepthX = tag.nReals
+                                     ? CalcAnimation(paramsReal[0], style.shadowDepthX, fAnimate)
                                      : org.shadowDepthX;
                 break;
             case SSA_ybord:
-                if (!tag.paramsReal.IsEmpty()) {
-                    double ny = CalcAnimation(tag.paramsReal[0], style.outlineWidthY, fAnimate);
+                if (tag.nReals) {
+                    double ny = CalcAnimation(paramsReal[0], style.outlineWidthY, fAnimate);
                     style.outlineWidthY = (ny < 0 ? 0 : ny);
                 } else {
                     style.outlineWidthY = org.outlineWidthY;
                 }
                 break;
             case SSA_yshad:
-                style.shadowDepthY = !tag.paramsReal.IsEmpty()
-                                     ? CalcAnimation(tag.paramsReal[0], style.shadowDepthY, fAnimate)
+                style.shadowDepthY = tag.nReals
+                                     ? CalcAnimation(paramsReal[0], style.shadowDepthY, fAnimate)
                                      : org.shadowDepthY;
                 break;
         }
@@ -2634,17 +2896,33 @@ bool CRenderedTextSubtitle::ParseHtmlTag(CSubtitle* sub, CStringW str, STSStyle&
     return true;
 }
 
-double CRenderedTextSubtitle::CalcAnimation(double dst, double src, bool fAnimate)
+void CRenderedTextSubtitle::SetAnimation(int start, int end, double accel)
 {
-    int s = m_animStart ? m_animStart : 0;
-    int e = m_animEnd ? m_animEnd : m_delay;
+    int s = start ? start : 0;
+    int e = end ? end : m_delay;
+
+    m_animProgress = 1.0;
+    if (m_time < s) {
+        m_animPhase = ANIM_BEFORE;
+        m_animUnchangedUntil = std::min(m_animUnchangedUntil, s);
+    } else if (s <= m_time && m_time < e) {
+        m_animPhase = ANIM_DURING;
+        m_animProgress = pow(1.0 * (m_time - s) / (e - s), accel);
+        m_animUnchangedUntil = std::min(m_animUnchangedUntil, e);
+    } else {
+        m_animPhase = ANIM_AFTER;
+    }
+}
 
+double CRenderedTextSubtitle::CalcAnimation(double dst, double src, bool fAnimate)
+{
     if (fabs(dst - src) >= 0.0001 && fAnimate) {
-        if (m_time < s) {
+        if (m_animPhase == ANIM_BEFORE) {
             dst = src;
-        } else if (s <= m_time && m_time < e) {
-            double t = pow(1.0 * (m_time - s) / (e - s), m_animAccel);
-            dst = (1 - t) * src + t * dst;
+        } else if (m_animPhase == ANIM_DURING) {
+            dst = (1 - m_animProgress) * src + m_animProgress * dst;
+            // Changes continuously
+            m_animUnchangedUntil = std::min(m_animUnchangedUntil, m_time + 1);
         }
         //      else dst = dst;
     }
@@ -2783,8 +3061,7 @@ CSubtitle* CRenderedTextSubtitle::GetSubtitle(int entry)
         marginRect.bottom += m_size.cy - m_vidrect.bottom;
     }
 
-    m_animStart = m_animEnd = 0;
-    m_animAccel = 1;
+    SetAnimation(0, 0, 1.0);
     m_ktype = m_kstart = m_kend = 0;
     m_nPolygon = 0;
     m_polygonBaselineOffset = 0;
@@ -2794,10 +3071,10 @@ CSubtitle* CRenderedTextSubtitle::GetSubtitle(int entry)
         bool bParsed = false;
 
         if (str[iStart] == L'{' && (iEnd = str.Find(L'}', iStart)) > 0) {
-            SSATagsList tagsList;
-            bParsed = ParseSSATag(tagsList, str.Mid(iStart + 1, iEnd - iStart - 1));
+            SSATagProgramSharedPtr program;
+            bParsed = ParseSSATag(program, str.Mid(iStart + 1, iEnd - iStart - 1));
             if (bParsed) {
-                CreateSubFromSSATag(sub, tagsList, stss, orgstss);
+                CreateSubFromSSATag(sub, *program, program->begin, program->end, stss, orgstss);
                 iStart = iEnd + 1;
             }
         } else if (str[iStart] == L'<' && (iEnd = str.Find(L'>', iStart)) > 0) {
@@ -2860,6 +3137,172 @@ CSubtitle* CRenderedTextSubtitle::GetSubtitle(int entry)
     return sub;
 }
 
+void CRenderedTextSubtitle::QueueLookAhead(REFERENCE_TIME rt, double fps)
+{
+    if (m_lookAheadStats.depth <= 0) {
+        return;
+    }
+
+    if (!m_lookAheadThread.joinable()) {
+        try {
+            m_lookAheadThread = std::thread(LookAheadThread, m_pLookAhead, this);
+        } catch (const std::system_error&) {
+            TRACE(_T("CRenderedTextSubtitle: failed to start the look-ahead thread\n"));
+            m_lookAheadStats.depth = 0;
+            return;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_pLookAhead->mutex);
+
+    m_pLookAhead->request++;
+    m_pLookAhead->rt = rt;
+    m_pLookAhead->fps = fps;
+    if (!m_pLookAhead->bBusy) {
+        m_pLookAhead->bBusy = true;
+        m_pLookAhead->wake.notify_one();
+    }
+}
+
+void CRenderedTextSubtitle::LookAheadThread(std::shared_ptr<LookAheadState> pState, CRenderedTextSubtitle* pRTS)
+{
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+
+    std::unique_lock<std::mutex> lock(pState->mutex);
+
+    for (;;) {
+        pState->wake.wait(lock, [&] { return pState->bExit || pState->bBusy; });
+        if (pState->bExit) {
+            // Cancelled by StopLookAhead or the destructor
+            pState->bBusy = false;
+            break;
+        }
+
+        unsigned int request = pState->request;
+        REFERENCE_TIME rt = pState->rt;
+        double fps = pState->fps;
+
+        lock.unlock();
+        pRTS->LookAhead(rt, fps, request);
+        lock.lock();
+
+        // Start over right away if playback moved on in the meantime
+        if (pState->request == request) {
+            pState->bBusy = false;
+        }
+    }
+}
+
+void CRenderedTextSubtitle::JoinLookAheadThread()
+{
+    if (!m_lookAheadThread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_pLookAhead->mutex);
+        // Makes LookAhead give up on the request in progress
+        m_pLookAhead->request++;
+        m_pLookAhead->bExit = true;
+    }
+    m_pLookAhead->wake.notify_one();
+
+    m_lookAheadThread.join();
+    // So that QueueLookAhead can start it again
+    m_pLookAhead->bExit = false;
+}
+
+bool CRenderedTextSubtitle::LockForLookAhead(unsigned int request)
+{
+    std::unique_lock<std::mutex> lock(m_pLookAhead->mutex);
+
+    // Polls m_pLock instead of waiting for it, the thread holding it might be
+    // the one joining us
+    while (m_pLookAhead->request == request) {
+        if (m_pLock->TryLock()) {
+            return true;
+        }
+        m_pLookAhead->wake.wait_for(lock, std::chrono::milliseconds(1));
+    }
+
+    return false;
+}
+
+void CRenderedTextSubtitle::LookAhead(REFERENCE_TIME rt, double fps, unsigned int request)
+{
+    CAtlArray<int> entries;
+
+    {
+        if (!LockForLookAhead(request)) {
+            return;
+        }
+        CAutoUnlock cAutoUnlock(m_pLock);
+
+        if (m_size.cx <= 0 || m_size.cy <= 0) {
+            return;
+        }
+
+        REFERENCE_TIME rtEnd = rt + MS2RT(m_lookAheadStats.depth);
+
+        int iSegment = -1;
+        SearchSubs(m_lookAheadCursor, rt, fps, &iSegment);
+        for (int i = std::max(iSegment, 0); const STSSegment* stss = GetSegment(i); i++) {
+            if (TranslateSegmentStart(i, fps) >= rtEnd) {
+                break;
+            }
+            for (size_t j = 0; j < stss->subs.GetCount(); j++) {
+                int entry = stss->subs[j];
+                if (!m_subtitleCache.Lookup(entry) && !m_lookAheadBuildTimes.Lookup(entry)) {
+                    entries.Add(entry);
+                }
+            }
+        }
+    }
+
+    // One subtitle at a time so that the rendering thread never waits long for the lock
+    for (size_t i = 0; i < entries.GetCount(); i++) {
+        if (!LockForLookAhead(request)) {
+            return;
+        }
+        CAutoUnlock cAutoUnlock(m_pLock);
+
+        int entry = entries[i];
+        // Already built, either because it spans several segments or because it was rendered meanwhile
+        if (m_size.cx <= 0 || m_size.cy <= 0 || m_subtitleCache.Lookup(entry) || m_lookAheadBuildTimes.Lookup(entry)) {
+            continue;
+        }
+
+        // Same state as for the first frame the subtitle is rendered in
+        REFERENCE_TIME start = TranslateStart(entry, fps);
+        m_time = 0;
+        m_delay = (int)RT2MS(TranslateEnd(entry, fps) - start);
+
+        auto buildStart = std::chrono::steady_clock::now();
+
+        CSubtitle* s = GetSubtitle(entry);
+        if (!s) {
+            continue;
+        }
+
+        if (s->m_fAnimated) {
+            // It is built again for every frame anyway, only the caches warmed up
+            // by the words of the subtitle are left
+            m_subtitleCache.RemoveKey(entry);
+            delete s;
+            m_lookAheadBuildTimes[entry] = -1;
+            continue;
+        }
+
+        if (s->m_pClipper) {
+            s->m_pClipper->GetAlphaMask(s->m_pClipper);
+        }
+
+        auto buildTime = std::chrono::steady_clock::now() - buildStart;
+        m_lookAheadBuildTimes[entry] = std::chrono::duration_cast<std::chrono::microseconds>(buildTime).count();
+        m_lookAheadStats.nBuilt++;
+    }
+}
+
 //
 
 STDMETHODIMP CRenderedTextSubtitle::NonDelegatingQueryInterface(REFIID riid, void** ppv)
@@ -2871,6 +3314,9 @@ STDMETHODIMP CRenderedTextSubtitle::NonDelegatingQueryInterface(REFIID riid, voi
         QI(IPersist)
         QI(ISubStream)
         QI(ISubPicProvider)
+        QI(IIncrementalSubPicProvider)
+        QI(IUnchangedSubPicProvider)
+        QI(IRenderingCacheStats)
         __super::NonDelegatingQueryInterface(riid, ppv);
 }
 
@@ -2879,7 +3325,7 @@ STDMETHODIMP CRenderedTextSubtitle::NonDelegatingQueryInterface(REFIID riid, voi
 STDMETHODIMP_(POSITION) CRenderedTextSubtitle::GetStartPosition(REFERENCE_TIME rt, double fps)
 {
     int iSegment = -1;
-    SearchSubs(rt, fps, &iSegment, nullptr);
+    SearchSubs(m_positionCursor, rt, fps, &iSegment, nullptr);
 
     if (iSegment < 0) {
         iSegment = 0;
@@ -2933,6 +3379,153 @@ STDMETHODIMP_(bool) CRenderedTextSubtitle::IsAnimated(POSITION pos)
     return false;
 }
 
+// The first time after time at which f gives another value, or end if it doesn't
+// before. f must be monotonic from time to end, as the interpolations and offsets
+// it is used for are, so that it keeps its value up to some time and never gets it
+// back after. That time is found by bisection, exactly, rounding included. In floating
+// point a + (b - a) * u is monotonic in u, but a * (1 - u) + b * u isn't: it can land
+// just under a when a == b and flicker by one unit.
+template<class F>
+static int FindChange(F f, int time, int end)
+{
+    auto value = f(time);
+    // f(lo) == value, and f(hi) != value unless hi == end
+    int lo = time, hi = std::max(end, time + 1);
+    while (hi - lo > 1) {
+        int mid = lo + (hi - lo) / 2;
+        if (f(mid) == value) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return hi;
+}
+
+// {\move(x1=param[0], y1=param[1], x2=param[2], y2=param[3], t1=t[0], t2=t[1])}
+static void GetMoveTimes(const Effect* e, int delay, int& t1, int& t2)
+{
+    t1 = e->t[0];
+    t2 = e->t[1];
+
+    if (t2 < t1) {
+        std::swap(t1, t2);
+    }
+
+    if (t1 <= 0 && t2 <= 0) {
+        t1 = 0;
+        t2 = delay;
+    }
+}
+
+static CPoint GetMovePosition(const Effect* e, int t1, int t2, int time)
+{
+    CPoint p;
+    CPoint p1(e->param[0], e->param[1]);
+    CPoint p2(e->param[2], e->param[3]);
+
+    if (time <= t1) {
+        p = p1;
+    } else if (p1 == p2) {
+        p = p1;
+    } else if (t1 < time && time < t2) {
+        // Unlike (1 - t) * p1 + t * p2, this can only move one way, see FindChange
+        double t = 1.0 * (time - t1) / (t2 - t1);
+        p.x = (int)(p1.x + t * (p2.x - p1.x));
+        p.y = (int)(p1.y + t * (p2.y - p1.y));
+    } else {
+        p = p2;
+    }
+
+    return p;
+}
+
+static int GetMoveChange(const Effect* e, int t1, int t2, int time)
+{
+    if (e->param[0] == e->param[2] && e->param[1] == e->param[3]) {
+        return INT_MAX;
+    } else if (time <= t1) {
+        return t1 + 1;
+    } else if (time < t2) {
+        return FindChange([&](int t) { return GetMovePosition(e, t1, t2, t); }, time, t2);
+    }
+    return INT_MAX;
+}
+
+// {\fade(a1=param[0], a2=param[1], a3=param[2], t1=t[0], t2=t[1], t3=t[2], t4=t[3]) or {\fad(t1=t[1], t2=t[2])
+static void GetFadeTimes(const Effect* e, int delay, int (&t)[4])
+{
+    std::copy_n(e->t, 4, t);
+
+    if (t[0] == -1 && t[3] == -1) {
+        t[0] = 0;
+        t[2] = delay - t[2];
+        t[3] = delay;
+    }
+}
+
+static int GetFadeAlpha(const Effect* e, const int (&t)[4], int time)
+{
+    int alpha = 0x00;
+
+    if (time < t[0]) {
+        alpha = e->param[0];
+    } else if (time >= t[0] && time < t[1]) {
+        // Unlike a1 * (1 - u) + a2 * u, this can only move one way and stays put when a1 == a2
+        double u = 1.0 * (time - t[0]) / (t[1] - t[0]);
+        alpha = (int)(e->param[0] + (e->param[1] - e->param[0]) * u);
+    } else if (time >= t[1] && time < t[2]) {
+        alpha = e->param[1];
+    } else if (time >= t[2] && time < t[3]) {
+        double u = 1.0 * (time - t[2]) / (t[3] - t[2]);
+        alpha = (int)(e->param[1] + (e->param[2] - e->param[1]) * u);
+    } else if (time >= t[3]) {
+        alpha = e->param[2];
+    }
+
+    return alpha;
+}
+
+static int GetFadeChange(const Effect* e, const int (&t)[4], int time)
+{
+    auto alpha = [&](int u) { return GetFadeAlpha(e, t, u); };
+
+    if (time < t[0]) {
+        return t[0];
+    } else if (time < t[1]) {
+        return FindChange(alpha, time, t[1]);
+    } else if (time < t[2]) {
+        return t[2];
+    } else if (time < t[3]) {
+        return FindChange(alpha, time, t[3]);
+    }
+    return INT_MAX;
+}
+
+// The first time after time at which the karaoke of s is drawn differently
+static int GetKaraokeChange(const CSubtitle* s, int time)
+{
+    int change = INT_MAX;
+
+    POSITION pos = s->GetHeadPosition();
+    while (pos) {
+        const CLine* l = s->GetNext(pos);
+
+        POSITION wpos = l->GetHeadPosition();
+        while (wpos) {
+            const CWord* w = l->GetNext(wpos);
+
+            if (time < w->m_kstart) {
+                change = std::min(change, w->m_kstart);
+            } else if (w->m_ktype == 1 && time < w->m_kend) {
+                change = std::min(change, time + 1);
+            }
+        }
+    }
+
+    return change;
+}
+
 struct LSub {
     int idx, layer, readorder;
 
@@ -2941,20 +3534,30 @@ struct LSub {
     }
 };
 
-STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, double fps, RECT& bbox)
+HRESULT CRenderedTextSubtitle::LayOut(const SubPicDesc& spd, REFERENCE_TIME rt, double fps, CDrawCommands& commands, CRect& bbox)
 {
     CRect bbox2(0, 0, 0, 0);
+    bbox = bbox2;
 
     if (m_size != CSize(spd.w * 8, spd.h * 8) || m_vidrect != CRect(spd.vidrect.left * 8, spd.vidrect.top * 8, spd.vidrect.right * 8, spd.vidrect.bottom * 8)) {
         Init(CSize(spd.w, spd.h), spd.vidrect);
     }
 
+    // The worker waits for us to release the lock, whether there is something to draw now or not
+    QueueLookAhead(rt, fps);
+
+    m_rtLastLayOut = m_rtUnchangedUntil = rt;
+    m_fpsLastLayOut = fps;
+
     int segment;
     const STSSegment* stss = SearchSubs(rt, fps, &segment);
     if (!stss) {
         return S_FALSE;
     }
 
+    // Nothing changes within a segment except for the animations
+    m_rtUnchangedUntil = TranslateSegmentEnd(segment, fps);
+
     // clear any cached subs that is behind current time
     {
         POSITION pos = m_subtitleCache.GetStartPosition();
@@ -2969,6 +3572,15 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
                 m_subtitleCache.RemoveKey(entry);
             }
         }
+
+        pos = m_lookAheadBuildTimes.GetStartPosition();
+        while (pos) {
+            POSITION cur = pos;
+            int entry = m_lookAheadBuildTimes.GetNextKey(pos);
+            if (GetAt(entry).end < rt) {
+                m_lookAheadBuildTimes.RemoveAtPos(cur);
+            }
+        }
     }
 
     m_sla.AdvanceToSegment(segment, stss->subs);
@@ -2988,16 +3600,25 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
 
         STSEntry stse = GetAt(entry);
 
-        {
-            REFERENCE_TIME start = TranslateStart(entry, fps);
-            m_time = (int)RT2MS(rt - start);
-            m_delay = (int)RT2MS(TranslateEnd(entry, fps) - start);
-        }
+        REFERENCE_TIME start = TranslateStart(entry, fps);
+        m_time = (int)RT2MS(rt - start);
+        m_delay = (int)RT2MS(TranslateEnd(entry, fps) - start);
 
+        m_animUnchangedUntil = INT_MAX;
         CSubtitle* s = GetSubtitle(entry);
         if (!s) {
             continue;
         }
+        // In ms from the start of the subtitle, like m_time
+        int unchangedUntil = m_animUnchangedUntil;
+
+        if (auto pPair = m_lookAheadBuildTimes.Lookup(entry)) {
+            if (pPair->m_value >= 0) {
+                m_lookAheadStats.nUsed++;
+                m_lookAheadStats.timeSaved += pPair->m_value;
+                m_lookAheadBuildTimes.RemoveKey(entry);
+            }
+        }
 
         CRect clipRect = s->m_clip;
         CRect r = s->m_rect;
@@ -3011,13 +3632,10 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
 
         CPoint org2;
 
-        BYTE* pAlphaMask = nullptr;
+        CAlphaMaskSharedPtr pAlphaMask;
 
         if (s->m_pClipper) {
-            const auto& ptr = s->m_pClipper->GetAlphaMask(s->m_pClipper);
-            if (ptr) {
-                pAlphaMask = ptr->get();
-            }
+            pAlphaMask = s->m_pClipper->GetAlphaMask(s->m_pClipper);
         }
 
         for (int k = 0; k < EF_NUMBEROFEFFECTS; k++) {
@@ -3027,32 +3645,11 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
 
             switch (k) {
                 case EF_MOVE: { // {\move(x1=param[0], y1=param[1], x2=param[2], y2=param[3], t1=t[0], t2=t[1])}
-                    CPoint p;
-                    CPoint p1(s->m_effects[k]->param[0], s->m_effects[k]->param[1]);
-                    CPoint p2(s->m_effects[k]->param[2], s->m_effects[k]->param[3]);
-                    int t1 = s->m_effects[k]->t[0];
-                    int t2 = s->m_effects[k]->t[1];
-
-                    if (t2 < t1) {
-                        std::swap(t1, t2);
-                    }
-
-                    if (t1 <= 0 && t2 <= 0) {
-                        t1 = 0;
-                        t2 = m_delay;
-                    }
+                    int t1, t2;
+                    GetMoveTimes(s->m_effects[k], m_delay, t1, t2);
+                    CPoint p = GetMovePosition(s->m_effects[k], t1, t2, m_time);
+                    unchangedUntil = std::min(unchangedUntil, GetMoveChange(s->m_effects[k], t1, t2, m_time));
 
-                    if (m_time <= t1) {
-                        p = p1;
-                    } else if (p1 == p2) {
-                        p = p1;
-                    } else if (t1 < m_time && m_time < t2) {
-                        double t = 1.0 * (m_time - t1) / (t2 - t1);
-                        p.x = (int)((1 - t) * p1.x + t * p2.x);
-                        p.y = (int)((1 - t) * p1.y + t * p2.y);
-                    } else {
-                        p = p2;
-                    }
                     r = CRect(
                             CPoint((s->m_scrAlignment % 3) == 1 ? p.x : (s->m_scrAlignment % 3) == 0 ? p.x - spaceNeeded.cx : p.x - (spaceNeeded.cx + 1) / 2,
                                    s->m_scrAlignment <= 3 ? p.y - spaceNeeded.cy : s->m_scrAlignment <= 6 ? p.y - (spaceNeeded.cy + 1) / 2 : p.y),
@@ -3070,39 +3667,24 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
                 }
                 break;
                 case EF_FADE: { // {\fade(a1=param[0], a2=param[1], a3=param[2], t1=t[0], t2=t[1], t3=t[2], t4=t[3]) or {\fad(t1=t[1], t2=t[2])
-                    int t1 = s->m_effects[k]->t[0];
-                    int t2 = s->m_effects[k]->t[1];
-                    int t3 = s->m_effects[k]->t[2];
-                    int t4 = s->m_effects[k]->t[3];
-
-                    if (t1 == -1 && t4 == -1) {
-                        t1 = 0;
-                        t3 = m_delay - t3;
-                        t4 = m_delay;
-                    }
-
-                    if (m_time < t1) {
-                        alpha = s->m_effects[k]->param[0];
-                    } else if (m_time >= t1 && m_time < t2) {
-                        double t = 1.0 * (m_time - t1) / (t2 - t1);
-                        alpha = (int)(s->m_effects[k]->param[0] * (1 - t) + s->m_effects[k]->param[1] * t);
-                    } else if (m_time >= t2 && m_time < t3) {
-                        alpha = s->m_effects[k]->param[1];
-                    } else if (m_time >= t3 && m_time < t4) {
-                        double t = 1.0 * (m_time - t3) / (t4 - t3);
-                        alpha = (int)(s->m_effects[k]->param[1] * (1 - t) + s->m_effects[k]->param[2] * t);
-                    } else if (m_time >= t4) {
-                        alpha = s->m_effects[k]->param[2];
-                    }
+                    int t[4];
+                    GetFadeTimes(s->m_effects[k], m_delay, t);
+                    alpha = GetFadeAlpha(s->m_effects[k], t, m_time);
+                    unchangedUntil = std::min(unchangedUntil, GetFadeChange(s->m_effects[k], t, m_time));
                 }
                 break;
                 case EF_BANNER: { // Banner;delay=param[0][;leftoright=param[1];fadeawaywidth=param[2]]
                     int left = (s->m_relativeTo == STSStyle::VIDEO) ? m_vidrect.left : 0,
                         right = (s->m_relativeTo == STSStyle::VIDEO) ? m_vidrect.right : m_size.cx;
 
+                    auto offset = [&](int time) {
+                        return (int)(time * 8.0 / s->m_effects[k]->param[0]);
+                    };
+
                     r.left = !!s->m_effects[k]->param[1]
-                             ? (left/*marginRect.left*/ - spaceNeeded.cx) + (int)(m_time * 8.0 / s->m_effects[k]->param[0])
-                             : (right /*- marginRect.right*/) - (int)(m_time * 8.0 / s->m_effects[k]->param[0]);
+                             ? (left/*marginRect.left*/ - spaceNeeded.cx) + offset(m_time)
+                             : (right /*- marginRect.right*/) - offset(m_time);
+                    unchangedUntil = std::min(unchangedUntil, FindChange(offset, m_time, m_delay));
 
                     r.right = r.left + spaceNeeded.cx;
 
@@ -3112,9 +3694,14 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
                 }
                 break;
                 case EF_SCROLL: { // Scroll up/down(toptobottom=param[3]);top=param[0];bottom=param[1];delay=param[2][;fadeawayheight=param[4]]
+                    auto offset = [&](int time) {
+                        return (int)(time * 8.0 / s->m_effects[k]->param[2]);
+                    };
+
                     r.top = !!s->m_effects[k]->param[3]
-                            ? s->m_effects[k]->param[0] + (int)(m_time * 8.0 / s->m_effects[k]->param[2]) - spaceNeeded.cy
-                            : s->m_effects[k]->param[1] - (int)(m_time * 8.0 / s->m_effects[k]->param[2]);
+                            ? s->m_effects[k]->param[0] + offset(m_time) - spaceNeeded.cy
+                            : s->m_effects[k]->param[1] - offset(m_time);
+                    unchangedUntil = std::min(unchangedUntil, FindChange(offset, m_time, m_delay));
 
                     r.bottom = r.top + spaceNeeded.cy;
 
@@ -3138,6 +3725,13 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
             }
         }
 
+        if (s->m_bIsAnimated) {
+            unchangedUntil = std::min(unchangedUntil, GetKaraokeChange(s, m_time));
+        }
+        if (unchangedUntil != INT_MAX) {
+            m_rtUnchangedUntil = std::min(m_rtUnchangedUntil, start + MS2RT(unchangedUntil));
+        }
+
         if (!fPosOverride && !fOrgOverride && !s->m_fAnimated) {
             r = m_sla.AllocRect(s, segment, entry, stse.layer, m_collisions);
         }
@@ -3171,12 +3765,12 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
                   : (s->m_scrAlignment % 3) == 0 ? org.x - l->m_width
                   :                            org.x - (l->m_width / 2);
             if (s->m_clipInverse) {
-                bbox2 |= l->PaintShadow(spd, iclipRect[0], pAlphaMask, p, org2, m_time, alpha);
-                bbox2 |= l->PaintShadow(spd, iclipRect[1], pAlphaMask, p, org2, m_time, alpha);
-                bbox2 |= l->PaintShadow(spd, iclipRect[2], pAlphaMask, p, org2, m_time, alpha);
-                bbox2 |= l->PaintShadow(spd, iclipRect[3], pAlphaMask, p, org2, m_time, alpha);
+                bbox2 |= l->PaintShadow(commands, spd, iclipRect[0], pAlphaMask, p, org2, m_time, alpha);
+                bbox2 |= l->PaintShadow(commands, spd, iclipRect[1], pAlphaMask, p, org2, m_time, alpha);
+                bbox2 |= l->PaintShadow(commands, spd, iclipRect[2], pAlphaMask, p, org2, m_time, alpha);
+                bbox2 |= l->PaintShadow(commands, spd, iclipRect[3], pAlphaMask, p, org2, m_time, alpha);
             } else {
-                bbox2 |= l->PaintShadow(spd, clipRect, pAlphaMask, p, org2, m_time, alpha);
+                bbox2 |= l->PaintShadow(commands, spd, clipRect, pAlphaMask, p, org2, m_time, alpha);
             }
             p.y += l->m_ascent + l->m_descent;
         }
@@ -3191,12 +3785,12 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
                   : (s->m_scrAlignment % 3) == 0 ? org.x - l->m_width
                   :                            org.x - (l->m_width / 2);
             if (s->m_clipInverse) {
-                bbox2 |= l->PaintOutline(spd, iclipRect[0], pAlphaMask, p, org2, m_time, alpha);
-                bbox2 |= l->PaintOutline(spd, iclipRect[1], pAlphaMask, p, org2, m_time, alpha);
-                bbox2 |= l->PaintOutline(spd, iclipRect[2], pAlphaMask, p, org2, m_time, alpha);
-                bbox2 |= l->PaintOutline(spd, iclipRect[3], pAlphaMask, p, org2, m_time, alpha);
+                bbox2 |= l->PaintOutline(commands, spd, iclipRect[0], pAlphaMask, p, org2, m_time, alpha);
+                bbox2 |= l->PaintOutline(commands, spd, iclipRect[1], pAlphaMask, p, org2, m_time, alpha);
+                bbox2 |= l->PaintOutline(commands, spd, iclipRect[2], pAlphaMask, p, org2, m_time, alpha);
+                bbox2 |= l->PaintOutline(commands, spd, iclipRect[3], pAlphaMask, p, org2, m_time, alpha);
             } else {
-                bbox2 |= l->PaintOutline(spd, clipRect, pAlphaMask, p, org2, m_time, alpha);
+                bbox2 |= l->PaintOutline(commands, spd, clipRect, pAlphaMask, p, org2, m_time, alpha);
             }
             p.y += l->m_ascent + l->m_descent;
         }
@@ -3211,12 +3805,12 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
                   : (s->m_scrAlignment % 3) == 0 ? org.x - l->m_width
                   :                            org.x - (l->m_width / 2);
             if (s->m_clipInverse) {
-                bbox2 |= l->PaintBody(spd, iclipRect[0], pAlphaMask, p, org2, m_time, alpha);
-                bbox2 |= l->PaintBody(spd, iclipRect[1], pAlphaMask, p, org2, m_time, alpha);
-                bbox2 |= l->PaintBody(spd, iclipRect[2], pAlphaMask, p, org2, m_time, alpha);
-                bbox2 |= l->PaintBody(spd, iclipRect[3], pAlphaMask, p, org2, m_time, alpha);
+                bbox2 |= l->PaintBody(commands, spd, iclipRect[0], pAlphaMask, p, org2, m_time, alpha);
+                bbox2 |= l->PaintBody(commands, spd, iclipRect[1], pAlphaMask, p, org2, m_time, alpha);
+                bbox2 |= l->PaintBody(commands, spd, iclipRect[2], pAlphaMask, p, org2, m_time, alpha);
+                bbox2 |= l->PaintBody(commands, spd, iclipRect[3], pAlphaMask, p, org2, m_time, alpha);
             } else {
-                bbox2 |= l->PaintBody(spd, clipRect, pAlphaMask, p, org2, m_time, alpha);
+                bbox2 |= l->PaintBody(commands, spd, clipRect, pAlphaMask, p, org2, m_time, alpha);
             }
             p.y += l->m_ascent + l->m_descent;
         }
@@ -3227,6 +3821,102 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
     return (subs.GetCount() && !bbox2.IsRectEmpty()) ? S_OK : S_FALSE;
 }
 
+// The part of the picture where before and after differ, the pixels outside of
+// it are covered by the same commands in the same order in both of them
+static CRect GetChangedRect(const std::vector<CDrawnCommand>& before, const CDrawCommands& after)
+{
+    CRect r(0, 0, 0, 0);
+
+    if (before.size() == after.size()) {
+        for (size_t i = 0; i < after.size(); i++) {
+            if (before[i] != after[i]) {
+                r |= before[i].rect;
+                r |= after[i].rect;
+            }
+        }
+    } else {
+        // Subtitles came or went, only what they share at both ends is kept
+        size_t nHead = 0, nTail = 0;
+        size_t nMax = std::min(before.size(), after.size());
+        while (nHead < nMax && before[nHead] == after[nHead]) {
+            nHead++;
+        }
+        while (nTail < nMax - nHead && before[before.size() - 1 - nTail] == after[after.size() - 1 - nTail]) {
+            nTail++;
+        }
+        for (size_t i = nHead; i < before.size() - nTail; i++) {
+            r |= before[i].rect;
+        }
+        for (size_t i = nHead; i < after.size() - nTail; i++) {
+            r |= after[i].rect;
+        }
+    }
+
+    return r;
+}
+
+STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, double fps, RECT& bbox)
+{
+    RECT dirty;
+    return RenderUpdate(spd, rt, fps, false, 0, bbox, dirty);
+}
+
+// IIncrementalSubPicProvider
+
+STDMETHODIMP CRenderedTextSubtitle::RenderUpdate(SubPicDesc& spd, REFERENCE_TIME rt, double fps, bool bUpdate, DWORD clearColor, RECT& bbox, RECT& dirty)
+{
+    CDrawCommands commands;
+    CRect bbox2;
+    HRESULT hr = LayOut(spd, rt, fps, commands, bbox2);
+
+    CRect rDirty = bbox2;
+    if (bUpdate) {
+        ASSERT(spd.bpp == 32);
+        if (spd.bits == m_lastDraw.bits && spd.w == m_lastDraw.w && spd.h == m_lastDraw.h && spd.pitch == m_lastDraw.pitch) {
+            // Karaoke and most animations only change a few words from one frame to the next
+            rDirty = GetChangedRect(m_lastDraw.commands, commands);
+        } else {
+            // Whatever spd holds wasn't drawn by us
+            rDirty.SetRect(0, 0, spd.w, spd.h);
+        }
+
+        for (int y = rDirty.top; y < rDirty.bottom; y++) {
+            std::fill_n((DWORD*)(spd.bits + spd.pitch * y) + rDirty.left, rDirty.Width(), clearColor);
+        }
+    }
+
+    // Outside of the dirty rectangle the picture already is what the commands would draw
+    for (const auto& command : commands) {
+        CRect clipRect = command.clipRect & rDirty;
+        if (!clipRect.IsRectEmpty()) {
+            command.pRasterizer->Draw(*command.pOverlayData, spd, clipRect, command.pAlphaMask ? command.pAlphaMask->get() : nullptr,
+                                      command.x, command.y, command.switchpts, command.fBody, command.fBorder);
+        }
+    }
+
+    m_lastDraw.commands.assign(commands.cbegin(), commands.cend());
+    m_lastDraw.bits = spd.bits;
+    m_lastDraw.w = spd.w;
+    m_lastDraw.h = spd.h;
+    m_lastDraw.pitch = spd.pitch;
+
+    bbox = bbox2;
+    dirty = rDirty;
+
+    return hr;
+}
+
+// IUnchangedSubPicProvider
+
+STDMETHODIMP_(REFERENCE_TIME) CRenderedTextSubtitle::GetUnchangedUntil(REFERENCE_TIME rt, double fps)
+{
+    if (rt != m_rtLastLayOut || fps != m_fpsLastLayOut) {
+        return rt;
+    }
+
+    return m_rtUnchangedUntil;
+}
+
 // IPersist
 
 STDMETHODIMP CRenderedTextSubtitle::GetClassID(CLSID* pClassID)
@@ -3331,3 +4021,73 @@ STDMETHODIMP CRenderedTextSubtitle::SetSourceTargetInfo(CString yuvVideoMatrix,
 
     return S_OK;
 }
+
+// IRenderingCacheStats
+
+STDMETHODIMP_(int) CRenderedTextSubtitle::GetCacheCount()
+{
+    return RenderingCaches::CACHE_COUNT;
+}
+
+STDMETHODIMP CRenderedTextSubtitle::GetCacheStats(int i, LPCWSTR* ppName, CRenderingCacheStats* pStats)
+{
+    CheckPointer(ppName, E_POINTER);
+    CheckPointer(pStats, E_POINTER);
+
+    CAutoLock cAutoLock(m_pLock);
+
+    return m_renderingCaches.GetStats(i, *ppName, *pStats) ? S_OK : E_INVALIDARG;
+}
+
+STDMETHODIMP CRenderedTextSubtitle::SetCacheBudget(int i, size_t maxBytes)
+{
+    CAutoLock cAutoLock(m_pLock);
+
+    return m_renderingCaches.SetMaxBytes(i, maxBytes) ? S_OK : E_INVALIDARG;
+}
+
+STDMETHODIMP CRenderedTextSubtitle::GetBufferPoolStats(CBufferPoolStats* pStats)
+{
+    CheckPointer(pStats, E_POINTER);
+
+    CBufferPool::GetStats(*pStats);
+
+    return S_OK;
+}
+
+STDMETHODIMP CRenderedTextSubtitle::SetLookAheadDepth(int depth)
+{
+    if (depth < 0) {
+        return E_INVALIDARG;
+    }
+
+    CAutoLock cAutoLock(m_pLock);
+
+    m_lookAheadStats.depth = depth;
+
+    return S_OK;
+}
+
+STDMETHODIMP CRenderedTextSubtitle::GetLookAheadStats(CLookAheadStats* pStats)
+{
+    CheckPointer(pStats, E_POINTER);
+
+    CAutoLock cAutoLock(m_pLock);
+
+    *pStats = m_lookAheadStats;
+
+    return S_OK;
+}
+
+STDMETHODIMP CRenderedTextSubtitle::StopLookAhead()
+{
+    {
+        CAutoLock cAutoLock(m_pLock);
+        // Keeps Render from queuing more requests
+        m_lookAheadStats.depth = 0;
+    }
+
+    JoinLookAheadThread();
+
+    return S_OK;
+}
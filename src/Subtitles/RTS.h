@@ -21,12 +21,18 @@
 
 #pragma once
 
-#include <list>
+#include <condition_variable>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include "STS.h"
 #include "Rasterizer.h"
 #include "../SubPic/SubPicProviderImpl.h"
 #include "RenderingCache.h"
+#include "RenderingCacheStats.h"
+#include "GlyphOutlineCache.h"
+#include "WorkStealingPool.h"
 
 class Effect;
 struct CTextDims;
@@ -36,52 +42,89 @@ struct CPolygonPath {
     CSize size;
 };
 
-struct CAlphaMask;
-
-struct alpha_mask_deleter {
-    explicit alpha_mask_deleter(std::list<CAlphaMask>& alphaMaskPool)
-        : m_alphaMaskPool(alphaMaskPool) {
-    }
-
-    void operator()(CAlphaMask* ptr) const noexcept;
-
-    std::list<CAlphaMask>& m_alphaMaskPool;
-};
-
-struct CAlphaMask final : std::unique_ptr<BYTE[]> {
+// The alpha mask buffers come from CBufferPool, \clip heavy scripts create and release them every frame
+struct CAlphaMask final {
     CAlphaMask() = delete;
-    CAlphaMask(CAlphaMask&&) = default;
     CAlphaMask(const CAlphaMask&) = delete;
     CAlphaMask& operator=(const CAlphaMask&) = delete;
 
     size_t m_size;
 
     explicit CAlphaMask(size_t size)
-        : std::unique_ptr<BYTE[]>(DEBUG_NEW BYTE[size])
-        , m_size(size) {
+        : m_size(size)
+        , m_pBuffer((BYTE*)CBufferPool::Alloc(size)) {
+        if (!m_pBuffer) {
+            AfxThrowMemoryException();
+        }
     }
 
-    static std::shared_ptr<CAlphaMask> Alloc(std::list<CAlphaMask>& alphaMaskPool, size_t size) {
-        for (auto it = alphaMaskPool.begin(); it != alphaMaskPool.end(); ++it) {
-            auto& am = *it;
-            if (am.m_size >= size) {
-                auto ret = std::shared_ptr<CAlphaMask>(DEBUG_NEW CAlphaMask(std::move(am)), alpha_mask_deleter(alphaMaskPool));
-                alphaMaskPool.erase(it);
-                return std::move(ret);
-            }
-        }
-        return std::shared_ptr<CAlphaMask>(DEBUG_NEW CAlphaMask(size), alpha_mask_deleter(alphaMaskPool));
+    ~CAlphaMask() {
+        CBufferPool::Free(m_pBuffer, m_size);
+    }
+
+    BYTE* get() const { return m_pBuffer; }
+
+    static std::shared_ptr<CAlphaMask> Alloc(size_t size) {
+        return std::make_shared<CAlphaMask>(size);
     }
+
+private:
+    BYTE* m_pBuffer;
 };
 
 typedef std::shared_ptr<CPolygonPath> CPolygonPathSharedPtr;
-struct SSATag;
-typedef std::shared_ptr<CAtlList<SSATag>> SSATagsList;
+struct SSATagProgram;
+typedef std::shared_ptr<const SSATagProgram> SSATagProgramSharedPtr;
 typedef std::shared_ptr<CAlphaMask> CAlphaMaskSharedPtr;
 
+template<>
+struct CRenderingCacheSizeTraits<CPolygonPathKey, CPolygonPathSharedPtr> {
+    static size_t GetSize(const CPolygonPathKey& key, const CPolygonPathSharedPtr& value) {
+        size_t size = sizeof(key) + sizeof(CPolygonPath);
+        if (value) {
+            size += value->typesOrg.GetCount() * sizeof(BYTE) + value->pointsOrg.GetCount() * sizeof(CPoint);
+        }
+        return size;
+    }
+};
+
+template<>
+struct CRenderingCacheSizeTraits<COutlineKey, COutlineDataSharedPtr> {
+    static size_t GetSize(const COutlineKey& key, const COutlineDataSharedPtr& value) {
+        size_t size = sizeof(key) + sizeof(STSStyle) + sizeof(COutlineData);
+        if (value) {
+            size += (value->mOutline.capacity() + value->mWideOutline.capacity()) * sizeof(tSpanBuffer::value_type);
+        }
+        return size;
+    }
+};
+
+template<>
+struct CRenderingCacheSizeTraits<COverlayKey, COverlayDataSharedPtr> {
+    static size_t GetSize(const COverlayKey& key, const COverlayDataSharedPtr& value) {
+        size_t size = sizeof(key) + sizeof(STSStyle) + sizeof(COverlayData);
+        if (value && value->mpOverlayBufferBody) {
+            // Body and border
+            size += 2 * size_t(value->mOverlayPitch) * value->mOverlayHeight;
+        }
+        return size;
+    }
+};
+
+template<>
+struct CRenderingCacheSizeTraits<CClipperKey, CAlphaMaskSharedPtr> {
+    static size_t GetSize(const CClipperKey& key, const CAlphaMaskSharedPtr& value) {
+        size_t size = sizeof(key) + sizeof(CAlphaMask);
+        if (value) {
+            size += value->m_size;
+        }
+        return size;
+    }
+};
+
 typedef CRenderingCache<CTextDimsKey, CTextDims, CKeyTraits<CTextDimsKey>> CTextDimsCache;
 typedef CRenderingCache<CPolygonPathKey, CPolygonPathSharedPtr, CKeyTraits<CPolygonPathKey>> CPolygonCache;
-typedef CRenderingCache<CStringW, SSATagsList, CStringElementTraits<CStringW>> CSSATagsCache;
+typedef CRenderingCache<CStringW, SSATagProgramSharedPtr, CStringElementTraits<CStringW>> CSSATagsCache;
 typedef CRenderingCache<CEllipseKey, CEllipseSharedPtr, CKeyTraits<CEllipseKey>> CEllipseCache;
 typedef CRenderingCache<COutlineKey, COutlineDataSharedPtr, CKeyTraits<COutlineKey>> COutlineCache;
 typedef CRenderingCache<COverlayKey, COverlayDataSharedPtr, CKeyTraits<COverlayKey>> COverlayCache;
@@ -94,18 +137,35 @@ struct RenderingCaches {
     CEllipseCache ellipseCache;
     COutlineCache outlineCache;
     COverlayCache overlayCache;
-    // Be careful about the order alphaMaskCache need to be destroyed before alphaMaskPool.
-    std::list<CAlphaMask> alphaMaskPool;
     CAlphaMaskCache alphaMaskCache;
+    // Shared between all the subtitles, unlike the other caches
+    std::shared_ptr<CGlyphOutlineCache> glyphOutlineCache;
 
+    // The caches holding bitmaps are also bounded by the memory they use,
+    // a single 4K overlay or alpha mask can take megabytes
     RenderingCaches()
         : textDimsCache(2048)
-        , polygonCache(2048)
+        , polygonCache(2048, 16 * 1024 * 1024)
         , SSATagsCache(2048)
         , ellipseCache(64)
-        , outlineCache(128)
-        , overlayCache(128)
-        , alphaMaskCache(128) {}
+        , outlineCache(128, 32 * 1024 * 1024)
+        , overlayCache(128, 64 * 1024 * 1024)
+        , alphaMaskCache(128, 64 * 1024 * 1024)
+        , glyphOutlineCache(CGlyphOutlineCache::GetShared()) {}
+
+    enum {
+        TEXT_DIMS_CACHE,
+        POLYGON_CACHE,
+        SSA_TAGS_CACHE,
+        ELLIPSE_CACHE,
+        OUTLINE_CACHE,
+        OVERLAY_CACHE,
+        ALPHA_MASK_CACHE,
+        CACHE_COUNT
+    };
+
+    bool GetStats(int i, LPCWSTR& name, CRenderingCacheStats& stats) const;
+    bool SetMaxBytes(int i, size_t maxBytes);
 };
 
 class CMyFont : public CFont
@@ -114,6 +174,8 @@ public:
     int m_ascent, m_descent;
 
     CMyFont(const STSStyle& style);
+
+    static void GetLogFont(const STSStyle& style, LOGFONT& lf);
 };
 
 struct CTextDims {
@@ -123,15 +185,19 @@ struct CTextDims {
 
 class CPolygon;
 
+// The shift, scale, rotations and perspective of style that CWord applies to the points
+// of its path around org before rasterizing it. The SSE2 and AVX2 versions compute in
+// float and can be one unit off the C version, see RTS.cpp.
+void TransformPoints_C(POINT* points, int count, const STSStyle& style, double scalex, double scaley, const CPoint& org);
+void TransformPoints_SSE2(POINT* points, int count, const STSStyle& style, double scalex, double scaley, const CPoint& org);
+void TransformPoints_AVX2(POINT* points, int count, const STSStyle& style, double scalex, double scaley, const CPoint& org);
+
 class CWord : public Rasterizer
 {
     bool m_fDrawn;
     CPoint m_p;
 
     void Transform(CPoint org);
-
-    void Transform_C(const CPoint& org);
-    void Transform_SSE2(const CPoint& org);
     bool CreateOpaqueBox();
 
 protected:
@@ -278,6 +344,57 @@ private:
 
 using CClipperSharedPtr = std::shared_ptr<CClipper>;
 
+// An overlay to be drawn on the subtitle picture, with everything Rasterizer::Draw reads
+struct CDrawCommand {
+    const Rasterizer* pRasterizer; // Only valid until the subtitles are laid out again
+    COverlayDataSharedPtr pOverlayData;
+    CAlphaMaskSharedPtr pAlphaMask;
+    CRect clipRect;
+    int x, y;
+    DWORD switchpts[6];
+    bool fBody, fBorder;
+    CRect rect; // The part of the picture it paints
+};
+
+typedef std::vector<CDrawCommand> CDrawCommands;
+
+// What a draw command painted, kept until the next frame to find out what changed.
+// Commands which compare equal paint the same pixels. The overlay and alpha mask are
+// only referenced weakly so that they are released with the caches, an expired
+// reference can't compare equal to anything drawn later.
+struct CDrawnCommand {
+    std::weak_ptr<COverlayData> pOverlayData;
+    std::weak_ptr<CAlphaMask> pAlphaMask;
+    CRect clipRect;
+    int x, y;
+    DWORD switchpts[6];
+    bool fBody, fBorder;
+    CRect rect;
+
+    explicit CDrawnCommand(const CDrawCommand& command)
+        : pOverlayData(command.pOverlayData)
+        , pAlphaMask(command.pAlphaMask)
+        , clipRect(command.clipRect)
+        , x(command.x)
+        , y(command.y)
+        , fBody(command.fBody)
+        , fBorder(command.fBorder)
+        , rect(command.rect) {
+        memcpy(switchpts, command.switchpts, sizeof(switchpts));
+    }
+
+    bool operator==(const CDrawCommand& other) const {
+        return !pOverlayData.owner_before(other.pOverlayData) && !other.pOverlayData.owner_before(pOverlayData)
+               && !pAlphaMask.owner_before(other.pAlphaMask) && !other.pAlphaMask.owner_before(pAlphaMask)
+               && clipRect == other.clipRect && x == other.x && y == other.y
+               && !memcmp(switchpts, other.switchpts, sizeof(switchpts))
+               && fBody == other.fBody && fBorder == other.fBorder;
+    }
+    bool operator!=(const CDrawCommand& other) const {
+        return !(*this == other);
+    }
+};
+
 class CLine : public CAtlList<CWord*>
 {
 public:
@@ -287,9 +404,10 @@ public:
 
     void Compact();
 
-    CRect PaintShadow(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CPoint p, CPoint org, int time, int alpha);
-    CRect PaintOutline(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CPoint p, CPoint org, int time, int alpha);
-    CRect PaintBody(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CPoint p, CPoint org, int time, int alpha);
+    // The words are not drawn right away but added to commands
+    CRect PaintShadow(CDrawCommands& commands, const SubPicDesc& spd, const CRect& clipRect, const CAlphaMaskSharedPtr& pAlphaMask, CPoint p, CPoint org, int time, int alpha);
+    CRect PaintOutline(CDrawCommands& commands, const SubPicDesc& spd, const CRect& clipRect, const CAlphaMaskSharedPtr& pAlphaMask, CPoint p, CPoint org, int time, int alpha);
+    CRect PaintBody(CDrawCommands& commands, const SubPicDesc& spd, const CRect& clipRect, const CAlphaMaskSharedPtr& pAlphaMask, CPoint p, CPoint org, int time, int alpha);
 };
 
 enum SSATagCmd {
@@ -354,25 +472,28 @@ enum SSATagCmd {
 #define SSA_CMD_MIN_LENGTH 1
 #define SSA_CMD_MAX_LENGTH 5
 
-struct SSATag {
+struct SSATagInstr {
     SSATagCmd cmd;
-    CAtlArray<CStringW, CStringElementTraits<CStringW>> params;
-    CAtlArray<int> paramsInt;
-    CAtlArray<double> paramsReal;
-    SSATagsList subTagsList;
-
-    SSATag() : cmd(SSA_unknown) {};
-
-    SSATag(const SSATag& tag)
-        : cmd(tag.cmd)
-        , params()
-        , paramsInt()
-        , paramsReal()
-        , subTagsList(tag.subTagsList) {
-        params.Copy(tag.params);
-        paramsInt.Copy(tag.paramsInt);
-        paramsReal.Copy(tag.paramsReal);
-    }
+    bool bRelative;     // \fs+ and \fs-
+    bool bAnimation;    // \t, animating the instructions [subBegin, subEnd)
+    UINT iInts, nInts;  // Arguments, as ranges of the arrays of the program
+    UINT iReals, nReals;
+    UINT iStrs, nStrs;
+    UINT subBegin, subEnd;
+};
+
+// A {\...} block compiled once into a flat list of instructions whose arguments are
+// already converted, so that applying it again for every frame of an animated line
+// only deals with numbers. Strings are only kept for \fn, \r and drawing clips.
+// The instructions animated by a \t are stored before those of the block itself.
+struct SSATagProgram {
+    std::vector<SSATagInstr> instrs;
+    std::vector<int> ints;
+    std::vector<double> reals;
+    std::vector<CStringW> strs;
+    UINT begin, end; // The instructions of the block itself
+
+    SSATagProgram() : begin(0), end(0) {}
 };
 
 enum eftype {
@@ -424,14 +545,31 @@ public:
     void MakeLines(CSize size, const CRect& marginRect);
 };
 
+// Places the subtitles of a segment so that those of the same layer don't overlap.
+// The rects are indexed by layer and vertical position, so that placing one only
+// looks at the rects around it instead of at every rect on the screen.
 class CScreenLayoutAllocator
 {
+    // The rects of a layer, sorted by their top
+    struct Layer {
+        std::multimap<LONG, POSITION> rects;
+        LONG maxHeight;
+
+        Layer() : maxHeight(0) {}
+    };
+
     struct SubRect {
         CRect r;
         int segment, entry, layer;
+        bool bIndexed; // Empty rects can't collide and aren't indexed
+        std::multimap<LONG, POSITION>::iterator it;
     };
 
     CAtlList<SubRect> m_subrects;
+    std::map<int, Layer> m_layers;
+    CAtlMap<int, POSITION> m_entries;
+
+    void Remove(POSITION pos);
 
 public:
     /*virtual*/
@@ -442,22 +580,69 @@ public:
 };
 
 class __declspec(uuid("537DCACA-2812-4a4f-B2C6-1A34C17ADEB0"))
-    CRenderedTextSubtitle : public CSimpleTextSubtitle, public CSubPicProviderImpl, public ISubStream
+    CRenderedTextSubtitle : public CSimpleTextSubtitle, public CSubPicProviderImpl, public IIncrementalSubPicProvider, public IUnchangedSubPicProvider,
+    public ISubStream, public IRenderingCacheStats
 {
     static CAtlMap<CStringW, SSATagCmd, CStringElementTraits<CStringW>> s_SSATagCmds;
     CAtlMap<int, CSubtitle*> m_subtitleCache;
 
     RenderingCaches m_renderingCaches;
 
+    // Keeps the pool used by the rasterizer alive as long as we are
+    std::shared_ptr<CWorkStealingPool> m_pWorkerPool;
+
     CScreenLayoutAllocator m_sla;
 
+    // Lays out the subtitles of the next few seconds on a low priority thread,
+    // so that Render mostly finds them in m_subtitleCache. The worker never blocks
+    // on m_pLock, it gives up as soon as a newer request or a stop comes in, so
+    // the destructor can always join it, even when it runs with m_pLock held.
+    struct LookAheadState {
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool bExit = false;
+        bool bBusy = false; // A request is queued or running
+        unsigned int request = 0;
+        REFERENCE_TIME rt = 0;
+        double fps = 0.0;
+    };
+    std::shared_ptr<LookAheadState> m_pLookAhead;
+    std::thread m_lookAheadThread;
+    // Layout time of the subtitles built in advance which were not rendered yet,
+    // in microseconds, or -1 for the animated ones which are not worth it
+    CAtlMap<int, LONGLONG> m_lookAheadBuildTimes;
+    CLookAheadStats m_lookAheadStats;
+    // The look ahead and the subpic queue don't look up the same times as Render
+    STSSearchCursor m_lookAheadCursor;
+    STSSearchCursor m_positionCursor;
+
+    void QueueLookAhead(REFERENCE_TIME rt, double fps);
+    void LookAhead(REFERENCE_TIME rt, double fps, unsigned int request);
+    bool LockForLookAhead(unsigned int request);
+    static void LookAheadThread(std::shared_ptr<LookAheadState> pState, CRenderedTextSubtitle* pRTS);
+    void JoinLookAheadThread();
+
+    // What the last call to Render drew, see RenderUpdate
+    struct LastDraw {
+        std::vector<CDrawnCommand> commands;
+        BYTE* bits = nullptr;
+        int w = 0, h = 0, pitch = 0;
+    } m_lastDraw;
+
+    HRESULT LayOut(const SubPicDesc& spd, REFERENCE_TIME rt, double fps, CDrawCommands& commands, CRect& bbox);
+    // Until when the animations of the last layout keep drawing the same thing, see GetUnchangedUntil
+    REFERENCE_TIME m_rtLastLayOut, m_rtUnchangedUntil;
+    double m_fpsLastLayOut;
+
     CSize m_size;
     CRect m_vidrect;
 
     // temp variables, used when parsing the script
     int m_time, m_delay;
-    int m_animStart, m_animEnd;
-    double m_animAccel;
+    // Where the \t being applied is at, see SetAnimation
+    enum { ANIM_BEFORE, ANIM_DURING, ANIM_AFTER } m_animPhase;
+    double m_animProgress;
+    int m_animUnchangedUntil; // When the \t applied since it was reset may start giving other values
     int m_ktype, m_kstart, m_kend;
     int m_nPolygon;
     int m_polygonBaselineOffset;
@@ -469,10 +654,12 @@ class __declspec(uuid("537DCACA-2812-4a4f-B2C6-1A34C17ADEB0"))
     void ParseEffect(CSubtitle* sub, CString str);
     void ParseString(CSubtitle* sub, CStringW str, STSStyle& style);
     void ParsePolygon(CSubtitle* sub, CStringW str, STSStyle& style);
-    bool ParseSSATag(SSATagsList& tagsList, const CStringW& str);
-    bool CreateSubFromSSATag(CSubtitle* sub, const SSATagsList& tagsList, STSStyle& style, STSStyle& org, bool fAnimate = false);
+    bool ParseSSATag(SSATagProgramSharedPtr& program, const CStringW& str);
+    void CompileSSATag(SSATagProgram& program, const CStringW& str, UINT& begin, UINT& end);
+    bool CreateSubFromSSATag(CSubtitle* sub, const SSATagProgram& program, UINT begin, UINT end, STSStyle& style, STSStyle& org, bool fAnimate = false);
     bool ParseHtmlTag(CSubtitle* sub, CStringW str, STSStyle& style, const STSStyle& org);
 
+    void SetAnimation(int start, int end, double accel);
     double CalcAnimation(double dst, double src, bool fAnimate);
 
     CSubtitle* GetSubtitle(int entry);
@@ -513,6 +700,12 @@ public:
     STDMETHODIMP_(bool) IsAnimated(POSITION pos);
     STDMETHODIMP Render(SubPicDesc& spd, REFERENCE_TIME rt, double fps, RECT& bbox);
 
+    // IIncrementalSubPicProvider
+    STDMETHODIMP RenderUpdate(SubPicDesc& spd, REFERENCE_TIME rt, double fps, bool bUpdate, DWORD clearColor, RECT& bbox, RECT& dirty);
+
+    // IUnchangedSubPicProvider
+    STDMETHODIMP_(REFERENCE_TIME) GetUnchangedUntil(REFERENCE_TIME rt, double fps);
+
     // IPersist
     STDMETHODIMP GetClassID(CLSID* pClassID);
 
@@ -523,4 +716,13 @@ public:
     STDMETHODIMP SetStream(int iStream);
     STDMETHODIMP Reload();
     STDMETHODIMP SetSourceTargetInfo(CString yuvMatrix, int targetBlackLevel, int targetWhiteLevel);
+
+    // IRenderingCacheStats
+    STDMETHODIMP_(int) GetCacheCount();
+    STDMETHODIMP GetCacheStats(int i, LPCWSTR* ppName, CRenderingCacheStats* pStats);
+    STDMETHODIMP SetCacheBudget(int i, size_t maxBytes);
+    STDMETHODIMP GetBufferPoolStats(CBufferPoolStats* pStats);
+    STDMETHODIMP SetLookAheadDepth(int depth);
+    STDMETHODIMP GetLookAheadStats(CLookAheadStats* pStats);
+    STDMETHODIMP StopLookAhead();
 };
@@ -21,11 +21,13 @@
 
 #include "stdafx.h"
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <intrin.h>
 #include <vector>
 #include "Rasterizer.h"
 #include "SeparableFilter.h"
+#include "WorkStealingPool.h"
 #include "../SubPic/ISubPic.h"
 
 int Rasterizer::getOverlayWidth() const
@@ -39,6 +41,7 @@ Rasterizer::Rasterizer()
     , mpPathPoints(nullptr)
     , mPathPoints(0)
     , m_bUseAVX2(false)
+    , m_bUseAVX512(false)
     , mpEdgeBuffer(nullptr)
     , mEdgeHeapSize(0)
     , mEdgeNext(0)
@@ -51,6 +54,8 @@ Rasterizer::Rasterizer()
     }
     __cpuidex(cpuInfo, 7, 0);
     m_bUseAVX2 = !!(cpuInfo[1] & (1 << 5)) && (_xgetbv(_XCR_XFEATURE_ENABLED_MASK) & 0x6) == 0x6;
+    // AVX-512F also needs the OS to save the opmask and upper ZMM registers
+    m_bUseAVX512 = !!(cpuInfo[1] & (1 << 16)) && (_xgetbv(_XCR_XFEATURE_ENABLED_MASK) & 0xE6) == 0xE6;
 }
 
 Rasterizer::~Rasterizer()
@@ -69,8 +74,10 @@ void Rasterizer::_TrashPath()
 
 void Rasterizer::_ReallocEdgeBuffer(unsigned int edges)
 {
-    Edge* pNewEdgeBuffer = (Edge*)realloc(mpEdgeBuffer, sizeof(Edge) * edges);
+    Edge* pNewEdgeBuffer = (Edge*)CBufferPool::Alloc(sizeof(Edge) * edges);
     if (pNewEdgeBuffer) {
+        memcpy(pNewEdgeBuffer, mpEdgeBuffer, sizeof(Edge) * std::min(edges, mEdgeHeapSize));
+        CBufferPool::Free(mpEdgeBuffer, sizeof(Edge) * mEdgeHeapSize);
         mpEdgeBuffer = pNewEdgeBuffer;
         mEdgeHeapSize = edges;
     } else {
@@ -337,6 +344,39 @@ bool Rasterizer::PartialEndPath(HDC hdc, long dx, long dy)
     return false;
 }
 
+bool Rasterizer::AppendPath(const BYTE* pTypes, const POINT* pPoints, int nPoints, long dx, long dy, bool bClearPath)
+{
+    if (bClearPath) {
+        _TrashPath();
+    }
+
+    if (!nPoints) {
+        return true;
+    }
+
+    BYTE* pNewTypes = (BYTE*)realloc(mpPathTypes, (mPathPoints + nPoints) * sizeof(BYTE));
+    if (pNewTypes) {
+        mpPathTypes = pNewTypes;
+    }
+    POINT* pNewPoints = (POINT*)realloc(mpPathPoints, (mPathPoints + nPoints) * sizeof(POINT));
+    if (pNewPoints) {
+        mpPathPoints = pNewPoints;
+    }
+
+    if (!pNewTypes || !pNewPoints) {
+        return false;
+    }
+
+    for (ptrdiff_t i = 0; i < nPoints; ++i) {
+        mpPathPoints[mPathPoints + i].x = pPoints[i].x + dx;
+        mpPathPoints[mPathPoints + i].y = pPoints[i].y + dy;
+        mpPathTypes[mPathPoints + i] = pTypes[i];
+    }
+    mPathPoints += nPoints;
+
+    return true;
+}
+
 bool Rasterizer::ScanConvert()
 {
     try {
@@ -400,14 +440,17 @@ bool Rasterizer::ScanConvert()
 
         mEdgeNext = 1;
         mEdgeHeapSize = 2048;
-        mpEdgeBuffer = (Edge*)malloc(sizeof(Edge) * mEdgeHeapSize);
+        mpEdgeBuffer = (Edge*)CBufferPool::Alloc(sizeof(Edge) * mEdgeHeapSize);
         if (!mpEdgeBuffer) {
             TRACE(_T("Rasterizer::ScanConvert: Failed to allocate mpEdgeBuffer\n"));
             return false;
         }
 
         // Initialize scanline list.
-        mpScanBuffer = DEBUG_NEW unsigned int[m_pOutlineData->mHeight];
+        mpScanBuffer = (unsigned int*)CBufferPool::Alloc(m_pOutlineData->mHeight * sizeof(unsigned int));
+        if (!mpScanBuffer) {
+            AfxThrowMemoryException();
+        }
         ZeroMemory(mpScanBuffer, m_pOutlineData->mHeight * sizeof(unsigned int));
 
         // Scan convert the outline.  Yuck, Bezier curves....
@@ -528,15 +571,19 @@ bool Rasterizer::ScanConvert()
         }
 
         // Dump the edge and scan buffers, since we no longer need them.
-        free(mpEdgeBuffer);
-        delete[] mpScanBuffer;
+        CBufferPool::Free(mpEdgeBuffer, sizeof(Edge) * mEdgeHeapSize);
+        CBufferPool::Free(mpScanBuffer, m_pOutlineData->mHeight * sizeof(unsigned int));
+        mpEdgeBuffer = nullptr;
+        mpScanBuffer = nullptr;
 
         // All done!
         return true;
     } catch (CMemoryException* e) {
         TRACE(_T("Rasterizer::ScanConvert: Memory allocation failed\n"));
-        free(mpEdgeBuffer);
-        delete[] mpScanBuffer;
+        CBufferPool::Free(mpEdgeBuffer, sizeof(Edge) * mEdgeHeapSize);
+        CBufferPool::Free(mpScanBuffer, m_pOutlineData->mHeight * sizeof(unsigned int));
+        mpEdgeBuffer = nullptr;
+        mpScanBuffer = nullptr;
         e->Delete();
         return false;
     }
@@ -779,72 +826,253 @@ void Rasterizer::CreateWidenedRegionFast(int rx, int ry)
     flushLines(yPrec - ry, yPrec + ry + 1, m_pOutlineData->mWideOutline);
 }
 
-bool Rasterizer::Rasterize(int xsub, int ysub, int fBlur, double fGaussianBlur)
+namespace
 {
-    m_pOverlayData = std::make_shared<COverlayData>();
+    // Number of distance values computed at once by CreateWidenedRegionEDT
+    const int EDT_STRIP_SIZE = 1 << 20;
+    const int EDT_MIN_STRIP_LINES = 64;
+    // Outlines with at least one span per this many points of the widened region are dense
+    const int EDT_MAX_POINTS_PER_SPAN = 64;
+}
 
-    if (!m_pOutlineData || !m_pOutlineData->mWidth || !m_pOutlineData->mHeight) {
+bool Rasterizer::PreferWidenedRegionEDT(int rx, int ry) const
+{
+    // The distance transform costs the same for every point of the widened region while the
+    // cost of CreateWidenedRegionFast grows with the number of spans, and with the border size
+    // when many of them are within reach of each other. The latter is much faster on text.
+    if (!m_pOutlineData || ry >= USHRT_MAX) {
+        return false;
+    }
+    __int64 points = __int64(m_pOutlineData->mWidth + 2 * std::max(rx, 0)) * (m_pOutlineData->mHeight + 2 * std::max(ry, 0));
+    return __int64(m_pOutlineData->mOutline.size()) * EDT_MAX_POINTS_PER_SPAN >= points;
+}
+
+// Widen the outline with a separable distance transform: the vertical distance to the outline
+// is computed for every point, then each point covers the part of its line within the ellipse
+// arc at that distance. The cost only depends on the size of the widened region, not on the
+// border size or on the complexity of the outline. The result is exactly the same as the one
+// of CreateWidenedRegion.
+bool Rasterizer::CreateWidenedRegionEDT(int rx, int ry)
+{
+    if (m_pOutlineData->mOutline.empty()) {
         return true;
     }
 
-    xsub &= 7;
-    ysub &= 7;
+    if (rx < 0) {
+        rx = 0;
+    }
+    if (ry < 0) {
+        ry = 0;
+    }
 
-    int width =  m_pOutlineData->mWidth + xsub;
-    int height = m_pOutlineData->mHeight;// + ysub
+    // The vertical distances are stored on 16 bits
+    if (ry >= USHRT_MAX) {
+        ASSERT(FALSE);
+        return false;
+    }
 
-    m_pOverlayData->mOffsetX = m_pOutlineData->mPathOffsetX - xsub;
-    m_pOverlayData->mOffsetY = m_pOutlineData->mPathOffsetY - ysub;
+    m_pOutlineData->mWideBorder = std::max(rx, ry);
 
-    m_pOutlineData->mWideBorder = (m_pOutlineData->mWideBorder + 7) & ~7;
+    const tSpanBuffer& outline = m_pOutlineData->mOutline;
+    tSpanBuffer& wideOutline = m_pOutlineData->mWideOutline;
 
-    if (!m_pOutlineData->mWideOutline.empty() || fBlur || fGaussianBlur > 0) {
-        int bluradjust = 0;
-        if (fGaussianBlur > 0) {
-            bluradjust += (int)(fGaussianBlur * 3 * 8 + 0.5) | 1;
+    try {
+        const int yFirst = int(outline.front().first >> 32);
+        const int yLast = int(outline.back().first >> 32);
+
+        // Index the first span of each line and find the horizontal extent of the outline
+        std::vector<size_t> lineStart(yLast - yFirst + 2);
+        int xFirst = INT_MAX;
+        int xLast = INT_MIN;
+        size_t iSpan = 0;
+        for (int y = yFirst; y <= yLast; y++) {
+            lineStart[y - yFirst] = iSpan;
+            for (; iSpan < outline.size() && int(outline[iSpan].first >> 32) == y; iSpan++) {
+                xFirst = std::min(xFirst, int(outline[iSpan].first));
+                xLast = std::max(xLast, int(outline[iSpan].second));
+            }
         }
-        if (fBlur) {
-            bluradjust += 8;
+        lineStart[yLast - yFirst + 1] = outline.size();
+
+        const int xOffset = xFirst - rx;
+        const int width = xLast - xFirst + 2 * rx;
+
+        // Horizontal reach of the border at a given vertical distance from the outline,
+        // rounded the same way as CEllipse. Distances above ry are out of reach.
+        std::vector<int> arc(ry + 2);
+        arc[0] = rx;
+        for (int dy = 1; dy <= ry; dy++) {
+            arc[dy] = std::lround(rx * std::sqrt(1 - double(dy) * dy / (double(ry) * ry)));
+        }
+        arc[ry + 1] = -1;
+
+        // The distances to the outline below are computed for a few lines at a time to bound the
+        // memory used. Strips at least as high as the border mean each line is looked at twice at most.
+        const int nStripLines = std::max({ ry + 1, EDT_MIN_STRIP_LINES, EDT_STRIP_SIZE / width });
+        std::vector<unsigned short> distanceBelow(size_t(width) * nStripLines);
+        std::vector<int> nearestAbove(width, yFirst - 2 * ry - 2);
+        std::vector<int> nearestBelow(width);
+        std::vector<int> reach(width);
+
+        auto markLine = [&](std::vector<int>& nearest, int y) {
+            if (y >= yFirst && y <= yLast) {
+                for (size_t i = lineStart[y - yFirst], iEnd = lineStart[y - yFirst + 1]; i < iEnd; i++) {
+                    std::fill(nearest.begin() + (int(outline[i].first) - xOffset),
+                              nearest.begin() + (int(outline[i].second) - xOffset), y);
+                }
+            }
+        };
+
+        auto addSpan = [&](int y, int xLeft, int xRight) {
+            wideOutline.emplace_back(unsigned __int64(y) << 32 | unsigned int(xLeft + xOffset),
+                                     unsigned __int64(y) << 32 | unsigned int(xRight + xOffset));
+        };
+
+        wideOutline.reserve(outline.size() + outline.size() / 2);
+
+        for (int yStart = yFirst - ry; yStart <= yLast + ry; yStart += nStripLines) {
+            const int yEnd = std::min(yStart + nStripLines, yLast + ry + 1);
+
+            // Vertical distance to the closest outline point below in each column
+            std::fill(nearestBelow.begin(), nearestBelow.end(), yEnd + ry);
+            for (int y = std::max(yEnd - 1, std::min(yEnd - 1 + ry, yLast)); y >= yStart; y--) {
+                markLine(nearestBelow, y);
+                if (y < yEnd) {
+                    unsigned short* row = &distanceBelow[size_t(y - yStart) * width];
+                    for (int x = 0; x < width; x++) {
+                        row[x] = (unsigned short)std::min(nearestBelow[x] - y, ry + 1);
+                    }
+                }
+            }
+
+            for (int y = yStart; y < yEnd; y++) {
+                markLine(nearestAbove, y);
+
+                // The border covers x if arc[distance(x')] - |x - x'| >= 0 for some x',
+                // one sweep in each direction finds the maximum of that expression
+                const unsigned short* row = &distanceBelow[size_t(y - yStart) * width];
+                int maxReach = -1;
+                for (int x = width - 1; x >= 0; x--) {
+                    int distance = std::min(y - nearestAbove[x], int(row[x]));
+                    maxReach = std::max(arc[distance], maxReach - 1);
+                    reach[x] = maxReach;
+                }
+                maxReach = -1;
+                int xLeft = -1;
+                for (int x = 0; x < width; x++) {
+                    maxReach = std::max(reach[x], maxReach - 1);
+                    if (maxReach >= 0) {
+                        if (xLeft < 0) {
+                            xLeft = x;
+                        }
+                    } else if (xLeft >= 0) {
+                        addSpan(y, xLeft, x);
+                        xLeft = -1;
+                    }
+                }
+                if (xLeft >= 0) {
+                    addSpan(y, xLeft, width);
+                }
+            }
         }
+    } catch (CMemoryException* e) {
+        TRACE(_T("Rasterizer::CreateWidenedRegionEDT: Memory allocation failed\n"));
+        wideOutline.clear();
+        e->Delete();
+        return false;
+    }
 
-        // Expand the buffer a bit when we're blurring, since that can also widen the borders a bit
-        bluradjust = (bluradjust + 7) & ~7;
+    return true;
+}
 
-        width  += 2 * m_pOutlineData->mWideBorder + bluradjust * 2;
-        height += 2 * m_pOutlineData->mWideBorder + bluradjust * 2;
+namespace
+{
+    // Bands smaller than this aren't worth the extra synchronization and halo rows
+    const int BAND_MIN_ROWS = 32;
+    const int BAND_MIN_OVERLAY_SIZE = 256 * 128;
+
+    std::atomic<int> s_nBandCount(0);
+
+    // Below this many passes the exact blur is cheap enough and the approximation too coarse
+    const int BE_FAST_MIN_PASSES = 3;
+    // Number of box filters used to approximate the repeated 3x3 blur
+    const int BE_FAST_BOXES = 4;
+    // Average amount of coverage lost to rounding by every pass of the exact blur
+    const float BE_ROUNDING_LOSS = 0.39f;
+    // Fractional bits of the fixed point values FastBoxBlur works with, fewer are used
+    // when the sums of very wide boxes wouldn't fit otherwise
+    const int BE_FAST_MAX_FRAC_BITS = 16;
+
+    std::atomic<bool> s_bExactBeBlur(true);
+
+    // Get the widths of BE_FAST_BOXES box filters whose combined variance is as close as
+    // possible to the one of the 3x3 [1 2 1] blur repeated the given number of times
+    void GetBeBoxWidths(int passes, int widths[BE_FAST_BOXES])
+    {
+        const double variance12 = 12.0 * passes / 2.0;
+        int widthLow = (int)sqrt(variance12 / BE_FAST_BOXES + 1.0);
+        if (!(widthLow & 1)) {
+            widthLow--;
+        }
+        int nLow = (int)floor((variance12 - BE_FAST_BOXES * (widthLow * widthLow + 4.0 * widthLow + 3.0))
+                              / (-4.0 * widthLow - 4.0) + 0.5);
+        for (int i = 0; i < BE_FAST_BOXES; i++) {
+            widths[i] = i < nLow ? widthLow : widthLow + 2;
+        }
+    }
 
-        xsub += m_pOutlineData->mWideBorder + bluradjust;
-        ysub += m_pOutlineData->mWideBorder + bluradjust;
+    // Dividing by the width of a box is a multiplication by this followed by a 32-bit shift
+    ULONGLONG GetBeBoxScale(int width)
+    {
+        return ((1ui64 << 32) + width / 2) / width;
+    }
 
-        m_pOverlayData->mOffsetX -= m_pOutlineData->mWideBorder + bluradjust;
-        m_pOverlayData->mOffsetY -= m_pOutlineData->mWideBorder + bluradjust;
+    // The rounded average of the values of a box, given their sum
+    int BeBoxAverage(int sum, ULONGLONG scale)
+    {
+        return (int)((ULONGLONG(sum) * scale + (1ui64 << 31)) >> 32);
     }
+}
 
-    m_pOverlayData->mOverlayWidth = ((width + 7) >> 3) + 1;
-    // fixed image height
-    m_pOverlayData->mOverlayHeight = ((height + 14) >> 3) + 1;
-    m_pOverlayData->mOverlayPitch = (m_pOverlayData->mOverlayWidth + 15) & ~15; // Round the next multiple of 16
+void Rasterizer::SetBandCount(int nBands)
+{
+    s_nBandCount = std::max(0, nBands);
+}
 
-    m_pOverlayData->mpOverlayBufferBody = (byte*)_aligned_malloc(m_pOverlayData->mOverlayPitch * m_pOverlayData->mOverlayHeight, 16);
-    m_pOverlayData->mpOverlayBufferBorder = (byte*)_aligned_malloc(m_pOverlayData->mOverlayPitch * m_pOverlayData->mOverlayHeight, 16);
-    if (!m_pOverlayData->mpOverlayBufferBody || !m_pOverlayData->mpOverlayBufferBorder) {
-        m_pOverlayData = nullptr;
-        return false;
-    }
+int Rasterizer::GetBandCount()
+{
+    return s_nBandCount;
+}
 
-    ZeroMemory(m_pOverlayData->mpOverlayBufferBody, m_pOverlayData->mOverlayPitch * m_pOverlayData->mOverlayHeight);
-    ZeroMemory(m_pOverlayData->mpOverlayBufferBorder, m_pOverlayData->mOverlayPitch * m_pOverlayData->mOverlayHeight);
+void Rasterizer::SetExactBeBlur(bool bExact)
+{
+    s_bExactBeBlur = bExact;
+}
 
-    // Are we doing a border?
+bool Rasterizer::GetExactBeBlur()
+{
+    return s_bExactBeBlur;
+}
+
+void Rasterizer::FillOverlay(int xsub, int ysub, int rowStart, int rowEnd)
+{
+    // The spans are sorted by line so we only need to look at the ones of our rows
+    auto getRow = [ysub](const tSpanBuffer::value_type & span) {
+        return int(((unsigned int)(span.first >> 32) - 0x40000000 + ysub) >> 3);
+    };
 
     const tSpanBuffer* pOutline[2] = { &m_pOutlineData->mOutline, &m_pOutlineData->mWideOutline };
 
     for (ptrdiff_t i = _countof(pOutline) - 1; i >= 0; i--) {
-        auto it = pOutline[i]->cbegin();
+        ASSERT(std::is_sorted(pOutline[i]->cbegin(), pOutline[i]->cend()));
+        auto it = std::lower_bound(pOutline[i]->cbegin(), pOutline[i]->cend(), rowStart,
+        [&getRow](const tSpanBuffer::value_type & span, int row) {
+            return getRow(span) < row;
+        });
         auto itEnd = pOutline[i]->cend();
         byte* buffer = (i == 0) ? m_pOverlayData->mpOverlayBufferBody : m_pOverlayData->mpOverlayBufferBorder;
 
-        for (; it != itEnd; ++it) {
+        for (; it != itEnd && getRow(*it) < rowEnd; ++it) {
             unsigned __int64 f = (*it).first;
             unsigned int y = (f >> 32) - 0x40000000 + ysub;
             unsigned int x1 = (f & 0xffffffff) - 0x40000000 + xsub;
@@ -873,68 +1101,374 @@ bool Rasterizer::Rasterize(int xsub, int ysub, int fBlur, double fGaussianBlur)
             }
         }
     }
+}
 
-    // Do some gaussian blur magic
-    if (fGaussianBlur > 0) {
-        GaussianKernel filter(fGaussianBlur);
-        if (m_pOverlayData->mOverlayWidth >= filter.width && m_pOverlayData->mOverlayHeight >= filter.width) {
-            size_t pitch = m_pOverlayData->mOverlayPitch;
+bool Rasterizer::GaussianBlur(byte* buffer, int width, int height, int pitch, const GaussianKernel& filter) const
+{
+    const size_t tmpSize = size_t(pitch) * height;
+    byte* tmp = (byte*)CBufferPool::Alloc(tmpSize);
+    if (!tmp) {
+        return false;
+    }
+
+#if defined(_M_IX86_FP) && _M_IX86_FP < 2
+    if (!m_bUseSSE2) {
+        SeparableFilterX<1>(buffer, tmp, width, height, pitch,
+                            filter.kernel, filter.width, filter.divisor);
+        SeparableFilterY<1>(tmp, buffer, width, height, pitch,
+                            filter.kernel, filter.width, filter.divisor);
+    } else
+#endif
+#if SEPARABLE_FILTER_HAS_AVX512
+    if (m_bUseAVX512 && SeparableFilterUseFloatDivision(filter.divisor)) {
+        SeparableFilterX_AVX512(buffer, tmp, width, height, pitch,
+                                filter.kernel, filter.width, filter.divisor);
+        SeparableFilterY_AVX512(tmp, buffer, width, height, pitch,
+                                filter.kernel, filter.width, filter.divisor);
+    } else
+#endif
+    if (m_bUseAVX2 && SeparableFilterUseFloatDivision(filter.divisor)) {
+        SeparableFilterX_AVX2(buffer, tmp, width, height, pitch,
+                              filter.kernel, filter.width, filter.divisor);
+        SeparableFilterY_AVX2(tmp, buffer, width, height, pitch,
+                              filter.kernel, filter.width, filter.divisor);
+    } else {
+        SeparableFilterX_SSE2(buffer, tmp, width, height, pitch,
+                              filter.kernel, filter.width, filter.divisor);
+        SeparableFilterY_SSE2(tmp, buffer, width, height, pitch,
+                              filter.kernel, filter.width, filter.divisor);
+    }
+
+    CBufferPool::Free(tmp, tmpSize);
 
-            byte* tmp = (byte*)_aligned_malloc(pitch * m_pOverlayData->mOverlayHeight * sizeof(byte), 16);
-            if (!tmp) {
-                return false;
+    return true;
+}
+
+bool Rasterizer::BoxBlur(byte* buffer, int width, int height, int pitch, int passes)
+{
+    if (passes >= BE_FAST_MIN_PASSES && !s_bExactBeBlur) {
+        return FastBoxBlur(buffer, width, height, pitch, passes);
+    }
+
+    const size_t tmpSize = size_t(pitch) * height;
+    byte* tmp = (byte*)CBufferPool::Alloc(tmpSize);
+    if (!tmp) {
+        return false;
+    }
+
+    for (int pass = 0; pass < passes; pass++) {
+        memcpy(tmp, buffer, pitch * height);
+
+        // This could be done in a separated way and win some speed
+        for (ptrdiff_t j = 1; j < height - 1; j++) {
+            byte* src = tmp + pitch * j + 1;
+            byte* dst = buffer + pitch * j + 1;
+
+            for (ptrdiff_t i = 1; i < width - 1; i++, src++, dst++) {
+                *dst = (src[-1 - pitch] + (src[-pitch] << 1) + src[+1 - pitch]
+                        + (src[-1] << 1) + (src[0] << 2) + (src[+1] << 1)
+                        + src[-1 + pitch] + (src[+pitch] << 1) + src[+1 + pitch]) >> 4;
             }
+        }
+    }
 
-            byte* src = m_pOutlineData->mWideOutline.empty() ? m_pOverlayData->mpOverlayBufferBody : m_pOverlayData->mpOverlayBufferBorder;
+    CBufferPool::Free(tmp, tmpSize);
 
-#if defined(_M_IX86_FP) && _M_IX86_FP < 2
-            if (!m_bUseSSE2) {
-                SeparableFilterX<1>(src, tmp, m_pOverlayData->mOverlayWidth, m_pOverlayData->mOverlayHeight, pitch,
-                                    filter.kernel, filter.width, filter.divisor);
-                SeparableFilterY<1>(tmp, src, m_pOverlayData->mOverlayWidth, m_pOverlayData->mOverlayHeight, pitch,
-                                    filter.kernel, filter.width, filter.divisor);
-            } else
-#endif
-            {
-                SeparableFilterX_SSE2(src, tmp, m_pOverlayData->mOverlayWidth, m_pOverlayData->mOverlayHeight, pitch,
-                                      filter.kernel, filter.width, filter.divisor);
-                SeparableFilterY_SSE2(tmp, src, m_pOverlayData->mOverlayWidth, m_pOverlayData->mOverlayHeight, pitch,
-                                      filter.kernel, filter.width, filter.divisor);
+    return true;
+}
+
+// Approximate the repeated 3x3 blur with BE_FAST_BOXES running-sum box filters in each
+// direction, the cost per pixel is the same for every number of passes. Like the exact blur
+// the outermost pixels are left untouched. On text the result differs from the exact blur by
+// less than one level (out of 64) on average and by at most 5 levels up to \be10, 9 levels
+// up to \be20. The influence radius of the boxes is always smaller than the number of passes
+// so the halo rows used by BlurBands are still enough. The values are kept in fixed point:
+// integer running sums are exact, so a row comes out the same whichever row the buffer
+// starts at and banding doesn't change the result.
+bool Rasterizer::FastBoxBlur(byte* buffer, int width, int height, int pitch, int passes)
+{
+    // Only the inner part of the buffer is filtered, the rest is considered empty
+    const int w = width - 2;
+    const int h = height - 2;
+    if (w <= 0 || h <= 0) {
+        return true;
+    }
+
+    const size_t planeSize = sizeof(int) * w * h;
+    int* pSrc = (int*)CBufferPool::Alloc(planeSize);
+    int* pDst = (int*)CBufferPool::Alloc(planeSize);
+    int* pSum = (int*)CBufferPool::Alloc(sizeof(int) * w);
+    if (!pSrc || !pDst || !pSum) {
+        CBufferPool::Free(pSrc, planeSize);
+        CBufferPool::Free(pDst, planeSize);
+        CBufferPool::Free(pSum, sizeof(int) * w);
+        return false;
+    }
+
+    int widths[BE_FAST_BOXES];
+    GetBeBoxWidths(passes, widths);
+
+    int fracBits = BE_FAST_MAX_FRAC_BITS;
+    const int maxWidth = *std::max_element(widths, widths + BE_FAST_BOXES);
+    while (fracBits > 0 && (255i64 << fracBits) * maxWidth > INT_MAX) {
+        fracBits--;
+    }
+
+    for (int y = 0; y < h; y++) {
+        const byte* src = buffer + pitch * (y + 1) + 1;
+        for (int x = 0; x < w; x++) {
+            pSrc[y * w + x] = src[x] << fracBits;
+        }
+    }
+
+    // Horizontal passes
+    for (int i = 0; i < BE_FAST_BOXES; i++) {
+        const int r = widths[i] / 2;
+        if (r == 0) {
+            continue;
+        }
+        const ULONGLONG scale = GetBeBoxScale(widths[i]);
+
+        for (int y = 0; y < h; y++) {
+            const int* src = pSrc + y * w;
+            int* dst = pDst + y * w;
+
+            int sum = 0;
+            for (int x = 0; x < std::min(r, w); x++) {
+                sum += src[x];
             }
+            for (int x = 0; x < w; x++) {
+                if (x + r < w) {
+                    sum += src[x + r];
+                }
+                dst[x] = BeBoxAverage(sum, scale);
+                if (x - r >= 0) {
+                    sum -= src[x - r];
+                }
+            }
+        }
+        std::swap(pSrc, pDst);
+    }
 
-            _aligned_free(tmp);
+    // Vertical passes, a whole row of running sums is kept to walk the buffer in memory order
+    for (int i = 0; i < BE_FAST_BOXES; i++) {
+        const int r = widths[i] / 2;
+        if (r == 0) {
+            continue;
+        }
+        const ULONGLONG scale = GetBeBoxScale(widths[i]);
+
+        std::fill(pSum, pSum + w, 0);
+        for (int y = 0; y < std::min(r, h); y++) {
+            const int* src = pSrc + y * w;
+            for (int x = 0; x < w; x++) {
+                pSum[x] += src[x];
+            }
+        }
+        for (int y = 0; y < h; y++) {
+            if (y + r < h) {
+                const int* src = pSrc + (y + r) * w;
+                for (int x = 0; x < w; x++) {
+                    pSum[x] += src[x];
+                }
+            }
+            int* dst = pDst + y * w;
+            for (int x = 0; x < w; x++) {
+                dst[x] = BeBoxAverage(pSum[x], scale);
+            }
+            if (y - r >= 0) {
+                const int* src = pSrc + (y - r) * w;
+                for (int x = 0; x < w; x++) {
+                    pSum[x] -= src[x];
+                }
+            }
         }
+        std::swap(pSrc, pDst);
     }
 
-    // If we're blurring, do a 3x3 box blur
-    // Can't do it on subpictures smaller than 3x3 pixels
-    for (int pass = 0; pass < fBlur; pass++) {
-        if (m_pOverlayData->mOverlayWidth >= 3 && m_pOverlayData->mOverlayHeight >= 3) {
-            int pitch = m_pOverlayData->mOverlayPitch;
-
-            byte* tmp = DEBUG_NEW byte[pitch * m_pOverlayData->mOverlayHeight];
-            if (!tmp) {
-                return false;
+    // The exact blur rounds down after every pass, which slowly darkens everything that
+    // isn't fully covered. Mimic that so that both look the same.
+    const int one = 1 << fracBits;
+    const int loss = (int)(std::min(BE_ROUNDING_LOSS * passes, 64.0f) * one + 0.5f);
+    for (int y = 0; y < h; y++) {
+        const int* src = pSrc + y * w;
+        byte* dst = buffer + pitch * (y + 1) + 1;
+        for (int x = 0; x < w; x++) {
+            // Fully covered pixels don't lose anything
+            int value = src[x];
+            if (value < 0x40 * one - one / 2) {
+                value -= std::min(loss, value);
             }
+            dst[x] = (byte)std::min(255, (value + one / 2) >> fracBits);
+        }
+    }
 
-            byte* buffer = m_pOutlineData->mWideOutline.empty() ? m_pOverlayData->mpOverlayBufferBody : m_pOverlayData->mpOverlayBufferBorder;
-            memcpy(tmp, buffer, pitch * m_pOverlayData->mOverlayHeight);
+    CBufferPool::Free(pSrc, planeSize);
+    CBufferPool::Free(pDst, planeSize);
+    CBufferPool::Free(pSum, sizeof(int) * w);
 
-            // This could be done in a separated way and win some speed
-            for (ptrdiff_t j = 1; j < m_pOverlayData->mOverlayHeight - 1; j++) {
-                byte* src = tmp + pitch * j + 1;
-                byte* dst = buffer + pitch * j + 1;
+    return true;
+}
 
-                for (ptrdiff_t i = 1; i < m_pOverlayData->mOverlayWidth - 1; i++, src++, dst++) {
-                    *dst = (src[-1 - pitch] + (src[-pitch] << 1) + src[+1 - pitch]
-                            + (src[-1] << 1) + (src[0] << 2) + (src[+1] << 1)
-                            + src[-1 + pitch] + (src[+pitch] << 1) + src[+1 + pitch]) >> 4;
-                }
+bool Rasterizer::BlurBands(size_t nBands, byte* buffer, int fBlur, const GaussianKernel* pFilter) const
+{
+    const int width = m_pOverlayData->mOverlayWidth;
+    const int height = m_pOverlayData->mOverlayHeight;
+    const int pitch = m_pOverlayData->mOverlayPitch;
+
+    // Each band is blurred in its own buffer, together with enough rows of its neighbours
+    // for the kernels to see exactly what they would see on the whole overlay. The results
+    // are only copied back once all bands are done since the neighbours read those rows.
+    const int halo = (pFilter ? pFilter->width / 2 : 0) + fBlur;
+
+    struct Band {
+        int rowStart, rowEnd, bufferStart;
+        byte* pBuffer;
+        size_t bufferSize;
+    };
+    std::vector<Band> bands(nBands);
+    std::atomic<bool> bSuccess(true);
+
+    CWorkStealingPool::GetShared()->ParallelFor(nBands, [&](size_t i) {
+        Band& band = bands[i];
+        band.rowStart = int(height * i / nBands);
+        band.rowEnd = int(height * (i + 1) / nBands);
+        band.bufferStart = std::max(0, band.rowStart - halo);
+        int bufferHeight = std::min(height, band.rowEnd + halo) - band.bufferStart;
+
+        band.bufferSize = size_t(pitch) * bufferHeight;
+        band.pBuffer = (byte*)CBufferPool::Alloc(band.bufferSize);
+        if (!band.pBuffer) {
+            bSuccess = false;
+            return;
+        }
+        memcpy(band.pBuffer, buffer + pitch * band.bufferStart, pitch * bufferHeight);
+
+        try {
+            if (pFilter && !GaussianBlur(band.pBuffer, width, bufferHeight, pitch, *pFilter)) {
+                bSuccess = false;
+            } else if (fBlur > 0 && !BoxBlur(band.pBuffer, width, bufferHeight, pitch, fBlur)) {
+                bSuccess = false;
             }
+        } catch (CMemoryException* e) {
+            e->Delete();
+            bSuccess = false;
+        }
+    });
+
+    for (const auto& band : bands) {
+        if (bSuccess) {
+            memcpy(buffer + pitch * band.rowStart, band.pBuffer + pitch * (band.rowStart - band.bufferStart),
+                   pitch * (band.rowEnd - band.rowStart));
+        }
+        CBufferPool::Free(band.pBuffer, band.bufferSize);
+    }
+
+    return bSuccess;
+}
+
+bool Rasterizer::Rasterize(int xsub, int ysub, int fBlur, double fGaussianBlur)
+{
+    m_pOverlayData = std::make_shared<COverlayData>();
+
+    if (!m_pOutlineData || !m_pOutlineData->mWidth || !m_pOutlineData->mHeight) {
+        return true;
+    }
+
+    xsub &= 7;
+    ysub &= 7;
+
+    int width =  m_pOutlineData->mWidth + xsub;
+    int height = m_pOutlineData->mHeight;// + ysub
+
+    m_pOverlayData->mOffsetX = m_pOutlineData->mPathOffsetX - xsub;
+    m_pOverlayData->mOffsetY = m_pOutlineData->mPathOffsetY - ysub;
+
+    m_pOutlineData->mWideBorder = (m_pOutlineData->mWideBorder + 7) & ~7;
+
+    if (!m_pOutlineData->mWideOutline.empty() || fBlur || fGaussianBlur > 0) {
+        int bluradjust = 0;
+        if (fGaussianBlur > 0) {
+            bluradjust += (int)(fGaussianBlur * 3 * 8 + 0.5) | 1;
+        }
+        if (fBlur) {
+            bluradjust += 8;
+        }
+
+        // Expand the buffer a bit when we're blurring, since that can also widen the borders a bit
+        bluradjust = (bluradjust + 7) & ~7;
+
+        width  += 2 * m_pOutlineData->mWideBorder + bluradjust * 2;
+        height += 2 * m_pOutlineData->mWideBorder + bluradjust * 2;
+
+        xsub += m_pOutlineData->mWideBorder + bluradjust;
+        ysub += m_pOutlineData->mWideBorder + bluradjust;
+
+        m_pOverlayData->mOffsetX -= m_pOutlineData->mWideBorder + bluradjust;
+        m_pOverlayData->mOffsetY -= m_pOutlineData->mWideBorder + bluradjust;
+    }
+
+    m_pOverlayData->mOverlayWidth = ((width + 7) >> 3) + 1;
+    // fixed image height
+    m_pOverlayData->mOverlayHeight = ((height + 14) >> 3) + 1;
+    m_pOverlayData->mOverlayPitch = (m_pOverlayData->mOverlayWidth + 15) & ~15; // Round the next multiple of 16
+
+    if (!m_pOverlayData->AllocOverlay()) {
+        m_pOverlayData = nullptr;
+        return false;
+    }
+
+    ZeroMemory(m_pOverlayData->mpOverlayBufferBody, m_pOverlayData->mOverlayPitch * m_pOverlayData->mOverlayHeight);
+    ZeroMemory(m_pOverlayData->mpOverlayBufferBorder, m_pOverlayData->mOverlayPitch * m_pOverlayData->mOverlayHeight);
 
-            delete [] tmp;
+    std::unique_ptr<GaussianKernel> pFilter;
+    if (fGaussianBlur > 0) {
+        pFilter = std::make_unique<GaussianKernel>(fGaussianBlur);
+        if (m_pOverlayData->mOverlayWidth < pFilter->width || m_pOverlayData->mOverlayHeight < pFilter->width) {
+            pFilter = nullptr;
         }
     }
+    // Can't do a 3x3 box blur on subpictures smaller than 3x3 pixels
+    if (m_pOverlayData->mOverlayWidth < 3 || m_pOverlayData->mOverlayHeight < 3) {
+        fBlur = 0;
+    }
+
+    size_t nBands = 1;
+    if (m_pOverlayData->mOverlayPitch * m_pOverlayData->mOverlayHeight >= BAND_MIN_OVERLAY_SIZE) {
+        int halo = (pFilter ? pFilter->width / 2 : 0) + std::max(fBlur, 0);
+        int nMaxBands = m_pOverlayData->mOverlayHeight / std::max(BAND_MIN_ROWS, 2 * halo);
+        int nWantedBands = s_nBandCount ? s_nBandCount : (int)std::thread::hardware_concurrency();
+        nBands = (size_t)std::max(1, std::min(nWantedBands, nMaxBands));
+    }
+
+    // Are we doing a border?
+    if (nBands > 1) {
+        CWorkStealingPool::GetShared()->ParallelFor(nBands, [&](size_t i) {
+            FillOverlay(xsub, ysub, int(m_pOverlayData->mOverlayHeight * i / nBands), int(m_pOverlayData->mOverlayHeight * (i + 1) / nBands));
+        });
+    } else {
+        FillOverlay(xsub, ysub, 0, m_pOverlayData->mOverlayHeight);
+    }
+
+    if (!pFilter && fBlur <= 0) {
+        return true;
+    }
+
+    byte* buffer = m_pOutlineData->mWideOutline.empty() ? m_pOverlayData->mpOverlayBufferBody : m_pOverlayData->mpOverlayBufferBorder;
+
+    if (nBands > 1) {
+        return BlurBands(nBands, buffer, fBlur, pFilter.get());
+    }
+
+    // Do some gaussian blur magic
+    if (pFilter && !GaussianBlur(buffer, m_pOverlayData->mOverlayWidth, m_pOverlayData->mOverlayHeight, m_pOverlayData->mOverlayPitch, *pFilter)) {
+        return false;
+    }
+
+    // If we're blurring, do a 3x3 box blur
+    if (fBlur > 0 && !BoxBlur(buffer, m_pOverlayData->mOverlayWidth, m_pOverlayData->mOverlayHeight, m_pOverlayData->mOverlayPitch, fBlur)) {
+        return false;
+    }
 
     return true;
 }
@@ -1715,15 +2249,8 @@ namespace
 //    switchpts[i*2] contains a colour and switchpts[i*2+1] contains the coordinate to use that colour from
 // fBody tells whether to render the body of the subs.
 // fBorder tells whether to render the border of the subs.
-CRect Rasterizer::Draw(SubPicDesc& spd, CRect& clipRect, byte* pAlphaMask, int xsub, int ysub,
-                       const DWORD* switchpts, bool fBody, bool fBorder) const
+CRect Rasterizer::GetDrawRect(const COverlayData& overlayData, const SubPicDesc& spd, const CRect& clipRect, int xsub, int ysub)
 {
-    CRect bbox(0, 0, 0, 0);
-
-    if (!m_pOverlayData || !switchpts || (!fBody && !fBorder)) {
-        return bbox;
-    }
-
     // Limit drawn area to intersection of rendering surface and rectangular clip area
     CRect r(0, 0, spd.w, spd.h);
     r &= clipRect;
@@ -1731,40 +2258,50 @@ CRect Rasterizer::Draw(SubPicDesc& spd, CRect& clipRect, byte* pAlphaMask, int x
     // Remember that all subtitle coordinates are specified in 1/8 pixels
     // (x+4)>>3 rounds to nearest whole pixel.
     // ??? What is xsub, ysub, mOffsetX and mOffsetY ?
-    int x = (xsub + m_pOverlayData->mOffsetX + 4) >> 3;
-    int y = (ysub + m_pOverlayData->mOffsetY + 4) >> 3;
-    int w = m_pOverlayData->mOverlayWidth;
-    int h = m_pOverlayData->mOverlayHeight;
-    int xo = 0, yo = 0;
+    int x = (xsub + overlayData.mOffsetX + 4) >> 3;
+    int y = (ysub + overlayData.mOffsetY + 4) >> 3;
 
-    // Again, limiting?
-    if (x < r.left) {
-        xo = r.left - x;
-        w -= r.left - x;
-        x = r.left;
-    }
-    if (y < r.top) {
-        yo = r.top - y;
-        h -= r.top - y;
-        y = r.top;
+    CRect bbox(x, y, x + overlayData.mOverlayWidth, y + overlayData.mOverlayHeight);
+    if (!bbox.IntersectRect(bbox, r)) {
+        bbox.SetRectEmpty();
     }
-    if (x + w > r.right) {
-        w = r.right - x;
+
+    return bbox;
+}
+
+CRect Rasterizer::Draw(SubPicDesc& spd, CRect& clipRect, byte* pAlphaMask, int xsub, int ysub,
+                       const DWORD* switchpts, bool fBody, bool fBorder) const
+{
+    if (!m_pOverlayData) {
+        return CRect(0, 0, 0, 0);
     }
-    if (y + h > r.bottom) {
-        h = r.bottom - y;
+
+    return Draw(*m_pOverlayData, spd, clipRect, pAlphaMask, xsub, ysub, switchpts, fBody, fBorder);
+}
+
+CRect Rasterizer::Draw(const COverlayData& overlayData, SubPicDesc& spd, const CRect& clipRect, byte* pAlphaMask, int xsub, int ysub,
+                       const DWORD* switchpts, bool fBody, bool fBorder) const
+{
+    if (!switchpts || (!fBody && !fBorder)) {
+        return CRect(0, 0, 0, 0);
     }
 
+    CRect bbox = GetDrawRect(overlayData, spd, clipRect, xsub, ysub);
+
     // Check if there's actually anything to render
-    if (w <= 0 || h <= 0) {
+    if (bbox.IsRectEmpty()) {
         return bbox;
     }
 
-    bbox.SetRect(x, y, x + w, y + h);
-    bbox &= CRect(0, 0, spd.w, spd.h);
+    int x = bbox.left;
+    int y = bbox.top;
+    int w = bbox.Width();
+    int h = bbox.Height();
+    int xo = x - ((xsub + overlayData.mOffsetX + 4) >> 3);
+    int yo = y - ((ysub + overlayData.mOffsetY + 4) >> 3);
 
-    BYTE* srcBody = m_pOverlayData->mpOverlayBufferBody + m_pOverlayData->mOverlayPitch * yo + xo;
-    BYTE* srcBorder = m_pOverlayData->mpOverlayBufferBorder + m_pOverlayData->mOverlayPitch * yo + xo;
+    BYTE* srcBody = overlayData.mpOverlayBufferBody + overlayData.mOverlayPitch * yo + xo;
+    BYTE* srcBorder = overlayData.mpOverlayBufferBorder + overlayData.mOverlayPitch * yo + xo;
     BYTE* alphaMask = pAlphaMask + spd.w * y + x;
     BYTE* dst = (BYTE*)((DWORD*)(spd.bits + spd.pitch * y) + x);
     BYTE* s = fBorder ? srcBorder : srcBody;
@@ -1784,48 +2321,48 @@ CRect Rasterizer::Draw(SubPicDesc& spd, CRect& clipRect, byte* pAlphaMask, int x
     switch (draw_op) {
         case BODY:
             // Draw single color fill or shadow
-            DrawInternal(m_bUseAVX2, dst, spd.pitch, s, m_pOverlayData->mOverlayPitch, w, h, switchpts);
+            DrawInternal(m_bUseAVX2, dst, spd.pitch, s, overlayData.mOverlayPitch, w, h, switchpts);
             break;
         case NONE:
             // Draw single color border
             ASSERT(s == srcBorder);
             __assume(s == srcBorder);
-            DrawInternal(m_bUseAVX2, dst, spd.pitch, s, m_pOverlayData->mOverlayPitch, w, h, switchpts, srcBorder,
+            DrawInternal(m_bUseAVX2, dst, spd.pitch, s, overlayData.mOverlayPitch, w, h, switchpts, srcBorder,
                          srcBody);
             break;
         case BODY | SWITCHPOINT:
             // Draw multi color fill or shadow
-            DrawInternal(m_bUseAVX2, dst, spd.pitch, s, m_pOverlayData->mOverlayPitch, w, h, switchpts, xo);
+            DrawInternal(m_bUseAVX2, dst, spd.pitch, s, overlayData.mOverlayPitch, w, h, switchpts, xo);
             break;
         case SWITCHPOINT:
             // Draw multi color border
             ASSERT(s == srcBorder);
             __assume(s == srcBorder);
-            DrawInternal(m_bUseAVX2, dst, spd.pitch, s, m_pOverlayData->mOverlayPitch, w, h, switchpts, srcBorder,
+            DrawInternal(m_bUseAVX2, dst, spd.pitch, s, overlayData.mOverlayPitch, w, h, switchpts, srcBorder,
                          srcBody, xo);
             break;
         case ALPHA:
             // Draw single color border with alpha mask
             ASSERT(s == srcBorder);
             __assume(s == srcBorder);
-            DrawInternal(m_bUseAVX2, dst, spd.pitch, s, m_pOverlayData->mOverlayPitch, w, h, switchpts, srcBorder,
+            DrawInternal(m_bUseAVX2, dst, spd.pitch, s, overlayData.mOverlayPitch, w, h, switchpts, srcBorder,
                          srcBody, alphaMask, spd.w);
             break;
         case ALPHA | BODY:
             // Draw single color fill or shadow with alpha mask
-            DrawInternal(m_bUseAVX2, dst, spd.pitch, s, m_pOverlayData->mOverlayPitch, w, h, switchpts, alphaMask,
+            DrawInternal(m_bUseAVX2, dst, spd.pitch, s, overlayData.mOverlayPitch, w, h, switchpts, alphaMask,
                          spd.w);
             break;
         case ALPHA | SWITCHPOINT:
             // Draw multi color border with alpha mask
             ASSERT(s == srcBorder);
             __assume(s == srcBorder);
-            DrawInternal(m_bUseAVX2, dst, spd.pitch, s, m_pOverlayData->mOverlayPitch, w, h, switchpts, srcBorder,
+            DrawInternal(m_bUseAVX2, dst, spd.pitch, s, overlayData.mOverlayPitch, w, h, switchpts, srcBorder,
                          srcBody, alphaMask, spd.w, xo);
             break;
         case ALPHA | BODY | SWITCHPOINT:
             // Draw multi color fill or shadow with alpha mask
-            DrawInternal(m_bUseAVX2, dst, spd.pitch, s, m_pOverlayData->mOverlayPitch, w, h, switchpts, alphaMask,
+            DrawInternal(m_bUseAVX2, dst, spd.pitch, s, overlayData.mOverlayPitch, w, h, switchpts, alphaMask,
                          spd.w, xo);
             break;
         default:
@@ -22,6 +22,7 @@
 #pragma once
 
 #include "Ellipse.h"
+#include "BufferPool.h"
 #include <memory>
 #include <vector>
 
@@ -31,6 +32,7 @@
 #define PT_BSPLINEPATCHTO   0xfa
 
 struct SubPicDesc;
+struct GaussianKernel;
 using tSpanBuffer = std::vector<std::pair<unsigned __int64, unsigned __int64>>;
 
 struct COutlineData {
@@ -61,27 +63,14 @@ struct COverlayData {
         , mOverlayHeight(0)
         , mOverlayPitch(0)
         , mpOverlayBufferBody(nullptr)
-        , mpOverlayBufferBorder(nullptr) {}
+        , mpOverlayBufferBorder(nullptr)
+        , mOverlayBufferSize(0) {}
 
     COverlayData(const COverlayData& overlayData)
-        : mOffsetX(overlayData.mOffsetX)
-        , mOffsetY(overlayData.mOffsetY)
-        , mOverlayWidth(overlayData.mOverlayWidth)
-        , mOverlayHeight(overlayData.mOverlayHeight)
-        , mOverlayPitch(overlayData.mOverlayPitch) {
-        if (mOverlayPitch > 0 && mOverlayHeight > 0) {
-            mpOverlayBufferBody = (byte*)_aligned_malloc(mOverlayPitch * mOverlayHeight, 16);
-            mpOverlayBufferBorder = (byte*)_aligned_malloc(mOverlayPitch * mOverlayHeight, 16);
-            if (!mpOverlayBufferBody || !mpOverlayBufferBorder) {
-                mOffsetX = mOffsetY = 0;
-                mOverlayWidth = mOverlayHeight = 0;
-                DeleteOverlay();
-            }
-            memcpy(mpOverlayBufferBody, overlayData.mpOverlayBufferBody, mOverlayPitch * mOverlayHeight);
-            memcpy(mpOverlayBufferBorder, overlayData.mpOverlayBufferBorder, mOverlayPitch * mOverlayHeight);
-        } else {
-            mpOverlayBufferBody = mpOverlayBufferBorder = nullptr;
-        }
+        : mpOverlayBufferBody(nullptr)
+        , mpOverlayBufferBorder(nullptr)
+        , mOverlayBufferSize(0) {
+        *this = overlayData;
     }
 
     ~COverlayData() {
@@ -89,40 +78,51 @@ struct COverlayData {
     }
 
     COverlayData& operator=(const COverlayData& overlayData) {
+        DeleteOverlay();
+
         mOffsetX = overlayData.mOffsetX;
         mOffsetY = overlayData.mOffsetY;
         mOverlayWidth = overlayData.mOverlayWidth;
         mOverlayHeight = overlayData.mOverlayHeight;
         mOverlayPitch = overlayData.mOverlayPitch;
 
-        DeleteOverlay();
         if (mOverlayPitch > 0 && mOverlayHeight > 0) {
-            mpOverlayBufferBody = (byte*)_aligned_malloc(mOverlayPitch * mOverlayHeight, 16);
-            mpOverlayBufferBorder = (byte*)_aligned_malloc(mOverlayPitch * mOverlayHeight, 16);
-            if (!mpOverlayBufferBody || !mpOverlayBufferBorder) {
+            if (AllocOverlay()) {
+                memcpy(mpOverlayBufferBody, overlayData.mpOverlayBufferBody, mOverlayBufferSize);
+                memcpy(mpOverlayBufferBorder, overlayData.mpOverlayBufferBorder, mOverlayBufferSize);
+            } else {
                 mOffsetX = mOffsetY = 0;
                 mOverlayWidth = mOverlayHeight = 0;
-                DeleteOverlay();
             }
-            memcpy(mpOverlayBufferBody, overlayData.mpOverlayBufferBody, mOverlayPitch * mOverlayHeight);
-            memcpy(mpOverlayBufferBorder, overlayData.mpOverlayBufferBorder, mOverlayPitch * mOverlayHeight);
-        } else {
-            mpOverlayBufferBody = mpOverlayBufferBorder = nullptr;
         }
 
         return *this;
     };
 
-    void DeleteOverlay() {
-        if (mpOverlayBufferBody) {
-            _aligned_free(mpOverlayBufferBody);
-            mpOverlayBufferBody = nullptr;
-        }
-        if (mpOverlayBufferBorder) {
-            _aligned_free(mpOverlayBufferBorder);
-            mpOverlayBufferBorder = nullptr;
+    // Allocate the body and border buffers for the current pitch and height
+    bool AllocOverlay() {
+        DeleteOverlay();
+
+        mOverlayBufferSize = size_t(mOverlayPitch) * mOverlayHeight;
+        mpOverlayBufferBody = (byte*)CBufferPool::Alloc(mOverlayBufferSize);
+        mpOverlayBufferBorder = (byte*)CBufferPool::Alloc(mOverlayBufferSize);
+        if (!mpOverlayBufferBody || !mpOverlayBufferBorder) {
+            DeleteOverlay();
+            return false;
         }
+
+        return true;
+    }
+
+    void DeleteOverlay() {
+        CBufferPool::Free(mpOverlayBufferBody, mOverlayBufferSize);
+        CBufferPool::Free(mpOverlayBufferBorder, mOverlayBufferSize);
+        mpOverlayBufferBody = mpOverlayBufferBorder = nullptr;
+        mOverlayBufferSize = 0;
     }
+
+private:
+    size_t mOverlayBufferSize;
 };
 
 typedef std::shared_ptr<COverlayData> COverlayDataSharedPtr;
@@ -137,6 +137,7 @@ protected:
     POINT* mpPathPoints;
     int mPathPoints;
     bool m_bUseAVX2;
+    bool m_bUseAVX512;
 
 private:
     enum {
@@ -169,6 +170,11 @@ private:
     template<int flag> __forceinline void _EvaluateLine(int x0, int y0, int x1, int y1);
     static void _OverlapRegion(tSpanBuffer& dst, const tSpanBuffer& src, int dx, int dy);
     void CreateWidenedRegionFast(int borderX, int borderY);
+    void FillOverlay(int xsub, int ysub, int rowStart, int rowEnd);
+    bool GaussianBlur(byte* buffer, int width, int height, int pitch, const GaussianKernel& filter) const;
+    static bool BoxBlur(byte* buffer, int width, int height, int pitch, int passes);
+    static bool FastBoxBlur(byte* buffer, int width, int height, int pitch, int passes);
+    bool BlurBands(size_t nBands, byte* buffer, int fBlur, const GaussianKernel* pFilter) const;
 
 public:
     Rasterizer();
@@ -178,11 +184,34 @@ public:
     bool EndPath(HDC hdc);
     bool PartialBeginPath(HDC hdc, bool bClearPath);
     bool PartialEndPath(HDC hdc, long dx, long dy);
+    // Append a path extracted beforehand, moved by (dx, dy)
+    bool AppendPath(const BYTE* pTypes, const POINT* pPoints, int nPoints, long dx, long dy, bool bClearPath);
     bool ScanConvert();
     bool CreateWidenedRegion(int borderX, int borderY);
+    // Same result as CreateWidenedRegion, faster for large borders around dense outlines
+    bool CreateWidenedRegionEDT(int borderX, int borderY);
+    bool PreferWidenedRegionEDT(int borderX, int borderY) const;
     bool Rasterize(int xsub, int ysub, int fBlur, double fGaussianBlur);
     int getOverlayWidth() const;
 
+    // Large overlays are split into horizontal bands which are filled and blurred in parallel.
+    // 0 uses one band per CPU core, 1 always rasterizes on the calling thread.
+    static void SetBandCount(int nBands);
+    static int GetBandCount();
+
+    // \be repeats a 3x3 blur, which is the default. Setting this to false approximates it
+    // from \be3 upwards by a few running-sum box filters whose cost doesn't depend on its
+    // strength (see FastBoxBlur). The approximation differs from the exact blur by at most
+    // 5 levels out of 64 up to \be10 and 9 levels up to \be20.
+    static void SetExactBeBlur(bool bExact);
+    static bool GetExactBeBlur();
+
     CRect Draw(SubPicDesc& spd, CRect& clipRect, byte* pAlphaMask, int xsub, int ysub, const DWORD* switchpts, bool fBody, bool fBorder) const;
+    // Same as above with an overlay produced earlier, which may have been replaced since
+    CRect Draw(const COverlayData& overlayData, SubPicDesc& spd, const CRect& clipRect, byte* pAlphaMask, int xsub, int ysub,
+               const DWORD* switchpts, bool fBody, bool fBorder) const;
+    // The part of spd that drawing overlayData at (xsub, ysub) covers
+    static CRect GetDrawRect(const COverlayData& overlayData, const SubPicDesc& spd, const CRect& clipRect, int xsub, int ysub);
+    const COverlayDataSharedPtr& GetOverlayData() const { return m_pOverlayData; }
     void FillSolidRect(SubPicDesc& spd, int x, int y, int nWidth, int nHeight, DWORD lColor) const;
 };
@@ -177,6 +177,7 @@ bool COutlineKey::operator==(const COutlineKey& outLineKey) const
 COverlayKey::COverlayKey(const CWord* word, CPoint p, CPoint org)
     : COutlineKey(word, CPoint(org.x - p.x, org.y - p.y))
     , m_subp(p.x & 7, p.y & 7)
+    , m_bExactBeBlur(Rasterizer::GetExactBeBlur())
 {
     UpdateHash();
 }
@@ -184,6 +185,7 @@ COverlayKey::COverlayKey(const CWord* word, CPoint p, CPoint org)
 COverlayKey::COverlayKey(const COverlayKey& overlayKey)
     : COutlineKey(overlayKey)
     , m_subp(overlayKey.m_subp)
+    , m_bExactBeBlur(overlayKey.m_bExactBeBlur)
     , m_hash(overlayKey.m_hash)
 {
 }
@@ -197,12 +199,15 @@ void COverlayKey::UpdateHash()
     m_hash += m_style->fBlur;
     m_hash += m_hash << 5;
     m_hash += int(m_style->fGaussianBlur);
+    m_hash += m_hash << 5;
+    m_hash += m_bExactBeBlur;
 }
 
 bool COverlayKey::operator==(const COverlayKey& overlayKey) const
 {
     return __super::operator==(overlayKey)
            && m_subp == overlayKey.m_subp
+           && m_bExactBeBlur == overlayKey.m_bExactBeBlur
            && m_style->fBlur == overlayKey.m_style->fBlur
            && IsNearlyEqual(m_style->fGaussianBlur, overlayKey.m_style->fGaussianBlur, 1e-6);
 }
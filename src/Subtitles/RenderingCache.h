@@ -21,20 +21,55 @@
 #pragma once
 
 #include <atlcoll.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "RenderingCacheStats.h"
+
+// Approximate memory held by a cache entry, specialize it for values owning buffers
+template<typename K, typename V>
+struct CRenderingCacheSizeTraits {
+    static size_t GetSize(const K& key, const V& value) {
+        UNREFERENCED_PARAMETER(key);
+        UNREFERENCED_PARAMETER(value);
+        return sizeof(K) + sizeof(V);
+    }
+};
 
-template<typename K, typename V, class KTraits = CElementTraits<K>, class VTraits = CElementTraits<V>>
+template<typename K, typename V, class KTraits = CElementTraits<K>, class VTraits = CElementTraits<V>, class STraits = CRenderingCacheSizeTraits<K, V>>
 class CRenderingCache : private CAtlMap<K, POSITION, KTraits>
 {
 private:
-    size_t m_maxSize;
+    size_t m_maxSize, m_maxBytes;
+    size_t m_bytes;
+    ULONGLONG m_hits, m_misses, m_evictions;
     struct CPositionValue {
         POSITION pos;
+        size_t size;
         V value;
     };
     CAtlList<CPositionValue> m_list;
 
+    void Trim() {
+        // Never evict the most recent entry, it is about to be used
+        while (m_list.GetCount() > 1 && (m_list.GetCount() > m_maxSize || m_bytes > m_maxBytes)) {
+            m_bytes -= m_list.GetTail().size;
+            __super::RemoveAtPos(m_list.GetTail().pos);
+            m_list.RemoveTailNoReturn();
+            m_evictions++;
+        }
+    }
+
 public:
-    CRenderingCache(size_t maxSize) : m_maxSize(maxSize) {};
+    CRenderingCache(size_t maxSize, size_t maxBytes = SIZE_MAX)
+        : m_maxSize(maxSize)
+        , m_maxBytes(maxBytes)
+        , m_bytes(0)
+        , m_hits(0)
+        , m_misses(0)
+        , m_evictions(0) {};
 
     bool Lookup(KINARGTYPE key, _Out_ typename VTraits::OUTARGTYPE value) {
         POSITION pos;
@@ -43,30 +78,41 @@ public:
         if (bFound) {
             m_list.MoveToHead(pos);
             value = m_list.GetHead().value;
+            m_hits++;
+        } else {
+            m_misses++;
         }
 
         return bFound;
     };
 
+    // Same as Lookup() but neither counts as a hit or a miss nor makes the entry the most recent
+    bool Contains(KINARGTYPE key) const {
+        return __super::Lookup(key) != nullptr;
+    }
+
     POSITION SetAt(KINARGTYPE key, typename VTraits::INARGTYPE value) {
         POSITION pos;
         bool bFound = __super::Lookup(key, pos);
+        size_t size = STraits::GetSize(key, value);
 
         if (bFound) {
             m_list.MoveToHead(pos);
             CPositionValue& posVal = m_list.GetHead();
             pos = posVal.pos;
+            m_bytes -= posVal.size;
+            posVal.size = size;
             posVal.value = value;
         } else {
-            if (m_list.GetCount() >= m_maxSize) {
-                __super::RemoveAtPos(m_list.GetTail().pos);
-                m_list.RemoveTailNoReturn();
-            }
             pos = __super::SetAt(key, m_list.AddHead());
             CPositionValue& posVal = m_list.GetHead();
             posVal.pos = pos;
+            posVal.size = size;
             posVal.value = value;
         }
+        m_bytes += size;
+
+        Trim();
 
         return pos;
     };
@@ -74,6 +120,185 @@ public:
     void Clear() {
         m_list.RemoveAll();
         __super::RemoveAll();
+        m_bytes = 0;
+    }
+
+    void SetMaxBytes(size_t maxBytes) {
+        m_maxBytes = maxBytes;
+        Trim();
+    }
+
+    void GetStats(CRenderingCacheStats& stats) const {
+        stats.entries = m_list.GetCount();
+        stats.maxEntries = m_maxSize;
+        stats.bytes = m_bytes;
+        stats.maxBytes = m_maxBytes;
+        stats.hits = m_hits;
+        stats.misses = m_misses;
+        stats.evictions = m_evictions;
+    }
+};
+
+// A variant of CRenderingCache which can be shared by several threads.
+// The entries are spread over independently locked shards and evicted
+// with the CLOCK algorithm, an approximation of LRU which does not need
+// to reorder anything on a hit.
+template<typename K, typename V, class KTraits = CElementTraits<K>, class VTraits = CElementTraits<V>, class STraits = CRenderingCacheSizeTraits<K, V>>
+class CConcurrentRenderingCache
+{
+private:
+    struct CSlot {
+        K key;
+        V value;
+        size_t size;
+        bool bReferenced;
+
+        CSlot(typename KTraits::INARGTYPE key, typename VTraits::INARGTYPE value, size_t size)
+            : key(key)
+            , value(value)
+            , size(size)
+            , bReferenced(false) {}
+    };
+
+    struct CShard {
+        std::mutex mutex;
+        CAtlMap<K, size_t, KTraits> map;
+        std::vector<std::unique_ptr<CSlot>> slots;
+        std::vector<size_t> freeSlots;
+        size_t hand = 0;
+        size_t count = 0;
+        size_t bytes = 0;
+        ULONGLONG hits = 0, misses = 0, evictions = 0;
+    };
+
+    const size_t m_nShards;
+    const size_t m_maxShardSize;
+    std::atomic<size_t> m_maxShardBytes;
+    std::vector<std::unique_ptr<CShard>> m_shards;
+
+    CShard& GetShard(typename KTraits::INARGTYPE key) {
+        ULONG hash = KTraits::Hash(key);
+        // The shard's map also takes the hash modulo its bin count, so the hash is folded
+        // and scrambled first to keep the keys of a shard spread over all of its bins
+        return *m_shards[(hash ^ (hash >> 16)) * 0x9e3779b1u % m_nShards];
+    }
+
+    // Free entries until nEntries more entries and size more bytes fit. The entries
+    // used since the hand last went past them get a second chance.
+    void MakeRoom(CShard& shard, size_t nEntries, size_t size) {
+        const size_t maxBytes = m_maxShardBytes;
+        while (shard.count > 0 && (shard.count + nEntries > m_maxShardSize || shard.bytes + size > maxBytes)) {
+            if (shard.hand >= shard.slots.size()) {
+                shard.hand = 0;
+            }
+            auto& pSlot = shard.slots[shard.hand];
+            if (pSlot) {
+                if (pSlot->bReferenced) {
+                    pSlot->bReferenced = false;
+                } else {
+                    shard.map.RemoveKey(pSlot->key);
+                    shard.bytes -= pSlot->size;
+                    shard.count--;
+                    shard.evictions++;
+                    pSlot.reset();
+                    shard.freeSlots.push_back(shard.hand);
+                }
+            }
+            shard.hand++;
+        }
+    }
+
+public:
+    CConcurrentRenderingCache(size_t maxSize, size_t maxBytes = SIZE_MAX, size_t nShards = 16)
+        : m_nShards(std::max<size_t>(1, std::min(nShards, maxSize)))
+        , m_maxShardSize(std::max<size_t>(1, maxSize / m_nShards))
+        , m_maxShardBytes(maxBytes == SIZE_MAX ? SIZE_MAX : maxBytes / m_nShards) {
+        for (size_t i = 0; i < m_nShards; i++) {
+            m_shards.emplace_back(std::make_unique<CShard>());
+        }
+    }
+
+    bool Lookup(typename KTraits::INARGTYPE key, _Out_ typename VTraits::OUTARGTYPE value) {
+        CShard& shard = GetShard(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        size_t iSlot;
+        if (shard.map.Lookup(key, iSlot)) {
+            CSlot& slot = *shard.slots[iSlot];
+            slot.bReferenced = true;
+            value = slot.value;
+            shard.hits++;
+            return true;
+        }
+
+        shard.misses++;
+        return false;
+    }
+
+    void SetAt(typename KTraits::INARGTYPE key, typename VTraits::INARGTYPE value) {
+        CShard& shard = GetShard(key);
+        size_t size = STraits::GetSize(key, value);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        size_t iSlot;
+        if (shard.map.Lookup(key, iSlot)) {
+            CSlot& slot = *shard.slots[iSlot];
+            shard.bytes += size - slot.size;
+            slot.value = value;
+            slot.size = size;
+            slot.bReferenced = true;
+            return;
+        }
+
+        MakeRoom(shard, 1, size);
+
+        auto pSlot = std::make_unique<CSlot>(key, value, size);
+        if (!shard.freeSlots.empty()) {
+            iSlot = shard.freeSlots.back();
+            shard.freeSlots.pop_back();
+            shard.slots[iSlot] = std::move(pSlot);
+        } else {
+            iSlot = shard.slots.size();
+            shard.slots.emplace_back(std::move(pSlot));
+        }
+        shard.map.SetAt(key, iSlot);
+        shard.count++;
+        shard.bytes += size;
+    }
+
+    void Clear() {
+        for (auto& pShard : m_shards) {
+            std::lock_guard<std::mutex> lock(pShard->mutex);
+            pShard->map.RemoveAll();
+            pShard->slots.clear();
+            pShard->freeSlots.clear();
+            pShard->hand = 0;
+            pShard->count = 0;
+            pShard->bytes = 0;
+        }
+    }
+
+    void SetMaxBytes(size_t maxBytes) {
+        m_maxShardBytes = (maxBytes == SIZE_MAX) ? SIZE_MAX : maxBytes / m_nShards;
+        for (auto& pShard : m_shards) {
+            std::lock_guard<std::mutex> lock(pShard->mutex);
+            MakeRoom(*pShard, 0, 0);
+        }
+    }
+
+    void GetStats(CRenderingCacheStats& stats) {
+        ZeroMemory(&stats, sizeof(stats));
+        for (auto& pShard : m_shards) {
+            std::lock_guard<std::mutex> lock(pShard->mutex);
+            stats.entries += pShard->count;
+            stats.bytes += pShard->bytes;
+            stats.hits += pShard->hits;
+            stats.misses += pShard->misses;
+            stats.evictions += pShard->evictions;
+        }
+        stats.maxEntries = m_maxShardSize * m_nShards;
+        const size_t maxShardBytes = m_maxShardBytes;
+        stats.maxBytes = (maxShardBytes == SIZE_MAX) ? SIZE_MAX : maxShardBytes * m_nShards;
     }
 };
 
@@ -179,6 +404,8 @@ class COverlayKey : public COutlineKey
 {
 private:
     CPoint m_subp;
+    // The approximated \be blur gives a slightly different overlay
+    bool m_bExactBeBlur;
     ULONG m_hash;
 
 public:
@@ -0,0 +1,54 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+struct CBufferPoolStats;
+
+struct CRenderingCacheStats {
+    size_t entries, maxEntries;
+    size_t bytes, maxBytes; // Approximate memory held by the entries
+    ULONGLONG hits, misses, evictions;
+};
+
+struct CLookAheadStats {
+    int depth;            // How far past the playback time subtitles are laid out, in ms
+    ULONGLONG nBuilt;     // Subtitles laid out in advance
+    ULONGLONG nUsed;      // Subtitles rendered without having to be laid out first
+    ULONGLONG timeSaved;  // Layout time taken off the rendering thread, in microseconds
+};
+
+// Lets the application watch how the rendering caches are used and resize them
+interface __declspec(uuid("DBD62CAD-E0F7-4F42-832A-628C02AEB5E3"))
+IRenderingCacheStats :
+public IUnknown {
+    STDMETHOD_(int, GetCacheCount)() PURE;
+    STDMETHOD(GetCacheStats)(int i, LPCWSTR* ppName /*[out]*/, CRenderingCacheStats* pStats /*[out]*/) PURE;
+    STDMETHOD(SetCacheBudget)(int i, size_t maxBytes) PURE;
+    // The buffers recycled by the renderer, heapAllocs stops growing once playback is steady
+    STDMETHOD(GetBufferPoolStats)(CBufferPoolStats* pStats /*[out]*/) PURE;
+    // The upcoming subtitles are laid out in the background, 0 disables it
+    STDMETHOD(SetLookAheadDepth)(int depth) PURE;
+    STDMETHOD(GetLookAheadStats)(CLookAheadStats* pStats /*[out]*/) PURE;
+    // Cancels the look ahead and waits for it to finish, SetLookAheadDepth enables it again.
+    // The destructor does it too, an owner which might destroy the lock it gave us while
+    // somebody else still holds a reference must call it before.
+    STDMETHOD(StopLookAhead)() PURE;
+};
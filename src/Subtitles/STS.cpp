@@ -23,10 +23,16 @@
 #include "STS.h"
 #include <atlbase.h>
 #include <algorithm>
+#include <atomic>
+#include <type_traits>
+#include <vector>
 
 #include "RealTextParser.h"
 #include <fstream>
+#include "SubtitleFileCache.h"
 #include "USFSubtitles.h"
+#include "Utf8.h"
+#include "WorkStealingPool.h"
 
 #include "../DSUtil/PathUtils.h"
 
@@ -1257,15 +1263,17 @@ static double GetFloat(LPCWSTR& pszBuff, int& nLength, WCHAR sep = L',')
     return ret;
 }
 
-static bool LoadFont(const CString& font)
+static bool DecodeUUEFont(const CString& font, std::vector<BYTE>& data)
 {
     int len = font.GetLength();
 
-    CAutoVectorPtr<BYTE> pData;
-    if (len == 0 || (len & 3) == 1 || !pData.Allocate(len)) {
+    if (len == 0 || (len & 3) == 1) {
         return false;
     }
 
+    data.resize(len);
+    BYTE* pData = data.data();
+
     const TCHAR* s = font;
     const TCHAR* e = s + len;
     for (BYTE* p = pData; s < e; s++, p++) {
@@ -1287,6 +1295,16 @@ static bool LoadFont(const CString& font)
         pData[datalen++] = ((pData[(len & ~3) + 1] & 15) << 4) | ((pData[(len & ~3) + 2] >> 2) & 15);
     }
 
+    data.resize(datalen);
+
+    return true;
+}
+
+static void AddFont(const std::vector<BYTE>& data)
+{
+    BYTE* pData = const_cast<BYTE*>(data.data());
+    DWORD datalen = DWORD(data.size());
+
     HANDLE hFont = INVALID_HANDLE_VALUE;
 
     if (HMODULE hModule = LoadLibrary(_T("gdi32.dll"))) {
@@ -1321,11 +1339,22 @@ static bool LoadFont(const CString& font)
 
         AddFontResource(fn);
     }
+}
+
+static bool LoadFont(const CString& font, CSimpleTextSubtitle& ret)
+{
+    std::vector<BYTE> data;
+    if (!DecodeUUEFont(font, data)) {
+        return false;
+    }
+
+    AddFont(data);
+    ret.m_embeddedFonts.emplace_back(std::move(data));
 
     return true;
 }
 
-static bool LoadUUEFont(CTextFile* file)
+static bool LoadUUEFont(CTextFile* file, CSimpleTextSubtitle& ret)
 {
     CString s, font;
     while (file->ReadString(s)) {
@@ -1354,7 +1383,7 @@ static bool LoadUUEFont(CTextFile* file)
             }
         }
         if (s.Find(_T("fontname:")) == 0) {
-            LoadFont(font);
+            LoadFont(font, ret);
             font.Empty();
             continue;
         }
@@ -1363,9 +1392,265 @@ static bool LoadUUEFont(CTextFile* file)
     }
 
     if (!font.IsEmpty()) {
-        LoadFont(font);
+        LoadFont(font, ret);
+    }
+
+    return true;
+}
+
+struct SSADialogue {
+    CStringW text;
+    REFERENCE_TIME start, end;
+    CString style, actor, effect;
+    CRect marginRect;
+    int layer;
+};
+
+// Parse what follows "Dialogue:", throws on syntax errors like the helpers above
+static void ParseSSADialogue(LPCWSTR pszBuff, int nBuffLength, int version, SSADialogue& dialogue)
+{
+    int hh1, mm1, ss1, ms1_div10, hh2, mm2, ss2, ms2_div10;
+
+    dialogue.layer = 0;
+    if (version <= 4) {
+        GetStrW(pszBuff, nBuffLength, L'=');      /* Marked = */
+        GetInt(pszBuff, nBuffLength);
+    }
+    if (version >= 5) {
+        dialogue.layer = GetInt(pszBuff, nBuffLength);
+    }
+    hh1 = GetInt(pszBuff, nBuffLength, L':');
+    mm1 = GetInt(pszBuff, nBuffLength, L':');
+    ss1 = GetInt(pszBuff, nBuffLength, L'.');
+    ms1_div10 = GetInt(pszBuff, nBuffLength);
+    hh2 = GetInt(pszBuff, nBuffLength, L':');
+    mm2 = GetInt(pszBuff, nBuffLength, L':');
+    ss2 = GetInt(pszBuff, nBuffLength, L'.');
+    ms2_div10 = GetInt(pszBuff, nBuffLength);
+    dialogue.style = WToT(GetStrW(pszBuff, nBuffLength));
+    dialogue.actor = WToT(GetStrW(pszBuff, nBuffLength));
+    dialogue.marginRect.left = GetInt(pszBuff, nBuffLength);
+    dialogue.marginRect.right = GetInt(pszBuff, nBuffLength);
+    dialogue.marginRect.top = dialogue.marginRect.bottom = GetInt(pszBuff, nBuffLength);
+    if (version >= 6) {
+        dialogue.marginRect.bottom = GetInt(pszBuff, nBuffLength);
+    }
+
+    dialogue.effect = WToT(GetStrW(pszBuff, nBuffLength));
+    int len = std::min(dialogue.effect.GetLength(), nBuffLength);
+    if (dialogue.effect.Left(len) == WToT(CStringW(pszBuff, len))) {
+        dialogue.effect.Empty();
+    }
+
+    dialogue.style.TrimLeft(_T('*'));
+    if (!dialogue.style.CompareNoCase(_T("Default"))) {
+        dialogue.style = _T("Default");
+    }
+
+    dialogue.text = pszBuff;
+    dialogue.start = MS2RT((((hh1 * 60i64 + mm1) * 60i64) + ss1) * 1000i64 + ms1_div10 * 10i64);
+    dialogue.end = MS2RT((((hh2 * 60i64 + mm2) * 60i64) + ss2) * 1000i64 + ms2_div10 * 10i64);
+}
+
+// [Events] sections smaller than this are simply read line by line
+static const size_t SSA_MAPPED_EVENTS_MIN_SIZE = 1024 * 1024;
+static const size_t SSA_EVENTS_CHUNK_MIN_SIZE = 256 * 1024;
+
+static std::atomic<bool> s_bParallelParsing(true);
+
+struct SSAEventsChunk {
+    size_t begin, end;
+    // Where the line by line parser has to take over, end if the whole chunk was parsed
+    size_t stop;
+    std::vector<SSADialogue> dialogues;
+};
+
+static bool IsSSAEntry(LPCWSTR pszMatch, int nMatchLength, LPCWSTR entry)
+{
+    return nMatchLength == (int)wcslen(entry) && !_wcsnicmp(pszMatch, entry, nMatchLength);
+}
+
+// The position following the first line break at or after pos
+static size_t FindSSALineStart(const BYTE* data, size_t size, bool bUTF16, size_t pos)
+{
+    if (bUTF16) {
+        for (pos &= ~size_t(1); pos < size; pos += sizeof(WCHAR)) {
+            if (*(const WCHAR*)(data + pos) == L'\n') {
+                return pos + sizeof(WCHAR);
+            }
+        }
+        return size;
+    }
+
+    const BYTE* p = (const BYTE*)memchr(data + pos, '\n', size - pos);
+    return p ? size_t(p - data) + 1 : size;
+}
+
+// Decode the line at pos into line (null terminated) and move pos to the next line. Gives the same
+// result as CTextFile::ReadString, except that it fails on what ReadString has special handling for:
+// invalid or unsupported UTF-8 sequences and null characters.
+static bool DecodeSSALine(const BYTE* data, size_t size, bool bUTF16, size_t& pos, std::vector<WCHAR>& line)
+{
+    line.clear();
+
+    while (pos < size) {
+        WCHAR c;
+        if (bUTF16) {
+            c = *(const WCHAR*)(data + pos);
+            pos += sizeof(WCHAR);
+        } else if (Utf8::isSingleByte(data[pos])) {
+            c = data[pos++];
+        } else if (Utf8::isFirstOfMultibyte(data[pos])) {
+            int nContinuationBytes = Utf8::continuationBytes(data[pos]);
+            if (nContinuationBytes > 2 || pos + nContinuationBytes >= size) {
+                return false;
+            }
+            for (int j = 1; j <= nContinuationBytes; j++) {
+                if (!Utf8::isContinuation(data[pos + j])) {
+                    return false;
+                }
+            }
+            if (nContinuationBytes == 1) { // 110xxxxx 10xxxxxx
+                c = (data[pos] & 0x1f) << 6 | (data[pos + 1] & 0x3f);
+            } else { // 1110xxxx 10xxxxxx 10xxxxxx
+                c = (data[pos] & 0x0f) << 12 | (data[pos + 1] & 0x3f) << 6 | (data[pos + 2] & 0x3f);
+            }
+            pos += 1 + nContinuationBytes;
+        } else {
+            return false;
+        }
+
+        if (c == L'\n') {
+            break;
+        } else if (c == L'\0') {
+            return false;
+        } else if (c != L'\r') {
+            line.push_back(c);
+        }
+    }
+
+    line.push_back(L'\0');
+
+    return true;
+}
+
+static void ParseSSAEventsChunk(const BYTE* data, bool bUTF16, int version, SSAEventsChunk& chunk)
+{
+    std::vector<WCHAR> line;
+    line.reserve(1024);
+
+    chunk.stop = chunk.end;
+
+    for (size_t pos = chunk.begin; pos < chunk.end;) {
+        size_t lineStart = pos;
+
+        try {
+            if (!DecodeSSALine(data, chunk.end, bUTF16, pos, line)) {
+                chunk.stop = lineStart;
+                break;
+            }
+
+            // Same as FastTrim
+            LPWSTR pszBuff = line.data();
+            int nBuffLength = int(line.size()) - 1;
+            while (nBuffLength > 0 && CStringW::StrTraits::IsSpace(pszBuff[nBuffLength - 1])) {
+                nBuffLength--;
+            }
+            pszBuff[nBuffLength] = L'\0';
+            while (CStringW::StrTraits::IsSpace(*pszBuff)) {
+                pszBuff++;
+                nBuffLength--;
+            }
+            if (nBuffLength == 0 || *pszBuff == L';') {
+                continue;
+            }
+
+            LPCWSTR pszEntry = pszBuff;
+            LPCWSTR pszMatch;
+            int nMatchLength;
+            GetStrW(pszEntry, nBuffLength, L':', pszMatch, nMatchLength);
+
+            if (IsSSAEntry(pszMatch, nMatchLength, L"dialogue")) {
+                SSADialogue dialogue;
+                ParseSSADialogue(pszEntry, nBuffLength, version, dialogue);
+                chunk.dialogues.emplace_back(dialogue);
+            } else if (!IsSSAEntry(pszMatch, nMatchLength, L"comment") && !IsSSAEntry(pszMatch, nMatchLength, L"format")) {
+                // Anything else might change the state of the parser
+                chunk.stop = lineStart;
+                break;
+            }
+        } catch (int) {
+            // Let the line by line parser report the syntax error
+            chunk.stop = lineStart;
+            break;
+        } catch (CException* e) {
+            e->Delete();
+            chunk.stop = lineStart;
+            break;
+        }
+    }
+}
+
+// Large scripts are mostly made of Dialogue lines. Those are parsed directly from a memory mapping
+// of the file, split in chunks which are parsed in parallel and then added in order. Stops on the
+// first line which needs OpenSubStationAlpha and leaves the file positioned at its beginning.
+static bool OpenSSAEventsMapped(CTextFile* file, CSimpleTextSubtitle& ret, int version)
+{
+    ULONGLONG start = file->GetPosition();
+    if (!s_bParallelParsing || file->GetLength() < start + SSA_MAPPED_EVENTS_MIN_SIZE) {
+        return true;
+    }
+
+    CTextFileView view;
+    if (!view.Map(*file) || view.GetSize() <= start) {
+        return true;
+    }
+
+    const BYTE* data = view.GetData();
+    size_t size = view.GetSize();
+    bool bUTF16 = (file->GetEncoding() == CTextFile::LE16);
+
+    auto pPool = CWorkStealingPool::GetShared();
+    size_t nChunks = std::min<size_t>((size - size_t(start)) / SSA_EVENTS_CHUNK_MIN_SIZE, pPool->GetThreadCount() * 4);
+    nChunks = std::max<size_t>(nChunks, 1);
+
+    std::vector<SSAEventsChunk> chunks(nChunks);
+    for (size_t i = 0, pos = size_t(start); i < nChunks; i++) {
+        chunks[i].begin = pos;
+        if (i + 1 < nChunks) {
+            pos = FindSSALineStart(data, size, bUTF16, std::max(pos, size_t(start) + (size - size_t(start)) / nChunks * (i + 1)));
+        } else {
+            pos = size;
+        }
+        chunks[i].end = pos;
+    }
+
+    pPool->ParallelFor(nChunks, [&](size_t i) {
+        ParseSSAEventsChunk(data, bUTF16, version, chunks[i]);
+    });
+
+    size_t stop = size;
+    try {
+        for (auto& chunk : chunks) {
+            for (const auto& dialogue : chunk.dialogues) {
+                ret.Add(dialogue.text, true, dialogue.start, dialogue.end,
+                        dialogue.style, dialogue.actor, dialogue.effect,
+                        dialogue.marginRect, dialogue.layer);
+            }
+            std::vector<SSADialogue>().swap(chunk.dialogues);
+
+            if (chunk.stop != chunk.end) {
+                stop = chunk.stop;
+                break;
+            }
+        }
+    } catch (CMemoryException* e) {
+        e->Delete();
+        return false;
     }
 
+    file->Seek(stop, CFile::begin);
+
     return true;
 }
 
@@ -1388,51 +1673,16 @@ static bool OpenSubStationAlpha(CTextFile* file, CSimpleTextSubtitle& ret, int C
 
         if (entry == L"dialogue") {
             try {
-                int hh1, mm1, ss1, ms1_div10, hh2, mm2, ss2, ms2_div10, layer = 0;
-                CRect marginRect;
-
-                if (version <= 4) {
-                    GetStrW(pszBuff, nBuffLength, L'=');      /* Marked = */
-                    GetInt(pszBuff, nBuffLength);
-                }
-                if (version >= 5) {
-                    layer = GetInt(pszBuff, nBuffLength);
-                }
-                hh1 = GetInt(pszBuff, nBuffLength, L':');
-                mm1 = GetInt(pszBuff, nBuffLength, L':');
-                ss1 = GetInt(pszBuff, nBuffLength, L'.');
-                ms1_div10 = GetInt(pszBuff, nBuffLength);
-                hh2 = GetInt(pszBuff, nBuffLength, L':');
-                mm2 = GetInt(pszBuff, nBuffLength, L':');
-                ss2 = GetInt(pszBuff, nBuffLength, L'.');
-                ms2_div10 = GetInt(pszBuff, nBuffLength);
-                CString style = WToT(GetStrW(pszBuff, nBuffLength));
-                CString actor = WToT(GetStrW(pszBuff, nBuffLength));
-                marginRect.left = GetInt(pszBuff, nBuffLength);
-                marginRect.right = GetInt(pszBuff, nBuffLength);
-                marginRect.top = marginRect.bottom = GetInt(pszBuff, nBuffLength);
-                if (version >= 6) {
-                    marginRect.bottom = GetInt(pszBuff, nBuffLength);
-                }
-
-                CString effect = WToT(GetStrW(pszBuff, nBuffLength));
-                int len = std::min(effect.GetLength(), nBuffLength);
-                if (effect.Left(len) == WToT(CStringW(pszBuff, len))) {
-                    effect.Empty();
-                }
+                SSADialogue dialogue;
+                ParseSSADialogue(pszBuff, nBuffLength, version, dialogue);
 
-                style.TrimLeft(_T('*'));
-                if (!style.CompareNoCase(_T("Default"))) {
-                    style = _T("Default");
-                }
-
-                ret.Add(pszBuff,
+                ret.Add(dialogue.text,
                         file->IsUnicode(),
-                        MS2RT((((hh1 * 60i64 + mm1) * 60i64) + ss1) * 1000i64 + ms1_div10 * 10i64),
-                        MS2RT((((hh2 * 60i64 + mm2) * 60i64) + ss2) * 1000i64 + ms2_div10 * 10i64),
-                        style, actor, effect,
-                        marginRect,
-                        layer);
+                        dialogue.start,
+                        dialogue.end,
+                        dialogue.style, dialogue.actor, dialogue.effect,
+                        dialogue.marginRect,
+                        dialogue.layer);
             } catch (...) {
                 return false;
             }
@@ -1578,8 +1828,11 @@ static bool OpenSubStationAlpha(CTextFile* file, CSimpleTextSubtitle& ret, int C
             sver = 6;
         } else if (entry == L"[events]") {
             fRet = true;
+            if (!OpenSSAEventsMapped(file, ret, version)) {
+                return false;
+            }
         } else if (entry == L"fontname") {
-            LoadUUEFont(file);
+            LoadUUEFont(file, ret);
         } else if (entry == L"ycbcr matrix") {
             ret.m_sYCbCrMatrix = GetStrW(pszBuff, nBuffLength);
         }
@@ -1723,7 +1976,7 @@ static bool OpenXombieSub(CTextFile* file, CSimpleTextSubtitle& ret, int CharSet
                 return false;
             }
         } else if (entry == L"fontname") {
-            LoadUUEFont(file);
+            LoadUUEFont(file, ret);
         }
     }
 
@@ -1810,6 +2063,86 @@ static OpenFunctStruct OpenFuncts[] = {
 
 static int nOpenFuncts = _countof(OpenFuncts);
 
+static std::atomic<ULONGLONG> s_nOpenSniffed, s_nOpenMissed, s_nOpenUnknown;
+
+// Guess from the first lines of the file which of the parsers above reads it, so that a file
+// isn't parsed by every other format before getting to its own. The patterns are checked in
+// the same order as OpenFuncts. Returns nullptr when unsure, the file is rewound either way.
+static STSOpenFunct SniffSubtitleFormat(CTextFile* file)
+{
+    const int SNIFF_MAX_LINES = 64;
+    const int SNIFF_MAX_CHARS = 4096;
+
+    ULONGLONG pos = file->GetPosition();
+
+    CStringW buff, first, second;
+    bool fUSF = false;
+    for (int i = 0, nChars = 0; i < SNIFF_MAX_LINES && nChars < SNIFF_MAX_CHARS && file->ReadString(buff); i++) {
+        nChars += buff.GetLength();
+        FastTrim(buff);
+        if (buff.IsEmpty()) {
+            continue;
+        }
+
+        if (buff.Find(L"USFSubtitles") >= 0) {
+            fUSF = true;
+        }
+        if (first.IsEmpty()) {
+            first = buff;
+        } else if (second.IsEmpty()) {
+            second = buff;
+        }
+    }
+
+    file->Seek(pos, CFile::begin);
+
+    if (first.IsEmpty()) {
+        return nullptr;
+    }
+
+    CStringW lower = first;
+    lower.MakeLower();
+
+    int n1, n2, n3, n4, n5, n6, n7, n8;
+    LONGLONG ll1, ll2;
+    WCHAR wc, wc2;
+
+    if ((swscanf_s(first, L"%d%c", &n1, &wc, 1) == 1 && second.Find(L"-->") > 0)
+            || (swscanf_s(first, L"%d%c", &n1, &wc, 1) == 2 && first.Find(L"-->") > 0)) {
+        return OpenSubRipper;
+    }
+    if (swscanf_s(first, L"{%d:%d:%d}{%d:%d:%d}", &n1, &n2, &n3, &n4, &n5, &n6) == 6) {
+        return OpenOldSubRipper;
+    }
+    if (lower.Find(L"[information]") == 0
+            || swscanf_s(first, L"%d:%d:%d%c%d,%d:%d:%d%c%d", &n1, &n2, &n3, &wc, 1, &n4, &n5, &n6, &n7, &wc2, 1, &n8) == 10) {
+        return OpenSubViewer;
+    }
+    if (swscanf_s(first, L"{%lld}{%lld}", &ll1, &ll2) == 2 || swscanf_s(first, L"{%lld}{}", &ll1) == 1) {
+        return OpenMicroDVD;
+    }
+    if (swscanf_s(first, L"%d:%d:%d:", &n1, &n2, &n3) == 3) {
+        return OpenVPlayer;
+    }
+    if (lower.Find(L"[script info]") == 0 || lower.Find(L"[v4") == 0 || lower.Find(L"[events]") == 0) {
+        return OpenSubStationAlpha;
+    }
+    if (swscanf_s(first, L"[%d][%d]", &n1, &n2) == 2) {
+        return OpenMPL2;
+    }
+    if (lower.Find(L"<window") == 0) {
+        return OpenRealText;
+    }
+    if (lower.Find(L"<sami>") >= 0) {
+        return OpenSami;
+    }
+    if (first[0] == L'<' && fUSF) {
+        return OpenUSF;
+    }
+
+    return nullptr;
+}
+
 //
 
 CSimpleTextSubtitle::CSimpleTextSubtitle()
@@ -1826,7 +2159,10 @@ CSimpleTextSubtitle::CSimpleTextSubtitle()
     , m_fUsingAutoGeneratedDefaultStyle(false)
     , m_ePARCompensationType(EPCTDisabled)
     , m_dPARCompensation(1.0)
+    , m_iNextCachedSegment(0)
+    , m_segmentsVersion(1)
 {
+    ZeroMemory(&m_searchStats, sizeof(m_searchStats));
 }
 
 CSimpleTextSubtitle::~CSimpleTextSubtitle()
@@ -1865,7 +2201,8 @@ void CSimpleTextSubtitle::Copy(CSimpleTextSubtitle& sts)
         m_provider = sts.m_provider;
         m_eHearingImpaired = sts.m_eHearingImpaired;
         CopyStyles(sts.m_styles);
-        m_segments.Copy(sts.m_segments);
+        m_segments = sts.m_segments;
+        InvalidateSegmentCache();
         __super::Copy(sts);
     }
 }
@@ -1938,15 +2275,12 @@ void CSimpleTextSubtitle::Empty()
 {
     m_dstScreenSize = CSize(0, 0);
     m_styles.Free();
-    m_segments.RemoveAll();
+    m_segments.Clear();
+    InvalidateSegmentCache();
+    m_embeddedFonts.clear();
     RemoveAll();
 }
 
-static bool SegmentCompStart(const STSSegment& segment, REFERENCE_TIME start)
-{
-    return (segment.start < start);
-}
-
 void CSimpleTextSubtitle::Add(CStringW str, bool fUnicode, REFERENCE_TIME start, REFERENCE_TIME end, CString style, CString actor, CString effect, const CRect& marginRect, int layer, int readorder)
 {
     FastTrim(str);
@@ -1984,84 +2318,8 @@ void CSimpleTextSubtitle::Add(CStringW str, bool fUnicode, REFERENCE_TIME start,
         return;
     }
 
-    size_t segmentsCount = m_segments.GetCount();
-
-    if (segmentsCount == 0) { // First segment
-        STSSegment stss(start, end);
-        stss.subs.Add(n);
-        m_segments.Add(stss);
-    } else {
-        STSSegment* segmentsStart = m_segments.GetData();
-        STSSegment* segmentsEnd   = segmentsStart + segmentsCount;
-        STSSegment* segment = std::lower_bound(segmentsStart, segmentsEnd, start, SegmentCompStart);
-
-        size_t i = segment - segmentsStart;
-        if (i > 0 && m_segments[i - 1].end > start) {
-            // The beginning of i-1th segment isn't modified
-            // by the new entry so separate it in two segments
-            STSSegment stss(m_segments[i - 1].start, start);
-            stss.subs.Copy(m_segments[i - 1].subs);
-            m_segments[i - 1].start = start;
-            m_segments.InsertAt(i - 1, stss);
-        } else if (i < segmentsCount && start < m_segments[i].start) {
-            // The new entry doesn't start in an existing segment.
-            // It might even not overlap with any segment at all
-            STSSegment stss(start, std::min(end, m_segments[i].start));
-            stss.subs.Add(n);
-            m_segments.InsertAt(i, stss);
-            i++;
-        }
-
-        REFERENCE_TIME lastEnd = _I64_MAX;
-        for (; i < m_segments.GetCount() && m_segments[i].start < end; i++) {
-            STSSegment& s = m_segments[i];
-
-            if (lastEnd < s.start) {
-                // There is a gap between the segments overlapped by
-                // the new entry so we have to create a new one
-                STSSegment stss(lastEnd, s.start);
-                stss.subs.Add(n);
-                lastEnd = s.start; // s might not point on the right segment after inserting so do the modification now
-                m_segments.InsertAt(i, stss);
-            } else {
-                if (end < s.end) {
-                    // The end of current segment isn't modified
-                    // by the new entry so separate it in two segments
-                    STSSegment stss(end, s.end);
-                    stss.subs.Copy(s.subs);
-                    s.end = end; // s might not point on the right segment after inserting so do the modification now
-                    m_segments.InsertAt(i + 1, stss);
-                }
-
-                // The array might have been reallocated so create a new reference
-                STSSegment& sAdd = m_segments[i];
-
-                // Add the entry to the current segment now that we are you it belongs to it
-                size_t entriesCount = sAdd.subs.GetCount();
-                // Take a shortcut when possible
-                if (!entriesCount || sub.readorder >= GetAt(sAdd.subs[entriesCount - 1]).readorder) {
-                    sAdd.subs.Add(n);
-                } else {
-                    for (size_t j = 0; j < entriesCount; j++) {
-                        if (sub.readorder < GetAt(sAdd.subs[j]).readorder) {
-                            sAdd.subs.InsertAt(j, n);
-                            break;
-                        }
-                    }
-                }
-
-                lastEnd = sAdd.end;
-            }
-        }
-
-        if (end > m_segments[i - 1].end) {
-            // The new entry ends after the last overlapping segment.
-            // It might even not overlap with any segment at all
-            STSSegment stss(std::max(start, m_segments[i - 1].end), end);
-            stss.subs.Add(n);
-            m_segments.InsertAt(i, stss);
-        }
-    }
+    m_segments.Insert(n, start, end);
+    InvalidateSegmentCache();
 }
 
 STSStyle* CSimpleTextSubtitle::CreateDefaultStyle(int CharSet)
@@ -2255,72 +2513,141 @@ int CSimpleTextSubtitle::SearchSub(REFERENCE_TIME t, double fps)
 
 const STSSegment* CSimpleTextSubtitle::SearchSubs(REFERENCE_TIME t, double fps, /*[out]*/ int* iSegment, int* nSegments)
 {
-    int i = 0, j = (int)m_segments.GetCount() - 1, ret = -1;
+    return SearchSubs(m_searchCursor, t, fps, iSegment, nSegments);
+}
+
+const STSSegment* CSimpleTextSubtitle::SearchSubs(STSSearchCursor& cursor, REFERENCE_TIME t, double fps, /*[out]*/ int* iSegment, int* nSegments)
+{
+    int j = (int)m_segments.GetCount() - 1;
 
     if (nSegments) {
         *nSegments = j + 1;
     }
 
-    // last segment
-    if (j >= 0 && t >= TranslateSegmentStart(j, fps) && t < TranslateSegmentEnd(j, fps)) {
-        if (iSegment) {
-            *iSegment = j;
+    int ret = FindSegment(cursor, t, fps);
+
+    // before first segment
+    if (ret < 0) {
+        if (j > 0 && iSegment) {
+            *iSegment = -1;
         }
-        return &m_segments[j];
+        return nullptr;
     }
 
     // after last segment
-    if (j >= 0 && t >= TranslateSegmentEnd(j, fps)) {
+    if (ret == j && t >= cursor.end) {
         if (iSegment) {
             *iSegment = j + 1;
         }
         return nullptr;
     }
 
-    // before first segment
-    if (j > 0 && t < TranslateSegmentStart(i, fps)) {
-        if (iSegment) {
-            *iSegment = -1;
-        }
-        return nullptr;
+    if (iSegment) {
+        *iSegment = ret;
     }
 
-    while (i < j) {
-        int mid = (i + j) >> 1;
+    return t < cursor.end ? GetSegment(ret) : nullptr;
+}
 
-        REFERENCE_TIME midt = TranslateSegmentStart(mid, fps);
+REFERENCE_TIME CSimpleTextSubtitle::TranslateSegmentTime(REFERENCE_TIME t, double fps) const
+{
+    return (m_mode == TIME ? t :
+            m_mode == FRAME ? std::llround(t * UNITS_FLOAT / fps) :
+            0);
+}
 
-        if (t == midt) {
-            ret = mid;
-            break;
-        } else if (t < midt) {
-            ret = -1;
-            if (j == mid) {
-                mid--;
-            }
-            j = mid;
-        } else if (t > midt) {
-            ret = mid;
-            if (i == mid) {
-                mid++;
+void CSimpleTextSubtitle::GetCursorBounds(int i, double fps, REFERENCE_TIME& start, REFERENCE_TIME& end)
+{
+    if (i < 0) {
+        start = end = _I64_MIN;
+    } else if (!m_segments.GetBounds(i, start, end)) {
+        start = end = _I64_MAX;
+    } else {
+        start = TranslateSegmentTime(start, fps);
+        end = TranslateSegmentTime(end, fps);
+        m_searchStats.nProbes++;
+    }
+}
+
+// The last segment starting before t, -1 if none
+int CSimpleTextSubtitle::FindSegment(STSSearchCursor& cursor, REFERENCE_TIME t, double fps)
+{
+    // Farther than this, searching is faster than walking
+    const int MAX_WALK = 4;
+
+    int count = (int)m_segments.GetCount();
+
+    m_searchStats.nLookups++;
+
+    if (cursor.version == m_segmentsVersion && cursor.fps == fps) {
+        for (int walk = 0; walk <= MAX_WALK; walk++) {
+            if (cursor.iSegment >= 0 && t < cursor.start) {
+                cursor.iSegment--;
+                cursor.nextStart = cursor.start;
+                cursor.nextEnd = cursor.end;
+                GetCursorBounds(cursor.iSegment, fps, cursor.start, cursor.end);
+            } else if (cursor.iSegment + 1 < count && t >= cursor.nextStart) {
+                cursor.iSegment++;
+                cursor.start = cursor.nextStart;
+                cursor.end = cursor.nextEnd;
+                GetCursorBounds(cursor.iSegment + 1, fps, cursor.nextStart, cursor.nextEnd);
+            } else {
+                return cursor.iSegment;
             }
-            i = mid;
         }
     }
 
-    if (0 <= ret && (size_t)ret < m_segments.GetCount()) {
-        if (iSegment) {
-            *iSegment = ret;
+    m_searchStats.nSeeks++;
+
+    cursor.version = m_segmentsVersion;
+    cursor.fps = fps;
+    cursor.iSegment = (int)m_segments.FindLast([&](REFERENCE_TIME start) {
+        m_searchStats.nProbes++;
+        return TranslateSegmentTime(start, fps) <= t;
+    });
+    GetCursorBounds(cursor.iSegment, fps, cursor.start, cursor.end);
+    GetCursorBounds(cursor.iSegment + 1, fps, cursor.nextStart, cursor.nextEnd);
+
+    return cursor.iSegment;
+}
+
+const STSSegment* CSimpleTextSubtitle::GetSegment(int iSegment)
+{
+    if (iSegment < 0 || (size_t)iSegment >= m_segments.GetCount()) {
+        return nullptr;
+    }
+
+    for (auto& cached : m_segmentCache) {
+        if (cached.iSegment == iSegment) {
+            return &cached.segment;
         }
     }
 
-    if (0 <= ret && (size_t)ret < m_segments.GetCount()
-            && !m_segments[ret].subs.IsEmpty()
-            && TranslateSegmentStart(ret, fps) <= t && t < TranslateSegmentEnd(ret, fps)) {
-        return &m_segments[ret];
+    CachedSegment& cached = m_segmentCache[m_iNextCachedSegment];
+    m_iNextCachedSegment = (m_iNextCachedSegment + 1) % m_segmentCache.size();
+
+    STSSegment& stss = cached.segment;
+    m_segments.GetBounds(iSegment, stss.start, stss.end);
+    m_segments.GetEntries(iSegment, stss.subs);
+    // Same order as the entries were added in
+    std::sort(stss.subs.GetData(), stss.subs.GetData() + stss.subs.GetCount(), [this](int e1, int e2) {
+        int readorder1 = GetAt(e1).readorder, readorder2 = GetAt(e2).readorder;
+        return (readorder1 == readorder2) ? e1 < e2 : readorder1 < readorder2;
+    });
+    cached.iSegment = iSegment;
+
+    return &stss;
+}
+
+void CSimpleTextSubtitle::InvalidateSegmentCache()
+{
+    if (++m_segmentsVersion == 0) {
+        m_segmentsVersion = 1;
     }
 
-    return nullptr;
+    for (auto& cached : m_segmentCache) {
+        cached.iSegment = -1;
+    }
 }
 
 REFERENCE_TIME CSimpleTextSubtitle::TranslateStart(int i, double fps)
@@ -2341,18 +2668,14 @@ REFERENCE_TIME CSimpleTextSubtitle::TranslateEnd(int i, double fps)
 
 REFERENCE_TIME CSimpleTextSubtitle::TranslateSegmentStart(int i, double fps)
 {
-    return (i < 0 || m_segments.GetCount() <= (size_t)i ? -1 :
-            m_mode == TIME ? m_segments[i].start :
-            m_mode == FRAME ? std::llround(m_segments[i].start * UNITS_FLOAT / fps) :
-            0);
+    REFERENCE_TIME start, end;
+    return (i < 0 || !m_segments.GetBounds(i, start, end) ? -1 : TranslateSegmentTime(start, fps));
 }
 
 REFERENCE_TIME CSimpleTextSubtitle::TranslateSegmentEnd(int i, double fps)
 {
-    return (i < 0 || m_segments.GetCount() <= (size_t)i ? -1 :
-            m_mode == TIME ? m_segments[i].end :
-            m_mode == FRAME ? std::llround(m_segments[i].end * UNITS_FLOAT / fps) :
-            0);
+    REFERENCE_TIME start, end;
+    return (i < 0 || !m_segments.GetBounds(i, start, end) ? -1 : TranslateSegmentTime(end, fps));
 }
 
 STSStyle* CSimpleTextSubtitle::GetStyle(int i)
@@ -2542,84 +2865,350 @@ void CSimpleTextSubtitle::Sort(bool fRestoreReadorder)
     CreateSegments();
 }
 
-struct Breakpoint {
-    REFERENCE_TIME t;
-    bool isStart;
-
-    Breakpoint(REFERENCE_TIME t, bool isStart) : t(t), isStart(isStart) {};
-};
-
-static int BreakpointComp(const void* e1, const void* e2)
+void CSimpleTextSubtitle::CreateSegments()
 {
-    const Breakpoint* bp1 = (const Breakpoint*)e1;
-    const Breakpoint* bp2 = (const Breakpoint*)e2;
+    m_segments.Clear();
+    InvalidateSegmentCache();
 
-    return SGN(bp1->t - bp2->t);
+    for (size_t i = 0; i < GetCount(); i++) {
+        const STSEntry& stse = GetAt(i);
+        m_segments.Insert(int(i), stse.start, stse.end);
+    }
+
+    OnChanged();
 }
 
-void CSimpleTextSubtitle::CreateSegments()
+bool CSimpleTextSubtitle::Open(CString fn, int CharSet, CString name, CString videoName)
 {
-    m_segments.RemoveAll();
+    Empty();
 
-    CAtlArray<Breakpoint> breakpoints;
+    CSubtitleFileCache cache;
+    if (cache.Lookup(fn, CharSet)) {
+        if (LoadParsed(cache.GetData(), cache.GetSize())) {
+            CString guessed = Subtitle::GuessSubtitleName(fn, videoName, m_lcid, m_eHearingImpaired);
+            m_name = name.IsEmpty() ? guessed : name;
+            return true;
+        }
+        TRACE(_T("CSimpleTextSubtitle: the cache of \"%s\" is unreadable\n"), fn.GetString());
+        cache.Close();
+        Empty();
+    }
 
-    for (size_t i = 0; i < GetCount(); i++) {
-        STSEntry& stse = GetAt(i);
-        breakpoints.Add(Breakpoint(stse.start, true));
-        breakpoints.Add(Breakpoint(stse.end, false));
+    CWebTextFile f(CTextFile::UTF8);
+    if (!f.Open(fn)) {
+        return false;
     }
 
-    qsort(breakpoints.GetData(), breakpoints.GetCount(), sizeof(Breakpoint), BreakpointComp);
+    CString guessed = Subtitle::GuessSubtitleName(fn, videoName, m_lcid, m_eHearingImpaired);
+    if (name.IsEmpty()) {
+        name = guessed;
+    }
 
-    ptrdiff_t startsCount = 0;
-    for (size_t i = 1, end = breakpoints.GetCount(); i < end; i++) {
-        startsCount += breakpoints[i - 1].isStart ? +1 : -1;
-        if (breakpoints[i - 1].t != breakpoints[i].t && startsCount > 0) {
-            m_segments.Add(STSSegment(breakpoints[i - 1].t, breakpoints[i].t));
-        }
+    if (!Open(&f, CharSet, name)) {
+        return false;
     }
 
-    STSSegment* segmentsStart = m_segments.GetData();
-    STSSegment* segmentsEnd   = segmentsStart + m_segments.GetCount();
-    for (size_t i = 0; i < GetCount(); i++) {
-        const STSEntry& stse = GetAt(i);
-        STSSegment* segment = std::lower_bound(segmentsStart, segmentsEnd, stse.start, SegmentCompStart);
-        for (size_t j = segment - segmentsStart; j < m_segments.GetCount() && m_segments[j].end <= stse.end; j++) {
-            m_segments[j].subs.Add(int(i));
-        }
+    if (cache.CanStore()) {
+        std::vector<BYTE> data;
+        SaveParsed(data);
+        cache.Store(data);
     }
+    // The fonts are already installed, they were only kept for the cache
+    std::vector<std::vector<BYTE>>().swap(m_embeddedFonts);
 
-    OnChanged();
-    /*
-        for (size_t i = 0, j = m_segments.GetCount(); i < j; i++) {
-            STSSegment& stss = m_segments[i];
+    return true;
+}
 
-            TRACE(_T("%d - %d"), stss.start, stss.end);
+namespace
+{
+    // Plain data is stored as is, the cache is only read by the same build on the same machine
+    class CParsedWriter
+    {
+        std::vector<BYTE>& m_data;
 
-            for (size_t k = 0, l = stss.subs.GetCount(); k < l; k++) {
-                TRACE(_T(", %d"), stss.subs[k]);
+    public:
+        explicit CParsedWriter(std::vector<BYTE>& data) : m_data(data) {}
+
+        template<class T>
+        void Write(const T& value) {
+            static_assert(std::is_trivially_copyable<T>::value, "only plain data can be written");
+            const BYTE* p = reinterpret_cast<const BYTE*>(&value);
+            m_data.insert(m_data.end(), p, p + sizeof(T));
+        }
+
+        void WriteString(const CStringW& str) {
+            Write(str.GetLength());
+            const BYTE* p = reinterpret_cast<const BYTE*>(str.GetString());
+            m_data.insert(m_data.end(), p, p + str.GetLength() * sizeof(WCHAR));
+        }
+
+        void WriteBytes(const std::vector<BYTE>& bytes) {
+            Write(bytes.size());
+            m_data.insert(m_data.end(), bytes.begin(), bytes.end());
+        }
+    };
+
+    // Fails instead of reading past the end of truncated or corrupted data
+    class CParsedReader
+    {
+        const BYTE* m_p;
+        const BYTE* m_end;
+
+    public:
+        CParsedReader(const BYTE* data, size_t size) : m_p(data), m_end(data + size) {}
+
+        bool IsAtEnd() const { return m_p == m_end; }
+
+        template<class T>
+        bool Read(T& value) {
+            static_assert(std::is_trivially_copyable<T>::value, "only plain data can be read");
+            if (size_t(m_end - m_p) < sizeof(T)) {
+                return false;
             }
+            memcpy(&value, m_p, sizeof(T));
+            m_p += sizeof(T);
+            return true;
+        }
+
+        bool ReadString(CStringW& str) {
+            int len;
+            if (!Read(len) || len < 0 || size_t(m_end - m_p) / sizeof(WCHAR) < size_t(len)) {
+                return false;
+            }
+            str.SetString(reinterpret_cast<LPCWSTR>(m_p), len);
+            m_p += len * sizeof(WCHAR);
+            return true;
+        }
+
+        bool ReadString(CString& str) {
+            CStringW strW;
+            if (!ReadString(strW)) {
+                return false;
+            }
+            str = WToT(strW);
+            return true;
+        }
 
-            TRACE(_T("\n"));
+        bool ReadBytes(std::vector<BYTE>& bytes) {
+            size_t len;
+            if (!Read(len) || size_t(m_end - m_p) < len) {
+                return false;
+            }
+            bytes.assign(m_p, m_p + len);
+            m_p += len;
+            return true;
         }
-    */
+    };
+
+    void WriteStyle(CParsedWriter& w, const STSStyle& s)
+    {
+        w.Write(RECT(s.marginRect));
+        w.Write(s.scrAlignment);
+        w.Write(s.borderStyle);
+        w.Write(s.outlineWidthX);
+        w.Write(s.outlineWidthY);
+        w.Write(s.shadowDepthX);
+        w.Write(s.shadowDepthY);
+        w.Write(s.colors);
+        w.Write(s.alpha);
+        w.Write(s.charSet);
+        w.WriteString(TToW(s.fontName));
+        w.Write(s.fontSize);
+        w.Write(s.fontScaleX);
+        w.Write(s.fontScaleY);
+        w.Write(s.fontSpacing);
+        w.Write(s.fontWeight);
+        w.Write(s.fItalic);
+        w.Write(s.fUnderline);
+        w.Write(s.fStrikeOut);
+        w.Write(s.fBlur);
+        w.Write(s.fGaussianBlur);
+        w.Write(s.fontAngleZ);
+        w.Write(s.fontAngleX);
+        w.Write(s.fontAngleY);
+        w.Write(s.fontShiftX);
+        w.Write(s.fontShiftY);
+        w.Write(s.relativeTo);
+    }
+
+    bool ReadStyle(CParsedReader& r, STSStyle& s)
+    {
+        RECT marginRect;
+        bool bRet = r.Read(marginRect)
+                    && r.Read(s.scrAlignment)
+                    && r.Read(s.borderStyle)
+                    && r.Read(s.outlineWidthX)
+                    && r.Read(s.outlineWidthY)
+                    && r.Read(s.shadowDepthX)
+                    && r.Read(s.shadowDepthY)
+                    && r.Read(s.colors)
+                    && r.Read(s.alpha)
+                    && r.Read(s.charSet)
+                    && r.ReadString(s.fontName)
+                    && r.Read(s.fontSize)
+                    && r.Read(s.fontScaleX)
+                    && r.Read(s.fontScaleY)
+                    && r.Read(s.fontSpacing)
+                    && r.Read(s.fontWeight)
+                    && r.Read(s.fItalic)
+                    && r.Read(s.fUnderline)
+                    && r.Read(s.fStrikeOut)
+                    && r.Read(s.fBlur)
+                    && r.Read(s.fGaussianBlur)
+                    && r.Read(s.fontAngleZ)
+                    && r.Read(s.fontAngleX)
+                    && r.Read(s.fontAngleY)
+                    && r.Read(s.fontShiftX)
+                    && r.Read(s.fontShiftY)
+                    && r.Read(s.relativeTo);
+        s.marginRect = marginRect;
+        return bRet;
+    }
+}
+
+void CSimpleTextSubtitle::SaveParsed(std::vector<BYTE>& data) const
+{
+    data.clear();
+    CParsedWriter w(data);
+
+    w.Write(m_subtitleType);
+    w.Write(m_mode);
+    w.Write(m_encoding);
+    w.WriteString(TToW(m_path));
+    w.Write(SIZE(m_dstScreenSize));
+    w.Write(m_defaultWrapStyle);
+    w.Write(m_collisions);
+    w.Write(m_fScaledBAS);
+    w.WriteString(TToW(m_sYCbCrMatrix));
+    w.Write(m_fUsingAutoGeneratedDefaultStyle);
+
+    w.Write(m_styles.GetCount());
+    POSITION pos = m_styles.GetStartPosition();
+    while (pos) {
+        CString name;
+        STSStyle* style;
+        m_styles.GetNextAssoc(pos, name, style);
+        w.WriteString(TToW(name));
+        WriteStyle(w, *style);
+    }
+
+    w.Write(GetCount());
+    for (size_t i = 0, count = GetCount(); i < count; i++) {
+        const STSEntry& stse = GetAt(i);
+        w.WriteString(stse.str);
+        w.Write(stse.fUnicode);
+        w.WriteString(TToW(stse.style));
+        w.WriteString(TToW(stse.actor));
+        w.WriteString(TToW(stse.effect));
+        w.Write(RECT(stse.marginRect));
+        w.Write(stse.layer);
+        w.Write(stse.start);
+        w.Write(stse.end);
+        w.Write(stse.readorder);
+    }
+
+    // The segments are stored so that they don't have to be computed again
+    std::vector<CSegmentIndex::Interval> segments;
+    m_segments.GetSegments(segments);
+    w.Write(segments.size());
+    for (const auto& segment : segments) {
+        w.Write(segment);
+    }
+
+    // Installing the fonts is the only part of parsing that has an effect outside of us
+    w.Write(m_embeddedFonts.size());
+    for (const auto& font : m_embeddedFonts) {
+        w.WriteBytes(font);
+    }
 }
 
-bool CSimpleTextSubtitle::Open(CString fn, int CharSet, CString name, CString videoName)
+bool CSimpleTextSubtitle::LoadParsed(const BYTE* data, size_t size)
 {
     Empty();
 
-    CWebTextFile f(CTextFile::UTF8);
-    if (!f.Open(fn)) {
+    CParsedReader r(data, size);
+
+    SIZE dstScreenSize;
+    if (!r.Read(m_subtitleType) || !r.Read(m_mode) || !r.Read(m_encoding) || !r.ReadString(m_path)
+            || !r.Read(dstScreenSize) || !r.Read(m_defaultWrapStyle) || !r.Read(m_collisions) || !r.Read(m_fScaledBAS)
+            || !r.ReadString(m_sYCbCrMatrix) || !r.Read(m_fUsingAutoGeneratedDefaultStyle)) {
         return false;
     }
+    m_dstScreenSize = dstScreenSize;
 
-    CString guessed = Subtitle::GuessSubtitleName(fn, videoName, m_lcid, m_eHearingImpaired);
-    if (name.IsEmpty()) {
-        name = guessed;
+    size_t nStyles;
+    if (!r.Read(nStyles)) {
+        return false;
+    }
+    for (size_t i = 0; i < nStyles; i++) {
+        CString name;
+        CAutoPtr<STSStyle> style(DEBUG_NEW STSStyle);
+        if (!r.ReadString(name) || !ReadStyle(r, *style)) {
+            return false;
+        }
+        STSStyle* val;
+        if (m_styles.Lookup(name, val)) {
+            return false;
+        }
+        m_styles[name] = style.Detach();
+    }
+
+    size_t nEntries;
+    if (!r.Read(nEntries) || nEntries > size) {
+        return false;
+    }
+    if (!SetCount(nEntries)) {
+        return false;
+    }
+    std::vector<std::pair<int, CSegmentIndex::Interval>> intervals(nEntries);
+    for (size_t i = 0; i < nEntries; i++) {
+        STSEntry& stse = GetAt(i);
+        RECT marginRect;
+        if (!r.ReadString(stse.str) || !r.Read(stse.fUnicode)
+                || !r.ReadString(stse.style) || !r.ReadString(stse.actor) || !r.ReadString(stse.effect)
+                || !r.Read(marginRect) || !r.Read(stse.layer) || !r.Read(stse.start) || !r.Read(stse.end)
+                || !r.Read(stse.readorder)) {
+            return false;
+        }
+        stse.marginRect = marginRect;
+        intervals[i].first = (int)i;
+        intervals[i].second.start = stse.start;
+        intervals[i].second.end = stse.end;
+    }
+
+    size_t nSegments;
+    if (!r.Read(nSegments) || nSegments > size) {
+        return false;
+    }
+    std::vector<CSegmentIndex::Interval> segments(nSegments);
+    for (auto& segment : segments) {
+        if (!r.Read(segment)) {
+            return false;
+        }
+    }
+
+    size_t nFonts;
+    if (!r.Read(nFonts) || nFonts > size) {
+        return false;
+    }
+    std::vector<std::vector<BYTE>> fonts(nFonts);
+    for (auto& font : fonts) {
+        if (!r.ReadBytes(font)) {
+            return false;
+        }
+    }
+    if (!r.IsAtEnd()) {
+        return false;
     }
 
-    return Open(&f, CharSet, name);
+    for (const auto& font : fonts) {
+        AddFont(font);
+    }
+
+    m_segments.Build(intervals, segments);
+    InvalidateSegmentCache();
+
+    return true;
 }
 
 static size_t CountLines(CTextFile* f, ULONGLONG from, ULONGLONG to, CString s = _T(""))
@@ -2638,7 +3227,22 @@ bool CSimpleTextSubtitle::Open(CTextFile* f, int CharSet, CString name)
 
     ULONGLONG pos = f->GetPosition();
 
-    for (ptrdiff_t i = 0; i < nOpenFuncts; i++) {
+    // Try the parser the content points to first, then the others in turn
+    STSOpenFunct sniffed = SniffSubtitleFormat(f);
+    if (!sniffed) {
+        s_nOpenUnknown++;
+    }
+
+    for (ptrdiff_t j = sniffed ? -1 : 0; j < nOpenFuncts; j++) {
+        ptrdiff_t i = j;
+        if (j < 0) {
+            for (i = 0; OpenFuncts[i].open != sniffed; i++) {
+                ;
+            }
+        } else if (OpenFuncts[j].open == sniffed) {
+            continue;
+        }
+
         if (!OpenFuncts[i].open(f, *this, CharSet)) {
             if (!IsEmpty()) {
                 CString lastLine;
@@ -2650,11 +3254,20 @@ bool CSimpleTextSubtitle::Open(CTextFile* f, int CharSet, CString name)
                 break;
             }
 
+            if (j < 0) {
+                TRACE(_T("CSimpleTextSubtitle: \"%s\" isn't in the guessed format, trying all of them\n"), f->GetFilePath().GetString());
+                s_nOpenMissed++;
+            }
+
             f->Seek(pos, CFile::begin);
             Empty();
             continue;
         }
 
+        if (j < 0) {
+            s_nOpenSniffed++;
+        }
+
         m_name = name;
         m_subtitleType = OpenFuncts[i].type;
         m_mode = OpenFuncts[i].mode;
@@ -2682,6 +3295,18 @@ bool CSimpleTextSubtitle::Open(CTextFile* f, int CharSet, CString name)
     return false;
 }
 
+void CSimpleTextSubtitle::GetOpenStats(STSOpenStats& stats)
+{
+    stats.nSniffed = s_nOpenSniffed;
+    stats.nMissed = s_nOpenMissed;
+    stats.nUnknown = s_nOpenUnknown;
+}
+
+void CSimpleTextSubtitle::SetParallelParsing(bool bParallel)
+{
+    s_bParallelParsing = bParallel;
+}
+
 bool CSimpleTextSubtitle::Open(CString provider, BYTE* data, int len, int CharSet, CString name, Subtitle::HearingImpairedType eHearingImpaired, LCID lcid)
 {
     bool fRet = Open(data, len, CharSet, name);
@@ -23,7 +23,9 @@
 
 #include <atlcoll.h>
 #include <array>
+#include <vector>
 #include "TextFile.h"
+#include "SegmentIndex.h"
 #include "SubtitleHelpers.h"
 
 enum tmode { TIME, FRAME }; // the meaning of STSEntry::start/end
@@ -122,15 +124,73 @@ public:
     }
 };
 
+// Where a segment lookup ended. During playback the next lookup is usually for a slightly
+// later time, it then only has to check the following segments instead of searching them
+// all. Each caller looking up times independently from the others should have its own.
+struct STSSearchCursor {
+    UINT version; // Segments the cursor is valid for, 0 if it isn't set
+    double fps;
+    int iSegment; // The last segment starting before the last time looked up, -1 if none
+    REFERENCE_TIME start, end, nextStart, nextEnd; // Translated bounds of iSegment and iSegment + 1
+
+    STSSearchCursor()
+        : version(0)
+        , fps(0.0)
+        , iSegment(-1)
+        , start(0)
+        , end(0)
+        , nextStart(0)
+        , nextEnd(0) {}
+};
+
+struct STSSearchStats {
+    ULONGLONG nLookups;
+    ULONGLONG nProbes;  // Segment bounds read and translated, nProbes / nLookups stays close to 0 during playback
+    ULONGLONG nSeeks;   // Lookups too far from the cursor, which had to search all the segments
+};
+
+// How CSimpleTextSubtitle::Open found the parser of the files it opened
+struct STSOpenStats {
+    ULONGLONG nSniffed; // The format guessed from the first lines was right
+    ULONGLONG nMissed;  // The guessed format was wrong, all the parsers were tried
+    ULONGLONG nUnknown; // Nothing could be guessed, all the parsers were tried
+};
+
 class CSimpleTextSubtitle : public CAtlArray<STSEntry>
 {
     friend class CSubtitleEditorDlg;
     friend class SubtitlesProvider;
 
 protected:
-    CAtlArray<STSSegment> m_segments;
+    CSegmentIndex m_segments;
     virtual void OnChanged() {}
 
+private:
+    // The segments last handed out by GetSegment and SearchSubs, so that their entries
+    // aren't looked up again while the renderer walks through them
+    struct CachedSegment {
+        int iSegment;
+        STSSegment segment;
+
+        CachedSegment() : iSegment(-1) {}
+    };
+    static const size_t SEGMENT_CACHE_SIZE = 8;
+    std::array<CachedSegment, SEGMENT_CACHE_SIZE> m_segmentCache;
+    size_t m_iNextCachedSegment;
+    // Incremented whenever the segments change
+    UINT m_segmentsVersion;
+    STSSearchCursor m_searchCursor;
+    STSSearchStats m_searchStats;
+
+    void InvalidateSegmentCache();
+    REFERENCE_TIME TranslateSegmentTime(REFERENCE_TIME t, double fps) const;
+    void GetCursorBounds(int i, double fps, REFERENCE_TIME& start, REFERENCE_TIME& end);
+    int FindSegment(STSSearchCursor& cursor, REFERENCE_TIME t, double fps);
+
+    // What Open needs to restore a parsed file, see CSubtitleFileCache
+    void SaveParsed(std::vector<BYTE>& data) const;
+    bool LoadParsed(const BYTE* data, size_t size);
+
 public:
     CString m_name;
     LCID m_lcid;
@@ -151,6 +211,10 @@ public:
 
     bool m_fUsingAutoGeneratedDefaultStyle;
 
+    // The decoded fonts of the [Fonts] section, installed while parsing. Open keeps them
+    // until they are stored with the parsed file so that the cache can install them again.
+    std::vector<std::vector<BYTE>> m_embeddedFonts;
+
     CSTSStyleMap m_styles;
 
     enum EPARCompensationType {
@@ -180,6 +244,10 @@ public:
     bool Open(CTextFile* f, int CharSet, CString name);
     bool Open(BYTE* data, int len, int CharSet, CString name);
     bool Open(CString provider, BYTE* data, int len, int CharSet, CString name, Subtitle::HearingImpairedType eHearingImpaired, LCID lcid);
+    static void GetOpenStats(STSOpenStats& stats);
+    // Large [Events] sections of SSA/ASS files are parsed in parallel from a memory mapping
+    // of the file. Setting this to false reads them line by line like the rest of the file.
+    static void SetParallelParsing(bool bParallel);
     bool SaveAs(CString fn, Subtitle::SubType type, double fps = -1, LONGLONG delay = 0, CTextFile::enc e = CTextFile::DEFAULT_ENCODING, bool bCreateExternalStyleFile = true);
 
     void Add(CStringW str, bool fUnicode, REFERENCE_TIME start, REFERENCE_TIME end, CString style = _T("Default"), CString actor = _T(""), CString effect = _T(""), const CRect& marginRect = CRect(0, 0, 0, 0), int layer = 0, int readorder = -1);
@@ -200,10 +268,16 @@ public:
 
     REFERENCE_TIME TranslateSegmentStart(int i, double fps);
     REFERENCE_TIME TranslateSegmentEnd(int i, double fps);
+    // The segment returned by SearchSubs has the same lifetime as the one returned by GetSegment
     const STSSegment* SearchSubs(REFERENCE_TIME t, double fps, /*[out]*/ int* iSegment = nullptr, int* nSegments = nullptr);
-    const STSSegment* GetSegment(int iSegment) {
-        return iSegment >= 0 && iSegment < (int)m_segments.GetCount() ? &m_segments[iSegment] : nullptr;
-    }
+    const STSSegment* SearchSubs(STSSearchCursor& cursor, REFERENCE_TIME t, double fps, /*[out]*/ int* iSegment = nullptr, int* nSegments = nullptr);
+    void GetSearchStats(STSSearchStats& stats) const { stats = m_searchStats; }
+    // The returned segment is owned by the cache of the last SEGMENT_CACHE_SIZE segments
+    // handed out. It stays valid until the subtitle is modified or SEGMENT_CACHE_SIZE other
+    // segments are requested through GetSegment or SearchSubs, so it must not be kept across
+    // calls which might look segments up. The cache isn't thread-safe: like everything else
+    // it must only be used by the thread holding the subtitle lock.
+    const STSSegment* GetSegment(int iSegment);
 
     STSStyle* GetStyle(int i);
     bool GetStyle(int i, STSStyle& stss);
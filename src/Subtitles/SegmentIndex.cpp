@@ -0,0 +1,343 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+#include "SegmentIndex.h"
+#include <algorithm>
+#include <climits>
+
+CSegmentIndex::CSegmentIndex()
+    : m_entryRoot(-1)
+    , m_segmentRoot(-1)
+    , m_seed(0x9e3779b9)
+{
+}
+
+void CSegmentIndex::Clear()
+{
+    m_entries.clear();
+    m_entryRoot = -1;
+    m_segments.clear();
+    m_segmentRoot = -1;
+    m_runs.clear();
+}
+
+unsigned int CSegmentIndex::NextPriority()
+{
+    // xorshift, the treaps only need the priorities to look random
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    return m_seed;
+}
+
+void CSegmentIndex::Insert(int entry, REFERENCE_TIME start, REFERENCE_TIME end)
+{
+    if (start >= end) {
+        return;
+    }
+
+    EntryNode e = { start, end, end, entry, NextPriority(), -1, -1 };
+    m_entries.push_back(e);
+    int left, right;
+    SplitEntries(m_entryRoot, start, entry, left, right);
+    m_entryRoot = MergeEntries(MergeEntries(left, int(m_entries.size()) - 1), right);
+
+    // The bounds of the entry become segment bounds
+    CutSegment(start);
+    CutSegment(end);
+
+    // and the parts it covers alone become new segments
+    auto it = m_runs.upper_bound(start);
+    if (it != m_runs.begin() && std::prev(it)->second >= start) {
+        --it;
+    }
+    REFERENCE_TIME covered = start;
+    REFERENCE_TIME runStart = start, runEnd = end;
+    while (it != m_runs.end() && it->first <= end) {
+        if (it->first > covered) {
+            AddSegment(covered, it->first);
+        }
+        covered = std::max(covered, it->second);
+        runStart = std::min(runStart, it->first);
+        runEnd = std::max(runEnd, it->second);
+        it = m_runs.erase(it);
+    }
+    if (covered < end) {
+        AddSegment(covered, end);
+    }
+    m_runs[runStart] = runEnd;
+}
+
+bool CSegmentIndex::GetBounds(size_t i, REFERENCE_TIME& start, REFERENCE_TIME& end) const
+{
+    int node = SelectSegment(i);
+    if (node < 0) {
+        return false;
+    }
+
+    start = m_segments[node].start;
+    end = m_segments[node].end;
+    return true;
+}
+
+void CSegmentIndex::GetEntries(size_t i, CAtlArray<int>& entries) const
+{
+    entries.RemoveAll();
+
+    int node = SelectSegment(i);
+    if (node >= 0) {
+        // Segments never contain an entry bound so whatever is displayed at their start lasts until their end
+        Stab(m_entryRoot, m_segments[node].start, entries);
+    }
+}
+
+void CSegmentIndex::GetSegments(std::vector<Interval>& segments) const
+{
+    segments.clear();
+    segments.reserve(m_segments.size());
+    CollectSegments(m_segmentRoot, segments);
+}
+
+void CSegmentIndex::Build(const std::vector<std::pair<int, Interval>>& entries, const std::vector<Interval>& segments)
+{
+    Clear();
+
+    m_entries.reserve(entries.size());
+    for (const auto& e : entries) {
+        if (e.second.start < e.second.end) {
+            EntryNode n = { e.second.start, e.second.end, e.second.end, e.first, 0, -1, -1 };
+            m_entries.push_back(n);
+        }
+    }
+    std::sort(m_entries.begin(), m_entries.end(), [](const EntryNode & a, const EntryNode & b) {
+        return a.start < b.start || (a.start == b.start && a.entry < b.entry);
+    });
+    m_entryRoot = BuildEntries(0, int(m_entries.size()), UINT_MAX);
+
+    m_segments.reserve(segments.size());
+    for (const auto& i : segments) {
+        SegmentNode n = { i.start, i.end, 1, 0, -1, -1 };
+        m_segments.push_back(n);
+
+        // Touching segments belong to the same run, as in Insert
+        if (!m_runs.empty() && std::prev(m_runs.end())->second >= i.start) {
+            std::prev(m_runs.end())->second = std::max(std::prev(m_runs.end())->second, i.end);
+        } else {
+            m_runs.emplace_hint(m_runs.end(), i.start, i.end);
+        }
+    }
+    m_segmentRoot = BuildSegments(0, int(m_segments.size()), UINT_MAX);
+}
+
+// Balanced trees are built from the sorted nodes, the priorities decrease with the depth
+// so that the treaps stay valid for the entries and segments inserted afterwards
+static const unsigned int BUILD_PRIORITY_STEP = 1u << 26;
+
+int CSegmentIndex::BuildEntries(int first, int last, unsigned int priority)
+{
+    if (first >= last) {
+        return -1;
+    }
+
+    int node = first + (last - first) / 2;
+    m_entries[node].priority = priority;
+    m_entries[node].left = BuildEntries(first, node, priority - BUILD_PRIORITY_STEP);
+    m_entries[node].right = BuildEntries(node + 1, last, priority - BUILD_PRIORITY_STEP);
+    UpdateEntry(node);
+    return node;
+}
+
+void CSegmentIndex::UpdateEntry(int node)
+{
+    EntryNode& n = m_entries[node];
+    n.maxEnd = n.end;
+    if (n.left >= 0) {
+        n.maxEnd = std::max(n.maxEnd, m_entries[n.left].maxEnd);
+    }
+    if (n.right >= 0) {
+        n.maxEnd = std::max(n.maxEnd, m_entries[n.right].maxEnd);
+    }
+}
+
+void CSegmentIndex::SplitEntries(int node, REFERENCE_TIME start, int entry, int& left, int& right)
+{
+    if (node < 0) {
+        left = right = -1;
+        return;
+    }
+
+    EntryNode& n = m_entries[node];
+    if (n.start < start || (n.start == start && n.entry < entry)) {
+        SplitEntries(n.right, start, entry, m_entries[node].right, right);
+        left = node;
+    } else {
+        SplitEntries(n.left, start, entry, left, m_entries[node].left);
+        right = node;
+    }
+    UpdateEntry(node);
+}
+
+int CSegmentIndex::MergeEntries(int left, int right)
+{
+    if (left < 0 || right < 0) {
+        return left >= 0 ? left : right;
+    }
+
+    if (m_entries[left].priority > m_entries[right].priority) {
+        int merged = MergeEntries(m_entries[left].right, right);
+        m_entries[left].right = merged;
+        UpdateEntry(left);
+        return left;
+    } else {
+        int merged = MergeEntries(left, m_entries[right].left);
+        m_entries[right].left = merged;
+        UpdateEntry(right);
+        return right;
+    }
+}
+
+void CSegmentIndex::Stab(int node, REFERENCE_TIME t, CAtlArray<int>& entries) const
+{
+    // The subtrees ending before t and the right subtrees of the nodes starting after t are skipped
+    while (node >= 0 && m_entries[node].maxEnd > t) {
+        const EntryNode& n = m_entries[node];
+        Stab(n.left, t, entries);
+        if (n.start > t) {
+            return;
+        }
+        if (t < n.end) {
+            entries.Add(n.entry);
+        }
+        node = n.right;
+    }
+}
+
+void CSegmentIndex::UpdateSegment(int node)
+{
+    SegmentNode& n = m_segments[node];
+    n.size = GetSize(n.left) + 1 + GetSize(n.right);
+}
+
+void CSegmentIndex::SplitSegments(int node, REFERENCE_TIME start, int& left, int& right)
+{
+    if (node < 0) {
+        left = right = -1;
+        return;
+    }
+
+    if (m_segments[node].start < start) {
+        SplitSegments(m_segments[node].right, start, m_segments[node].right, right);
+        left = node;
+    } else {
+        SplitSegments(m_segments[node].left, start, left, m_segments[node].left);
+        right = node;
+    }
+    UpdateSegment(node);
+}
+
+int CSegmentIndex::MergeSegments(int left, int right)
+{
+    if (left < 0 || right < 0) {
+        return left >= 0 ? left : right;
+    }
+
+    if (m_segments[left].priority > m_segments[right].priority) {
+        int merged = MergeSegments(m_segments[left].right, right);
+        m_segments[left].right = merged;
+        UpdateSegment(left);
+        return left;
+    } else {
+        int merged = MergeSegments(left, m_segments[right].left);
+        m_segments[right].left = merged;
+        UpdateSegment(right);
+        return right;
+    }
+}
+
+int CSegmentIndex::SelectSegment(size_t i) const
+{
+    int node = m_segmentRoot;
+    while (node >= 0) {
+        const SegmentNode& n = m_segments[node];
+        size_t leftSize = GetSize(n.left);
+        if (i < leftSize) {
+            node = n.left;
+        } else if (i == leftSize) {
+            return node;
+        } else {
+            i -= leftSize + 1;
+            node = n.right;
+        }
+    }
+    return -1;
+}
+
+void CSegmentIndex::AddSegment(REFERENCE_TIME start, REFERENCE_TIME end)
+{
+    SegmentNode s = { start, end, 1, NextPriority(), -1, -1 };
+    m_segments.push_back(s);
+    int left, right;
+    SplitSegments(m_segmentRoot, start, left, right);
+    m_segmentRoot = MergeSegments(MergeSegments(left, int(m_segments.size()) - 1), right);
+}
+
+void CSegmentIndex::CutSegment(REFERENCE_TIME t)
+{
+    ptrdiff_t i = FindLast([t](REFERENCE_TIME start) {
+        return start <= t;
+    });
+    if (i < 0) {
+        return;
+    }
+
+    int node = SelectSegment(size_t(i));
+    SegmentNode& n = m_segments[node];
+    if (n.start < t && t < n.end) {
+        REFERENCE_TIME end = n.end;
+        n.end = t;
+        AddSegment(t, end);
+    }
+}
+
+void CSegmentIndex::CollectSegments(int node, std::vector<Interval>& segments) const
+{
+    while (node >= 0) {
+        const SegmentNode& n = m_segments[node];
+        CollectSegments(n.left, segments);
+        Interval i = { n.start, n.end };
+        segments.push_back(i);
+        node = n.right;
+    }
+}
+
+int CSegmentIndex::BuildSegments(int first, int last, unsigned int priority)
+{
+    if (first >= last) {
+        return -1;
+    }
+
+    int node = first + (last - first) / 2;
+    m_segments[node].priority = priority;
+    m_segments[node].left = BuildSegments(first, node, priority - BUILD_PRIORITY_STEP);
+    m_segments[node].right = BuildSegments(node + 1, last, priority - BUILD_PRIORITY_STEP);
+    UpdateSegment(node);
+    return node;
+}
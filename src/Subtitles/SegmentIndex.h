@@ -0,0 +1,120 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <atlcoll.h>
+#include <map>
+#include <vector>
+
+// Splits the time covered by a set of entries into segments, the intervals between two
+// consecutive entry boundaries during which at least one entry is displayed.
+//
+// Only the entries and the segment bounds are stored, in two treaps: an interval tree of
+// the entries and an order statistic tree of the segments. Adding an entry and finding
+// a segment take O(log n), the entries of a segment are found with a stabbing query
+// instead of being copied in every segment they span. The memory used is O(n).
+class CSegmentIndex
+{
+public:
+    struct Interval {
+        REFERENCE_TIME start, end;
+    };
+
+    CSegmentIndex();
+
+    void Clear();
+
+    // The entry is displayed during [start, end), empty entries are ignored
+    void Insert(int entry, REFERENCE_TIME start, REFERENCE_TIME end);
+
+    size_t GetCount() const { return m_segments.size(); }
+    bool GetBounds(size_t i, REFERENCE_TIME& start, REFERENCE_TIME& end) const;
+    // The entries displayed during the i-th segment, in no particular order
+    void GetEntries(size_t i, CAtlArray<int>& entries) const;
+
+    // All the segments, in order
+    void GetSegments(std::vector<Interval>& segments) const;
+    // Same as Clear() followed by Insert() for every entry, given the segments GetSegments
+    // returned once they were inserted. Takes O(n) instead of O(n log n) and doesn't check
+    // that the segments match the entries.
+    void Build(const std::vector<std::pair<int, Interval>>& entries, const std::vector<Interval>& segments);
+
+    // The last segment whose start satisfies pred, -1 if none does. pred must be
+    // true up to some point and false afterwards, like "start <= t".
+    template<class Pred>
+    ptrdiff_t FindLast(Pred pred) const {
+        ptrdiff_t ret = -1;
+        size_t rank = 0;
+        for (int node = m_segmentRoot; node >= 0;) {
+            const SegmentNode& n = m_segments[node];
+            if (pred(n.start)) {
+                rank += GetSize(n.left) + 1;
+                ret = ptrdiff_t(rank) - 1;
+                node = n.right;
+            } else {
+                node = n.left;
+            }
+        }
+        return ret;
+    }
+
+private:
+    struct EntryNode {
+        REFERENCE_TIME start, end;
+        REFERENCE_TIME maxEnd; // Largest end in the subtree
+        int entry;
+        unsigned int priority;
+        int left, right;
+    };
+
+    struct SegmentNode {
+        REFERENCE_TIME start, end;
+        size_t size; // Nodes in the subtree
+        unsigned int priority;
+        int left, right;
+    };
+
+    std::vector<EntryNode> m_entries;
+    int m_entryRoot;
+    std::vector<SegmentNode> m_segments;
+    int m_segmentRoot;
+    // Maximal intervals covered by at least one entry, used to find the gaps an entry fills
+    std::map<REFERENCE_TIME, REFERENCE_TIME> m_runs;
+    unsigned int m_seed;
+
+    unsigned int NextPriority();
+
+    void UpdateEntry(int node);
+    void SplitEntries(int node, REFERENCE_TIME start, int entry, int& left, int& right);
+    int MergeEntries(int left, int right);
+    void Stab(int node, REFERENCE_TIME t, CAtlArray<int>& entries) const;
+    int BuildEntries(int first, int last, unsigned int priority);
+
+    size_t GetSize(int node) const { return node >= 0 ? m_segments[node].size : 0; }
+    void UpdateSegment(int node);
+    void SplitSegments(int node, REFERENCE_TIME start, int& left, int& right);
+    int MergeSegments(int left, int right);
+    int SelectSegment(size_t i) const;
+    void AddSegment(REFERENCE_TIME start, REFERENCE_TIME end);
+    void CutSegment(REFERENCE_TIME t);
+    void CollectSegments(int node, std::vector<Interval>& segments) const;
+    int BuildSegments(int first, int last, unsigned int priority);
+};
@@ -21,7 +21,16 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cmath>
+#include <immintrin.h>
+
+// AVX-512 intrinsics need at least Visual Studio 2017 15.3
+#if defined(_MSC_VER) && _MSC_VER >= 1911 || defined(__AVX512F__)
+#define SEPARABLE_FILTER_HAS_AVX512 1
+#else
+#define SEPARABLE_FILTER_HAS_AVX512 0
+#endif
 
 #define LIBDIVIDE_USE_SSE2 1
 #pragma warning(push)
@@ -114,8 +123,8 @@ void SeparableFilterY(unsigned char* src, unsigned char* dst, int width, int hei
 
 
 // Filter an image in horizontal direction with a one-dimensional filter
-void SeparableFilterX_SSE2(unsigned char* src, unsigned char* dst, int width, int height, ptrdiff_t stride,
-                           short* kernel, int kernel_size, int divisor)
+inline void SeparableFilterX_SSE2(unsigned char* src, unsigned char* dst, int width, int height, ptrdiff_t stride,
+                                  short* kernel, int kernel_size, int divisor)
 {
     int width16 = width & ~15;
     int* tmp = (int*)_aligned_malloc(stride * sizeof(int), 16);
@@ -226,8 +235,8 @@ void SeparableFilterX_SSE2(unsigned char* src, unsigned char* dst, int width, in
 
 
 // Filter an image in vertical direction with a one-dimensional filter
-void SeparableFilterY_SSE2(unsigned char* src, unsigned char* dst, int width, int height, ptrdiff_t stride,
-                           short* kernel, int kernel_size, int divisor)
+inline void SeparableFilterY_SSE2(unsigned char* src, unsigned char* dst, int width, int height, ptrdiff_t stride,
+                                  short* kernel, int kernel_size, int divisor)
 {
     int width16 = width & ~15;
     int* tmp = (int*)_aligned_malloc(stride * sizeof(int), 16);
@@ -332,6 +341,205 @@ void SeparableFilterY_SSE2(unsigned char* src, unsigned char* dst, int width, in
 }
 
 
+// The AVX2 and AVX-512 versions below compute each output pixel directly instead
+// of accumulating every tap into a temporary row. The results are identical to the
+// SSE2 and C versions: every coefficient is positive, so the integer sums can be
+// divided in single precision without rounding errors as long as the divisor is
+// smaller than 2^16 (see SeparableFilterUseFloatDivision).
+static inline bool SeparableFilterUseFloatDivision(int divisor)
+{
+    return divisor > 0 && divisor < 0x10000;
+}
+
+// Compute one pixel of the horizontal filter, skipping the taps outside the image
+static inline unsigned char SeparableFilterPixelX(const unsigned char* in, int x, int width,
+                                                  const short* kernel, int kernel_size, int divisor)
+{
+    int kOffset = kernel_size / 2;
+    int kStart = std::max(0, kOffset - x);
+    int kEnd = std::min(kernel_size, width - x + kOffset);
+    int accum = 0;
+    for (int k = kStart; k < kEnd; k++) {
+        accum += in[x + k - kOffset] * kernel[k];
+    }
+    return (unsigned char)std::min(std::max(accum / divisor, 0), 255);
+}
+
+// Filter an image in horizontal direction with a one-dimensional filter
+inline void SeparableFilterX_AVX2(unsigned char* src, unsigned char* dst, int width, int height, ptrdiff_t stride,
+                                  short* kernel, int kernel_size, int divisor)
+{
+    const int kOffset = kernel_size / 2;
+    // Only the pixels whose taps are all inside the image are vectorized
+    const int xStart = std::min(kOffset, width);
+    const int xEnd = std::max(xStart, width - kOffset);
+    const __m256 divisorPS = _mm256_set1_ps((float)divisor);
+    const __m256i permute = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    for (int y = 0; y < height; y++) {
+        const unsigned char* in = src + y * stride;
+        unsigned char* out = dst + y * stride;
+
+        int x = 0;
+        for (; x < xStart; x++) {
+            out[x] = SeparableFilterPixelX(in, x, width, kernel, kernel_size, divisor);
+        }
+        for (; x + 16 <= xEnd; x += 16) {
+            __m256i accumLo = _mm256_setzero_si256();
+            __m256i accumHi = _mm256_setzero_si256();
+            for (int k = 0; k < kernel_size; k++) {
+                // The coefficient only occupies the low 16 bits of each 32-bit lane so
+                // a single madd gives the 32-bit product of the zero-extended pixels
+                __m256i coeff = _mm256_set1_epi32(kernel[k]);
+                __m128i data16 = _mm_loadu_si128((const __m128i*)&in[x + k - kOffset]);
+                accumLo = _mm256_add_epi32(accumLo, _mm256_madd_epi16(_mm256_cvtepu8_epi32(data16), coeff));
+                accumHi = _mm256_add_epi32(accumHi, _mm256_madd_epi16(_mm256_cvtepu8_epi32(_mm_srli_si128(data16, 8)), coeff));
+            }
+            accumLo = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(accumLo), divisorPS));
+            accumHi = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(accumHi), divisorPS));
+
+            // Pack the 16 32-bit integers into 16 8-bit unsigned integers and undo the lane interleaving
+            __m256i res = _mm256_packs_epi32(accumLo, accumHi);
+            res = _mm256_packus_epi16(res, res);
+            res = _mm256_permutevar8x32_epi32(res, permute);
+            _mm_storeu_si128((__m128i*)&out[x], _mm256_castsi256_si128(res));
+        }
+        for (; x < width; x++) {
+            out[x] = SeparableFilterPixelX(in, x, width, kernel, kernel_size, divisor);
+        }
+    }
+}
+
+
+// Filter an image in vertical direction with a one-dimensional filter
+inline void SeparableFilterY_AVX2(unsigned char* src, unsigned char* dst, int width, int height, ptrdiff_t stride,
+                                  short* kernel, int kernel_size, int divisor)
+{
+    const int kOffset = kernel_size / 2;
+    const __m256 divisorPS = _mm256_set1_ps((float)divisor);
+    const __m256i permute = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    for (int y = 0; y < height; y++) {
+        const unsigned char* in = src + y * stride;
+        unsigned char* out = dst + y * stride;
+
+        int kStart = std::max(0, kOffset - y);
+        int kEnd = std::min(kernel_size, height - y + kOffset);
+
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            __m256i accumLo = _mm256_setzero_si256();
+            __m256i accumHi = _mm256_setzero_si256();
+            for (int k = kStart; k < kEnd; k++) {
+                __m256i coeff = _mm256_set1_epi32(kernel[k]);
+                __m128i data16 = _mm_loadu_si128((const __m128i*)&in[(k - kOffset) * stride + x]);
+                accumLo = _mm256_add_epi32(accumLo, _mm256_madd_epi16(_mm256_cvtepu8_epi32(data16), coeff));
+                accumHi = _mm256_add_epi32(accumHi, _mm256_madd_epi16(_mm256_cvtepu8_epi32(_mm_srli_si128(data16, 8)), coeff));
+            }
+            accumLo = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(accumLo), divisorPS));
+            accumHi = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(accumHi), divisorPS));
+
+            __m256i res = _mm256_packs_epi32(accumLo, accumHi);
+            res = _mm256_packus_epi16(res, res);
+            res = _mm256_permutevar8x32_epi32(res, permute);
+            _mm_storeu_si128((__m128i*)&out[x], _mm256_castsi256_si128(res));
+        }
+        for (; x < width; x++) {
+            int accum = 0;
+            for (int k = kStart; k < kEnd; k++) {
+                accum += in[(k - kOffset) * stride + x] * kernel[k];
+            }
+            out[x] = (unsigned char)std::min(std::max(accum / divisor, 0), 255);
+        }
+    }
+}
+
+
+#if SEPARABLE_FILTER_HAS_AVX512
+// Filter an image in horizontal direction with a one-dimensional filter.
+// Only AVX-512F instructions are used.
+inline void SeparableFilterX_AVX512(unsigned char* src, unsigned char* dst, int width, int height, ptrdiff_t stride,
+                                    short* kernel, int kernel_size, int divisor)
+{
+    const int kOffset = kernel_size / 2;
+    const int xStart = std::min(kOffset, width);
+    const int xEnd = std::max(xStart, width - kOffset);
+    const __m512 divisorPS = _mm512_set1_ps((float)divisor);
+
+    for (int y = 0; y < height; y++) {
+        const unsigned char* in = src + y * stride;
+        unsigned char* out = dst + y * stride;
+
+        int x = 0;
+        for (; x < xStart; x++) {
+            out[x] = SeparableFilterPixelX(in, x, width, kernel, kernel_size, divisor);
+        }
+        for (; x + 32 <= xEnd; x += 32) {
+            __m512i accumLo = _mm512_setzero_si512();
+            __m512i accumHi = _mm512_setzero_si512();
+            for (int k = 0; k < kernel_size; k++) {
+                __m512i coeff = _mm512_set1_epi32(kernel[k]);
+                const unsigned char* p = &in[x + k - kOffset];
+                accumLo = _mm512_add_epi32(accumLo, _mm512_mullo_epi32(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)p)), coeff));
+                accumHi = _mm512_add_epi32(accumHi, _mm512_mullo_epi32(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(p + 16))), coeff));
+            }
+            accumLo = _mm512_cvttps_epi32(_mm512_div_ps(_mm512_cvtepi32_ps(accumLo), divisorPS));
+            accumHi = _mm512_cvttps_epi32(_mm512_div_ps(_mm512_cvtepi32_ps(accumHi), divisorPS));
+
+            // Narrow the 32-bit integers to 8-bit with unsigned saturation
+            _mm_storeu_si128((__m128i*)&out[x], _mm512_cvtusepi32_epi8(accumLo));
+            _mm_storeu_si128((__m128i*)&out[x + 16], _mm512_cvtusepi32_epi8(accumHi));
+        }
+        for (; x < width; x++) {
+            out[x] = SeparableFilterPixelX(in, x, width, kernel, kernel_size, divisor);
+        }
+    }
+}
+
+
+// Filter an image in vertical direction with a one-dimensional filter.
+// Only AVX-512F instructions are used.
+inline void SeparableFilterY_AVX512(unsigned char* src, unsigned char* dst, int width, int height, ptrdiff_t stride,
+                                    short* kernel, int kernel_size, int divisor)
+{
+    const int kOffset = kernel_size / 2;
+    const __m512 divisorPS = _mm512_set1_ps((float)divisor);
+
+    for (int y = 0; y < height; y++) {
+        const unsigned char* in = src + y * stride;
+        unsigned char* out = dst + y * stride;
+
+        int kStart = std::max(0, kOffset - y);
+        int kEnd = std::min(kernel_size, height - y + kOffset);
+
+        int x = 0;
+        for (; x + 32 <= width; x += 32) {
+            __m512i accumLo = _mm512_setzero_si512();
+            __m512i accumHi = _mm512_setzero_si512();
+            for (int k = kStart; k < kEnd; k++) {
+                __m512i coeff = _mm512_set1_epi32(kernel[k]);
+                const unsigned char* p = &in[(k - kOffset) * stride + x];
+                accumLo = _mm512_add_epi32(accumLo, _mm512_mullo_epi32(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)p)), coeff));
+                accumHi = _mm512_add_epi32(accumHi, _mm512_mullo_epi32(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(p + 16))), coeff));
+            }
+            accumLo = _mm512_cvttps_epi32(_mm512_div_ps(_mm512_cvtepi32_ps(accumLo), divisorPS));
+            accumHi = _mm512_cvttps_epi32(_mm512_div_ps(_mm512_cvtepi32_ps(accumHi), divisorPS));
+
+            _mm_storeu_si128((__m128i*)&out[x], _mm512_cvtusepi32_epi8(accumLo));
+            _mm_storeu_si128((__m128i*)&out[x + 16], _mm512_cvtusepi32_epi8(accumHi));
+        }
+        for (; x < width; x++) {
+            int accum = 0;
+            for (int k = kStart; k < kEnd; k++) {
+                accum += in[(k - kOffset) * stride + x] * kernel[k];
+            }
+            out[x] = (unsigned char)std::min(std::max(accum / divisor, 0), 255);
+        }
+    }
+}
+#endif
+
+
 
 static inline double NormalDist(double sigma, double x)
 {
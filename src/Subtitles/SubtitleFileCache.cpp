@@ -0,0 +1,462 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+#include "SubtitleFileCache.h"
+#include <atomic>
+#include <mutex>
+#include <cstddef>
+#include <shlobj.h>
+#include "../DSUtil/PathUtils.h"
+
+namespace
+{
+    const DWORD CACHE_MAGIC = 'CSTS';
+    // Increment whenever the header or what CSimpleTextSubtitle stores changes
+    const DWORD CACHE_VERSION = 2;
+    const LPCTSTR CACHE_EXT = _T(".stc");
+
+    // Smaller files are parsed about as fast as their cached data is checked
+    const ULONGLONG MIN_FILE_SIZE = 256 * 1024;
+    const ULONGLONG DEFAULT_MAX_SIZE = 256 * 1024 * 1024;
+
+    // Files are hashed a view at a time so that large ones fit in a 32-bit address space
+    const ULONGLONG HASH_VIEW_SIZE = 64 * 1024 * 1024;
+
+    std::mutex s_settingsMutex;
+    CString s_directory;
+    ULONGLONG s_maxSize = DEFAULT_MAX_SIZE;
+
+    std::atomic<ULONGLONG> s_nHits(0), s_nMisses(0), s_nInvalidated(0), s_nEvicted(0);
+
+    // Not a cryptographic hash, it only has to notice that a file changed
+    ULONGLONG HashBytes(const BYTE* p, size_t len, ULONGLONG h)
+    {
+        const ULONGLONG k1 = 0x9e3779b97f4a7c15ull, k2 = 0xc2b2ae3d27d4eb4full;
+
+        for (; len >= 8; p += 8, len -= 8) {
+            ULONGLONG w;
+            memcpy(&w, p, sizeof(w));
+            h = _rotl64(h ^ (w * k1), 31) * k2;
+        }
+        for (; len > 0; p++, len--) {
+            h = (h ^ *p) * k1;
+        }
+
+        return h;
+    }
+
+    ULONGLONG FinalizeHash(ULONGLONG h, ULONGLONG len)
+    {
+        h ^= len;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+}
+
+CSubtitleFileCache::CSubtitleFileCache()
+    : m_charSet(0)
+    , m_hFile(INVALID_HANDLE_VALUE)
+    , m_hMapping(nullptr)
+    , m_pView(nullptr)
+    , m_pData(nullptr)
+    , m_size(0)
+    , m_bRestamp(false)
+{
+    ZeroMemory(&m_file, sizeof(m_file));
+    ZeroMemory(&m_styleFile, sizeof(m_styleFile));
+}
+
+CSubtitleFileCache::~CSubtitleFileCache()
+{
+    Close();
+}
+
+void CSubtitleFileCache::SetDirectory(LPCTSTR path)
+{
+    std::lock_guard<std::mutex> lock(s_settingsMutex);
+    s_directory = path;
+}
+
+CString CSubtitleFileCache::GetDirectory()
+{
+    std::lock_guard<std::mutex> lock(s_settingsMutex);
+    return s_directory;
+}
+
+CString CSubtitleFileCache::GetDefaultDirectory()
+{
+    CString path;
+    HRESULT hr = SHGetFolderPath(nullptr, CSIDL_LOCAL_APPDATA, nullptr, 0, path.GetBuffer(MAX_PATH));
+    path.ReleaseBuffer();
+    if (FAILED(hr)) {
+        return _T("");
+    }
+    return PathUtils::CombinePaths(path, _T("MPC-HC\\SubtitleCache"));
+}
+
+void CSubtitleFileCache::SetMaxSize(ULONGLONG maxSize)
+{
+    std::lock_guard<std::mutex> lock(s_settingsMutex);
+    s_maxSize = maxSize;
+}
+
+ULONGLONG CSubtitleFileCache::GetMaxSize()
+{
+    std::lock_guard<std::mutex> lock(s_settingsMutex);
+    return s_maxSize;
+}
+
+void CSubtitleFileCache::GetStats(CSubtitleFileCacheStats& stats)
+{
+    stats.nHits = s_nHits;
+    stats.nMisses = s_nMisses;
+    stats.nInvalidated = s_nInvalidated;
+    stats.nEvicted = s_nEvicted;
+}
+
+bool CSubtitleFileCache::GetStamp(LPCTSTR fn, FileStamp& stamp)
+{
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (!GetFileAttributesEx(fn, GetFileExInfoStandard, &fad) || (fad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        return false;
+    }
+
+    stamp.size = (ULONGLONG(fad.nFileSizeHigh) << 32) | fad.nFileSizeLow;
+    stamp.mtime = (ULONGLONG(fad.ftLastWriteTime.dwHighDateTime) << 32) | fad.ftLastWriteTime.dwLowDateTime;
+    stamp.hash = 0;
+    return true;
+}
+
+bool CSubtitleFileCache::HashFile(LPCTSTR fn, ULONGLONG size, ULONGLONG& hash)
+{
+    hash = 0;
+    if (size == 0) {
+        hash = FinalizeHash(hash, 0);
+        return true;
+    }
+
+    HANDLE hFile = CreateFile(fn, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    bool bRet = false;
+    HANDLE hMapping = CreateFileMapping(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (hMapping) {
+        ULONGLONG offset = 0;
+        for (; offset < size; offset += HASH_VIEW_SIZE) {
+            size_t len = size_t(std::min(HASH_VIEW_SIZE, size - offset));
+            const BYTE* pView = (const BYTE*)MapViewOfFile(hMapping, FILE_MAP_READ, DWORD(offset >> 32), DWORD(offset), len);
+            if (!pView) {
+                break;
+            }
+            hash = HashBytes(pView, len, hash);
+            UnmapViewOfFile(pView);
+        }
+        bRet = offset >= size;
+        hash = FinalizeHash(hash, size);
+        CloseHandle(hMapping);
+    }
+    CloseHandle(hFile);
+
+    return bRet;
+}
+
+bool CSubtitleFileCache::IsUnchanged(LPCTSTR fn, FileStamp& stamp, const FileStamp& stored)
+{
+    // A missing .style file has a zeroed stamp, it must still be missing
+    if (stamp.size != stored.size || !stamp.mtime != !stored.mtime) {
+        return false;
+    }
+    if (stamp.mtime == stored.mtime) {
+        stamp.hash = stored.hash;
+        return true;
+    }
+    // Touched or copied back without changing size, only the content can tell
+    return HashFile(fn, stamp.size, stamp.hash) && stamp.hash == stored.hash;
+}
+
+bool CSubtitleFileCache::Lookup(LPCTSTR fn, int CharSet)
+{
+    Close();
+    m_cacheFile.Empty();
+
+    CString dir = GetDirectory();
+    if (dir.IsEmpty()) {
+        return false;
+    }
+
+    DWORD len = GetFullPathName(fn, 0, nullptr, nullptr);
+    if (!len || !GetFullPathName(fn, len, m_fn.GetBuffer(len), nullptr)) {
+        m_fn.ReleaseBuffer(0);
+        return false;
+    }
+    m_fn.ReleaseBuffer();
+    m_styleFn = m_fn + _T(".style");
+    m_charSet = CharSet;
+
+    if (!GetStamp(m_fn, m_file) || m_file.size < MIN_FILE_SIZE) {
+        return false;
+    }
+    if (!GetStamp(m_styleFn, m_styleFile)) {
+        ZeroMemory(&m_styleFile, sizeof(m_styleFile));
+    }
+
+    CString key = m_fn;
+    key.MakeLower();
+    ULONGLONG hash = FinalizeHash(HashBytes((const BYTE*)key.GetString(), key.GetLength() * sizeof(TCHAR), ULONGLONG(CharSet)), key.GetLength());
+    CString name;
+    name.Format(_T("%016I64x%s"), hash, CACHE_EXT);
+    m_cacheFile = PathUtils::CombinePaths(dir, name);
+
+    if (Map()) {
+        s_nHits++;
+        return true;
+    }
+
+    s_nMisses++;
+    return false;
+}
+
+bool CSubtitleFileCache::Map()
+{
+    m_hFile = CreateFile(m_cacheFile, GENERIC_READ | FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_DELETE,
+                         nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    bool bValid = false;
+    if (GetFileSizeEx(m_hFile, &fileSize) && ULONGLONG(fileSize.QuadPart) > sizeof(Header)
+            && ULONGLONG(fileSize.QuadPart) <= SIZE_MAX) {
+        m_hMapping = CreateFileMapping(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_hMapping) {
+            m_pView = (const BYTE*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+        }
+    }
+
+    if (m_pView) {
+        Header header;
+        memcpy(&header, m_pView, sizeof(header));
+
+        if (header.magic == CACHE_MAGIC && header.version == CACHE_VERSION && header.charSet == m_charSet
+                && header.dataSize == ULONGLONG(fileSize.QuadPart) - sizeof(Header)) {
+            m_pData = m_pView + sizeof(Header);
+            m_size = size_t(header.dataSize);
+
+            // The checksum of the cached data itself guards against a corrupted cache
+            bValid = FinalizeHash(HashBytes(m_pData, m_size, 0), m_size) == header.dataHash
+                     && IsUnchanged(m_fn, m_file, header.file)
+                     && IsUnchanged(m_styleFn, m_styleFile, header.styleFile);
+            m_bRestamp = bValid && (m_file.mtime != header.file.mtime || m_styleFile.mtime != header.styleFile.mtime);
+        }
+    }
+
+    if (!bValid) {
+        Close();
+        if (DeleteFile(m_cacheFile)) {
+            TRACE(_T("CSubtitleFileCache: dropped the outdated cache of \"%s\"\n"), m_fn.GetString());
+            s_nInvalidated++;
+        }
+        return false;
+    }
+
+    // The modification time of the cached files tells which ones were used last
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    SetFileTime(m_hFile, nullptr, nullptr, &now);
+
+    return true;
+}
+
+void CSubtitleFileCache::Close()
+{
+    if (m_pView) {
+        UnmapViewOfFile(m_pView);
+        m_pView = nullptr;
+    }
+    if (m_hMapping) {
+        CloseHandle(m_hMapping);
+        m_hMapping = nullptr;
+    }
+    if (m_hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+    m_pData = nullptr;
+    m_size = 0;
+
+    if (m_bRestamp) {
+        m_bRestamp = false;
+        Restamp();
+    }
+}
+
+void CSubtitleFileCache::Restamp()
+{
+    static_assert(offsetof(Header, styleFile) == offsetof(Header, file) + sizeof(FileStamp),
+                  "the stamps are written at once");
+
+    // Record the new modification times so that the next hit doesn't hash the files again.
+    // This fails while another player has the file mapped, a later hit will try again.
+    HANDLE hFile = CreateFile(m_cacheFile, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    const FileStamp stamps[] = { m_file, m_styleFile };
+    OVERLAPPED ov;
+    ZeroMemory(&ov, sizeof(ov));
+    ov.Offset = offsetof(Header, file);
+    DWORD written;
+    WriteFile(hFile, stamps, sizeof(stamps), &written, &ov);
+    CloseHandle(hFile);
+}
+
+bool CSubtitleFileCache::Store(const std::vector<BYTE>& data)
+{
+    if (!CanStore()) {
+        return false;
+    }
+
+    ULONGLONG maxSize = GetMaxSize();
+    // CFile::Write can't write 4 GB or more at once
+    if (data.size() > UINT_MAX || sizeof(Header) + data.size() > maxSize) {
+        return false;
+    }
+
+    // The file may have changed while it was parsed
+    FileStamp file, styleFile;
+    if (!GetStamp(m_fn, file) || file.size != m_file.size || file.mtime != m_file.mtime) {
+        return false;
+    }
+    if (!GetStamp(m_styleFn, styleFile)) {
+        ZeroMemory(&styleFile, sizeof(styleFile));
+    }
+    if (styleFile.size != m_styleFile.size || styleFile.mtime != m_styleFile.mtime) {
+        return false;
+    }
+
+    Header header;
+    ZeroMemory(&header, sizeof(header));
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+    header.charSet = m_charSet;
+    header.file = m_file;
+    header.styleFile = m_styleFile;
+    header.dataSize = data.size();
+    header.dataHash = FinalizeHash(HashBytes(data.data(), data.size(), 0), data.size());
+    if (!HashFile(m_fn, m_file.size, header.file.hash)
+            || (m_styleFile.mtime && !HashFile(m_styleFn, m_styleFile.size, header.styleFile.hash))) {
+        return false;
+    }
+
+    CString dir = PathUtils::DirName(m_cacheFile);
+    if (!PathUtils::IsDir(dir) && !PathUtils::CreateDirRecursive(dir)) {
+        return false;
+    }
+
+    // Written aside then renamed so that other processes never see a partial file
+    CString tmp;
+    tmp.Format(_T("%s.%lu.tmp"), m_cacheFile.GetString(), GetCurrentThreadId());
+
+    CFile f;
+    if (!f.Open(tmp, CFile::modeCreate | CFile::modeWrite | CFile::shareDenyWrite)) {
+        return false;
+    }
+
+    try {
+        f.Write(&header, sizeof(header));
+        if (!data.empty()) {
+            f.Write(data.data(), UINT(data.size()));
+        }
+        f.Close();
+    } catch (CFileException* e) {
+        e->Delete();
+        f.Abort();
+        DeleteFile(tmp);
+        return false;
+    }
+
+    if (!MoveFileEx(tmp, m_cacheFile, MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFile(tmp);
+        return false;
+    }
+
+    Trim(dir, maxSize);
+
+    return true;
+}
+
+void CSubtitleFileCache::Trim(const CString& dir, ULONGLONG maxSize)
+{
+    struct CachedFile {
+        CString name;
+        ULONGLONG size;
+        ULONGLONG mtime;
+    };
+
+    std::vector<CachedFile> files;
+    ULONGLONG totalSize = 0;
+
+    WIN32_FIND_DATA fd;
+    HANDLE hFind = FindFirstFile(PathUtils::CombinePaths(dir, CString(_T("*")) + CACHE_EXT), &fd);
+    if (hFind == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    do {
+        if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            CachedFile file;
+            file.name = fd.cFileName;
+            file.size = (ULONGLONG(fd.nFileSizeHigh) << 32) | fd.nFileSizeLow;
+            file.mtime = (ULONGLONG(fd.ftLastWriteTime.dwHighDateTime) << 32) | fd.ftLastWriteTime.dwLowDateTime;
+            files.push_back(file);
+            totalSize += file.size;
+        }
+    } while (FindNextFile(hFind, &fd));
+    FindClose(hFind);
+
+    if (totalSize <= maxSize) {
+        return;
+    }
+
+    std::sort(files.begin(), files.end(), [](const CachedFile & a, const CachedFile & b) {
+        return a.mtime < b.mtime;
+    });
+
+    for (const auto& file : files) {
+        if (totalSize <= maxSize) {
+            break;
+        }
+        // Files mapped by another player can't be deleted, they are older ones' turn then
+        if (DeleteFile(PathUtils::CombinePaths(dir, file.name))) {
+            totalSize -= file.size;
+            s_nEvicted++;
+        }
+    }
+}
@@ -0,0 +1,105 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <vector>
+
+struct CSubtitleFileCacheStats {
+    ULONGLONG nHits;
+    ULONGLONG nMisses;
+    ULONGLONG nInvalidated; // Cached files dropped because the subtitle or its .style file changed
+    ULONGLONG nEvicted;     // Cached files dropped to stay under the size limit
+};
+
+// An on-disk cache of parsed subtitle files, so that large files aren't parsed again
+// every time they are opened. What is cached is up to the caller, the cache only
+// takes care of storing it and of checking that it is still valid: a cached file is
+// used as long as the size and the modification time of the subtitle file and of its
+// .style side file didn't change. The files are hashed only when a modification time
+// changed but not the size, so that touching a file doesn't drop its cache. The cached
+// files are memory mapped when read and the least recently used ones are removed once
+// the cache grows past its size limit. Several processes can share the same cache.
+// The cache is disabled until a directory is set.
+class CSubtitleFileCache
+{
+public:
+    CSubtitleFileCache();
+    ~CSubtitleFileCache();
+
+    CSubtitleFileCache(const CSubtitleFileCache&) = delete;
+    CSubtitleFileCache& operator=(const CSubtitleFileCache&) = delete;
+
+    // Where the cached files are kept, an empty path disables the cache
+    static void SetDirectory(LPCTSTR path);
+    static CString GetDirectory();
+    // "MPC-HC\SubtitleCache" in the local application data folder
+    static CString GetDefaultDirectory();
+    static void SetMaxSize(ULONGLONG maxSize);
+    static ULONGLONG GetMaxSize();
+    static void GetStats(CSubtitleFileCacheStats& stats);
+
+    // Look up what was stored for the file fn parsed with CharSet. On success the data
+    // stays mapped until Close() is called, otherwise Store() can be called once the file
+    // is parsed. Files too small to be worth caching are never found nor stored.
+    bool Lookup(LPCTSTR fn, int CharSet);
+    const BYTE* GetData() const { return m_pData; }
+    size_t GetSize() const { return m_size; }
+    void Close();
+
+    bool CanStore() const { return !m_cacheFile.IsEmpty() && !m_pView; }
+    bool Store(const std::vector<BYTE>& data);
+
+private:
+    struct FileStamp {
+        ULONGLONG size;
+        ULONGLONG mtime;
+        ULONGLONG hash; // Only computed when needed
+    };
+
+    struct Header {
+        DWORD magic;
+        DWORD version;
+        int charSet;
+        DWORD reserved;
+        FileStamp file, styleFile; // styleFile is zeroed when there is no .style file
+        ULONGLONG dataSize;
+        ULONGLONG dataHash;
+    };
+
+    CString m_fn, m_styleFn;
+    int m_charSet;
+    FileStamp m_file, m_styleFile;
+    CString m_cacheFile;
+
+    HANDLE m_hFile;
+    HANDLE m_hMapping;
+    const BYTE* m_pView;
+    const BYTE* m_pData;
+    size_t m_size;
+    bool m_bRestamp;
+
+    static bool GetStamp(LPCTSTR fn, FileStamp& stamp);
+    static bool HashFile(LPCTSTR fn, ULONGLONG size, ULONGLONG& hash);
+    static bool IsUnchanged(LPCTSTR fn, FileStamp& stamp, const FileStamp& stored);
+    bool Map();
+    void Restamp();
+    static void Trim(const CString& dir, ULONGLONG maxSize);
+};
@@ -180,6 +180,10 @@ HRESULT CSubtitleInputPin::BreakConnect()
     InvalidateSamples();
 
     RemoveSubStream(m_pSubStream);
+    // The look ahead would outlive m_pSubLock if the filter goes away next
+    if (CComQIPtr<IRenderingCacheStats> pCacheStats = m_pSubStream) {
+        pCacheStats->StopLookAhead();
+    }
     m_pSubStream = nullptr;
 
     ASSERT(IsStopped());
@@ -193,6 +197,9 @@ STDMETHODIMP CSubtitleInputPin::ReceiveConnection(IPin* pConnector, const AM_MED
         InvalidateSamples();
 
         RemoveSubStream(m_pSubStream);
+        if (CComQIPtr<IRenderingCacheStats> pCacheStats = m_pSubStream) {
+            pCacheStats->StopLookAhead();
+        }
         m_pSubStream = nullptr;
 
         m_Connected->Release();
@@ -23,11 +23,98 @@
 #include <atlbase.h>
 #include <afxinet.h>
 #include <algorithm>
+#include <emmintrin.h>
 #include "TextFile.h"
 #include "Utf8.h"
 
 #define TEXTFILE_BUFFER_SIZE (64 * 1024)
 
+// The lines are split and plain ASCII is decoded 16 bytes at a time, the scalar code
+// only takes over at the characters which need more care: line breaks and non-ASCII.
+
+// Index of the first '\r' or '\n', len if there is none
+static size_t FindLineBreak(const char* buf, size_t len)
+{
+    const __m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n');
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)&buf[i]);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+        if (mask) {
+            unsigned long first;
+            _BitScanForward(&first, mask);
+            return i + first;
+        }
+    }
+    for (; i < len && buf[i] != '\r' && buf[i] != '\n'; i++) {
+        ;
+    }
+    return i;
+}
+
+static size_t FindLineBreak(const WCHAR* buf, size_t len)
+{
+    const __m128i cr = _mm_set1_epi16(L'\r'), lf = _mm_set1_epi16(L'\n');
+
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)&buf[i]);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi16(v, cr), _mm_cmpeq_epi16(v, lf)));
+        if (mask) {
+            unsigned long first;
+            _BitScanForward(&first, mask);
+            return i + first / sizeof(WCHAR);
+        }
+    }
+    for (; i < len && buf[i] != L'\r' && buf[i] != L'\n'; i++) {
+        ;
+    }
+    return i;
+}
+
+// Decode the ASCII characters other than '\r' and '\n' at the start of src, in whole blocks only,
+// and return how many there were. dst must have room for as many characters as src has bytes.
+static size_t DecodeAsciiRun(const char* src, size_t len, WCHAR* dst)
+{
+    const __m128i zero = _mm_setzero_si128(), cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n');
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)&src[i]);
+        _mm_storeu_si128((__m128i*)&dst[i], _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128((__m128i*)&dst[i + 8], _mm_unpackhi_epi8(v, zero));
+        // The sign bit is set for non-ASCII bytes and line breaks
+        int mask = _mm_movemask_epi8(_mm_or_si128(v, _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf))));
+        if (mask) {
+            unsigned long first;
+            _BitScanForward(&first, mask);
+            return i + first;
+        }
+    }
+    return i;
+}
+
+// Same for big-endian UTF-16, len is in characters
+static size_t DecodeBE16Run(const char* src, size_t len, WCHAR* dst)
+{
+    const __m128i cr = _mm_set1_epi16(L'\r'), lf = _mm_set1_epi16(L'\n');
+
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)&src[i * sizeof(WCHAR)]);
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i*)&dst[i], v);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi16(v, cr), _mm_cmpeq_epi16(v, lf)));
+        if (mask) {
+            unsigned long first;
+            _BitScanForward(&first, mask);
+            return i + first / sizeof(WCHAR);
+        }
+    }
+    return i;
+}
+
 CTextFile::CTextFile(enc e)
     : m_encoding(e)
     , m_defaultencoding(e)
@@ -124,7 +211,7 @@ void CTextFile::SetEncoding(enc e)
     m_encoding = e;
 }
 
-CTextFile::enc CTextFile::GetEncoding()
+CTextFile::enc CTextFile::GetEncoding() const
 {
     return m_encoding;
 }
@@ -307,13 +394,7 @@ BOOL CTextFile::ReadString(CStringA& str)
         do {
             int nCharsRead;
 
-            for (nCharsRead = 0; m_posInBuffer + nCharsRead < m_nInBuffer; nCharsRead++) {
-                if (m_buffer[m_posInBuffer + nCharsRead] == '\n') {
-                    break;
-                } else if (m_buffer[m_posInBuffer + nCharsRead] == '\r') {
-                    break;
-                }
-            }
+            nCharsRead = (int)FindLineBreak(&m_buffer[m_posInBuffer], size_t(m_nInBuffer - m_posInBuffer));
 
             str.Append(&m_buffer[m_posInBuffer], nCharsRead);
 
@@ -523,13 +604,7 @@ BOOL CTextFile::ReadString(CStringW& str)
         do {
             int nCharsRead;
 
-            for (nCharsRead = 0; m_posInBuffer + nCharsRead < m_nInBuffer; nCharsRead++) {
-                if (m_buffer[m_posInBuffer + nCharsRead] == '\n') {
-                    break;
-                } else if (m_buffer[m_posInBuffer + nCharsRead] == '\r') {
-                    break;
-                }
-            }
+            nCharsRead = (int)FindLineBreak(&m_buffer[m_posInBuffer], size_t(m_nInBuffer - m_posInBuffer));
 
             // TODO: codepage
             str.Append(CStringW(&m_buffer[m_posInBuffer], nCharsRead));
@@ -560,6 +635,15 @@ BOOL CTextFile::ReadString(CStringW& str)
             int nCharsRead;
 
             for (nCharsRead = 0; m_posInBuffer < m_nInBuffer; m_posInBuffer++, nCharsRead++) {
+                size_t nAscii = DecodeAsciiRun(&m_buffer[m_posInBuffer], size_t(m_nInBuffer - m_posInBuffer), &m_wbuffer[nCharsRead]);
+                if (nAscii) {
+                    m_posInBuffer += nAscii;
+                    nCharsRead += (int)nAscii;
+                    if (m_posInBuffer >= m_nInBuffer) {
+                        break;
+                    }
+                }
+
                 if (Utf8::isSingleByte(m_buffer[m_posInBuffer])) { // 0xxxxxxx
                     m_wbuffer[nCharsRead] = m_buffer[m_posInBuffer] & 0x7f;
                 } else if (Utf8::isFirstOfMultibyte(m_buffer[m_posInBuffer])) {
@@ -645,13 +729,9 @@ BOOL CTextFile::ReadString(CStringW& str)
             int nCharsRead;
             WCHAR* wbuffer = (WCHAR*)&m_buffer[m_posInBuffer];
 
-            for (nCharsRead = 0; m_posInBuffer + 1 < m_nInBuffer; nCharsRead++, m_posInBuffer += sizeof(WCHAR)) {
-                if (wbuffer[nCharsRead] == L'\n') {
-                    break; // Stop at end of line
-                } else if (wbuffer[nCharsRead] == L'\r') {
-                    break; // Skip \r
-                }
-            }
+            // Stop at end of line, \r is skipped below
+            nCharsRead = (int)FindLineBreak(wbuffer, size_t(m_nInBuffer - m_posInBuffer) / sizeof(WCHAR));
+            m_posInBuffer += nCharsRead * sizeof(WCHAR);
 
             str.Append(wbuffer, nCharsRead);
 
@@ -680,6 +760,15 @@ BOOL CTextFile::ReadString(CStringW& str)
             int nCharsRead;
 
             for (nCharsRead = 0; m_posInBuffer + 1 < m_nInBuffer; nCharsRead++, m_posInBuffer += sizeof(WCHAR)) {
+                size_t nPlain = DecodeBE16Run(&m_buffer[m_posInBuffer], size_t(m_nInBuffer - m_posInBuffer) / sizeof(WCHAR), &m_wbuffer[nCharsRead]);
+                if (nPlain) {
+                    m_posInBuffer += nPlain * sizeof(WCHAR);
+                    nCharsRead += (int)nPlain;
+                    if (m_posInBuffer + 1 >= m_nInBuffer) {
+                        break;
+                    }
+                }
+
                 m_wbuffer[nCharsRead] = ((WCHAR(m_buffer[m_posInBuffer]) << 8) & 0xff00) | (WCHAR(m_buffer[m_posInBuffer + 1]) & 0x00ff);
                 if (m_wbuffer[nCharsRead] == L'\n') {
                     bLineEndFound = true; // Stop at end of line
@@ -781,6 +870,82 @@ void CWebTextFile::Close()
     }
 }
 
+//
+// CTextFileView
+//
+
+CTextFileView::CTextFileView()
+    : m_hFile(INVALID_HANDLE_VALUE)
+    , m_hMapping(nullptr)
+    , m_pView(nullptr)
+    , m_pData(nullptr)
+    , m_size(0)
+{
+}
+
+CTextFileView::~CTextFileView()
+{
+    Unmap();
+}
+
+bool CTextFileView::Map(const CTextFile& file)
+{
+    Unmap();
+
+    const CTextFile::enc encoding = file.GetEncoding();
+    if (encoding != CTextFile::UTF8 && encoding != CTextFile::LE16) {
+        return false;
+    }
+
+    m_hFile = CreateFile(file.GetFilePath(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                         nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_hFile, &size) || size.QuadPart <= file.GetOffset() || ULONGLONG(size.QuadPart) > SIZE_MAX) {
+        Unmap();
+        return false;
+    }
+
+    m_hMapping = CreateFileMapping(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_hMapping) {
+        m_pView = (const BYTE*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (!m_pView) {
+        TRACE(_T("CTextFileView: failed to map %s (%u)\n"), file.GetFilePath().GetString(), GetLastError());
+        Unmap();
+        return false;
+    }
+
+    m_pData = m_pView + file.GetOffset();
+    m_size = size_t(size.QuadPart) - file.GetOffset();
+    if (encoding == CTextFile::LE16) {
+        m_size &= ~size_t(1);
+    }
+
+    return true;
+}
+
+void CTextFileView::Unmap()
+{
+    if (m_pView) {
+        UnmapViewOfFile(m_pView);
+    }
+    if (m_hMapping) {
+        CloseHandle(m_hMapping);
+    }
+    if (m_hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_hFile);
+    }
+
+    m_hFile = INVALID_HANDLE_VALUE;
+    m_hMapping = nullptr;
+    m_pView = m_pData = nullptr;
+    m_size = 0;
+}
+
 ///////////////////////////////////////////////////////////////
 
 CStringW AToW(CStringA str)
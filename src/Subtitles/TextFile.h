@@ -49,7 +49,9 @@ public:
     virtual bool Save(LPCTSTR lpszFileName, enc e /*= DEFAULT_ENCODING*/);
 
     void SetEncoding(enc e);
-    enc GetEncoding();
+    enc GetEncoding() const;
+    // Size of the BOM, where the text starts in the file
+    int GetOffset() const { return m_offset; }
     bool IsUnicode();
 
     // CFile
@@ -86,6 +88,28 @@ public:
     void Close();
 };
 
+// Read-only view of the text of a CTextFile mapped in memory, BOM excluded,
+// so that offsets in the view are positions in the file. Only UTF-8 and
+// UTF-16LE files are mapped since those can be decoded from the raw bytes.
+// The view stays valid until Unmap even if the file is closed.
+class CTextFileView
+{
+    HANDLE m_hFile, m_hMapping;
+    const BYTE* m_pView;
+    const BYTE* m_pData;
+    size_t m_size;
+
+public:
+    CTextFileView();
+    ~CTextFileView();
+
+    bool Map(const CTextFile& file);
+    void Unmap();
+
+    const BYTE* GetData() const { return m_pData; }
+    size_t GetSize() const { return m_size; }
+};
+
 extern CStringW AToW(CStringA str);
 extern CStringA WToA(CStringW str);
 extern CString  AToT(CStringA str);
@@ -22,8 +22,11 @@
 #include "stdafx.h"
 #include <winioctl.h>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include "TextFile.h"
 #include "VobSubFile.h"
+#include "WorkStealingPool.h"
 #include "mpc-hc_config.h"
 
 #if !USE_STATIC_UNRAR
@@ -214,15 +217,30 @@ CString FindLangFromId(WORD id)
 // CVobSubFile
 //
 
+// Decoded subpictures kept in memory, a DVD subpicture takes up to 2.7 MB once decoded
+// but most are only a line or two of text and are much smaller once trimmed
+static const size_t DECODED_CACHE_SIZE = 256;
+static const size_t DECODED_CACHE_BYTES = 32 * 1024 * 1024;
+// How far past the playback time subpictures are decoded, in ms
+static const int LOOK_AHEAD_DEPTH = 10000;
+static const size_t LOOK_AHEAD_MAX_SUBPICS = 8;
+
 CVobSubFile::CVobSubFile(CCritSec* pLock)
     : CSubPicProviderImpl(pLock)
     , m_sub(1024 * 1024)
+    , m_decodedCache(DECODED_CACHE_SIZE, DECODED_CACHE_BYTES)
+    , m_decodedGeneration(0)
+    , m_pLookAhead(std::make_shared<LookAheadState>())
     , m_nLang(0)
 {
+    ZeroMemory(&m_decodedPalette, sizeof(m_decodedPalette));
+    ZeroMemory(&m_lookAheadStats, sizeof(m_lookAheadStats));
+    m_lookAheadStats.depth = LOOK_AHEAD_DEPTH;
 }
 
 CVobSubFile::~CVobSubFile()
 {
+    JoinLookAheadThread();
 }
 
 //
@@ -366,7 +384,8 @@ bool CVobSubFile::Open(CString fn)
     return false;
 }
 
-bool CVobSubFile::Save(CString fn, int delay, SubFormat sf)
+bool CVobSubFile::Save(CString fn, int delay, SubFormat sf, const ExportProgress& progress /*= nullptr*/,
+                       bool bParallel /*= true*/)
 {
     TrimExtension(fn);
 
@@ -379,11 +398,11 @@ bool CVobSubFile::Save(CString fn, int delay, SubFormat sf)
         case VobSub:
             return vsf.SaveVobSub(fn, delay);
         case WinSubMux:
-            return vsf.SaveWinSubMux(fn, delay);
+            return vsf.SaveWinSubMux(fn, delay, progress, bParallel);
         case Scenarist:
-            return vsf.SaveScenarist(fn, delay);
+            return vsf.SaveScenarist(fn, delay, progress, bParallel);
         case Maestro:
-            return vsf.SaveMaestro(fn, delay);
+            return vsf.SaveMaestro(fn, delay, progress, bParallel);
         default:
             break;
     }
@@ -391,12 +410,110 @@ bool CVobSubFile::Save(CString fn, int delay, SubFormat sf)
     return false;
 }
 
+// How many packets Polygonize() reads at once, it bounds the memory they take
+static const size_t POLYGONIZE_BATCH_SIZE = 256;
+
+bool CVobSubFile::Polygonize(std::vector<PolygonizedSubPic>& subPics, size_t nLang /*= SIZE_T_ERROR*/, bool bSmooth /*= true*/, int scale /*= 3*/)
+{
+    subPics.clear();
+
+    if (nLang >= m_langs.size()) {
+        nLang = m_nLang;
+    }
+    if (nLang >= m_langs.size()) {
+        return false;
+    }
+    const CAtlArray<SubPos>& sp = m_langs[nLang].subpos;
+
+    DecodePalette pal;
+    ZeroMemory(&pal, sizeof(pal));
+    pal.bCustomPal = m_bCustomPal;
+    pal.tridx = m_tridx;
+    memcpy(pal.orgpal, m_orgpal, sizeof(pal.orgpal));
+    memcpy(pal.cuspal, m_cuspal, sizeof(pal.cuspal));
+
+    struct Job {
+        size_t idx = 0;
+        std::unique_ptr<BYTE[]> buff;
+        size_t packetSize = 0, dataSize = 0;
+        bool bDone = false;
+        CStringW assstr;
+    };
+
+    auto pPool = CWorkStealingPool::GetShared();
+
+    try {
+        // One image per worker, the outlines they trace keep reusing the same storage
+        std::vector<std::unique_ptr<CVobSubImage>> imgs;
+        for (unsigned int i = 0; i < pPool->GetThreadCount(); i++) {
+            imgs.emplace_back(std::make_unique<CVobSubImage>());
+        }
+
+        std::vector<Job> jobs;
+        jobs.reserve(POLYGONIZE_BATCH_SIZE);
+
+        for (size_t first = 0; first < sp.GetCount(); first += POLYGONIZE_BATCH_SIZE) {
+            size_t last = std::min(first + POLYGONIZE_BATCH_SIZE, sp.GetCount());
+
+            jobs.clear();
+            for (size_t i = first; i < last; i++) {
+                if (!sp[i].bValid) {
+                    continue;
+                }
+
+                Job job;
+                job.idx = i;
+                job.buff.reset(GetPacket(i, job.packetSize, job.dataSize, nLang));
+                if (job.buff && job.packetSize > 0 && job.dataSize > 0) {
+                    jobs.emplace_back(std::move(job));
+                }
+            }
+
+            // The workers take the jobs in turn so that a few complex subpictures don't hold up
+            // the whole batch, the results are stored in the jobs and collected in order
+            std::atomic<size_t> nextJob(0);
+            pPool->ParallelFor(std::min(imgs.size(), jobs.size()), [&](size_t i) {
+                CVobSubImage& img = *imgs[i];
+                for (size_t j; (j = nextJob++) < jobs.size();) {
+                    Job& job = jobs[j];
+                    try {
+                        // Same state as when saving, the last one of animated subpictures
+                        job.bDone = img.Decode(job.buff.get(), job.packetSize, job.dataSize, INT_MAX,
+                                               pal.bCustomPal, pal.tridx, pal.orgpal, pal.cuspal, true)
+                                    && img.Polygonize(job.assstr, bSmooth, scale);
+                    } catch (CMemoryException* e) {
+                        ASSERT(FALSE);
+                        e->Delete();
+                    }
+                    job.buff.reset();
+                }
+            });
+
+            for (const Job& job : jobs) {
+                if (job.bDone) {
+                    PolygonizedSubPic subPic = { job.idx, sp[job.idx].start, sp[job.idx].stop, sp[job.idx].bForced, job.assstr };
+                    subPics.emplace_back(subPic);
+                }
+            }
+        }
+    } catch (CMemoryException* e) {
+        ASSERT(FALSE);
+        e->Delete();
+        subPics.clear();
+        return false;
+    }
+
+    return true;
+}
+
 void CVobSubFile::Close()
 {
     InitSettings();
     m_title.Empty();
     m_sub.SetLength(0);
     m_img.Invalidate();
+    m_decodedCache.Clear();
+    m_decodedGeneration++;
     m_nLang = SIZE_T_ERROR;
     for (auto& sl : m_langs) {
         sl.id = 0;
@@ -750,38 +867,37 @@ bool CVobSubFile::ReadIdx(CString fn, int& ver)
 
 bool CVobSubFile::ReadSub(CString fn)
 {
-    CFile f;
-    if (!f.Open(fn, CFile::modeRead | CFile::typeBinary | CFile::shareDenyNone)) {
-        return false;
-    }
-
-    m_sub.SetLength(f.GetLength());
-    m_sub.SeekToBegin();
-
-    int len;
-    BYTE buff[2048];
-    while ((len = f.Read(buff, sizeof(buff))) > 0 && *(DWORD*)buff == 0xba010000) {
-        m_sub.Write(buff, len);
-    }
-
-    return true;
+    // The sectors are read from the file when needed
+    return m_sub.OpenSource(fn);
 }
 
-static unsigned char* RARbuff = nullptr;
-static unsigned int RARpos = 0;
-
 static int CALLBACK MyCallbackProc(UINT msg, LPARAM UserData, LPARAM P1, LPARAM P2)
 {
     if (msg == UCM_PROCESSDATA) {
-        ASSERT(RARbuff);
+        HANDLE hFile = (HANDLE)UserData;
+        ASSERT(hFile != INVALID_HANDLE_VALUE);
 
-        memcpy(&RARbuff[RARpos], (char*)P1, (size_t)P2);
-        RARpos += (unsigned int)P2;
+        DWORD written = 0;
+        if (!WriteFile(hFile, (LPCVOID)P1, (DWORD)P2, &written, nullptr) || written != (DWORD)P2) {
+            return -1;
+        }
     }
 
     return 1;
 }
 
+static HANDLE CreateTempSubFile()
+{
+    TCHAR path[MAX_PATH], fn[MAX_PATH];
+    if (!GetTempPath(_countof(path), path) || !GetTempFileName(path, _T("sub"), 0, fn)) {
+        return INVALID_HANDLE_VALUE;
+    }
+
+    // The file is deleted as soon as m_sub doesn't use it anymore
+    return CreateFile(fn, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, CREATE_ALWAYS,
+                      FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE | FILE_FLAG_RANDOM_ACCESS, nullptr);
+}
+
 bool CVobSubFile::ReadRar(CString fn)
 {
 #if !USE_STATIC_UNRAR
@@ -826,7 +942,6 @@ bool CVobSubFile::ReadRar(CString fn)
     OpenArchiveData.ArcName = fnA;
     OpenArchiveData.OpenMode = RAR_OM_EXTRACT;
     OpenArchiveData.CmtBuf = 0;
-    OpenArchiveData.Callback = MyCallbackProc;
     HANDLE hArcData = OpenArchiveEx(&OpenArchiveData);
     if (!hArcData) {
 #if !USE_STATIC_UNRAR
@@ -842,8 +957,10 @@ bool CVobSubFile::ReadRar(CString fn)
         CString subfn(HeaderDataEx.FileNameW);
 
         if (!subfn.Right(4).CompareNoCase(_T(".sub"))) {
-            CAutoVectorPtr<BYTE> buff;
-            if (!buff.Allocate(HeaderDataEx.UnpSize)) {
+            // The archive can't be read at random so the .sub is unpacked to a temporary
+            // file, as it comes, and its sectors are then read from it like from a .sub
+            HANDLE hFile = CreateTempSubFile();
+            if (hFile == INVALID_HANDLE_VALUE) {
                 CloseArchive(hArcData);
 #if !USE_STATIC_UNRAR
                 FreeLibrary(h);
@@ -851,10 +968,14 @@ bool CVobSubFile::ReadRar(CString fn)
                 return false;
             }
 
-            RARbuff = buff;
-            RARpos = 0;
+            SetCallback(hArcData, MyCallbackProc, (LPARAM)hFile);
 
             if (ProcessFile(hArcData, RAR_TEST, nullptr, nullptr)) {
+                CloseHandle(hFile);
+                hFile = INVALID_HANDLE_VALUE;
+            }
+
+            if (hFile == INVALID_HANDLE_VALUE || !m_sub.AttachSource(hFile)) {
                 CloseArchive(hArcData);
 #if !USE_STATIC_UNRAR
                 FreeLibrary(h);
@@ -863,14 +984,6 @@ bool CVobSubFile::ReadRar(CString fn)
                 return false;
             }
 
-            m_sub.SetLength(HeaderDataEx.UnpSize);
-            m_sub.SeekToBegin();
-            m_sub.Write(buff, HeaderDataEx.UnpSize);
-            m_sub.SeekToBegin();
-
-            RARbuff = nullptr;
-            RARpos = 0;
-
             break;
         }
 
@@ -1227,22 +1340,47 @@ bool CVobSubFile::GetFrame(size_t idx, size_t nLang /*= SIZE_T_ERROR*/, REFERENC
 
     if (m_img.nLang != nLang || m_img.nIdx != idx
             || (sp[idx].bAnimated && sp[idx].start + m_img.tCurrent <= rt)) {
-        size_t packetSize = 0, dataSize = 0;
-        CAutoVectorPtr<BYTE> buff;
-        buff.Attach(GetPacket(idx, packetSize, dataSize, nLang));
-        if (!buff || packetSize == 0 || dataSize == 0) {
-            return false;
-        }
+        // Only the still subpictures are cached, the animated ones depend on rt. The
+        // subpictures decoded outside of playback, when saving for example, aren't either.
+        const bool bCache = rt >= 0 && !sp[idx].bAnimated;
+        if (bCache) {
+            CheckDecodedPalette();
+        }
+
+        CVobSubDecodedSubPicSharedPtr pDecoded;
+        if (bCache && m_decodedCache.Lookup(GetDecodedKey(nLang, idx), pDecoded) && m_img.SetDecoded(pDecoded->img)) {
+            if (pDecoded->bLookAhead) {
+                pDecoded->bLookAhead = false;
+                m_lookAheadStats.nUsed++;
+                m_lookAheadStats.timeSaved += pDecoded->decodeTime;
+            }
+
+            m_img.start = sp[idx].start;
+            m_img.delay = sp[idx].stop - sp[idx].start;
+        } else {
+            size_t packetSize = 0, dataSize = 0;
+            CAutoVectorPtr<BYTE> buff;
+            buff.Attach(GetPacket(idx, packetSize, dataSize, nLang));
+            if (!buff || packetSize == 0 || dataSize == 0) {
+                return false;
+            }
+
+            m_img.start = sp[idx].start;
 
-        m_img.start = sp[idx].start;
+            bool ret = m_img.Decode(buff, packetSize, dataSize, rt >= 0 ? int(rt - sp[idx].start) : INT_MAX,
+                                    m_bCustomPal, m_tridx, m_orgpal, m_cuspal, true);
 
-        bool ret = m_img.Decode(buff, packetSize, dataSize, rt >= 0 ? int(rt - sp[idx].start) : INT_MAX,
-                                m_bCustomPal, m_tridx, m_orgpal, m_cuspal, true);
+            m_img.delay = sp[idx].stop - sp[idx].start;
 
-        m_img.delay = sp[idx].stop - sp[idx].start;
+            if (!ret) {
+                return false;
+            }
 
-        if (!ret) {
-            return false;
+            if (bCache) {
+                pDecoded = std::make_shared<CVobSubDecodedSubPic>();
+                m_img.GetDecoded(pDecoded->img);
+                m_decodedCache.SetAt(GetDecodedKey(nLang, idx), pDecoded);
+            }
         }
 
         m_img.nIdx = idx;
@@ -1252,6 +1390,200 @@ bool CVobSubFile::GetFrame(size_t idx, size_t nLang /*= SIZE_T_ERROR*/, REFERENC
     return (m_bOnlyShowForcedSubs ? m_img.bForced : true);
 }
 
+void CVobSubFile::CheckDecodedPalette()
+{
+    DecodePalette pal;
+    ZeroMemory(&pal, sizeof(pal));
+    pal.bCustomPal = m_bCustomPal;
+    pal.tridx = m_tridx;
+    memcpy(pal.orgpal, m_orgpal, sizeof(pal.orgpal));
+    memcpy(pal.cuspal, m_cuspal, sizeof(pal.cuspal));
+
+    // Both are zeroed first so that the padding compares equal
+    if (memcmp(&pal, &m_decodedPalette, sizeof(pal))) {
+        memcpy(&m_decodedPalette, &pal, sizeof(pal));
+        m_decodedCache.Clear();
+        m_decodedGeneration++;
+    }
+}
+
+void CVobSubFile::QueueLookAhead(__int64 rt)
+{
+    if (m_lookAheadStats.depth <= 0) {
+        return;
+    }
+
+    if (!m_lookAheadThread.joinable()) {
+        try {
+            m_lookAheadThread = std::thread(LookAheadThread, m_pLookAhead, this);
+        } catch (const std::system_error&) {
+            TRACE(_T("CVobSubFile: failed to start the look-ahead thread\n"));
+            m_lookAheadStats.depth = 0;
+            return;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_pLookAhead->mutex);
+
+    m_pLookAhead->request++;
+    m_pLookAhead->rt = rt;
+    if (!m_pLookAhead->bBusy) {
+        m_pLookAhead->bBusy = true;
+        m_pLookAhead->wake.notify_one();
+    }
+}
+
+void CVobSubFile::LookAheadThread(std::shared_ptr<LookAheadState> pState, CVobSubFile* pVSF)
+{
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+
+    std::unique_lock<std::mutex> lock(pState->mutex);
+
+    for (;;) {
+        pState->wake.wait(lock, [&] { return pState->bExit || pState->bBusy; });
+        if (pState->bExit) {
+            // Cancelled by StopLookAhead or the destructor
+            pState->bBusy = false;
+            break;
+        }
+
+        unsigned int request = pState->request;
+        __int64 rt = pState->rt;
+
+        lock.unlock();
+        pVSF->LookAhead(rt, request);
+        lock.lock();
+
+        // Start over right away if playback moved on in the meantime
+        if (pState->request == request) {
+            pState->bBusy = false;
+        }
+    }
+}
+
+void CVobSubFile::JoinLookAheadThread()
+{
+    if (!m_lookAheadThread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_pLookAhead->mutex);
+        // Makes LookAhead give up on the request in progress
+        m_pLookAhead->request++;
+        m_pLookAhead->bExit = true;
+    }
+    m_pLookAhead->wake.notify_one();
+
+    m_lookAheadThread.join();
+    // So that QueueLookAhead can start it again
+    m_pLookAhead->bExit = false;
+}
+
+bool CVobSubFile::LockForLookAhead(unsigned int request)
+{
+    std::unique_lock<std::mutex> lock(m_pLookAhead->mutex);
+
+    // Polls m_pLock instead of waiting for it, the thread holding it might be
+    // the one joining us
+    while (m_pLookAhead->request == request) {
+        if (m_pLock->TryLock()) {
+            return true;
+        }
+        m_pLookAhead->wake.wait_for(lock, std::chrono::milliseconds(1));
+    }
+
+    return false;
+}
+
+void CVobSubFile::LookAhead(__int64 rt, unsigned int request)
+{
+    CAtlArray<size_t> entries;
+    size_t nLang;
+    DecodePalette pal;
+    unsigned int generation;
+
+    {
+        if (!LockForLookAhead(request)) {
+            return;
+        }
+        CAutoUnlock cAutoUnlock(m_pLock);
+
+        nLang = m_nLang;
+        if (nLang >= m_langs.size()) {
+            return;
+        }
+
+        CheckDecodedPalette();
+        pal = m_decodedPalette;
+        generation = m_decodedGeneration;
+
+        const CAtlArray<SubPos>& sp = m_langs[nLang].subpos;
+        size_t i = GetFrameIdxByTimeStamp(rt);
+        for (i = (i == SIZE_T_ERROR) ? 0 : i;
+                i < sp.GetCount() && sp[i].start < rt + m_lookAheadStats.depth && entries.GetCount() < LOOK_AHEAD_MAX_SUBPICS;
+                i++) {
+            if (sp[i].bValid && !sp[i].bAnimated && sp[i].stop > rt && !m_decodedCache.Contains(GetDecodedKey(nLang, i))) {
+                entries.Add(i);
+            }
+        }
+    }
+
+    // The packets are read with the lock held but decoded without it
+    for (size_t i = 0; i < entries.GetCount(); i++) {
+        size_t idx = entries[i];
+        size_t packetSize = 0, dataSize = 0;
+        CAutoVectorPtr<BYTE> buff;
+
+        {
+            if (!LockForLookAhead(request)) {
+                return;
+            }
+            CAutoUnlock cAutoUnlock(m_pLock);
+
+            if (m_decodedGeneration != generation) {
+                return;
+            }
+            // Decoded meanwhile because it was displayed
+            if (m_decodedCache.Contains(GetDecodedKey(nLang, idx))) {
+                continue;
+            }
+
+            buff.Attach(GetPacket(idx, packetSize, dataSize, nLang));
+        }
+
+        if (!buff || packetSize == 0 || dataSize == 0) {
+            continue;
+        }
+
+        auto decodeStart = std::chrono::steady_clock::now();
+
+        // Same state as for the first frame the subpicture is displayed in
+        CVobSubImage img;
+        if (!img.Decode(buff, packetSize, dataSize, 0, pal.bCustomPal, pal.tridx, pal.orgpal, pal.cuspal, true)) {
+            continue;
+        }
+
+        auto pDecoded = std::make_shared<CVobSubDecodedSubPic>();
+        img.GetDecoded(pDecoded->img);
+        pDecoded->bLookAhead = true;
+        pDecoded->decodeTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - decodeStart).count();
+
+        if (!LockForLookAhead(request)) {
+            return;
+        }
+        CAutoUnlock cAutoUnlock(m_pLock);
+
+        if (m_decodedGeneration != generation) {
+            return;
+        }
+        if (!m_decodedCache.Contains(GetDecodedKey(nLang, idx))) {
+            m_decodedCache.SetAt(GetDecodedKey(nLang, idx), pDecoded);
+            m_lookAheadStats.nBuilt++;
+        }
+    }
+}
+
 bool CVobSubFile::GetFrameByTimeStamp(__int64 time)
 {
     return GetFrame(GetFrameIdxByTimeStamp(time));
@@ -1307,6 +1639,7 @@ STDMETHODIMP CVobSubFile::NonDelegatingQueryInterface(REFIID riid, void** ppv)
         QI(IPersist)
         QI(ISubStream)
         QI(ISubPicProvider)
+        QI(IRenderingCacheStats)
         __super::NonDelegatingQueryInterface(riid, ppv);
 }
 
@@ -1367,6 +1700,8 @@ STDMETHODIMP CVobSubFile::Render(SubPicDesc& spd, REFERENCE_TIME rt, double fps,
 
     rt /= 10000;
 
+    QueueLookAhead(rt);
+
     if (!GetFrame(GetFrameIdxByTimeStamp(rt), SIZE_T_ERROR, rt)) {
         return E_FAIL;
     }
@@ -1472,6 +1807,87 @@ STDMETHODIMP CVobSubFile::Reload()
     return !m_title.IsEmpty() && Open(m_title) ? S_OK : E_FAIL;
 }
 
+// IRenderingCacheStats
+
+STDMETHODIMP_(int) CVobSubFile::GetCacheCount()
+{
+    return 1;
+}
+
+STDMETHODIMP CVobSubFile::GetCacheStats(int i, LPCWSTR* ppName, CRenderingCacheStats* pStats)
+{
+    CheckPointer(ppName, E_POINTER);
+    CheckPointer(pStats, E_POINTER);
+
+    if (i != 0) {
+        return E_INVALIDARG;
+    }
+
+    CAutoLock cAutoLock(m_pLock);
+
+    *ppName = L"Decoded subpictures";
+    m_decodedCache.GetStats(*pStats);
+
+    return S_OK;
+}
+
+STDMETHODIMP CVobSubFile::SetCacheBudget(int i, size_t maxBytes)
+{
+    if (i != 0) {
+        return E_INVALIDARG;
+    }
+
+    CAutoLock cAutoLock(m_pLock);
+
+    m_decodedCache.SetMaxBytes(maxBytes);
+
+    return S_OK;
+}
+
+STDMETHODIMP CVobSubFile::GetBufferPoolStats(CBufferPoolStats* pStats)
+{
+    UNREFERENCED_PARAMETER(pStats);
+    // The buffer pool is only used to render text subtitles
+    return E_NOTIMPL;
+}
+
+STDMETHODIMP CVobSubFile::SetLookAheadDepth(int depth)
+{
+    if (depth < 0) {
+        return E_INVALIDARG;
+    }
+
+    CAutoLock cAutoLock(m_pLock);
+
+    m_lookAheadStats.depth = depth;
+
+    return S_OK;
+}
+
+STDMETHODIMP CVobSubFile::GetLookAheadStats(CLookAheadStats* pStats)
+{
+    CheckPointer(pStats, E_POINTER);
+
+    CAutoLock cAutoLock(m_pLock);
+
+    *pStats = m_lookAheadStats;
+
+    return S_OK;
+}
+
+STDMETHODIMP CVobSubFile::StopLookAhead()
+{
+    {
+        CAutoLock cAutoLock(m_pLock);
+        // Keeps Render from queuing more requests
+        m_lookAheadStats.depth = 0;
+    }
+
+    JoinLookAheadThread();
+
+    return S_OK;
+}
+
 // StretchBlt
 
 static void PixelAtBiLinear(RGBQUAD& c, int x, int y, CVobSubImage& src)
@@ -1734,53 +2150,167 @@ bool CVobSubFile::SaveVobSub(CString fn, int delay)
     return WriteIdx(fn + _T(".idx"), delay) && WriteSub(fn + _T(".sub"));
 }
 
-bool CVobSubFile::SaveWinSubMux(CString fn, int delay)
+// How many subpictures the exporters keep in flight for each worker thread
+static const size_t EXPORT_JOBS_PER_THREAD = 4;
+
+bool CVobSubFile::ExportSubPics(const std::function<void(const CVobSubImage& img, ExportedSubPic& subPic)>& encode,
+                                const std::function<void(size_t i, const ExportedSubPic& subPic)>& write,
+                                const ExportProgress& progress, bool bParallel)
 {
-    TrimExtension(fn);
+    const CAtlArray<SubPos>& sp = m_langs[m_nLang].subpos;
+    const size_t nSubPics = sp.GetCount();
 
-    CStdioFile f;
-    if (!f.Open(fn + _T(".sub"), CFile::modeCreate | CFile::modeWrite | CFile::typeText | CFile::shareDenyWrite)) {
-        return false;
+    DecodePalette pal;
+    ZeroMemory(&pal, sizeof(pal));
+    pal.bCustomPal = m_bCustomPal;
+    pal.tridx = m_tridx;
+    memcpy(pal.orgpal, m_orgpal, sizeof(pal.orgpal));
+    memcpy(pal.cuspal, m_cuspal, sizeof(pal.cuspal));
+
+    struct Job {
+        std::unique_ptr<BYTE[]> buff;
+        size_t packetSize = 0, dataSize = 0;
+        bool bDone = false;
+        ExportedSubPic subPic;
+    };
+
+    auto pPool = bParallel ? CWorkStealingPool::GetShared() : nullptr;
+    // Used in turn, the job of a subpicture is reused once it was written
+    std::vector<Job> jobs(bParallel ? pPool->GetThreadCount() * EXPORT_JOBS_PER_THREAD : 1);
+    std::mutex mutex;
+    std::condition_variable jobDone;
+    std::atomic<bool> bCanceled(false), bFailed(false);
+
+    auto runJob = [&](size_t idx, Job & job) {
+        if (!bCanceled && job.buff && job.packetSize > 0 && job.dataSize > 0) {
+            try {
+                // Same as GetFrame()
+                CVobSubImage img;
+                img.start = sp[idx].start;
+                img.delay = sp[idx].stop - sp[idx].start;
+                if (img.Decode(job.buff.get(), job.packetSize, job.dataSize, INT_MAX,
+                               pal.bCustomPal, pal.tridx, pal.orgpal, pal.cuspal, true)
+                        && (!m_bOnlyShowForcedSubs || img.bForced)) {
+                    job.subPic.rect = img.rect;
+                    job.subPic.start = img.start;
+                    job.subPic.delay = img.delay;
+                    memcpy(job.subPic.pal, img.pal, sizeof(job.subPic.pal));
+                    encode(img, job.subPic);
+                    job.subPic.bOk = true;
+                }
+            } catch (CMemoryException* e) {
+                ASSERT(FALSE);
+                e->Delete();
+                bFailed = true;
+            }
+        }
+        job.buff.reset();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        job.bDone = true;
+        jobDone.notify_all();
+    };
+
+    auto waitForJob = [&](Job & job) {
+        std::unique_lock<std::mutex> lock(mutex);
+        jobDone.wait(lock, [&job]() { return job.bDone; });
+    };
+
+    size_t nSubmitted = 0;
+
+    // The jobs still running refer to our locals
+    auto waitForJobs = [&]() {
+        bCanceled = true;
+        for (size_t j = nSubmitted > jobs.size() ? nSubmitted - jobs.size() : 0; j < nSubmitted; j++) {
+            waitForJob(jobs[j % jobs.size()]);
+        }
+    };
+
+    bool bRet = true;
+
+    try {
+        for (size_t i = 0; i < nSubPics; i++) {
+            // The packets are read here, m_sub can only be used by one thread at a time
+            for (; nSubmitted < nSubPics && nSubmitted < i + jobs.size(); nSubmitted++) {
+                Job& job = jobs[nSubmitted % jobs.size()];
+                job.buff.reset(GetPacket(nSubmitted, job.packetSize, job.dataSize));
+                job.bDone = false;
+                // The bitmap keeps its storage, the encoders overwrite all of it
+                job.subPic.bOk = false;
+
+                size_t idx = nSubmitted;
+                if (bParallel) {
+                    pPool->Submit([&runJob, idx, &job]() {
+                        runJob(idx, job);
+                    });
+                } else {
+                    runJob(idx, job);
+                }
+            }
+
+            Job& job = jobs[i % jobs.size()];
+            waitForJob(job);
+            if (bFailed) {
+                bRet = false;
+                break;
+            }
+
+            write(i, job.subPic);
+
+            if (progress && !progress(i + 1, nSubPics)) {
+                bRet = false;
+                break;
+            }
+        }
+    } catch (...) {
+        waitForJobs();
+        throw;
     }
 
-    m_img.Invalidate();
+    waitForJobs();
+
+    return bRet;
+}
+
+bool CVobSubFile::SaveWinSubMux(CString fn, int delay, const ExportProgress& progress, bool bParallel)
+{
+    TrimExtension(fn);
 
-    CAutoVectorPtr<BYTE> p4bpp;
-    if (!p4bpp.Allocate(720 * 576 / 2)) {
+    CStdioFile f;
+    if (!f.Open(fn + _T(".sub"), CFile::modeCreate | CFile::modeWrite | CFile::typeText | CFile::shareDenyWrite)) {
         return false;
     }
 
-    CAtlArray<SubPos>& sp = m_langs[m_nLang].subpos;
-    for (size_t i = 0; i < sp.GetCount(); i++) {
-        if (!GetFrame(i)) {
-            continue;
-        }
-
+    auto encode = [this](const CVobSubImage & img, ExportedSubPic & subPic) {
         int pal[4] = {0, 1, 2, 3};
+        BYTE bg = 0;
 
         for (int j = 0; j < 5; j++) {
-            if (j == 4 || !m_img.pal[j].tr) {
+            if (j == 4 || !img.pal[j].tr) {
                 j &= 3;
-                memset(p4bpp, (j << 4) | j, 720 * 576 / 2);
+                bg = BYTE((j << 4) | j);
                 pal[j] ^= pal[0], pal[0] ^= pal[j], pal[j] ^= pal[0];
                 break;
             }
         }
 
-        int tr[4] = {m_img.pal[pal[0]].tr, m_img.pal[pal[1]].tr, m_img.pal[pal[2]].tr, m_img.pal[pal[3]].tr};
+        // The palette of the bitmap
+        for (int j = 0; j < 4; j++) {
+            subPic.pal[j] = img.pal[pal[j]];
+        }
 
-        DWORD uipal[4 + 12];
+        DWORD uipal[4 + 12] = {0};
 
         if (!m_bCustomPal) {
-            uipal[0] = *((DWORD*)&m_img.orgpal[m_img.pal[pal[0]].pal]);
-            uipal[1] = *((DWORD*)&m_img.orgpal[m_img.pal[pal[1]].pal]);
-            uipal[2] = *((DWORD*)&m_img.orgpal[m_img.pal[pal[2]].pal]);
-            uipal[3] = *((DWORD*)&m_img.orgpal[m_img.pal[pal[3]].pal]);
+            uipal[0] = *((DWORD*)&img.orgpal[img.pal[pal[0]].pal]);
+            uipal[1] = *((DWORD*)&img.orgpal[img.pal[pal[1]].pal]);
+            uipal[2] = *((DWORD*)&img.orgpal[img.pal[pal[2]].pal]);
+            uipal[3] = *((DWORD*)&img.orgpal[img.pal[pal[3]].pal]);
         } else {
-            uipal[0] = *((DWORD*)&m_img.cuspal[pal[0]]) & 0xffffff;
-            uipal[1] = *((DWORD*)&m_img.cuspal[pal[1]]) & 0xffffff;
-            uipal[2] = *((DWORD*)&m_img.cuspal[pal[2]]) & 0xffffff;
-            uipal[3] = *((DWORD*)&m_img.cuspal[pal[3]]) & 0xffffff;
+            uipal[0] = *((DWORD*)&img.cuspal[pal[0]]) & 0xffffff;
+            uipal[1] = *((DWORD*)&img.cuspal[pal[1]]) & 0xffffff;
+            uipal[2] = *((DWORD*)&img.cuspal[pal[2]]) & 0xffffff;
+            uipal[3] = *((DWORD*)&img.cuspal[pal[3]]) & 0xffffff;
         }
 
         CAtlMap<DWORD, BYTE> palmap;
@@ -1791,12 +2321,36 @@ bool CVobSubFile::SaveWinSubMux(CString fn, int delay)
 
         uipal[0] = 0xff; // blue background
 
-        int w = m_img.rect.Width() - 2;
-        int h = m_img.rect.Height() - 2;
+        int w = img.rect.Width() - 2;
+        int h = img.rect.Height() - 2;
         int pitch = (((w + 1) >> 1) + 3) & ~3;
 
+        BITMAPFILEHEADER fhdr = {
+            0x4d42,
+            sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + 16 * sizeof(RGBQUAD) + pitch * h,
+            0, 0,
+            sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + 16 * sizeof(RGBQUAD)
+        };
+
+        BITMAPINFOHEADER ihdr = {
+            sizeof(BITMAPINFOHEADER),
+            w, h, 1, 4, 0,
+            0,
+            pitch * h, 0,
+            16, 4
+        };
+
+        subPic.bmp.resize(fhdr.bfSize);
+        BYTE* bmp = subPic.bmp.data();
+        memcpy(bmp, &fhdr, sizeof(fhdr));
+        memcpy(bmp + sizeof(fhdr), &ihdr, sizeof(ihdr));
+        memcpy(bmp + sizeof(fhdr) + sizeof(ihdr), uipal, sizeof(RGBQUAD) * 16);
+
+        BYTE* p4bpp = bmp + fhdr.bfOffBits;
+        memset(p4bpp, bg, pitch * h);
+
         for (ptrdiff_t y = 0; y < h; y++) {
-            DWORD* p = (DWORD*)&m_img.lpPixels[(y + 1) * (w + 2) + 1];
+            const DWORD* p = (const DWORD*)&img.lpPixels[(y + 1) * (w + 2) + 1];
 
             for (ptrdiff_t x = 0; x < w; x++, p++) {
                 BYTE c = 0;
@@ -1810,14 +2364,22 @@ bool CVobSubFile::SaveWinSubMux(CString fn, int delay)
                 c4bpp = (x & 1) ? ((c4bpp & 0xf0) | c) : ((c4bpp & 0x0f) | (c << 4));
             }
         }
+    };
+
+    auto write = [&](size_t i, const ExportedSubPic & subPic) {
+        if (!subPic.bOk) {
+            return;
+        }
 
-        int t1 = (int)m_img.start + delay;
-        int t2 = t1 + (int)m_img.delay /*+ (m_size.cy==480?(1000/29.97+1):(1000/25))*/;
+        int tr[4] = {subPic.pal[0].tr, subPic.pal[1].tr, subPic.pal[2].tr, subPic.pal[3].tr};
+
+        int t1 = (int)subPic.start + delay;
+        int t2 = t1 + (int)subPic.delay /*+ (m_size.cy==480?(1000/29.97+1):(1000/25))*/;
 
         ASSERT(t2 > t1);
 
         if (t2 <= 0) {
-            continue;
+            return;
         }
         if (t1 < 0) {
             t1 = 0;
@@ -1831,41 +2393,74 @@ bool CVobSubFile::SaveWinSubMux(CString fn, int delay)
                    bmpfn.GetString(),
                    t1 / 1000 / 60 / 60, (t1 / 1000 / 60) % 60, (t1 / 1000) % 60, (t1 % 1000) / 10,
                    t2 / 1000 / 60 / 60, (t2 / 1000 / 60) % 60, (t2 / 1000) % 60, (t2 % 1000) / 10,
-                   m_img.rect.Width(), m_img.rect.Height(), m_img.rect.left, m_img.rect.top,
+                   subPic.rect.Width(), subPic.rect.Height(), subPic.rect.left, subPic.rect.top,
                    (tr[0] << 4) | tr[0], (tr[1] << 4) | tr[1], (tr[2] << 4) | tr[2], (tr[3] << 4) | tr[3]);
         f.WriteString(str);
 
-        BITMAPFILEHEADER fhdr = {
-            0x4d42,
-            sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + 16 * sizeof(RGBQUAD) + pitch * h,
-            0, 0,
-            sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + 16 * sizeof(RGBQUAD)
-        };
-
-        BITMAPINFOHEADER ihdr = {
-            sizeof(BITMAPINFOHEADER),
-            w, h, 1, 4, 0,
-            0,
-            pitch * h, 0,
-            16, 4
-        };
-
         CFile bmp;
         if (bmp.Open(bmpfn, CFile::modeCreate | CFile::modeWrite | CFile::typeBinary | CFile::shareDenyWrite)) {
-            bmp.Write(&fhdr, sizeof(fhdr));
-            bmp.Write(&ihdr, sizeof(ihdr));
-            bmp.Write(uipal, sizeof(RGBQUAD) * 16);
-            bmp.Write(p4bpp, pitch * h);
+            bmp.Write(subPic.bmp.data(), UINT(subPic.bmp.size()));
             bmp.Close();
 
             CompressFile(bmpfn);
         }
+    };
+
+    return ExportSubPics(encode, write, progress, bParallel);
+}
+
+// The full frame bitmaps of the Scenarist and Maestro scripts, the subpicture is expected
+// to be decoded with the colors of the first entries of pal
+static void EncodeFrameBitmap(const CVobSubImage& img, int height, const RGBQUAD* pal /*[16]*/, std::vector<BYTE>& bmp)
+{
+    BITMAPFILEHEADER fhdr = {
+        0x4d42,
+        sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + 16 * sizeof(RGBQUAD) + 360 * (height - 2),
+        0, 0,
+        sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + 16 * sizeof(RGBQUAD)
+    };
+
+    BITMAPINFOHEADER ihdr = {
+        sizeof(BITMAPINFOHEADER),
+        720, height - 2, 1, 4, 0,
+        DWORD(360 * (height - 2)),
+        0, 0,
+        16, 4
+    };
+
+    bmp.resize(fhdr.bfSize);
+    memcpy(bmp.data(), &fhdr, sizeof(fhdr));
+    memcpy(bmp.data() + sizeof(fhdr), &ihdr, sizeof(ihdr));
+    memcpy(bmp.data() + sizeof(fhdr) + sizeof(ihdr), pal, sizeof(RGBQUAD) * 16);
+
+    BYTE* p4bpp = bmp.data() + fhdr.bfOffBits;
+
+    for (int j = 0; j < 5; j++) {
+        if (j == 4 || !img.pal[j].tr) {
+            j &= 3;
+            memset(p4bpp, (j << 4) | j, (height - 2) * 360);
+            break;
+        }
     }
 
-    return true;
+    for (ptrdiff_t y = std::max(img.rect.top + 1, 2l); y < img.rect.bottom - 1; y++) {
+        ASSERT(height - y - 1 >= 0);
+        if (height - y - 1 < 0) {
+            break;
+        }
+
+        const DWORD* p = (const DWORD*)&img.lpPixels[(y - img.rect.top) * img.rect.Width() + 1];
+
+        for (ptrdiff_t x = img.rect.left + 1; x < img.rect.right - 1; x++, p++) {
+            DWORD rgb = *p & 0xffffff;
+            BYTE c = rgb == 0x0000ff ? 0 : rgb == 0xff0000 ? 1 : rgb == 0x000000 ? 2 : 3;
+            BYTE& c4bpp = p4bpp[(height - y - 1) * 360 + (x >> 1)];
+            c4bpp = (x & 1) ? ((c4bpp & 0xf0) | c) : ((c4bpp & 0x0f) | (c << 4));
+        }
+    }
 }
 
-bool CVobSubFile::SaveScenarist(CString fn, int delay)
+bool CVobSubFile::SaveScenarist(CString fn, int delay, const ExportProgress& progress, bool bParallel)
 {
     TrimExtension(fn);
 
@@ -1874,8 +2469,6 @@ bool CVobSubFile::SaveScenarist(CString fn, int delay)
         return false;
     }
 
-    m_img.Invalidate();
-
     fn.Replace('\\', '/');
     CString title = fn.Mid(fn.ReverseFind('/') + 1);
 
@@ -1938,32 +2531,12 @@ bool CVobSubFile::SaveScenarist(CString fn, int delay)
         {125, 0, 125, 0},
     };
 
-    BITMAPFILEHEADER fhdr = {
-        0x4d42,
-        sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + 16 * sizeof(RGBQUAD) + 360 * (m_size.cy - 2),
-        0, 0,
-        sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + 16 * sizeof(RGBQUAD)
-    };
-
-    BITMAPINFOHEADER ihdr = {
-        sizeof(BITMAPINFOHEADER),
-        720, m_size.cy - 2, 1, 4, 0,
-        DWORD(360 * (m_size.cy - 2)),
-        0, 0,
-        16, 4
-    };
-
     bool bCustomPal = m_bCustomPal;
     m_bCustomPal = true;
     RGBQUAD tempCusPal[4], newCusPal[4 + 12] = {{255, 0, 0, 0}, {0, 0, 255, 0}, {0, 0, 0, 0}, {255, 255, 255, 0}};
     memcpy(tempCusPal, m_cuspal, sizeof(tempCusPal));
     memcpy(m_cuspal, newCusPal, sizeof(m_cuspal));
 
-    CAutoVectorPtr<BYTE> p4bpp;
-    if (!p4bpp.Allocate((m_size.cy - 2) * 360)) {
-        return false;
-    }
-
     BYTE colormap[16];
 
     for (size_t i = 0; i < 16; i++) {
@@ -1987,34 +2560,16 @@ bool CVobSubFile::SaveScenarist(CString fn, int delay)
 
     int pc[4] = {1, 1, 1, 1}, pa[4] = {15, 15, 15, 0};
 
-    CAtlArray<SubPos>& sp = m_langs[m_nLang].subpos;
-    for (size_t i = 0, k = 0; i < sp.GetCount(); i++) {
-        if (!GetFrame(i)) {
-            continue;
-        }
-
-        for (int j = 0; j < 5; j++) {
-            if (j == 4 || !m_img.pal[j].tr) {
-                j &= 3;
-                memset(p4bpp, (j << 4) | j, (m_size.cy - 2) * 360);
-                break;
-            }
-        }
-
-        for (ptrdiff_t y = std::max(m_img.rect.top + 1, 2l); y < m_img.rect.bottom - 1; y++) {
-            ASSERT(m_size.cy - y - 1 >= 0);
-            if (m_size.cy - y - 1 < 0) {
-                break;
-            }
-
-            DWORD* p = (DWORD*)&m_img.lpPixels[(y - m_img.rect.top) * m_img.rect.Width() + 1];
+    int height = m_size.cy;
+    auto encode = [height, &newCusPal](const CVobSubImage & img, ExportedSubPic & subPic) {
+        EncodeFrameBitmap(img, height, newCusPal, subPic.bmp);
+    };
 
-            for (ptrdiff_t x = m_img.rect.left + 1; x < m_img.rect.right - 1; x++, p++) {
-                DWORD rgb = *p & 0xffffff;
-                BYTE c = rgb == 0x0000ff ? 0 : rgb == 0xff0000 ? 1 : rgb == 0x000000 ? 2 : 3;
-                BYTE& c4bpp = p4bpp[(m_size.cy - y - 1) * 360 + (x >> 1)];
-                c4bpp = (x & 1) ? ((c4bpp & 0xf0) | c) : ((c4bpp & 0x0f) | (c << 4));
-            }
+    CAtlArray<SubPos>& sp = m_langs[m_nLang].subpos;
+    size_t k = 0;
+    auto write = [&](size_t i, const ExportedSubPic & subPic) {
+        if (!subPic.bOk) {
+            return;
         }
 
         CString bmpfn;
@@ -2022,7 +2577,7 @@ bool CVobSubFile::SaveScenarist(CString fn, int delay)
         title = bmpfn.Mid(bmpfn.ReverseFind('/') + 1);
 
         // E1, E2, P, Bg
-        int c[4] = {colormap[m_img.pal[1].pal], colormap[m_img.pal[2].pal], colormap[m_img.pal[0].pal], colormap[m_img.pal[3].pal]};
+        int c[4] = {colormap[subPic.pal[1].pal], colormap[subPic.pal[2].pal], colormap[subPic.pal[0].pal], colormap[subPic.pal[3].pal]};
         c[0] ^= c[1], c[1] ^= c[0], c[0] ^= c[1];
 
         if (memcmp(pc, c, sizeof(c))) {
@@ -2032,7 +2587,7 @@ bool CVobSubFile::SaveScenarist(CString fn, int delay)
         }
 
         // E1, E2, P, Bg
-        int a[4] = {m_img.pal[1].tr, m_img.pal[2].tr, m_img.pal[0].tr, m_img.pal[3].tr};
+        int a[4] = {subPic.pal[1].tr, subPic.pal[2].tr, subPic.pal[0].tr, subPic.pal[3].tr};
         a[0] ^= a[1], a[1] ^= a[0], a[0] ^= a[1];
 
         if (memcmp(pa, a, sizeof(a))) {
@@ -2050,7 +2605,7 @@ bool CVobSubFile::SaveScenarist(CString fn, int delay)
         int f2 = (int)((m_size.cy == 480 ? 29.97 : 25) * (t2 % 1000) / 1000);
 
         if (t2 <= 0) {
-            continue;
+            return;
         }
         if (t1 < 0) {
             t1 = 0;
@@ -2097,7 +2652,7 @@ bool CVobSubFile::SaveScenarist(CString fn, int delay)
         }
 
         if (h1 == h2 && m1 == m2 && s1 == s2 && f1 == f2) {
-            continue;
+            return;
         }
 
         str.Format(_T("%04u\t%02d:%02d:%02d:%02d\t%02d:%02d:%02d:%02d\t%s\n"),
@@ -2109,23 +2664,22 @@ bool CVobSubFile::SaveScenarist(CString fn, int delay)
 
         CFile bmp;
         if (bmp.Open(bmpfn, CFile::modeCreate | CFile::modeWrite | CFile::modeRead | CFile::typeBinary)) {
-            bmp.Write(&fhdr, sizeof(fhdr));
-            bmp.Write(&ihdr, sizeof(ihdr));
-            bmp.Write(newCusPal, sizeof(RGBQUAD) * 16);
-            bmp.Write(p4bpp, 360 * (m_size.cy - 2));
+            bmp.Write(subPic.bmp.data(), UINT(subPic.bmp.size()));
             bmp.Close();
 
             CompressFile(bmpfn);
         }
-    }
+    };
+
+    bool bRet = ExportSubPics(encode, write, progress, bParallel);
 
     m_bCustomPal = bCustomPal;
     memcpy(m_cuspal, tempCusPal, sizeof(m_cuspal));
 
-    return true;
+    return bRet;
 }
 
-bool CVobSubFile::SaveMaestro(CString fn, int delay)
+bool CVobSubFile::SaveMaestro(CString fn, int delay, const ExportProgress& progress, bool bParallel)
 {
     TrimExtension(fn);
 
@@ -2134,8 +2688,6 @@ bool CVobSubFile::SaveMaestro(CString fn, int delay)
         return false;
     }
 
-    m_img.Invalidate();
-
     fn.Replace('\\', '/');
     CString title = fn.Mid(fn.ReverseFind('/') + 1);
 
@@ -2174,32 +2726,12 @@ bool CVobSubFile::SaveMaestro(CString fn, int delay)
 
     f.Flush();
 
-    BITMAPFILEHEADER fhdr = {
-        0x4d42,
-        sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + 16 * sizeof(RGBQUAD) + 360 * (m_size.cy - 2),
-        0, 0,
-        sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + 16 * sizeof(RGBQUAD)
-    };
-
-    BITMAPINFOHEADER ihdr = {
-        sizeof(BITMAPINFOHEADER),
-        720, m_size.cy - 2, 1, 4, 0,
-        DWORD(360 * (m_size.cy - 2)),
-        0, 0,
-        16, 4
-    };
-
     bool bCustomPal = m_bCustomPal;
     m_bCustomPal = true;
     RGBQUAD tempCusPal[4], newCusPal[4 + 12] = {{255, 0, 0, 0}, {0, 0, 255, 0}, {0, 0, 0, 0}, {255, 255, 255, 0}};
     memcpy(tempCusPal, m_cuspal, sizeof(tempCusPal));
     memcpy(m_cuspal, newCusPal, sizeof(m_cuspal));
 
-    CAutoVectorPtr<BYTE> p4bpp;
-    if (!p4bpp.Allocate((m_size.cy - 2) * 360)) {
-        return false;
-    }
-
     BYTE colormap[16];
     for (BYTE i = 0; i < 16; i++) {
         colormap[i] = i;
@@ -2217,34 +2749,16 @@ bool CVobSubFile::SaveMaestro(CString fn, int delay)
 
     int pc[4] = {1, 1, 1, 1}, pa[4] = {15, 15, 15, 0};
 
-    CAtlArray<SubPos>& sp = m_langs[m_nLang].subpos;
-    for (size_t i = 0, k = 0; i < sp.GetCount(); i++) {
-        if (!GetFrame(i)) {
-            continue;
-        }
-
-        for (int j = 0; j < 5; j++) {
-            if (j == 4 || !m_img.pal[j].tr) {
-                j &= 3;
-                memset(p4bpp, (j << 4) | j, (m_size.cy - 2) * 360);
-                break;
-            }
-        }
-
-        for (ptrdiff_t y = std::max(m_img.rect.top + 1, 2l); y < m_img.rect.bottom - 1; y++) {
-            ASSERT(m_size.cy - y - 1 >= 0);
-            if (m_size.cy - y - 1 < 0) {
-                break;
-            }
-
-            DWORD* p = (DWORD*)&m_img.lpPixels[(y - m_img.rect.top) * m_img.rect.Width() + 1];
+    int height = m_size.cy;
+    auto encode = [height, &newCusPal](const CVobSubImage & img, ExportedSubPic & subPic) {
+        EncodeFrameBitmap(img, height, newCusPal, subPic.bmp);
+    };
 
-            for (ptrdiff_t x = m_img.rect.left + 1; x < m_img.rect.right - 1; x++, p++) {
-                DWORD rgb = *p & 0xffffff;
-                BYTE c = rgb == 0x0000ff ? 0 : rgb == 0xff0000 ? 1 : rgb == 0x000000 ? 2 : 3;
-                BYTE& c4bpp = p4bpp[(m_size.cy - y - 1) * 360 + (x >> 1)];
-                c4bpp = (x & 1) ? ((c4bpp & 0xf0) | c) : ((c4bpp & 0x0f) | (c << 4));
-            }
+    CAtlArray<SubPos>& sp = m_langs[m_nLang].subpos;
+    size_t k = 0;
+    auto write = [&](size_t i, const ExportedSubPic & subPic) {
+        if (!subPic.bOk) {
+            return;
         }
 
         CString bmpfn;
@@ -2252,7 +2766,7 @@ bool CVobSubFile::SaveMaestro(CString fn, int delay)
         title = bmpfn.Mid(bmpfn.ReverseFind('/') + 1);
 
         // E1, E2, P, Bg
-        int c[4] = {colormap[m_img.pal[1].pal], colormap[m_img.pal[2].pal], colormap[m_img.pal[0].pal], colormap[m_img.pal[3].pal]};
+        int c[4] = {colormap[subPic.pal[1].pal], colormap[subPic.pal[2].pal], colormap[subPic.pal[0].pal], colormap[subPic.pal[3].pal]};
 
         if (memcmp(pc, c, sizeof(c))) {
             memcpy(pc, c, sizeof(c));
@@ -2261,7 +2775,7 @@ bool CVobSubFile::SaveMaestro(CString fn, int delay)
         }
 
         // E1, E2, P, Bg
-        int a[4] = {m_img.pal[1].tr, m_img.pal[2].tr, m_img.pal[0].tr, m_img.pal[3].tr};
+        int a[4] = {subPic.pal[1].tr, subPic.pal[2].tr, subPic.pal[0].tr, subPic.pal[3].tr};
 
         if (memcmp(pa, a, sizeof(a))) {
             memcpy(pa, a, sizeof(a));
@@ -2278,7 +2792,7 @@ bool CVobSubFile::SaveMaestro(CString fn, int delay)
         int f2 = (int)((m_size.cy == 480 ? 29.97 : 25) * (t2 % 1000) / 1000);
 
         if (t2 <= 0) {
-            continue;
+            return;
         }
         if (t1 < 0) {
             t1 = 0;
@@ -2325,7 +2839,7 @@ bool CVobSubFile::SaveMaestro(CString fn, int delay)
         }
 
         if (h1 == h2 && m1 == m2 && s1 == s2 && f1 == f2) {
-            continue;
+            return;
         }
 
         str.Format(_T("%04u\t%02d:%02d:%02d:%02d\t%02d:%02d:%02d:%02d\t%s\n"),
@@ -2337,20 +2851,19 @@ bool CVobSubFile::SaveMaestro(CString fn, int delay)
 
         CFile bmp;
         if (bmp.Open(bmpfn, CFile::modeCreate | CFile::modeWrite | CFile::typeBinary)) {
-            bmp.Write(&fhdr, sizeof(fhdr));
-            bmp.Write(&ihdr, sizeof(ihdr));
-            bmp.Write(newCusPal, sizeof(RGBQUAD) * 16);
-            bmp.Write(p4bpp, 360 * (m_size.cy - 2));
+            bmp.Write(subPic.bmp.data(), UINT(subPic.bmp.size()));
             bmp.Close();
 
             CompressFile(bmpfn);
         }
-    }
+    };
+
+    bool bRet = ExportSubPics(encode, write, progress, bParallel);
 
     m_bCustomPal = bCustomPal;
     memcpy(m_cuspal, tempCusPal, sizeof(m_cuspal));
 
-    return true;
+    return bRet;
 }
 
 //
@@ -22,7 +22,16 @@
 #pragma once
 
 #include <atlcoll.h>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "VobSubImage.h"
+#include "VobSubSectorFile.h"
+#include "RenderingCache.h"
+#include "RenderingCacheStats.h"
 #include "../SubPic/SubPicProviderImpl.h"
 
 #define VOBSUBIDXVER 7
@@ -77,8 +86,30 @@ public:
     void SetAlignment(bool bAlign, int x, int y, int hor = 1, int ver = 1);
 };
 
+// A decoded subpicture, and how long decoding it took if that was done ahead of playback
+struct CVobSubDecodedSubPic {
+    CVobSubImage::Decoded img;
+    bool bLookAhead = false;     // Decoded ahead and not displayed yet
+    LONGLONG decodeTime = 0;     // In microseconds
+};
+
+typedef std::shared_ptr<CVobSubDecodedSubPic> CVobSubDecodedSubPicSharedPtr;
+
+template<>
+struct CRenderingCacheSizeTraits<ULONGLONG, CVobSubDecodedSubPicSharedPtr> {
+    static size_t GetSize(const ULONGLONG& key, const CVobSubDecodedSubPicSharedPtr& value) {
+        size_t size = sizeof(key) + sizeof(CVobSubDecodedSubPic);
+        if (value) {
+            size += value->img.pixels.capacity() * sizeof(RGBQUAD);
+        }
+        return size;
+    }
+};
+
+typedef CRenderingCache<ULONGLONG, CVobSubDecodedSubPicSharedPtr> CVobSubDecodedCache;
+
 class __declspec(uuid("998D4C9A-460F-4de6-BDCD-35AB24F94ADF"))
-    CVobSubFile : public CVobSubSettings, public ISubStream, public CSubPicProviderImpl
+    CVobSubFile : public CVobSubSettings, public ISubStream, public CSubPicProviderImpl, public IRenderingCacheStats
 {
 public:
     struct SubPos {
@@ -103,6 +134,10 @@ public:
         CAtlArray<SubPos> subpos;
     };
 
+    // Called by the exporters with how many of the subpictures are written so far,
+    // returning false cancels the export
+    typedef std::function<bool(size_t nDone, size_t nTotal)> ExportProgress;
+
 protected:
     CString m_title;
 
@@ -110,7 +145,7 @@ protected:
     bool ReadIdx(CString fn, int& ver), ReadSub(CString fn), ReadRar(CString fn), ReadIfo(CString fn);
     bool WriteIdx(CString fn, int delay), WriteSub(CString fn);
 
-    CMemFile m_sub;
+    CVobSubSectorFile m_sub;
 
     BYTE* GetPacket(size_t idx, size_t& packetSize, size_t& dataSize, size_t nLang = SIZE_T_ERROR);
     const SubPos* GetFrameInfo(size_t idx, size_t nLang = SIZE_T_ERROR) const;
@@ -119,9 +154,65 @@ protected:
     size_t GetFrameIdxByTimeStamp(__int64 time);
 
     bool SaveVobSub(CString fn, int delay);
-    bool SaveWinSubMux(CString fn, int delay);
-    bool SaveScenarist(CString fn, int delay);
-    bool SaveMaestro(CString fn, int delay);
+    bool SaveWinSubMux(CString fn, int delay, const ExportProgress& progress, bool bParallel);
+    bool SaveScenarist(CString fn, int delay, const ExportProgress& progress, bool bParallel);
+    bool SaveMaestro(CString fn, int delay, const ExportProgress& progress, bool bParallel);
+
+    // A subpicture of the current language, as GetFrame() would have decoded it and
+    // converted by the exporter
+    struct ExportedSubPic {
+        bool bOk = false;           // What GetFrame() would have returned
+        CRect rect;
+        __int64 start = 0, delay = 0;
+        CVobSubImage::SubPal pal[4];
+        std::vector<BYTE> bmp;      // The bitmap file
+    };
+
+    // The subpictures are decoded and passed to encode on the worker pool, a few of them
+    // ahead of the one being written. write is called on the calling thread for each of
+    // them, in order, so the output is the same whatever the number of threads. Without
+    // bParallel, each subpicture is encoded on the calling thread right before it is written.
+    bool ExportSubPics(const std::function<void(const CVobSubImage& img, ExportedSubPic& subPic)>& encode,
+                       const std::function<void(size_t i, const ExportedSubPic& subPic)>& write,
+                       const ExportProgress& progress, bool bParallel);
+
+private:
+    // The still subpictures decoded during playback, keyed by language and index, so that
+    // seeking back to them doesn't decode their packet again. They are decoded with the
+    // palette they were cached with, m_decodedGeneration changes when it or the file does.
+    struct DecodePalette {
+        bool bCustomPal;
+        int tridx;
+        RGBQUAD orgpal[16], cuspal[4];
+    };
+    CVobSubDecodedCache m_decodedCache;
+    DecodePalette m_decodedPalette;
+    unsigned int m_decodedGeneration;
+
+    static ULONGLONG GetDecodedKey(size_t nLang, size_t idx) { return (ULONGLONG(nLang) << 32) | idx; }
+    void CheckDecodedPalette();
+
+    // Decodes the subpictures of the next few seconds on a low priority thread, so that
+    // GetFrame mostly finds them in m_decodedCache. Same scheme as the look-ahead of
+    // CRenderedTextSubtitle: the worker only polls m_pLock and gives up on a newer
+    // request or a stop, so the destructor can always join it.
+    struct LookAheadState {
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool bExit = false;
+        bool bBusy = false; // A request is queued or running
+        unsigned int request = 0;
+        __int64 rt = 0;     // ms
+    };
+    std::shared_ptr<LookAheadState> m_pLookAhead;
+    std::thread m_lookAheadThread;
+    CLookAheadStats m_lookAheadStats;
+
+    void QueueLookAhead(__int64 rt);
+    void LookAhead(__int64 rt, unsigned int request);
+    bool LockForLookAhead(unsigned int request);
+    static void LookAheadThread(std::shared_ptr<LookAheadState> pState, CVobSubFile* pVSF);
+    void JoinLookAheadThread();
 
 public:
     size_t m_nLang;
@@ -141,9 +232,28 @@ public:
     };
 
     bool Open(CString fn);
-    bool Save(CString fn, int delay = 0, SubFormat sf = VobSub);
+    // Only the formats with bitmaps report their progress and can be canceled, the files written
+    // before the export was canceled are left as is. Their bitmaps are encoded on the worker pool
+    // unless bParallel is false, which gives the same files.
+    bool Save(CString fn, int delay = 0, SubFormat sf = VobSub, const ExportProgress& progress = nullptr,
+              bool bParallel = true);
     void Close();
 
+    // A subpicture converted to an ASS drawing by Polygonize()
+    struct PolygonizedSubPic {
+        size_t idx;          // In the subpos of the language
+        __int64 start, stop; // ms
+        bool bForced;
+        CStringW assstr;     // As given by CVobSubImage::Polygonize()
+    };
+
+    // Converts all the subpictures of a language, the current one by default, to ASS drawings.
+    // They are decoded and vectorized in parallel on the shared worker pool but they are
+    // returned in order, the result doesn't depend on the number of threads. Those which
+    // can't be decoded or don't draw anything are left out. The packets are only read on
+    // the calling thread so, like for Save(), it is up to the caller to hold the lock.
+    bool Polygonize(std::vector<PolygonizedSubPic>& subPics, size_t nLang = SIZE_T_ERROR, bool bSmooth = true, int scale = 3);
+
     CString GetTitle() { return m_title; }
 
     DECLARE_IUNKNOWN
@@ -168,6 +278,15 @@ public:
     STDMETHODIMP SetStream(int iStream);
     STDMETHODIMP Reload();
     STDMETHODIMP SetSourceTargetInfo(CString yuvMatrix, int targetBlackLevel, int targetWhiteLevel) { return E_NOTIMPL; };
+
+    // IRenderingCacheStats
+    STDMETHODIMP_(int) GetCacheCount();
+    STDMETHODIMP GetCacheStats(int i, LPCWSTR* ppName, CRenderingCacheStats* pStats);
+    STDMETHODIMP SetCacheBudget(int i, size_t maxBytes);
+    STDMETHODIMP GetBufferPoolStats(CBufferPoolStats* pStats);
+    STDMETHODIMP SetLookAheadDepth(int depth);
+    STDMETHODIMP GetLookAheadStats(CLookAheadStats* pStats);
+    STDMETHODIMP StopLookAhead();
 };
 
 class __declspec(uuid("D7FBFB45-2D13-494F-9B3D-FFC9557D5C45"))
@@ -29,12 +29,11 @@ CVobSubImage::CVobSubImage()
     : org(CSize(0, 0))
     , lpTemp1(nullptr)
     , lpTemp2(nullptr)
-    , nPlane(0)
     , bCustomPal(false)
-    , bAligned(true)
     , tridx(0)
     , orgpal(nullptr)
     , cuspal(nullptr)
+    , nOutlines(0)
     , nLang(SIZE_T_ERROR)
     , nIdx(SIZE_T_ERROR)
     , bForced(false)
@@ -53,6 +52,9 @@ CVobSubImage::~CVobSubImage()
     Free();
 }
 
+// How many pixels Decode() can write past the end of a run
+static const int RLE_RUN_OVERWRITE = 8;
+
 bool CVobSubImage::Alloc(int w, int h)
 {
     // if there is nothing to crop TrimSubImage might even add a 1 pixel
@@ -63,7 +65,7 @@ bool CVobSubImage::Alloc(int w, int h)
         Free();
 
         try {
-            lpTemp1 = DEBUG_NEW RGBQUAD[w * h];
+            lpTemp1 = DEBUG_NEW RGBQUAD[w * h + RLE_RUN_OVERWRITE];
         } catch (CMemoryException* e) {
             ASSERT(FALSE);
             e->Delete();
@@ -97,6 +99,39 @@ void CVobSubImage::Free()
     lpPixels = nullptr;
 }
 
+namespace
+{
+    // The run-length codes of DVD subpictures take 1 to 4 nibbles depending on how many leading
+    // zero bits they have: 01RR, 0001RRRR, 000001RRRRRR and 0000000RRRRRRRR, followed by the
+    // 2 bits of the color. Indexed by the first 8 bits of a code, this gives how far 16 bits
+    // starting with it must be shifted to the right to get the code alone.
+    struct RLECodeShifts {
+        BYTE shift[256];
+
+        RLECodeShifts() {
+            for (int i = 0; i < 256; i++) {
+                shift[i] = i >= 0x40 ? 12 : i >= 0x10 ? 8 : i >= 0x04 ? 4 : 0;
+            }
+        }
+    } static const s_rleCodeShifts;
+
+    // The 16 bits starting at the given nibble, zero past the end of the data
+    inline DWORD Peek16(const BYTE* lpData, size_t size, size_t nibble)
+    {
+        size_t i = nibble >> 1;
+        DWORD bits;
+        if (i + 3 <= size) {
+            bits = (lpData[i] << 16) | (lpData[i + 1] << 8) | lpData[i + 2];
+        } else {
+            bits = 0;
+            for (size_t j = i; j < i + 3; j++) {
+                bits = (bits << 8) | (j < size ? lpData[j] : 0);
+            }
+        }
+        return (bits >> ((nibble & 1) ? 4 : 8)) & 0xffff;
+    }
+}
+
 bool CVobSubImage::Decode(BYTE* _lpData, size_t _packetSize, size_t _dataSize, int _t,
                           bool _bCustomPal,
                           int _tridx,
@@ -111,43 +146,74 @@ bool CVobSubImage::Decode(BYTE* _lpData, size_t _packetSize, size_t _dataSize, i
 
     lpPixels = lpTemp1;
 
-    nPlane = 0;
-    bAligned = true;
-
     bCustomPal = _bCustomPal;
     orgpal = _orgpal;
     tridx = _tridx;
     cuspal = _cuspal;
 
-    CPoint p = rect.TopLeft();
+    // The colors are resolved once instead of for every run
+    DWORD colors[4];
+    for (size_t i = 0; i < 4; i++) {
+        RGBQUAD c;
+        if (!bCustomPal) {
+            c = orgpal[pal[i].pal];
+            c.rgbReserved = (pal[i].tr << 4) | pal[i].tr;
+        } else {
+            c = cuspal[i];
+        }
+        colors[i] = *(DWORD*)&c;
+    }
 
+    // The even and the odd lines are stored one after the other, each line starts on a byte
+    const int w = rect.Width();
+    size_t nibble[] = { nOffset[0] * 2, nOffset[1] * 2 };
     size_t end[] = { nOffset[1], _dataSize };
+    size_t plane = 0;
+    LONG y = rect.top;
 
-    while (nOffset[nPlane] < end[nPlane]) {
-        DWORD code;
+    for (;;) {
+        DWORD* row = y < rect.bottom ? (DWORD*)&lpPixels[w * (y - rect.top)] : nullptr;
+        size_t& n = nibble[plane];
+        int x = 0;
 
-        if ((code = GetNibble(_lpData)) >= 0x4
-                || (code = (code << 4) | GetNibble(_lpData)) >= 0x10
-                || (code = (code << 4) | GetNibble(_lpData)) >= 0x40
-                || (code = (code << 4) | GetNibble(_lpData)) >= 0x100) {
-            DrawPixels(p, code >> 2, code & 3);
-            if ((p.x += code >> 2) < rect.right) {
-                continue;
+        // The line is left unfinished when the data of its field ends in the middle of it
+        bool bComplete = false;
+        while ((n >> 1) < end[plane]) {
+            DWORD bits = Peek16(_lpData, _packetSize, n);
+            BYTE shift = s_rleCodeShifts.shift[bits >> 8];
+            DWORD code = bits >> shift;
+            n += (16 - shift) >> 2;
+
+            // The codes shorter than 64 pixels written on 4 nibbles fill the rest of the line
+            bool bFill = shift == 0 && code < 0x100;
+            int length = bFill ? w - x : std::min<int>(code >> 2, w - x);
+            if (row && length > 0) {
+                // 8 pixels at a time, those written past the end of the run are overwritten
+                // by the next runs or are outside of the decoded lines
+                DWORD* dst = &row[x];
+                const DWORD c = colors[code & 3];
+                for (int i = 0; i < length; i += RLE_RUN_OVERWRITE) {
+                    for (int j = 0; j < RLE_RUN_OVERWRITE; j++) {
+                        dst[i + j] = c;
+                    }
+                }
+            }
+            if (bFill || (x += code >> 2) >= w) {
+                bComplete = true;
+                break;
             }
         }
 
-        DrawPixels(p, rect.right - p.x, code & 3);
-
-        if (!bAligned) {
-            GetNibble(_lpData);    // align to byte
+        if (!bComplete) {
+            break;
         }
 
-        p.x = rect.left;
-        p.y++;
-        nPlane = 1 - nPlane;
+        n = (n + 1) & ~size_t(1);
+        y++;
+        plane = 1 - plane;
     }
 
-    rect.bottom = std::min(p.y, rect.bottom);
+    rect.bottom = std::min(y, rect.bottom);
 
     if (_bTrim) {
         TrimSubImage();
@@ -156,6 +222,34 @@ bool CVobSubImage::Decode(BYTE* _lpData, size_t _packetSize, size_t _dataSize, i
     return true;
 }
 
+void CVobSubImage::GetDecoded(Decoded& decoded) const
+{
+    decoded.rect = rect;
+    decoded.bForced = bForced;
+    decoded.bAnimated = bAnimated;
+    decoded.tCurrent = tCurrent;
+    if (lpPixels && !rect.IsRectEmpty()) {
+        decoded.pixels.assign(lpPixels, lpPixels + rect.Width() * rect.Height());
+    } else {
+        decoded.pixels.clear();
+    }
+}
+
+bool CVobSubImage::SetDecoded(const Decoded& decoded)
+{
+    if (!Alloc(decoded.rect.Width(), decoded.rect.Height())) {
+        return false;
+    }
+
+    rect = decoded.rect;
+    bForced = decoded.bForced;
+    bAnimated = decoded.bAnimated;
+    tCurrent = decoded.tCurrent;
+    std::copy(decoded.pixels.cbegin(), decoded.pixels.cend(), lpPixels);
+
+    return true;
+}
+
 void CVobSubImage::GetPacketInfo(const BYTE* lpData, size_t packetSize, size_t dataSize, int t /*= INT_MAX*/)
 {
     //  delay = 0;
@@ -270,54 +364,6 @@ void CVobSubImage::GetPacketInfo(const BYTE* lpData, size_t packetSize, size_t d
     bAnimated = (nPal > 1 || nTr > 1);
 }
 
-BYTE CVobSubImage::GetNibble(const BYTE* lpData)
-{
-    size_t& off = nOffset[nPlane];
-    BYTE ret = lpData[off];
-    if (bAligned) {
-        ret >>= 4;
-    }
-    ret &= 0x0f;
-    bAligned = !bAligned;
-    if (bAligned) {
-        off++;
-    }
-    return ret;
-}
-
-void CVobSubImage::DrawPixels(CPoint p, int length, size_t colorId)
-{
-    if (length <= 0
-            || p.x + length < rect.left
-            || p.x >= rect.right
-            || p.y < rect.top
-            || p.y >= rect.bottom) {
-        return;
-    }
-
-    if (p.x < rect.left) {
-        p.x = rect.left;
-    }
-    if (p.x + length >= rect.right) {
-        length = rect.right - p.x;
-    }
-
-    RGBQUAD* ptr = &lpPixels[rect.Width() * (p.y - rect.top) + (p.x - rect.left)];
-
-    RGBQUAD c;
-
-    if (!bCustomPal) {
-        c = orgpal[pal[colorId].pal];
-        c.rgbReserved = (pal[colorId].tr << 4) | pal[colorId].tr;
-    } else {
-        c = cuspal[colorId];
-    }
-
-    while (length-- > 0) {
-        *ptr++ = c;
-    }
-}
-
 void CVobSubImage::TrimSubImage()
 {
     CRect r;
@@ -384,27 +430,24 @@ void CVobSubImage::TrimSubImage()
 
 #define GP(xx, yy) (((xx) < 0 || (yy) < 0 || (xx) >= w || (yy) >= h) ? 0 : p[(yy) * w + (xx)])
 
-CAutoPtrList<COutline>* CVobSubImage::GetOutlineList(CPoint& topleft)
+bool CVobSubImage::GetOutlineList(CPoint& topleft)
 {
+    nOutlines = 0;
+
     int w = rect.Width(), h = rect.Height(), len = w * h;
     if (len <= 0) {
-        return nullptr;
-    }
-
-    CAutoVectorPtr<BYTE> p;
-    if (!p.Allocate(len)) {
-        return nullptr;
+        return false;
     }
 
-    CAutoPtrList<COutline>* ol;
     try {
-        ol = DEBUG_NEW CAutoPtrList<COutline>();
+        outlineMask.resize(len);
     } catch (CMemoryException* e) {
         ASSERT(FALSE);
         e->Delete();
-        return nullptr;
+        return false;
     }
 
+    BYTE* p = outlineMask.data();
     BYTE* cp = p;
     RGBQUAD* rgbp = (RGBQUAD*)lpPixels;
 
@@ -444,15 +487,19 @@ CAutoPtrList<COutline>* CVobSubImage::GetOutlineList(CPoint& topleft)
 
         int ox = x, oy = y, odir = dir;
 
-        CAutoPtr<COutline> o;
-        try {
-            o.Attach(DEBUG_NEW COutline);
-        } catch (CMemoryException* e) {
-            ASSERT(FALSE);
-            e->Delete();
-            break;
+        if (nOutlines == outlines.size()) {
+            try {
+                outlines.emplace_back();
+            } catch (CMemoryException* e) {
+                ASSERT(FALSE);
+                e->Delete();
+                break;
+            }
         }
 
+        COutline* o = &outlines[nOutlines];
+        o->RemoveAll();
+
         do {
             CPoint pp;
             BYTE fl = 0;
@@ -558,19 +605,19 @@ CAutoPtrList<COutline>* CVobSubImage::GetOutlineList(CPoint& topleft)
             }
         } while (!(x == ox && y == oy && dir == odir));
 
-        if (!o->pa.IsEmpty() && (x == ox && y == oy && dir == odir)) {
-            ol->AddTail(o);
+        if (!o->pa.empty() && (x == ox && y == oy && dir == odir)) {
+            nOutlines++;
         } else {
             ASSERT(0);
         }
     }
 
-    return ol;
+    return true;
 }
 
 static bool FitLine(const COutline& o, int& start, int& end)
 {
-    int len = (int)o.pa.GetCount();
+    int len = (int)o.pa.size();
     if (len < 7) {
         return false;    // small segments should be handled with beziers...
     }
@@ -694,7 +741,7 @@ static bool FitLine(const COutline& o, int& start, int& end)
 
 static int CalcPossibleCurveDegree(const COutline& o)
 {
-    size_t len2 = o.da.GetCount();
+    size_t len2 = o.da.size();
 
     CUIntArray la;
 
@@ -763,9 +810,9 @@ inline double vectlen(CPoint p1, CPoint p2)
 
 static bool MinMaxCosfi(COutline& o, double& mincf, double& maxcf) // not really cosfi, it is weighted by the distance from the segment endpoints, and since it would be always between -1 and 0, the applied sign marks side
 {
-    CAtlArray<CPoint>& pa = o.pa;
+    const std::vector<CPoint>& pa = o.pa;
 
-    int len = (int)pa.GetCount();
+    int len = (int)pa.size();
     if (len < 6) {
         return false;
     }
@@ -800,9 +847,9 @@ static bool FitBezierVH(COutline& o, CPoint& p1, CPoint& p2)
 {
     int i;
 
-    CAtlArray<CPoint>& pa = o.pa;
+    const std::vector<CPoint>& pa = o.pa;
 
-    int len = (int)pa.GetCount();
+    int len = (int)pa.size();
 
     if (len <= 1) {
         return false;
@@ -906,7 +953,7 @@ int CVobSubImage::GrabSegment(int _start, const COutline& o, COutline& ret)
 {
     ret.RemoveAll();
 
-    int len = int(o.pa.GetCount());
+    int len = int(o.pa.size());
 
     int cur = (_start) % len, first = -1, last = -1;
     int lastDir = 0;
@@ -972,7 +1019,7 @@ int CVobSubImage::GrabSegment(int _start, const COutline& o, COutline& ret)
 
 void CVobSubImage::SplitOutline(const COutline& o, COutline& o1, COutline& o2)
 {
-    size_t len = o.pa.GetCount();
+    size_t len = o.pa.size();
     if (len < 4) {
         return;
     }
@@ -1035,7 +1082,7 @@ void CVobSubImage::SplitOutline(const COutline& o, COutline& o1, COutline& o2)
 
 void CVobSubImage::AddSegment(COutline& o, CAtlArray<BYTE>& pathTypes, CAtlArray<CPoint>& pathPoints)
 {
-    int i, len = int(o.pa.GetCount());
+    int i, len = int(o.pa.size());
     if (len < 3) {
         return;
     }
@@ -1155,7 +1202,7 @@ void CVobSubImage::AddSegment(COutline& o, CAtlArray<BYTE>& pathTypes, CAtlArray
         pathTypes.Add(PT_BEZIERTO);
         pathPoints.Add(p2);
         pathTypes.Add(PT_BEZIERTO);
-        pathPoints.Add(o.pa[o.pa.GetCount() - 1]);
+        pathPoints.Add(o.pa.back());
 
         return;
     }
@@ -1169,25 +1216,21 @@ void CVobSubImage::AddSegment(COutline& o, CAtlArray<BYTE>& pathTypes, CAtlArray
 bool CVobSubImage::Polygonize(CAtlArray<BYTE>& pathTypes, CAtlArray<CPoint>& pathPoints, bool bSmooth, int scale)
 {
     CPoint topleft;
-    CAutoPtr<CAutoPtrList<COutline>> ol(GetOutlineList(topleft));
-    if (!ol) {
+    if (!GetOutlineList(topleft)) {
         return false;
     }
 
-    POSITION pos;
-
-    pos = ol->GetHeadPosition();
-    while (pos) {
-        CAtlArray<CPoint>& pa = ol->GetNext(pos)->pa;
-        for (size_t i = 0; i < pa.GetCount(); i++) {
-            pa[i].x = (pa[i].x - topleft.x) << scale;
-            pa[i].y = (pa[i].y - topleft.y) << scale;
+    for (size_t j = 0; j < nOutlines; j++) {
+        for (CPoint& pt : outlines[j].pa) {
+            pt.x = (pt.x - topleft.x) << scale;
+            pt.y = (pt.y - topleft.y) << scale;
         }
     }
 
-    pos = ol->GetHeadPosition();
-    while (pos) {
-        COutline& o = *ol->GetNext(pos), o2;
+    COutline o2;
+
+    for (size_t j = 0; j < nOutlines; j++) {
+        COutline& o = outlines[j];
 
         if (bSmooth) {
             int i = 0, iFirst = -1;
@@ -1230,7 +1273,7 @@ bool CVobSubImage::Polygonize(CAtlArray<BYTE>& pathTypes, CAtlArray<CPoint>& pat
             pathTypes.Add(PT_MOVETO);
             pathPoints.Add(o.pa[0]);
 
-            for (size_t i = 1, len = o.pa.GetCount(); i < len; i++) {
+            for (size_t i = 1, len = o.pa.size(); i < len; i++) {
                 pathTypes.Add(PT_LINETO);
                 pathPoints.Add(o.pa[i]);
             }
@@ -22,17 +22,19 @@
 #pragma once
 
 #include <atlcoll.h>
+#include <vector>
 
 struct COutline {
-    CAtlArray<CPoint> pa;
-    CAtlArray<int> da;
+    std::vector<CPoint> pa;
+    std::vector<int> da;
+    // Keeps the storage, so that outlines can be reused
     void RemoveAll() {
-        pa.RemoveAll();
-        da.RemoveAll();
+        pa.clear();
+        da.clear();
     }
     void Add(CPoint p, int d) {
-        pa.Add(p);
-        da.Add(d);
+        pa.push_back(p);
+        da.push_back(d);
     }
 };
 
@@ -45,17 +47,19 @@ private:
     RGBQUAD* lpTemp1;
     RGBQUAD* lpTemp2;
 
-    size_t nOffset[2], nPlane;
+    size_t nOffset[2];
     bool bCustomPal;
-    bool bAligned;
     int tridx;
     RGBQUAD* orgpal /*[16]*/, * cuspal /*[4]*/;
 
+    // What GetOutlineList() traced, the outlines past nOutlines are only kept for their storage
+    std::vector<COutline> outlines;
+    size_t nOutlines;
+    std::vector<BYTE> outlineMask;
+
     bool Alloc(int w, int h);
     void Free();
 
-    BYTE GetNibble(const BYTE* lpData);
-    void DrawPixels(CPoint p, int length, size_t colorId);
     void TrimSubImage();
 
 public:
@@ -82,8 +86,18 @@ public:
                 RGBQUAD* orgpal /*[16]*/, RGBQUAD* cuspal /*[4]*/,
                 bool bTrim);
 
+    // What Decode() produced, so that the image can be restored without decoding its packet again
+    struct Decoded {
+        CRect rect;
+        bool bForced, bAnimated;
+        int tCurrent;
+        std::vector<RGBQUAD> pixels;
+    };
+    void GetDecoded(Decoded& decoded) const;
+    bool SetDecoded(const Decoded& decoded);
+
 private:
-    CAutoPtrList<COutline>* GetOutlineList(CPoint& topleft);
+    bool GetOutlineList(CPoint& topleft);
     int  GrabSegment(int start, const COutline& o, COutline& ret);
     void SplitOutline(const COutline& o, COutline& o1, COutline& o2);
     void AddSegment(COutline& o, CAtlArray<BYTE>& pathTypes, CAtlArray<CPoint>& pathPoints);
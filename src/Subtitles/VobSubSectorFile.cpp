@@ -0,0 +1,194 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+#include "VobSubSectorFile.h"
+#include <algorithm>
+
+CVobSubSectorFile::CVobSubSectorFile(UINT nGrowBytes /*= 1024*/)
+    : CMemFile(nGrowBytes)
+    , m_hSource(INVALID_HANDLE_VALUE)
+    , m_sourceLength(0)
+    , m_sourcePosition(0)
+    , m_useCount(0)
+{
+}
+
+CVobSubSectorFile::~CVobSubSectorFile()
+{
+    CloseSource();
+}
+
+bool CVobSubSectorFile::OpenSource(LPCTSTR fn)
+{
+    HANDLE hFile = CreateFile(fn, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    return AttachSource(hFile);
+}
+
+bool CVobSubSectorFile::AttachSource(HANDLE hFile)
+{
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(hFile, &size)) {
+        CloseHandle(hFile);
+        return false;
+    }
+
+    SetLength(0);
+
+    m_hSource = hFile;
+    m_sourceLength = size.QuadPart;
+    m_sourcePosition = 0;
+
+    return true;
+}
+
+void CVobSubSectorFile::CloseSource()
+{
+    if (m_hSource != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_hSource);
+        m_hSource = INVALID_HANDLE_VALUE;
+    }
+    m_sourceLength = m_sourcePosition = 0;
+
+    for (auto& b : m_blocks) {
+        b.size = 0;
+        b.data.clear();
+        b.data.shrink_to_fit();
+    }
+}
+
+ULONGLONG CVobSubSectorFile::GetPosition() const
+{
+    return HasSource() ? m_sourcePosition : __super::GetPosition();
+}
+
+ULONGLONG CVobSubSectorFile::Seek(LONGLONG lOff, UINT nFrom)
+{
+    if (!HasSource()) {
+        return __super::Seek(lOff, nFrom);
+    }
+
+    LONGLONG pos = lOff;
+    if (nFrom == CFile::current) {
+        pos += m_sourcePosition;
+    } else if (nFrom == CFile::end) {
+        pos += m_sourceLength;
+    }
+
+    if (pos < 0) {
+        AfxThrowFileException(CFileException::badSeek);
+    }
+
+    m_sourcePosition = pos;
+    return m_sourcePosition;
+}
+
+void CVobSubSectorFile::SetLength(ULONGLONG dwNewLen)
+{
+    CloseSource();
+    __super::SetLength(dwNewLen);
+}
+
+ULONGLONG CVobSubSectorFile::GetLength() const
+{
+    return HasSource() ? m_sourceLength : __super::GetLength();
+}
+
+UINT CVobSubSectorFile::Read(void* lpBuf, UINT nCount)
+{
+    if (!HasSource()) {
+        return __super::Read(lpBuf, nCount);
+    }
+
+    BYTE* pBuf = (BYTE*)lpBuf;
+    UINT nRead = 0;
+    while (nRead < nCount && m_sourcePosition < m_sourceLength) {
+        const Block* b = GetBlock(m_sourcePosition / BLOCK_SIZE);
+        DWORD offset = DWORD(m_sourcePosition % BLOCK_SIZE);
+        if (!b || offset >= b->size) {
+            break;
+        }
+
+        UINT size = std::min<UINT>(nCount - nRead, b->size - offset);
+        memcpy(&pBuf[nRead], &b->data[offset], size);
+        nRead += size;
+        m_sourcePosition += size;
+    }
+
+    return nRead;
+}
+
+void CVobSubSectorFile::Write(const void* lpBuf, UINT nCount)
+{
+    // The source is only read, SetLength() has to be called before writing
+    ASSERT(!HasSource());
+    if (HasSource()) {
+        AfxThrowNotSupportedException();
+    }
+
+    __super::Write(lpBuf, nCount);
+}
+
+const CVobSubSectorFile::Block* CVobSubSectorFile::GetBlock(ULONGLONG index)
+{
+    Block* lru = nullptr;
+    for (auto& b : m_blocks) {
+        if (b.size && b.index == index) {
+            b.lastUse = ++m_useCount;
+            return &b;
+        }
+        if (!lru || b.lastUse < lru->lastUse) {
+            lru = &b;
+        }
+    }
+
+    // The oldest block is replaced, the packets are mostly read in order
+    // so the same blocks are rarely needed again once we moved on
+    if (lru->data.empty()) {
+        try {
+            lru->data.resize(BLOCK_SIZE);
+        } catch (CMemoryException* e) {
+            ASSERT(FALSE);
+            e->Delete();
+            return nullptr;
+        }
+    }
+
+    OVERLAPPED ov = {};
+    ov.Offset = DWORD(index * BLOCK_SIZE);
+    ov.OffsetHigh = DWORD((index * BLOCK_SIZE) >> 32);
+    DWORD size = 0;
+    if (!ReadFile(m_hSource, lru->data.data(), BLOCK_SIZE, &size, &ov)) {
+        TRACE(_T("CVobSubSectorFile: ReadFile failed at %I64u (%u)\n"), index * BLOCK_SIZE, GetLastError());
+        lru->size = 0;
+        return nullptr;
+    }
+
+    lru->index = index;
+    lru->size = size;
+    lru->lastUse = ++m_useCount;
+
+    return size ? lru : nullptr;
+}
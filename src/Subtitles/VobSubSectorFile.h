@@ -0,0 +1,73 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <vector>
+
+// The sectors of a VobSub .sub file. Once a source file is attached they are read from it
+// on demand, through a small cache of the most recently used blocks, instead of being loaded
+// in memory: multi-language .sub files can take hundreds of MB while only the few sectors of
+// the packets being decoded are needed at a time. Without a source, or once the length is
+// changed, it behaves like the CMemFile it derives from so that it can still be written to
+// when ripping or copying subtitles.
+class CVobSubSectorFile : public CMemFile
+{
+public:
+    explicit CVobSubSectorFile(UINT nGrowBytes = 1024);
+    virtual ~CVobSubSectorFile();
+
+    // Read from the file fn, which stays opened and shared until the source is dropped
+    bool OpenSource(LPCTSTR fn);
+    // Same with an already opened file, which is then owned by this object even on failure
+    bool AttachSource(HANDLE hFile);
+    bool HasSource() const { return m_hSource != INVALID_HANDLE_VALUE; }
+
+    virtual ULONGLONG GetPosition() const;
+    virtual ULONGLONG Seek(LONGLONG lOff, UINT nFrom);
+    // Drops the source, the content is then empty or in memory
+    virtual void SetLength(ULONGLONG dwNewLen);
+    virtual ULONGLONG GetLength() const;
+    virtual UINT Read(void* lpBuf, UINT nCount);
+    virtual void Write(const void* lpBuf, UINT nCount);
+
+private:
+    enum {
+        BLOCK_SIZE = 32 * 2048, // 32 sectors
+        BLOCK_COUNT = 16
+    };
+
+    struct Block {
+        ULONGLONG index = 0;
+        ULONGLONG lastUse = 0;
+        DWORD size = 0; // 0 when the block is unused
+        std::vector<BYTE> data;
+    };
+
+    HANDLE m_hSource;
+    ULONGLONG m_sourceLength;
+    ULONGLONG m_sourcePosition;
+    std::array<Block, BLOCK_COUNT> m_blocks;
+    ULONGLONG m_useCount;
+
+    void CloseSource();
+    const Block* GetBlock(ULONGLONG index);
+};
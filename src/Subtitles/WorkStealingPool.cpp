@@ -0,0 +1,176 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+#include "WorkStealingPool.h"
+
+CWorkStealingPool::CWorkStealingPool(unsigned int nThreads /*= 0*/)
+    : m_nThreads(nThreads ? nThreads : std::max(1u, std::thread::hardware_concurrency()))
+    , m_nPending(0)
+    , m_nNextQueue(0)
+    , m_bExit(false)
+{
+    for (unsigned int i = 0; i < m_nThreads; i++) {
+        m_queues.emplace_back(std::make_unique<WorkerQueue>());
+    }
+}
+
+CWorkStealingPool::~CWorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_bExit = true;
+    }
+    m_wakeCondition.notify_all();
+
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+std::shared_ptr<CWorkStealingPool> CWorkStealingPool::GetShared()
+{
+    static std::mutex s_mutex;
+    static std::weak_ptr<CWorkStealingPool> s_pool;
+
+    std::lock_guard<std::mutex> lock(s_mutex);
+    auto pool = s_pool.lock();
+    if (!pool) {
+        pool = std::make_shared<CWorkStealingPool>();
+        s_pool = pool;
+    }
+    return pool;
+}
+
+void CWorkStealingPool::StartThreads()
+{
+    for (size_t i = 0; i < m_nThreads; i++) {
+        m_threads.emplace_back([this, i]() { WorkerProc(i); });
+    }
+}
+
+void CWorkStealingPool::Submit(Task task)
+{
+    std::call_once(m_startFlag, &CWorkStealingPool::StartThreads, this);
+
+    // Count the task before it becomes visible so that a worker popping it
+    // right away can never make the counter negative.
+    m_nPending++;
+
+    auto& queue = *m_queues[m_nNextQueue++ % m_nThreads];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.emplace_back(std::move(task));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+    }
+    m_wakeCondition.notify_one();
+}
+
+bool CWorkStealingPool::TryPop(size_t iQueue, Task& task)
+{
+    // Take the most recent task from our own queue first, it is the most likely
+    // to still be in cache, then steal the oldest task from the other workers.
+    for (size_t i = 0; i < m_nThreads; i++) {
+        auto& queue = *m_queues[(iQueue + i) % m_nThreads];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            if (i == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            m_nPending--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void CWorkStealingPool::WorkerProc(size_t iQueue)
+{
+    for (;;) {
+        Task task;
+        if (TryPop(iQueue, task)) {
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_wakeMutex);
+        m_wakeCondition.wait(lock, [this]() { return m_bExit || m_nPending > 0; });
+        if (m_bExit && m_nPending <= 0) {
+            break;
+        }
+    }
+}
+
+void CWorkStealingPool::ParallelFor(size_t count, const std::function<void(size_t)>& fn)
+{
+    if (count == 0) {
+        return;
+    }
+    if (count == 1 || m_nThreads < 2) {
+        for (size_t i = 0; i < count; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    struct Batch {
+        std::atomic<size_t> remaining;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    auto batch = std::make_shared<Batch>();
+    batch->remaining = count;
+
+    // Keep the first item for ourselves, the workers pick up the rest
+    for (size_t i = 1; i < count; i++) {
+        Submit([batch, &fn, i]() {
+            fn(i);
+            if (--batch->remaining == 0) {
+                std::lock_guard<std::mutex> lock(batch->mutex);
+                batch->done.notify_all();
+            }
+        });
+    }
+
+    fn(0);
+    if (--batch->remaining == 0) {
+        return;
+    }
+
+    // Help with whatever is still queued instead of sleeping
+    size_t iQueue = m_nNextQueue % m_nThreads;
+    while (batch->remaining > 0) {
+        Task task;
+        if (TryPop(iQueue, task)) {
+            task();
+        } else {
+            std::unique_lock<std::mutex> lock(batch->mutex);
+            batch->done.wait(lock, [&batch]() { return batch->remaining == 0; });
+        }
+    }
+}
@@ -0,0 +1,79 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small pool of worker threads sharing the subtitle rendering work.
+// Each worker owns a task queue; idle workers steal from the others.
+// The threads are only started when the first task is queued.
+class CWorkStealingPool
+{
+public:
+    typedef std::function<void()> Task;
+
+    explicit CWorkStealingPool(unsigned int nThreads = 0);
+    ~CWorkStealingPool();
+
+    CWorkStealingPool(const CWorkStealingPool&) = delete;
+    CWorkStealingPool& operator=(const CWorkStealingPool&) = delete;
+
+    // The process-wide pool. It lives as long as somebody holds a reference to it
+    // so that the worker threads are never joined while the loader lock is held.
+    static std::shared_ptr<CWorkStealingPool> GetShared();
+
+    unsigned int GetThreadCount() const { return m_nThreads; }
+
+    // Queue a task, it will be run asynchronously on one of the workers
+    void Submit(Task task);
+
+    // Run fn(0) ... fn(count - 1) on the pool and wait for all of them to finish.
+    // The calling thread takes part in the work while it waits.
+    void ParallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    const unsigned int m_nThreads;
+    std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+    std::vector<std::thread> m_threads;
+    std::once_flag m_startFlag;
+
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wakeCondition;
+    std::atomic<int> m_nPending;
+    std::atomic<unsigned int> m_nNextQueue;
+    bool m_bExit;
+
+    void StartThreads();
+    bool TryPop(size_t iQueue, Task& task);
+    void WorkerProc(size_t iQueue);
+};
@@ -0,0 +1,76 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+struct STSEntry;
+
+// Calls fn for at least minSeconds, after a first untimed call,
+// and returns the average duration of a call in seconds
+template<typename Fn>
+double TimeIt(Fn fn, double minSeconds = 0.25)
+{
+    fn();
+
+    int nCalls = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed;
+    do {
+        fn();
+        nCalls++;
+        elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed.count() < minSeconds);
+
+    return elapsed.count() / nCalls;
+}
+
+// Prints how many millions of units are processed per second
+void ReportRate(LPCTSTR label, double units, LPCTSTR unit, double seconds);
+// Prints a duration in milliseconds
+void ReportTime(LPCTSTR label, double seconds);
+// Prints the outcome of a check, a failed check makes the benchmark exit with 1
+void Check(bool bPassed, LPCTSTR label);
+
+// Same CPU feature probe as the Rasterizer
+bool HasAVX2();
+bool HasAVX512();
+
+// Writes data to a file of the temporary folder, whose path is returned
+CString WriteTempFile(LPCTSTR name, const void* data, size_t size);
+// An ASS script with the given number of Dialogue lines, encoded in UTF-8
+CStringA MakeScript(int nLines);
+// Whether two parsed lines are the same
+bool IsSameEntry(const STSEntry& a, const STSEntry& b);
+// A DVD subpicture packet of the image of rect, given as one color index per pixel row by row
+std::vector<BYTE> MakeSubPicture(const CRect& rect, const std::vector<BYTE>& image);
+
+void BenchmarkGaussianBlur();
+void BenchmarkRenderingCache();
+void BenchmarkScriptParsing();
+void BenchmarkSubtitleFileCache();
+void BenchmarkTextFile();
+void BenchmarkScreenLayout();
+void BenchmarkTransform();
+void BenchmarkVobSubDecoding();
+void BenchmarkVobSubPolygonize();
+void BenchmarkVobSubExport();
@@ -0,0 +1,126 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "../Subtitles/SeparableFilter.h"
+
+namespace
+{
+    typedef void (*SeparableFilterFn)(unsigned char* src, unsigned char* dst, int width, int height, ptrdiff_t stride,
+                                      short* kernel, int kernel_size, int divisor);
+
+    // A frame sized overlay, the worst case the Rasterizer has to blur
+    const int kWidth = 1920;
+    const int kHeight = 1080;
+    const ptrdiff_t kStride = (kWidth + 63) & ~63;
+
+    // Radii of the \blur tags, covering kernels from 3 to 61 taps
+    const double kRadii[] = { 0.5, 1.0, 2.0, 3.0, 5.0, 8.0, 12.0, 20.0 };
+
+    struct Image {
+        byte* data;
+
+        Image() : data((byte*)_aligned_malloc(kStride * kHeight, 64)) {}
+        ~Image() { _aligned_free(data); }
+
+        Image(const Image&) = delete;
+        Image& operator=(const Image&) = delete;
+
+        bool operator==(const Image& other) const {
+            for (int y = 0; y < kHeight; y++) {
+                if (memcmp(data + y * kStride, other.data + y * kStride, kWidth)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    // Glyph-like content: hard edged shapes with a few anti-aliased levels
+    void FillSource(Image& img)
+    {
+        unsigned int seed = 12345;
+        for (int y = 0; y < kHeight; y++) {
+            byte* row = img.data + y * kStride;
+            for (int x = 0; x < kWidth; x++) {
+                seed = seed * 1103515245 + 12345;
+                bool bInside = ((x / 24) + (y / 40)) % 3 == 0;
+                row[x] = bInside ? 255 : byte((seed >> 16) & 0x3f);
+            }
+        }
+    }
+
+    void Blur(SeparableFilterFn filterX, SeparableFilterFn filterY, const Image& src, Image& tmp, Image& dst,
+              const GaussianKernel& filter)
+    {
+        memcpy(dst.data, src.data, kStride * kHeight);
+        filterX(dst.data, tmp.data, kWidth, kHeight, kStride, filter.kernel, filter.width, filter.divisor);
+        filterY(tmp.data, dst.data, kWidth, kHeight, kStride, filter.kernel, filter.width, filter.divisor);
+    }
+
+    void RunKernel(LPCTSTR name, SeparableFilterFn filterX, SeparableFilterFn filterY, const Image& src,
+                   const Image& reference, const GaussianKernel& filter)
+    {
+        Image tmp, dst;
+        Blur(filterX, filterY, src, tmp, dst, filter);
+
+        CString label;
+        label.Format(_T("%s, %d taps"), name, filter.width);
+        Check(dst == reference, label + _T(" differs from the C version"));
+
+        double seconds = TimeIt([&] { Blur(filterX, filterY, src, tmp, dst, filter); });
+        ReportRate(label, double(kWidth) * kHeight, _T("pixels"), seconds);
+    }
+}
+
+void BenchmarkGaussianBlur()
+{
+    Image src;
+    FillSource(src);
+
+    const bool bAVX2 = HasAVX2();
+#if SEPARABLE_FILTER_HAS_AVX512
+    const bool bAVX512 = HasAVX512();
+#endif
+
+    for (double radius : kRadii) {
+        GaussianKernel filter(radius);
+        _tprintf(_T(" \\blur%g\n"), radius);
+
+        Image tmp, reference;
+        Blur(SeparableFilterX<1>, SeparableFilterY<1>, src, tmp, reference, filter);
+
+        RunKernel(_T("C"), SeparableFilterX<1>, SeparableFilterY<1>, src, reference, filter);
+        RunKernel(_T("SSE2"), SeparableFilterX_SSE2, SeparableFilterY_SSE2, src, reference, filter);
+        // The Rasterizer keeps using SSE2 for the divisors the float division can't handle exactly
+        if (!SeparableFilterUseFloatDivision(filter.divisor)) {
+            continue;
+        }
+        if (bAVX2) {
+            RunKernel(_T("AVX2"), SeparableFilterX_AVX2, SeparableFilterY_AVX2, src, reference, filter);
+        }
+#if SEPARABLE_FILTER_HAS_AVX512
+        if (bAVX512) {
+            RunKernel(_T("AVX-512"), SeparableFilterX_AVX512, SeparableFilterY_AVX512, src, reference, filter);
+        }
+#endif
+    }
+}
@@ -0,0 +1,138 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+#include <mutex>
+#include <random>
+#include "Benchmark.h"
+#include "../Subtitles/RenderingCache.h"
+
+namespace
+{
+    const size_t kMaxEntries = 2048;
+    // Keys are drawn from a range larger than the cache so that it keeps evicting
+    const unsigned int kKeyRange = 3000;
+    const int kOperationsPerThread = 200000;
+
+    // Values are derived from their keys so that a lookup can check what it gets
+    typedef std::shared_ptr<unsigned int> CValue;
+
+    // What the glyph outline cache used before: a single LRU cache behind a single lock
+    class CLockedRenderingCache
+    {
+        std::mutex m_mutex;
+        CRenderingCache<unsigned int, CValue> m_cache;
+
+    public:
+        CLockedRenderingCache(size_t maxSize) : m_cache(maxSize) {}
+
+        bool Lookup(unsigned int key, CValue& value) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_cache.Lookup(key, value);
+        }
+
+        void SetAt(unsigned int key, const CValue& value) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cache.SetAt(key, value);
+        }
+
+        void GetStats(CRenderingCacheStats& stats) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cache.GetStats(stats);
+        }
+    };
+
+    typedef CConcurrentRenderingCache<unsigned int, CValue> CShardedRenderingCache;
+
+    // Every thread looks keys up and inserts the missing ones, returns false if a lookup
+    // returned the value of another key
+    template<class Cache>
+    bool RunThreads(Cache& cache, int nThreads, double& seconds)
+    {
+        std::atomic<bool> bValid(true);
+        std::vector<std::thread> threads;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < nThreads; i++) {
+            threads.emplace_back([&cache, &bValid, i]() {
+                std::mt19937 random(i);
+                CValue value;
+                for (int j = 0; j < kOperationsPerThread; j++) {
+                    unsigned int key = random() % kKeyRange;
+                    if (!cache.Lookup(key, value)) {
+                        cache.SetAt(key, std::make_shared<unsigned int>(key));
+                    } else if (*value != key) {
+                        bValid = false;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        return bValid;
+    }
+
+    template<class Cache>
+    void RunCache(LPCTSTR name, int nThreads)
+    {
+        Cache cache(kMaxEntries);
+        double seconds;
+        bool bValid = RunThreads(cache, nThreads, seconds);
+
+        CRenderingCacheStats stats;
+        cache.GetStats(stats);
+
+        CString label;
+        label.Format(_T("%s, %d threads"), name, nThreads);
+        Check(bValid, label + _T(" returned the value of another key"));
+        Check(stats.entries <= stats.maxEntries, label + _T(" holds too many entries"));
+        Check(stats.hits + stats.misses == ULONGLONG(nThreads) * kOperationsPerThread, label + _T(" lost some statistics"));
+        ReportRate(label, double(nThreads) * kOperationsPerThread, _T("lookups"), seconds);
+    }
+
+    // The byte budget holds once it is lowered
+    void CheckByteBudget()
+    {
+        CConcurrentRenderingCache<unsigned int, int> cache(100000, 100 * 8, 4);
+        for (unsigned int key = 0; key < 1000; key++) {
+            cache.SetAt(key, int(key));
+        }
+
+        CRenderingCacheStats stats;
+        cache.GetStats(stats);
+        Check(stats.bytes <= stats.maxBytes, _T("sharded cache, byte budget exceeded"));
+
+        cache.SetMaxBytes(25 * 8);
+        cache.GetStats(stats);
+        Check(stats.bytes <= stats.maxBytes, _T("sharded cache, lowered byte budget exceeded"));
+    }
+}
+
+void BenchmarkRenderingCache()
+{
+    for (int nThreads : { 1, 2, 4, 8, 16 }) {
+        RunCache<CLockedRenderingCache>(_T("single lock LRU"), nThreads);
+        RunCache<CShardedRenderingCache>(_T("sharded CLOCK"), nThreads);
+    }
+    CheckByteBudget();
+}
@@ -0,0 +1,126 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "../Subtitles/STS.h"
+#include "../Subtitles/SubtitleFileCache.h"
+
+namespace
+{
+    const int kLines = 200000;
+
+    void ClearCache(const CString& dir)
+    {
+        WIN32_FIND_DATA fd;
+        HANDLE hFind = FindFirstFile(dir + _T("\\*.stc"), &fd);
+        if (hFind != INVALID_HANDLE_VALUE) {
+            do {
+                DeleteFile(dir + _T("\\") + fd.cFileName);
+            } while (FindNextFile(hFind, &fd));
+            FindClose(hFind);
+        }
+    }
+
+    // Changes the modification time but not the content, a new time on every call
+    void Touch(LPCTSTR fn)
+    {
+        static ULONGLONG s_nTouches = 0;
+
+        FILETIME ft;
+        GetSystemTimeAsFileTime(&ft);
+        ULONGLONG t = ((ULONGLONG(ft.dwHighDateTime) << 32) | ft.dwLowDateTime) + ++s_nTouches;
+        ft.dwHighDateTime = DWORD(t >> 32);
+        ft.dwLowDateTime = DWORD(t);
+
+        HANDLE hFile = CreateFile(fn, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                  nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        VERIFY(hFile != INVALID_HANDLE_VALUE && SetFileTime(hFile, nullptr, nullptr, &ft));
+        CloseHandle(hFile);
+    }
+
+    bool IsSameSubtitle(const CSimpleTextSubtitle& a, const CSimpleTextSubtitle& b)
+    {
+        bool bSame = a.GetCount() == b.GetCount() && a.m_styles.GetCount() == b.m_styles.GetCount();
+        for (size_t i = 0; bSame && i < a.GetCount(); i++) {
+            bSame = IsSameEntry(a[i], b[i]);
+        }
+        return bSame;
+    }
+}
+
+void BenchmarkSubtitleFileCache()
+{
+    CStringA script = MakeScript(kLines);
+    CString fn = WriteTempFile(_T("SubtitlesBenchmarkCache.ass"), script.GetString(), script.GetLength());
+    const double megabytes = script.GetLength() / 1e6;
+    script.Empty();
+
+    TCHAR path[MAX_PATH];
+    VERIFY(GetTempPath(MAX_PATH, path));
+    CString dir = CString(path) + _T("SubtitlesBenchmarkCache");
+    CString cacheDirectory = CSubtitleFileCache::GetDirectory();
+
+    CSimpleTextSubtitle cold, stored, hit, touched;
+    bool bColdOpened = false, bStoredOpened = false, bHitOpened = false, bTouchedOpened = false;
+    CSubtitleFileCacheStats before, afterHits, afterTouches;
+
+    CSubtitleFileCache::SetDirectory(_T(""));
+    double coldSeconds = TimeIt([&] { bColdOpened = cold.Open(fn, DEFAULT_CHARSET); }, 0.0);
+
+    CSubtitleFileCache::SetDirectory(dir);
+    double storeSeconds = TimeIt([&] {
+        ClearCache(dir);
+        bStoredOpened = stored.Open(fn, DEFAULT_CHARSET);
+    }, 0.0);
+
+    // The size and modification time match, nothing is parsed nor hashed but the cached data
+    CSubtitleFileCache::GetStats(before);
+    double hitSeconds = TimeIt([&] { bHitOpened = hit.Open(fn, DEFAULT_CHARSET); });
+    CSubtitleFileCache::GetStats(afterHits);
+
+    // The modification time changed but not the size, the file is hashed before the cache is used
+    double touchedSeconds = TimeIt([&] {
+        Touch(fn);
+        bTouchedOpened = touched.Open(fn, DEFAULT_CHARSET);
+    });
+    CSubtitleFileCache::GetStats(afterTouches);
+
+    CSubtitleFileCache::SetDirectory(cacheDirectory);
+    ClearCache(dir);
+    RemoveDirectory(dir);
+    DeleteFile(fn);
+
+    Check(bColdOpened && bStoredOpened && bHitOpened && bTouchedOpened, _T("the script couldn't be opened"));
+    Check(cold.GetCount() == size_t(kLines), _T("parsed, some lines are missing"));
+    Check(afterHits.nHits > before.nHits && afterHits.nMisses == before.nMisses,
+          _T("unchanged, the file isn't loaded from the cache"));
+    Check(afterTouches.nHits > afterHits.nHits && afterTouches.nMisses == afterHits.nMisses
+          && afterTouches.nInvalidated == afterHits.nInvalidated,
+          _T("touched, the file isn't loaded from the cache"));
+    Check(IsSameSubtitle(cold, stored), _T("storing in the cache changes the lines"));
+    Check(IsSameSubtitle(cold, hit), _T("the cache doesn't give the same lines"));
+    Check(IsSameSubtitle(cold, touched), _T("the cache doesn't give the same lines once touched"));
+
+    _tprintf(_T(" %d lines, %.1f MB\n"), kLines, megabytes);
+    ReportTime(_T("parsed"), coldSeconds);
+    ReportTime(_T("parsed and stored"), storeSeconds);
+    ReportTime(_T("cache hit"), hitSeconds);
+    ReportTime(_T("cache hit, touched"), touchedSeconds);
+}
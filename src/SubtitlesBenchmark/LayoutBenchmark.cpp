@@ -0,0 +1,242 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "stdafx.h"
+#include <memory>
+#include <random>
+#include <vector>
+#include "Benchmark.h"
+#include "../Subtitles/RTS.h"
+
+namespace
+{
+    const int kScenarios = 500;
+    const int kSegmentsPerScenario = 50;
+    const int kEntriesPerScenario = 60;
+    const int kLines = 200;
+    const int kLayers = 4;
+
+    // What CScreenLayoutAllocator did before its rects were indexed: every lookup
+    // and every collision check goes through all the rects already placed
+    class CReferenceLayoutAllocator
+    {
+        struct SubRect {
+            CRect r;
+            int segment, entry, layer;
+        };
+
+        CAtlList<SubRect> m_subrects;
+
+    public:
+        void Empty() {
+            m_subrects.RemoveAll();
+        }
+
+        void AdvanceToSegment(int segment, const CAtlArray<int>& sa) {
+            POSITION pos = m_subrects.GetHeadPosition();
+            while (pos) {
+                POSITION prev = pos;
+                SubRect& sr = m_subrects.GetNext(pos);
+
+                bool fFound = false;
+                if (abs(sr.segment - segment) <= 1) {
+                    for (size_t i = 0; i < sa.GetCount() && !fFound; i++) {
+                        if (sa[i] == sr.entry) {
+                            sr.segment = segment;
+                            fFound = true;
+                        }
+                    }
+                }
+                if (!fFound) {
+                    m_subrects.RemoveAt(prev);
+                }
+            }
+        }
+
+        CRect AllocRect(const CSubtitle* s, int segment, int entry, int layer) {
+            POSITION pos = m_subrects.GetHeadPosition();
+            while (pos) {
+                SubRect& sr = m_subrects.GetNext(pos);
+                if (sr.segment == segment && sr.entry == entry) {
+                    return (sr.r + CRect(0, -s->m_topborder, 0, -s->m_bottomborder));
+                }
+            }
+
+            CRect r = s->m_rect + CRect(0, s->m_topborder, 0, s->m_bottomborder);
+            bool fSearchDown = s->m_scrAlignment > 3;
+
+            bool fOK;
+            do {
+                fOK = true;
+                pos = m_subrects.GetHeadPosition();
+                while (pos) {
+                    SubRect& sr = m_subrects.GetNext(pos);
+                    if (layer == sr.layer && !(r & sr.r).IsRectEmpty()) {
+                        if (fSearchDown) {
+                            r.bottom = sr.r.bottom + r.Height();
+                            r.top = sr.r.bottom;
+                        } else {
+                            r.top = sr.r.top - r.Height();
+                            r.bottom = sr.r.top;
+                        }
+                        fOK = false;
+                    }
+                }
+            } while (!fOK);
+
+            SubRect sr;
+            sr.r = r;
+            sr.segment = segment;
+            sr.entry = entry;
+            sr.layer = layer;
+            m_subrects.AddTail(sr);
+
+            return (sr.r + CRect(0, -s->m_topborder, 0, -s->m_bottomborder));
+        }
+    };
+
+    struct Line {
+        std::unique_ptr<CSubtitle> s;
+        int layer;
+    };
+
+    // A line placed where its alignment puts it on a 1280x720 screen, some of them empty
+    Line MakeLine(RenderingCaches& renderingCaches, std::mt19937& rng, int alignment, int layer)
+    {
+        Line line;
+        line.s = std::make_unique<CSubtitle>(renderingCaches);
+        line.layer = layer;
+
+        CSubtitle* s = line.s.get();
+        s->m_scrAlignment = alignment;
+        s->m_topborder = rng() % 8;
+        s->m_bottomborder = rng() % 8;
+
+        int width = rng() % 20 ? 50 + rng() % 800 : 0;
+        int height = 20 + rng() % 100;
+        int left = alignment % 3 == 1 ? 30 : alignment % 3 == 2 ? (1280 - width) / 2 : 1280 - 30 - width;
+        int top = alignment <= 3 ? 720 - 30 - height : alignment <= 6 ? (720 - height) / 2 : 30;
+        s->m_rect.SetRect(left, top, left + width, top + height);
+
+        return line;
+    }
+
+    // Random scenarios of segments following each other or jumping around, with lines
+    // on several layers and alignments, placed by both allocators
+    bool IsSameLayout(RenderingCaches& renderingCaches)
+    {
+        std::mt19937 rng(42);
+
+        for (int scenario = 0; scenario < kScenarios; scenario++) {
+            std::vector<Line> lines;
+            for (int i = 0; i < kEntriesPerScenario; i++) {
+                lines.push_back(MakeLine(renderingCaches, rng, 1 + rng() % 9, rng() % kLayers));
+            }
+
+            CScreenLayoutAllocator sla;
+            CReferenceLayoutAllocator reference;
+
+            int segment = 0;
+            for (int i = 0; i < kSegmentsPerScenario; i++) {
+                segment = rng() % 10 ? segment + 1 : int(rng() % 1000);
+                if (rng() % 25 == 0) {
+                    sla.Empty();
+                    reference.Empty();
+                }
+
+                CAtlArray<int> sa;
+                for (int entry = 0; entry < kEntriesPerScenario; entry++) {
+                    if (rng() % 3 == 0) {
+                        sa.Add(entry);
+                    }
+                }
+
+                sla.AdvanceToSegment(segment, sa);
+                reference.AdvanceToSegment(segment, sa);
+
+                // Each line is placed, then queried again as on the next frames
+                for (int pass = 0; pass < 2; pass++) {
+                    for (size_t j = 0; j < sa.GetCount(); j++) {
+                        const Line& line = lines[sa[j]];
+                        if (sla.AllocRect(line.s.get(), segment, sa[j], line.layer, 0)
+                                != reference.AllocRect(line.s.get(), segment, sa[j], line.layer)) {
+                            return false;
+                        }
+                    }
+                }
+            }
+        }
+
+        return true;
+    }
+}
+
+void BenchmarkScreenLayout()
+{
+    RenderingCaches renderingCaches;
+
+    Check(IsSameLayout(renderingCaches), _T("the lines aren't placed as before"));
+
+    // A crowded screen: every line is bottom aligned and pushed above the previous ones
+    std::mt19937 rng(1);
+    std::vector<Line> lines;
+    for (int i = 0; i < kLines; i++) {
+        lines.push_back(MakeLine(renderingCaches, rng, 2, i % kLayers));
+    }
+
+    CScreenLayoutAllocator sla;
+    CReferenceLayoutAllocator reference;
+
+    double placeSeconds = TimeIt([&] {
+        sla.Empty();
+        for (int i = 0; i < kLines; i++) {
+            sla.AllocRect(lines[i].s.get(), 0, i, lines[i].layer, 0);
+        }
+    });
+    double referencePlaceSeconds = TimeIt([&] {
+        reference.Empty();
+        for (int i = 0; i < kLines; i++) {
+            reference.AllocRect(lines[i].s.get(), 0, i, lines[i].layer);
+        }
+    });
+
+    // The next frames of the same segment only look up the lines already placed
+    double querySeconds = TimeIt([&] {
+        for (int i = 0; i < kLines; i++) {
+            sla.AllocRect(lines[i].s.get(), 0, i, lines[i].layer, 0);
+        }
+    });
+    double referenceQuerySeconds = TimeIt([&] {
+        for (int i = 0; i < kLines; i++) {
+            reference.AllocRect(lines[i].s.get(), 0, i, lines[i].layer);
+        }
+    });
+    bool bSame = true;
+    for (int i = 0; i < kLines && bSame; i++) {
+        const Line& line = lines[i];
+        bSame = sla.AllocRect(line.s.get(), 0, i, line.layer, 0) == reference.AllocRect(line.s.get(), 0, i, line.layer);
+    }
+    Check(bSame, _T("the crowded screen isn't laid out as before"));
+
+    _tprintf(_T(" %d lines on %d layers\n"), kLines, kLayers);
+    ReportRate(_T("placed, indexed"), kLines, _T("lines"), placeSeconds);
+    ReportRate(_T("placed, all rects scanned"), kLines, _T("lines"), referencePlaceSeconds);
+    ReportRate(_T("queried again, indexed"), kLines, _T("lines"), querySeconds);
+    ReportRate(_T("queried again, all rects scanned"), kLines, _T("lines"), referenceQuerySeconds);
+}
@@ -0,0 +1,115 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "../Subtitles/STS.h"
+#include "../Subtitles/SubtitleFileCache.h"
+
+namespace
+{
+    const int kLines = 1000000;
+}
+
+bool IsSameEntry(const STSEntry& a, const STSEntry& b)
+{
+    return a.str == b.str && a.fUnicode == b.fUnicode && a.style == b.style && a.actor == b.actor
+           && a.effect == b.effect && a.marginRect == b.marginRect && a.layer == b.layer
+           && a.start == b.start && a.end == b.end && a.readorder == b.readorder;
+}
+
+CStringA MakeScript(int nLines)
+{
+    CStringA script =
+        "\xEF\xBB\xBF[Script Info]\r\n"
+        "ScriptType: v4.00+\r\n"
+        "PlayResX: 1280\r\n"
+        "PlayResY: 720\r\n"
+        "\r\n"
+        "[V4+ Styles]\r\n"
+        "Format: Name, Fontname, Fontsize, PrimaryColour, SecondaryColour, OutlineColour, BackColour, Bold, Italic, "
+        "Underline, StrikeOut, ScaleX, ScaleY, Spacing, Angle, BorderStyle, Outline, Shadow, Alignment, "
+        "MarginL, MarginR, MarginV, Encoding\r\n"
+        "Style: Default,Arial,48,&H00FFFFFF,&H000000FF,&H00000000,&H80000000,0,0,0,0,100,100,0,0,1,2,1,2,20,20,30,1\r\n"
+        "Style: Sign,Arial,36,&H00FFFFFF,&H000000FF,&H00000000,&H80000000,-1,0,0,0,100,100,0,0,1,3,0,8,20,20,30,1\r\n"
+        "\r\n"
+        "[Events]\r\n"
+        "Format: Layer, Start, End, Style, Name, MarginL, MarginR, MarginV, Effect, Text\r\n";
+
+    // Lines of typical length, with override tags and some non-ASCII text
+    CStringA line;
+    for (int i = 0; i < nLines; i++) {
+        int start = i * 40;
+        int end = start + 250 + (i % 7) * 10;
+        line.Format("Dialogue: %d,%d:%02d:%02d.%02d,%d:%02d:%02d.%02d,%s,Speaker %d,0,0,0,,",
+                    i % 3, start / 360000, start / 6000 % 60, start / 100 % 60, start % 100,
+                    end / 360000, end / 6000 % 60, end / 100 % 60, end % 100,
+                    i % 5 ? "Default" : "Sign", i % 11);
+        script += line;
+        if (i % 5 == 0) {
+            line.Format("{\\pos(640,%d)\\fad(200,200)}Sign number %d\r\n", 40 + i % 600, i);
+        } else if (i % 3 == 0) {
+            line.Format("{\\k20}Ka{\\k25}ra{\\k30}o{\\k20}ke \xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E %d\r\n", i);
+        } else {
+            line.Format("Line %d says something caf\xC3\xA9-worthy,\\Nthen {\\i1}a bit more{\\i0} on a second row.\r\n", i);
+        }
+        script += line;
+    }
+
+    return script;
+}
+
+void BenchmarkScriptParsing()
+{
+    CStringA script = MakeScript(kLines);
+    CString fn = WriteTempFile(_T("SubtitlesBenchmark.ass"), script.GetString(), script.GetLength());
+    const double megabytes = script.GetLength() / 1e6;
+    script.Empty();
+
+    // Parse the file every time
+    CString cacheDirectory = CSubtitleFileCache::GetDirectory();
+    CSubtitleFileCache::SetDirectory(_T(""));
+
+    CSimpleTextSubtitle serial, parallel;
+    bool bSerialOpened = false, bParallelOpened = false;
+
+    CSimpleTextSubtitle::SetParallelParsing(false);
+    double serialSeconds = TimeIt([&] { bSerialOpened = serial.Open(fn, DEFAULT_CHARSET); }, 0.0);
+    CSimpleTextSubtitle::SetParallelParsing(true);
+    double parallelSeconds = TimeIt([&] { bParallelOpened = parallel.Open(fn, DEFAULT_CHARSET); }, 0.0);
+
+    CSubtitleFileCache::SetDirectory(cacheDirectory);
+    DeleteFile(fn);
+
+    Check(bSerialOpened && bParallelOpened, _T("the script couldn't be opened"));
+    Check(serial.GetCount() == size_t(kLines), _T("line by line, some lines are missing"));
+
+    bool bSame = serial.GetCount() == parallel.GetCount();
+    for (size_t i = 0; bSame && i < serial.GetCount(); i++) {
+        bSame = IsSameEntry(serial[i], parallel[i]);
+    }
+    Check(bSame, _T("parallel parsing doesn't give the same lines"));
+
+    _tprintf(_T(" %d lines, %.1f MB\n"), kLines, megabytes);
+    ReportTime(_T("line by line"), serialSeconds);
+    ReportRate(_T("line by line"), kLines, _T("lines"), serialSeconds);
+    ReportTime(_T("parallel"), parallelSeconds);
+    ReportRate(_T("parallel"), kLines, _T("lines"), parallelSeconds);
+}
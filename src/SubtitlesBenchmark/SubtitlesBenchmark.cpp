@@ -0,0 +1,123 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Micro-benchmarks of the subtitle renderer. Each one checks that an optimized code path
+// produces the same result as the code it replaces, then reports its throughput.
+//
+// Usage: SubtitlesBenchmark [name ...]
+// Every benchmark runs when no name is given. The exit code is 1 if a check failed.
+
+#include "stdafx.h"
+#include <intrin.h>
+#include "Benchmark.h"
+
+namespace
+{
+    const struct {
+        LPCTSTR name;
+        void (*run)();
+    } s_benchmarks[] = {
+        { _T("blur"), BenchmarkGaussianBlur },
+        { _T("cache"), BenchmarkRenderingCache },
+        { _T("script"), BenchmarkScriptParsing },
+        { _T("filecache"), BenchmarkSubtitleFileCache },
+        { _T("textfile"), BenchmarkTextFile },
+        { _T("layout"), BenchmarkScreenLayout },
+        { _T("transform"), BenchmarkTransform },
+        { _T("vobsub"), BenchmarkVobSubDecoding },
+        { _T("polygonize"), BenchmarkVobSubPolygonize },
+        { _T("export"), BenchmarkVobSubExport },
+    };
+
+    bool s_bFailed = false;
+}
+
+void ReportRate(LPCTSTR label, double units, LPCTSTR unit, double seconds)
+{
+    _tprintf(_T("  %-40s %10.1f M%s/s\n"), label, units / seconds / 1e6, unit);
+}
+
+void ReportTime(LPCTSTR label, double seconds)
+{
+    _tprintf(_T("  %-40s %10.2f ms\n"), label, seconds * 1000.0);
+}
+
+void Check(bool bPassed, LPCTSTR label)
+{
+    if (!bPassed) {
+        _tprintf(_T("  FAILED: %s\n"), label);
+        s_bFailed = true;
+    }
+}
+
+bool HasAVX2()
+{
+    int cpuInfo[4];
+    __cpuid(cpuInfo, 0);
+    if (cpuInfo[0] < 7) {
+        return false;
+    }
+    __cpuidex(cpuInfo, 7, 0);
+    return !!(cpuInfo[1] & (1 << 5)) && (_xgetbv(_XCR_XFEATURE_ENABLED_MASK) & 0x6) == 0x6;
+}
+
+bool HasAVX512()
+{
+    int cpuInfo[4];
+    __cpuid(cpuInfo, 0);
+    if (cpuInfo[0] < 7) {
+        return false;
+    }
+    __cpuidex(cpuInfo, 7, 0);
+    return !!(cpuInfo[1] & (1 << 16)) && (_xgetbv(_XCR_XFEATURE_ENABLED_MASK) & 0xE6) == 0xE6;
+}
+
+CString WriteTempFile(LPCTSTR name, const void* data, size_t size)
+{
+    TCHAR path[MAX_PATH];
+    VERIFY(GetTempPath(MAX_PATH, path));
+    CString fn = CString(path) + name;
+
+    CFile file(fn, CFile::modeCreate | CFile::modeWrite);
+    file.Write(data, (UINT)size);
+
+    return fn;
+}
+
+int _tmain(int argc, TCHAR* argv[])
+{
+    if (!AfxWinInit(::GetModuleHandle(nullptr), nullptr, ::GetCommandLine(), 0)) {
+        _tprintf(_T("MFC initialization failed\n"));
+        return 1;
+    }
+
+    for (const auto& benchmark : s_benchmarks) {
+        bool bRun = argc < 2;
+        for (int i = 1; i < argc && !bRun; i++) {
+            bRun = _tcsicmp(argv[i], benchmark.name) == 0;
+        }
+        if (bRun) {
+            _tprintf(_T("%s\n"), benchmark.name);
+            benchmark.run();
+        }
+    }
+
+    return s_bFailed ? 1 : 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "../Subtitles/TextFile.h"
+#include <vector>
+
+namespace
+{
+    const int kLines = 200000;
+
+    // What ReadString should return: the text up to each '\n', without any '\r'
+    std::vector<CStringW> SplitLines(const CStringW& text)
+    {
+        std::vector<CStringW> lines;
+        CStringW line;
+        for (int i = 0; i < text.GetLength(); i++) {
+            if (text[i] == L'\n') {
+                lines.push_back(line);
+                line.Empty();
+            } else if (text[i] != L'\r') {
+                line += text[i];
+            }
+        }
+        if (!line.IsEmpty()) {
+            lines.push_back(line);
+        }
+        return lines;
+    }
+
+    // Reads the file line by line like the parsers do, and counts
+    // how many times the line had to be moved to a larger buffer
+    bool ReadLines(LPCTSTR fn, CTextFile::enc e, std::vector<CStringW>* pLines, int& nReallocs)
+    {
+        CTextFile f(e);
+        if (!f.Open(fn)) {
+            return false;
+        }
+
+        CStringW line;
+        LPCWSTR pBuffer = nullptr;
+        nReallocs = 0;
+        while (f.ReadString(line)) {
+            if (line.GetString() != pBuffer) {
+                pBuffer = line.GetString();
+                nReallocs++;
+            }
+            if (pLines) {
+                pLines->push_back(CStringW(line.GetString(), line.GetLength()));
+            }
+        }
+        return true;
+    }
+
+    void Run(LPCTSTR label, LPCTSTR name, const void* data, size_t size, CTextFile::enc e, const std::vector<CStringW>& expected)
+    {
+        CString fn = WriteTempFile(name, data, size);
+
+        std::vector<CStringW> lines;
+        int nReallocs = 0;
+        bool bRead = ReadLines(fn, e, &lines, nReallocs);
+        double seconds = TimeIt([&] { ReadLines(fn, e, nullptr, nReallocs); });
+
+        DeleteFile(fn);
+
+        CString message;
+        message.Format(_T("%s, the lines differ from the reference decoding"), label);
+        Check(bRead && lines == expected, message);
+        // The buffer only grows when a line is longer than all the previous ones
+        message.Format(_T("%s, the line buffer was reallocated %d times"), label, nReallocs);
+        Check(nReallocs <= 16, message);
+
+        ReportRate(label, double(size), _T("B"), seconds);
+    }
+}
+
+void BenchmarkTextFile()
+{
+    CStringA utf8 = MakeScript(kLines);
+    const int nBom = 3;
+
+    CStringW text;
+    int len = MultiByteToWideChar(CP_UTF8, 0, utf8.GetString() + nBom, utf8.GetLength() - nBom, nullptr, 0);
+    MultiByteToWideChar(CP_UTF8, 0, utf8.GetString() + nBom, utf8.GetLength() - nBom, text.GetBuffer(len), len);
+    text.ReleaseBuffer(len);
+    const std::vector<CStringW> expected = SplitLines(text);
+
+    std::vector<BYTE> le16(2 + text.GetLength() * sizeof(WCHAR)), be16(le16.size());
+    le16[0] = be16[1] = 0xff;
+    le16[1] = be16[0] = 0xfe;
+    for (int i = 0; i < text.GetLength(); i++) {
+        WCHAR c = text[i];
+        le16[2 + 2 * i] = be16[3 + 2 * i] = BYTE(c);
+        le16[3 + 2 * i] = be16[2 + 2 * i] = BYTE(c >> 8);
+    }
+
+    // ANSI is read with the default code page, keep to ASCII so that the result doesn't depend on it
+    CStringA ansi = utf8.Mid(nBom);
+    for (int i = 0; i < ansi.GetLength(); i++) {
+        if (ansi[i] & 0x80) {
+            ansi.SetAt(i, '?');
+        }
+    }
+    const std::vector<CStringW> expectedAnsi = SplitLines(CStringW(ansi));
+
+    _tprintf(_T(" %d lines\n"), kLines);
+    Run(_T("UTF-8"), _T("SubtitlesBenchmarkUtf8.txt"), utf8.GetString(), utf8.GetLength(), CTextFile::UTF8, expected);
+    Run(_T("UTF-16LE"), _T("SubtitlesBenchmarkLe16.txt"), le16.data(), le16.size(), CTextFile::UTF8, expected);
+    Run(_T("UTF-16BE"), _T("SubtitlesBenchmarkBe16.txt"), be16.data(), be16.size(), CTextFile::UTF8, expected);
+    Run(_T("ANSI"), _T("SubtitlesBenchmarkAnsi.txt"), ansi.GetString(), ansi.GetLength(), CTextFile::ANSI, expectedAnsi);
+}
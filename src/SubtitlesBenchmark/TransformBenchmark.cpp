@@ -0,0 +1,121 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "stdafx.h"
+#include <random>
+#include <vector>
+#include "Benchmark.h"
+#include "../Subtitles/RTS.h"
+
+namespace
+{
+    typedef void (*TransformPointsFn)(POINT* points, int count, const STSStyle& style, double scalex, double scaley,
+                                      const CPoint& org);
+
+    // A large \p drawing, in the 1/8 pixel units of the paths
+    const int kPoints = 100000;
+
+    struct Transform {
+        LPCTSTR name;
+        double scaleX, scaleY, shiftX, shiftY;
+        double angleX, angleY, angleZ;
+    };
+
+    // Rotations stay away from the perspective clamp, where the float versions can be off by more than one unit
+    const Transform kTransforms[] = {
+        { _T("\\frz30"), 100.0, 100.0, 0.0, 0.0, 0.0, 0.0, 30.0 },
+        { _T("\\fscx120\\fscy80\\fax0.2"), 120.0, 80.0, 0.2, 0.0, 0.0, 0.0, 0.0 },
+        { _T("\\frx20\\fry-25\\frz10"), 100.0, 100.0, 0.0, 0.0, 20.0, -25.0, 10.0 },
+        { _T("\\frx-40\\fry35\\fay0.1"), 100.0, 100.0, 0.0, 0.1, -40.0, 35.0, 0.0 },
+    };
+
+    void TransformCopy(TransformPointsFn transform, const std::vector<POINT>& src, std::vector<POINT>& dst,
+                       const STSStyle& style, const CPoint& org)
+    {
+        dst = src;
+        transform(dst.data(), int(dst.size()), style, 1.5, 1.5, org);
+    }
+
+    void RunTransform(LPCTSTR name, TransformPointsFn transform, const std::vector<POINT>& src,
+                      const std::vector<POINT>& reference, const STSStyle& style, const CPoint& org)
+    {
+        std::vector<POINT> dst;
+        TransformCopy(transform, src, dst, style, org);
+
+        size_t nDiffering = 0;
+        LONG maxDiff = 0;
+        for (size_t i = 0; i < dst.size(); i++) {
+            LONG diff = std::max(labs(dst[i].x - reference[i].x), labs(dst[i].y - reference[i].y));
+            maxDiff = std::max(maxDiff, diff);
+            nDiffering += diff != 0;
+        }
+
+        Check(maxDiff <= 1, CString(name) + _T(" is more than one unit off the C version"));
+
+        double seconds = TimeIt([&] { TransformCopy(transform, src, dst, style, org); });
+        CString label;
+        label.Format(_T("%s, %.2f%% off by one"), name, 100.0 * nDiffering / dst.size());
+        ReportRate(label, double(kPoints), _T("points"), seconds);
+    }
+}
+
+void BenchmarkTransform()
+{
+    // A random walk, as the outline of a complex drawing on a 1080p screen
+    std::mt19937 rng(7);
+    std::vector<POINT> src(kPoints);
+    LONG x = 960 * 8, y = 540 * 8;
+    for (auto& p : src) {
+        x = std::min(std::max(x + LONG(rng() % 161) - 80, 0l), 1920l * 8);
+        y = std::min(std::max(y + LONG(rng() % 161) - 80, 0l), 1080l * 8);
+        p.x = x;
+        p.y = y;
+    }
+
+    // CWord transforms around the origin of the rotations, relative to the position of the drawing
+    const CPoint org(-640 * 8, -360 * 8);
+    const bool bAVX2 = HasAVX2();
+
+    for (const auto& transform : kTransforms) {
+        STSStyle style;
+        style.fontScaleX = transform.scaleX;
+        style.fontScaleY = transform.scaleY;
+        style.fontShiftX = transform.shiftX;
+        style.fontShiftY = transform.shiftY;
+        style.fontAngleX = transform.angleX;
+        style.fontAngleY = transform.angleY;
+        style.fontAngleZ = transform.angleZ;
+        _tprintf(_T(" %s, %d points\n"), transform.name, kPoints);
+
+        std::vector<POINT> reference;
+        TransformCopy(TransformPoints_C, src, reference, style, org);
+
+        std::vector<POINT> sse2, avx2;
+        TransformCopy(TransformPoints_SSE2, src, sse2, style, org);
+        RunTransform(_T("C"), TransformPoints_C, src, reference, style, org);
+        RunTransform(_T("SSE2"), TransformPoints_SSE2, src, reference, style, org);
+        if (bAVX2) {
+            TransformCopy(TransformPoints_AVX2, src, avx2, style, org);
+            Check(avx2.size() == sse2.size() && std::equal(avx2.cbegin(), avx2.cend(), sse2.cbegin(), [](const POINT & a, const POINT & b) {
+                return a.x == b.x && a.y == b.y;
+            }), _T("AVX2 differs from SSE2"));
+            RunTransform(_T("AVX2"), TransformPoints_AVX2, src, reference, style, org);
+        }
+    }
+}
@@ -0,0 +1,310 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "stdafx.h"
+#include <random>
+#include <vector>
+#include "Benchmark.h"
+#include "../Subtitles/VobSubImage.h"
+
+namespace
+{
+    const int kRandomPackets = 6000;
+
+    // What CVobSubImage::Decode did before it used a lookup table: the codes are read
+    // nibble by nibble and each run is clipped and colored on its own
+    class CReferenceDecoder
+    {
+        const BYTE* m_data;
+        size_t m_offset[2], m_plane;
+        bool m_bAligned;
+        CRect m_rect;
+        const RGBQUAD* m_colors;
+        std::vector<RGBQUAD>& m_pixels;
+
+        BYTE GetNibble() {
+            size_t& off = m_offset[m_plane];
+            BYTE ret = m_data[off];
+            if (m_bAligned) {
+                ret >>= 4;
+            }
+            ret &= 0x0f;
+            m_bAligned = !m_bAligned;
+            if (m_bAligned) {
+                off++;
+            }
+            return ret;
+        }
+
+        void DrawPixels(CPoint p, int length, size_t colorId) {
+            if (length <= 0 || p.x + length < m_rect.left || p.x >= m_rect.right || p.y < m_rect.top || p.y >= m_rect.bottom) {
+                return;
+            }
+            if (p.x < m_rect.left) {
+                p.x = m_rect.left;
+            }
+            if (p.x + length >= m_rect.right) {
+                length = m_rect.right - p.x;
+            }
+            RGBQUAD* ptr = &m_pixels[m_rect.Width() * (p.y - m_rect.top) + (p.x - m_rect.left)];
+            while (length-- > 0) {
+                *ptr++ = m_colors[colorId];
+            }
+        }
+
+    public:
+        CReferenceDecoder(const RGBQUAD* colors, std::vector<RGBQUAD>& pixels)
+            : m_data(nullptr), m_plane(0), m_bAligned(true), m_colors(colors), m_pixels(pixels) {}
+
+        // Returns the decoded rect, the lines past its bottom were left unfinished
+        CRect Decode(const BYTE* data, size_t dataSize, const CRect& rect, size_t offset0, size_t offset1) {
+            m_data = data;
+            m_offset[0] = offset0;
+            m_offset[1] = offset1;
+            m_plane = 0;
+            m_bAligned = true;
+            m_rect = rect;
+            m_pixels.assign(rect.Width() * rect.Height(), RGBQUAD());
+
+            CPoint p = rect.TopLeft();
+            size_t end[] = { offset1, dataSize };
+
+            while (m_offset[m_plane] < end[m_plane]) {
+                DWORD code;
+                if ((code = GetNibble()) >= 0x4
+                        || (code = (code << 4) | GetNibble()) >= 0x10
+                        || (code = (code << 4) | GetNibble()) >= 0x40
+                        || (code = (code << 4) | GetNibble()) >= 0x100) {
+                    DrawPixels(p, code >> 2, code & 3);
+                    if ((p.x += code >> 2) < rect.right) {
+                        continue;
+                    }
+                }
+                DrawPixels(p, rect.right - p.x, code & 3);
+                if (!m_bAligned) {
+                    GetNibble();
+                }
+                p.x = rect.left;
+                p.y++;
+                m_plane = 1 - m_plane;
+            }
+
+            return CRect(rect.left, rect.top, rect.right, std::min(p.y, rect.bottom));
+        }
+    };
+
+    class CNibbleWriter
+    {
+        std::vector<BYTE>& m_data;
+        bool m_bHigh;
+
+    public:
+        CNibbleWriter(std::vector<BYTE>& data) : m_data(data), m_bHigh(true) {}
+
+        void Write(DWORD code, int nNibbles) {
+            for (int i = nNibbles - 1; i >= 0; i--) {
+                BYTE nibble = (code >> (i * 4)) & 0xf;
+                if (m_bHigh) {
+                    m_data.push_back(BYTE(nibble << 4));
+                } else {
+                    m_data.back() |= nibble;
+                }
+                m_bHigh = !m_bHigh;
+            }
+        }
+
+        void Align() {
+            m_bHigh = true;
+        }
+    };
+
+    struct Packet {
+        std::vector<BYTE> data;
+        size_t dataSize;
+        CRect rect;
+        size_t offsets[2];
+    };
+
+    // Encodes the lines of a subpicture, given as runs of (length, color) where a zero length
+    // fills the rest of the line, then wraps them in a packet with a single control block.
+    // The garbage is appended to the data of both fields.
+    Packet MakePacket(const CRect& rect, const std::vector<std::vector<std::pair<int, int>>>& lines,
+                      size_t nTruncatedBytes = 0, const std::vector<BYTE>& garbage = std::vector<BYTE>())
+    {
+        Packet packet;
+        packet.rect = rect;
+        std::vector<BYTE>& data = packet.data;
+        data.assign(4, 0);
+
+        for (int field = 0; field < 2; field++) {
+            packet.offsets[field] = data.size();
+            CNibbleWriter writer(data);
+            for (size_t y = field; y < lines.size(); y += 2) {
+                for (const auto& run : lines[y]) {
+                    DWORD code = (DWORD(run.first) << 2) | run.second;
+                    int nNibbles = run.first == 0 ? 4 : run.first < 4 ? 1 : run.first < 16 ? 2 : run.first < 64 ? 3 : 4;
+                    writer.Write(code, nNibbles);
+                }
+                writer.Align();
+            }
+            data.insert(data.end(), garbage.cbegin(), garbage.cend());
+        }
+
+        data.resize(data.size() - std::min(nTruncatedBytes, data.size() - packet.offsets[1]));
+        packet.dataSize = data.size();
+
+        const BYTE control[] = {
+            0x00, 0x00, BYTE(packet.dataSize >> 8), BYTE(packet.dataSize),
+            0x01,
+            0x03, 0x32, 0x10,
+            0x04, 0xff, 0xf0,
+            0x05, BYTE(rect.left >> 4), BYTE((rect.left << 4) | ((rect.right - 1) >> 8)), BYTE(rect.right - 1),
+            BYTE(rect.top >> 4), BYTE((rect.top << 4) | ((rect.bottom - 1) >> 8)), BYTE(rect.bottom - 1),
+            0x06, BYTE(packet.offsets[0] >> 8), BYTE(packet.offsets[0]), BYTE(packet.offsets[1] >> 8), BYTE(packet.offsets[1]),
+            0xff
+        };
+        data.insert(data.end(), std::begin(control), std::end(control));
+
+        data[0] = BYTE(data.size() >> 8);
+        data[1] = BYTE(data.size());
+        data[2] = BYTE(packet.dataSize >> 8);
+        data[3] = BYTE(packet.dataSize);
+
+        return packet;
+    }
+
+    // Lines of text: transparent gaps, then glyphs drawn with the body, outline and antialiasing colors
+    std::vector<std::vector<std::pair<int, int>>> MakeTextLines(std::mt19937& rng, int width, int height)
+    {
+        std::vector<std::vector<std::pair<int, int>>> lines(height);
+        for (auto& line : lines) {
+            for (int x = 0; x < width;) {
+                int length = std::min(width - x, int(rng() % 3 ? 1 + rng() % 12 : 20 + rng() % 300));
+                int color = rng() % 4;
+                if (x + length == width && rng() % 2) {
+                    line.emplace_back(0, color);
+                } else {
+                    for (int left = length; left > 0; left -= 255) {
+                        line.emplace_back(std::min(left, 255), color);
+                    }
+                }
+                x += length;
+            }
+        }
+        return lines;
+    }
+
+    bool Decode(CVobSubImage& image, Packet& packet, RGBQUAD* palette)
+    {
+        return image.Decode(packet.data.data(), packet.data.size(), packet.dataSize, 0, true, 0, nullptr, palette, false);
+    }
+
+    bool IsSameDecoding(CVobSubImage& image, Packet& packet, RGBQUAD* palette, std::vector<RGBQUAD>& reference)
+    {
+        CReferenceDecoder decoder(palette, reference);
+        CRect rect = decoder.Decode(packet.data.data(), packet.dataSize, packet.rect, packet.offsets[0], packet.offsets[1]);
+
+        if (!Decode(image, packet, palette) || image.rect != rect) {
+            return false;
+        }
+        // Only the complete lines are written
+        size_t size = rect.Width() * rect.Height();
+        return !size || !memcmp(image.lpPixels, reference.data(), size * sizeof(RGBQUAD));
+    }
+
+    void RunDecoder(LPCTSTR name, int width, int height, RGBQUAD* palette)
+    {
+        std::mt19937 rng(width ^ height);
+        Packet packet = MakePacket(CRect(0, 0, width, height), MakeTextLines(rng, width, height));
+
+        CVobSubImage image;
+        std::vector<RGBQUAD> reference;
+        Check(IsSameDecoding(image, packet, palette, reference), CString(name) + _T(" isn't decoded as before"));
+
+        double seconds = TimeIt([&] { Decode(image, packet, palette); });
+        double referenceSeconds = TimeIt([&] {
+            CReferenceDecoder(palette, reference).Decode(packet.data.data(), packet.dataSize, packet.rect, packet.offsets[0], packet.offsets[1]);
+        });
+
+        CString label;
+        label.Format(_T("%s, lookup table"), name);
+        ReportRate(label, double(width) * height, _T("pixels"), seconds);
+        label.Format(_T("%s, nibble by nibble"), name);
+        ReportRate(label, double(width) * height, _T("pixels"), referenceSeconds);
+    }
+}
+
+std::vector<BYTE> MakeSubPicture(const CRect& rect, const std::vector<BYTE>& image)
+{
+    const int width = rect.Width();
+    std::vector<std::vector<std::pair<int, int>>> lines(rect.Height());
+    for (int y = 0; y < rect.Height(); y++) {
+        const BYTE* row = &image[y * width];
+        for (int x = 0; x < width;) {
+            int length = 1;
+            while (x + length < width && length < 255 && row[x + length] == row[x]) {
+                length++;
+            }
+            lines[y].emplace_back(x + length == width ? 0 : length, row[x]);
+            x += length;
+        }
+    }
+    return MakePacket(rect, lines).data;
+}
+
+void BenchmarkVobSubDecoding()
+{
+    RGBQUAD palette[4] = {
+        { 0x00, 0x00, 0x00, 0x00 }, { 0xff, 0xff, 0xff, 0xff }, { 0x20, 0x20, 0x20, 0xff }, { 0x80, 0x80, 0x80, 0x80 }
+    };
+
+    // Valid, truncated and garbage packets, decoded as the nibble by nibble decoder did
+    std::mt19937 rng(23);
+    bool bSame = true;
+    CVobSubImage image;
+    std::vector<RGBQUAD> reference;
+    for (int i = 0; i < kRandomPackets && bSame; i++) {
+        int left = rng() % 200, top = rng() % 200;
+        CRect rect(left, top, left + 1 + rng() % 400, top + 1 + rng() % 60);
+
+        Packet packet;
+        switch (i % 3) {
+            case 0:
+                packet = MakePacket(rect, MakeTextLines(rng, rect.Width(), rect.Height()));
+                break;
+            case 1:
+                packet = MakePacket(rect, MakeTextLines(rng, rect.Width(), rect.Height()), rng() % 64);
+                break;
+            case 2: {
+                std::vector<std::vector<std::pair<int, int>>> lines;
+                std::vector<BYTE> garbage(rng() % 2000);
+                for (auto& b : garbage) {
+                    b = BYTE(rng());
+                }
+                packet = MakePacket(rect, lines, 0, garbage);
+            }
+            break;
+        }
+        bSame = IsSameDecoding(image, packet, palette, reference);
+    }
+    Check(bSame, _T("random packets aren't decoded as before"));
+
+    RunDecoder(_T("720x100"), 720, 100, palette);
+    RunDecoder(_T("1920x1080"), 1920, 1080, palette);
+}
@@ -0,0 +1,252 @@
+/*
+ * (C) 2017 see Authors.txt
+ *
+ * This file is part of MPC-HC.
+ *
+ * MPC-HC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-HC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "stdafx.h"
+#include <random>
+#include <vector>
+#include "Benchmark.h"
+#include "../Subtitles/VobSubFile.h"
+#include "../Subtitles/WorkStealingPool.h"
+
+namespace
+{
+    const int kSubPics = 300;
+    const int kSubPicWidth = 560;
+    const int kSubPicHeight = 88;
+
+    // Lines of text: discs and rings drawn with the body color, outlined with another one
+    std::vector<BYTE> MakeGlyphs(std::mt19937& rng, int width, int height)
+    {
+        std::vector<BYTE> image(width * height, 0);
+        for (int top = 0; top + 44 <= height; top += 44) {
+            for (int left = 4; left + 40 < width; left += 16 + rng() % 16) {
+                int cx = left + 18, cy = top + 22 + int(rng() % 9) - 4, r = 4 + rng() % 12;
+                bool bRing = rng() % 2 == 0;
+                for (int y = cy - r - 2; y <= cy + r + 2; y++) {
+                    for (int x = cx - r - 2; x <= cx + r + 2; x++) {
+                        int d = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+                        BYTE& pixel = image[y * width + x];
+                        if (d <= r * r && (!bRing || 4 * d >= r * r)) {
+                            pixel = 1;
+                        } else if (d <= (r + 2) * (r + 2) && pixel == 0) {
+                            pixel = 2;
+                        }
+                    }
+                }
+            }
+        }
+        return image;
+    }
+
+    // Writes the packets as the subpictures of the first language of a VobSub file, one every
+    // 2 seconds, and returns the path of its .idx
+    CString WriteVobSub(LPCTSTR name, const std::vector<std::vector<BYTE>>& packets)
+    {
+        static const BYTE packHeader[] = {
+            0x00, 0x00, 0x01, 0xba, 0x44, 0x00, 0x04, 0x00, 0x04, 0x01, 0x01, 0x89, 0xc3, 0xf8
+        };
+        // Private stream 1 for the first subpicture stream, only the first sector of a packet has a PTS
+        static const BYTE firstStreamHeader[] = {
+            0x00, 0x00, 0x01, 0xbd, 0x07, 0xec, 0x81, 0x80, 0x05, 0x21, 0x00, 0x01, 0x00, 0x01, 0x20
+        };
+        static const BYTE nextStreamHeader[] = {
+            0x00, 0x00, 0x01, 0xbd, 0x07, 0xec, 0x81, 0x00, 0x00, 0x20
+        };
+
+        CStringA idx = "# VobSub index file, v7 (do not modify this line!)\n"
+                       "size: 720x480\n"
+                       "palette: 000000, ffffff, 202020, 808080, 000000, 000000, 000000, 000000, "
+                       "000000, 000000, 000000, 000000, 000000, 000000, 000000, 000000\n"
+                       "id: en, index: 0\n";
+        std::vector<BYTE> sub;
+        for (size_t i = 0; i < packets.size(); i++) {
+            int s = int(i) * 2;
+            idx.AppendFormat("timestamp: %02d:%02d:%02d:000, filepos: %09x\n", s / 3600, s / 60 % 60, s % 60, unsigned(sub.size()));
+
+            const std::vector<BYTE>& packet = packets[i];
+            for (size_t offset = 0; offset < packet.size();) {
+                size_t sectorEnd = sub.size() + 0x800;
+                sub.insert(sub.end(), std::begin(packHeader), std::end(packHeader));
+                if (offset == 0) {
+                    sub.insert(sub.end(), std::begin(firstStreamHeader), std::end(firstStreamHeader));
+                } else {
+                    sub.insert(sub.end(), std::begin(nextStreamHeader), std::end(nextStreamHeader));
+                }
+                size_t size = std::min(packet.size() - offset, sectorEnd - sub.size());
+                sub.insert(sub.end(), packet.cbegin() + offset, packet.cbegin() + offset + size);
+                sub.resize(sectorEnd, 0xff);
+                offset += size;
+            }
+        }
+
+        WriteTempFile(CString(name) + _T(".sub"), sub.data(), sub.size());
+        return WriteTempFile(CString(name) + _T(".idx"), (LPCSTR)idx, idx.GetLength());
+    }
+
+    // Writes the subpictures of the benchmarks as a VobSub file and opens it
+    bool OpenVobSub(CVobSubFile& vsf, std::vector<std::vector<BYTE>>& packets)
+    {
+        std::mt19937 rng(24);
+        const CRect rect(120, 400, 120 + kSubPicWidth, 400 + kSubPicHeight);
+        packets.clear();
+        for (int i = 0; i < kSubPics; i++) {
+            packets.emplace_back(MakeSubPicture(rect, MakeGlyphs(rng, kSubPicWidth, kSubPicHeight)));
+        }
+
+        bool bOpened = vsf.Open(WriteVobSub(_T("SubtitlesBenchmark"), packets));
+        Check(bOpened, _T("the VobSub file couldn't be opened"));
+        return bOpened;
+    }
+
+    struct ExportFormat {
+        LPCTSTR name;
+        CVobSubFile::SubFormat sf;
+        LPCTSTR scriptExtensions[2];
+        LPCTSTR bitmapName;    // Formatted with the path and the number of the subpicture
+    };
+
+    const ExportFormat kExportFormats[] = {
+        { _T("WinSubMux"), CVobSubFile::WinSubMux, { _T(".sub"), nullptr }, _T("%s_%06d.bmp") },
+        { _T("Scenarist"), CVobSubFile::Scenarist, { _T(".sst"), nullptr }, _T("%s_%04d.bmp") },
+        { _T("Maestro"), CVobSubFile::Maestro, { _T(".son"), _T(".spf") }, _T("%s_%04d.bmp") },
+    };
+
+    // Reads the files an export to fn may have written, those which don't exist are empty,
+    // and deletes them
+    std::vector<std::vector<BYTE>> TakeExportedFiles(const CString& fn, const ExportFormat& format)
+    {
+        std::vector<CString> names;
+        for (LPCTSTR ext : format.scriptExtensions) {
+            if (ext) {
+                names.emplace_back(fn + ext);
+            }
+        }
+        for (int i = 1; i <= kSubPics; i++) {
+            CString name;
+            name.Format(format.bitmapName, fn.GetString(), i);
+            names.emplace_back(name);
+        }
+
+        std::vector<std::vector<BYTE>> files(names.size());
+        for (size_t i = 0; i < names.size(); i++) {
+            CFile file;
+            if (file.Open(names[i], CFile::modeRead | CFile::shareDenyNone)) {
+                files[i].resize(size_t(file.GetLength()));
+                if (!files[i].empty()) {
+                    file.Read(files[i].data(), UINT(files[i].size()));
+                }
+                file.Close();
+                DeleteFile(names[i]);
+            }
+        }
+        return files;
+    }
+
+    bool IsSamePolygonized(const std::vector<CVobSubFile::PolygonizedSubPic>& a,
+                           const std::vector<CVobSubFile::PolygonizedSubPic>& b)
+    {
+        return a.size() == b.size() && std::equal(a.cbegin(), a.cend(), b.cbegin(), [](const auto & x, const auto & y) {
+            return x.idx == y.idx && x.start == y.start && x.stop == y.stop && x.bForced == y.bForced && x.assstr == y.assstr;
+        });
+    }
+}
+
+void BenchmarkVobSubPolygonize()
+{
+    CVobSubFile vsf(nullptr);
+    std::vector<std::vector<BYTE>> packets;
+    if (!OpenVobSub(vsf, packets)) {
+        return;
+    }
+
+    // What the batch gives, subpicture by subpicture on the calling thread
+    auto polygonizeSerially = [&](std::vector<CVobSubFile::PolygonizedSubPic>& subPics) {
+        subPics.clear();
+        CVobSubImage img;
+        const auto& sp = vsf.m_langs[0].subpos;
+        for (size_t i = 0; i < packets.size(); i++) {
+            std::vector<BYTE>& packet = packets[i];
+            CStringW assstr;
+            if (sp[i].bValid
+                    && img.Decode(packet.data(), packet.size(), (packet[2] << 8) | packet[3], INT_MAX,
+                                  vsf.m_bCustomPal, vsf.m_tridx, vsf.m_orgpal, vsf.m_cuspal, true)
+                    && img.Polygonize(assstr, true, 3)) {
+                CVobSubFile::PolygonizedSubPic subPic = { i, sp[i].start, sp[i].stop, sp[i].bForced, assstr };
+                subPics.emplace_back(subPic);
+            }
+        }
+    };
+
+    std::vector<CVobSubFile::PolygonizedSubPic> serial, batch, batchAgain;
+    polygonizeSerially(serial);
+    bool bBatch = vsf.Polygonize(batch, 0);
+    bool bBatchAgain = vsf.Polygonize(batchAgain, 0);
+    Check(serial.size() == size_t(kSubPics), _T("serially, some subpictures weren't polygonized"));
+    Check(bBatch && IsSamePolygonized(serial, batch), _T("the batch doesn't give the same drawings"));
+    Check(bBatchAgain && IsSamePolygonized(batch, batchAgain), _T("the batch isn't deterministic"));
+
+    double serialSeconds = TimeIt([&] { polygonizeSerially(serial); });
+    double batchSeconds = TimeIt([&] { vsf.Polygonize(batch, 0); });
+
+    CString label;
+    label.Format(_T("%d subpictures, serially"), kSubPics);
+    ReportTime(label, serialSeconds);
+    label.Format(_T("%d subpictures, batch of %u threads"), kSubPics, CWorkStealingPool::GetShared()->GetThreadCount());
+    ReportTime(label, batchSeconds);
+}
+
+void BenchmarkVobSubExport()
+{
+    CVobSubFile vsf(nullptr);
+    std::vector<std::vector<BYTE>> packets;
+    if (!OpenVobSub(vsf, packets)) {
+        return;
+    }
+
+    TCHAR path[MAX_PATH];
+    VERIFY(GetTempPath(MAX_PATH, path));
+    const CString fn = CString(path) + _T("SubtitlesBenchmarkExport");
+
+    for (const auto& format : kExportFormats) {
+        TakeExportedFiles(fn, format);
+
+        bool bSerial = false, bParallel = false;
+        double serialSeconds = TimeIt([&] { bSerial = vsf.Save(fn, 0, format.sf, nullptr, false); }, 0.0);
+        auto serial = TakeExportedFiles(fn, format);
+
+        size_t nProgress = 0;
+        bool bInOrder = true;
+        auto progress = [&](size_t nDone, size_t nTotal) {
+            bInOrder = bInOrder && nDone == ++nProgress && nTotal == size_t(kSubPics);
+            return true;
+        };
+        double parallelSeconds = TimeIt([&] { nProgress = 0; bParallel = vsf.Save(fn, 0, format.sf, progress, true); }, 0.0);
+        auto parallel = TakeExportedFiles(fn, format);
+
+        Check(bSerial && bParallel && !serial.front().empty(), CString(format.name) + _T(" couldn't be exported"));
+        Check(serial == parallel, CString(format.name) + _T(" isn't exported the same on the worker pool"));
+        Check(bInOrder && nProgress == size_t(kSubPics), CString(format.name) + _T(" doesn't report its progress in order"));
+
+        CString label;
+        label.Format(_T("%s, serially"), format.name);
+        ReportTime(label, serialSeconds);
+        label.Format(_T("%s, on the worker pool"), format.name);
+        ReportTime(label, parallelSeconds);
+    }
+}
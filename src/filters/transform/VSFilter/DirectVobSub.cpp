@@ -22,6 +22,7 @@
 #include "stdafx.h"
 #include "DirectVobSub.h"
 #include "VSFilter.h"
+#include "../../../Subtitles/SubtitleFileCache.h"
 
 CDirectVobSub::CDirectVobSub()
     : m_iSelectedLanguage(0)
@@ -54,6 +55,9 @@ CDirectVobSub::CDirectVobSub()
     m_SubtitleSpeedDiv = theApp.GetProfileInt(ResStr(IDS_R_TIMING), ResStr(IDS_RTM_SUBTITLESPEEDDIV), 1000);
     m_fMediaFPSEnabled = !!theApp.GetProfileInt(ResStr(IDS_R_TIMING), ResStr(IDS_RTM_MEDIAFPSENABLED), FALSE);
     m_ePARCompensationType = static_cast<CSimpleTextSubtitle::EPARCompensationType>(theApp.GetProfileInt(ResStr(IDS_R_TEXT), ResStr(IDS_RT_AUTOPARCOMPENSATION), 0));
+    if (theApp.GetProfileInt(ResStr(IDS_R_GENERAL), ResStr(IDS_RG_SUBTITLEFILECACHE), FALSE)) {
+        CSubtitleFileCache::SetDirectory(CSubtitleFileCache::GetDefaultDirectory());
+    }
 
     int gcd = GCD(m_SubtitleSpeedMul, m_SubtitleSpeedDiv);
     m_SubtitleSpeedNormalizedMul = m_SubtitleSpeedMul / gcd;
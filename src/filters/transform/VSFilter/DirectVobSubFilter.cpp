@@ -102,6 +102,14 @@ CDirectVobSubFilter::CDirectVobSubFilter(LPUNKNOWN punk, HRESULT* phr, const GUI
 CDirectVobSubFilter::~CDirectVobSubFilter()
 {
     CAutoLock cAutoLock(&m_csQueueLock);
+
+    // The look ahead of the streams would outlive m_csSubLock otherwise
+    POSITION pos = m_pSubStreams.GetHeadPosition();
+    while (pos) {
+        if (CComQIPtr<IRenderingCacheStats> pCacheStats = m_pSubStreams.GetNext(pos)) {
+            pCacheStats->StopLookAhead();
+        }
+    }
     if (m_pSubPicQueue) {
         m_pSubPicQueue->Invalidate();
     }
@@ -66,6 +66,10 @@ namespace Plugin
         }
         virtual ~CFilter() {
             CAMThread::CallWorker(0);
+            // The look ahead of the provider would outlive m_csSubLock otherwise
+            if (CComQIPtr<IRenderingCacheStats> pCacheStats = m_pSubPicProvider) {
+                pCacheStats->StopLookAhead();
+            }
         }
 
         CString GetFileName() {
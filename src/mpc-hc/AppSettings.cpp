@@ -32,6 +32,8 @@
 #include "WinAPIUtils.h"
 #include "moreuuids.h"
 #include "mplayerc.h"
+#include "../Subtitles/Rasterizer.h"
+#include "../Subtitles/SubtitleFileCache.h"
 #include "../thirdparty/sanear/sanear/src/Factory.h"
 #include <VersionHelpersInternal.h>
 #include <mvrInterfaces.h>
@@ -210,6 +212,9 @@ CAppSettings::CAppSettings()
     , nCoverArtSizeLimit(600)
     , bEnableLogging(false)
     , bUseLegacyToolbar(false)
+    , nSubtitleRasterizerBands(0)
+    , bSubtitleFastBeBlur(false)
+    , bSubtitleFileCache(false)
     , iLAVGPUDevice(DWORD_MAX)
     , nCmdVolume(0)
     , eSubtitleRenderer(SubtitleRenderer::INTERNAL)
@@ -1062,6 +1067,10 @@ void CAppSettings::SaveSettings()
     pApp->WriteProfileInt(IDS_R_SETTINGS, IDS_RS_LOGGING, bEnableLogging);
     pApp->WriteProfileInt(IDS_R_SETTINGS, IDS_RS_USE_LEGACY_TOOLBAR, bUseLegacyToolbar);
 
+    pApp->WriteProfileInt(IDS_R_SETTINGS, IDS_RS_SUBTITLE_RASTERIZER_BANDS, nSubtitleRasterizerBands);
+    pApp->WriteProfileInt(IDS_R_SETTINGS, IDS_RS_SUBTITLE_FAST_BE_BLUR, bSubtitleFastBeBlur);
+    pApp->WriteProfileInt(IDS_R_SETTINGS, IDS_RS_SUBTITLE_FILE_CACHE, bSubtitleFileCache);
+
     VERIFY(pApp->WriteProfileInt(IDS_R_SETTINGS, IDS_RS_SUBTITLE_RENDERER,
                                  static_cast<int>(eSubtitleRenderer)));
 
@@ -1803,6 +1812,13 @@ void CAppSettings::LoadSettings()
     bEnableLogging = !!pApp->GetProfileInt(IDS_R_SETTINGS, IDS_RS_LOGGING, FALSE);
     bUseLegacyToolbar = !!pApp->GetProfileInt(IDS_R_SETTINGS, IDS_RS_USE_LEGACY_TOOLBAR, FALSE);
 
+    nSubtitleRasterizerBands = std::max(0, (int)pApp->GetProfileInt(IDS_R_SETTINGS, IDS_RS_SUBTITLE_RASTERIZER_BANDS, 0));
+    Rasterizer::SetBandCount(nSubtitleRasterizerBands);
+    bSubtitleFastBeBlur = !!pApp->GetProfileInt(IDS_R_SETTINGS, IDS_RS_SUBTITLE_FAST_BE_BLUR, FALSE);
+    Rasterizer::SetExactBeBlur(!bSubtitleFastBeBlur);
+    bSubtitleFileCache = !!pApp->GetProfileInt(IDS_R_SETTINGS, IDS_RS_SUBTITLE_FILE_CACHE, FALSE);
+    CSubtitleFileCache::SetDirectory(bSubtitleFileCache ? CSubtitleFileCache::GetDefaultDirectory() : CString());
+
     eSubtitleRenderer = static_cast<SubtitleRenderer>(pApp->GetProfileInt(IDS_R_SETTINGS,
                                                       IDS_RS_SUBTITLE_RENDERER, static_cast<int>(SubtitleRenderer::INTERNAL)));
 
@@ -701,6 +701,13 @@ public:
     bool            bEnableLogging;
     bool            bUseLegacyToolbar;
 
+    // Bands rasterized in parallel for large subtitles, 0 for one per CPU core and 1 for none
+    int             nSubtitleRasterizerBands;
+    // Approximate strong \be blurs in constant time instead of repeating the exact blur
+    bool            bSubtitleFastBeBlur;
+    // Keep large subtitle files parsed on disk
+    bool            bSubtitleFileCache;
+
     bool            IsD3DFullscreen() const;
     CString         SelectedAudioRenderer() const;
     bool            IsISRAutoLoadEnabled() const;
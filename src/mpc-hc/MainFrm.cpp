@@ -12039,6 +12039,13 @@ void CMainFrame::CloseMediaPrivate()
     m_pCB.Release();
 
     SetSubtitle(SubtitleInput(nullptr));
+    // The subpic queue might keep the streams alive for a while, their look ahead stops now
+    POSITION pos = m_pSubStreams.GetHeadPosition();
+    while (pos) {
+        if (CComQIPtr<IRenderingCacheStats> pCacheStats = m_pSubStreams.GetNext(pos).pSubStream) {
+            pCacheStats->StopLookAhead();
+        }
+    }
     {
         CAutoLock cAutoLock(&m_csSubLock);
         m_pSubStreams.RemoveAll();
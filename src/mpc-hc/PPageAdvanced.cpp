@@ -23,6 +23,8 @@
 #include "mplayerc.h"
 #include "MainFrm.h"
 #include "EventDispatcher.h"
+#include "../Subtitles/Rasterizer.h"
+#include "../Subtitles/SubtitleFileCache.h"
 #include <strsafe.h>
 
 CPPageAdvanced::CPPageAdvanced()
@@ -143,6 +145,12 @@ void CPPageAdvanced::InitSettings()
     addIntItem(DEFAULT_TOOLBAR_SIZE, IDS_RS_DEFAULTTOOLBARSIZE, 24, s.nDefaultToolbarSize,
                std::make_pair(16, 128), StrRes(IDS_PPAGEADVANCED_DEFAULTTOOLBARSIZE));
     addBoolItem(USE_LEGACY_TOOLBAR, IDS_RS_USE_LEGACY_TOOLBAR, false, s.bUseLegacyToolbar, StrRes(IDS_PPAGEADVANCED_USE_LEGACY_TOOLBAR));
+    addIntItem(SUBTITLE_RASTERIZER_BANDS, IDS_RS_SUBTITLE_RASTERIZER_BANDS, 0, s.nSubtitleRasterizerBands,
+               std::make_pair(0, 64), StrRes(IDS_PPAGEADVANCED_SUBTITLE_RASTERIZER_BANDS));
+    addBoolItem(SUBTITLE_FAST_BE_BLUR, IDS_RS_SUBTITLE_FAST_BE_BLUR, false, s.bSubtitleFastBeBlur,
+                StrRes(IDS_PPAGEADVANCED_SUBTITLE_FAST_BE_BLUR));
+    addBoolItem(SUBTITLE_FILE_CACHE, IDS_RS_SUBTITLE_FILE_CACHE, false, s.bSubtitleFileCache,
+                StrRes(IDS_PPAGEADVANCED_SUBTITLE_FILE_CACHE));
 }
 
 BOOL CPPageAdvanced::OnApply()
@@ -161,6 +169,10 @@ BOOL CPPageAdvanced::OnApply()
     s.filePositions.SetMaxSize(s.iRecentFilesNumber);
     s.dvdPositions.SetMaxSize(s.iRecentFilesNumber);
 
+    Rasterizer::SetBandCount(s.nSubtitleRasterizerBands);
+    Rasterizer::SetExactBeBlur(!s.bSubtitleFastBeBlur);
+    CSubtitleFileCache::SetDirectory(s.bSubtitleFileCache ? CSubtitleFileCache::GetDefaultDirectory() : CString());
+
     // There is no main frame when the option dialog is displayed stand-alone
     if (CMainFrame* pMainFrame = AfxGetMainFrame()) {
         pMainFrame->UpdateControlState(CMainFrame::UPDATE_CONTROLS_VISIBILITY);
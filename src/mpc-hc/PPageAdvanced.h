@@ -148,6 +148,9 @@ private:
         AUTO_DOWNLOAD_SCORE_SERIES,
         DEFAULT_TOOLBAR_SIZE,
         USE_LEGACY_TOOLBAR,
+        SUBTITLE_RASTERIZER_BANDS,
+        SUBTITLE_FAST_BE_BLUR,
+        SUBTITLE_FILE_CACHE,
     };
 
     enum {
@@ -314,6 +314,9 @@
 #define IDS_RS_USE_LEGACY_TOOLBAR           _T("UseLegacyToolbar")
 
 #define IDS_RS_SUBTITLE_RENDERER            _T("SubtitleRenderer")
+#define IDS_RS_SUBTITLE_RASTERIZER_BANDS    _T("SubtitleRasterizerBands")
+#define IDS_RS_SUBTITLE_FAST_BE_BLUR        _T("SubtitleFastBeBlur")
+#define IDS_RS_SUBTITLE_FILE_CACHE          _T("SubtitleFileCache")
 
 #define IDS_R_SANEAR                        IDS_R_INTERNAL_FILTERS _T("\\Audio Renderer")
 #define IDS_RS_SANEAR_DEVICE_ID             _T("DeviceId")
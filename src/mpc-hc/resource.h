@@ -1572,6 +1572,9 @@
 #define IDS_CMD_VIEWPRESET              57536
 #define IDS_CMD_MUTE                    57537
 #define IDS_CMD_VOLUME                  57538
+#define IDS_PPAGEADVANCED_SUBTITLE_RASTERIZER_BANDS 57539
+#define IDS_PPAGEADVANCED_SUBTITLE_FAST_BE_BLUR 57540
+#define IDS_PPAGEADVANCED_SUBTITLE_FILE_CACHE 57541
 
 // Next default values for new objects
 // 
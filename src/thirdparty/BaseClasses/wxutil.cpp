@@ -510,6 +510,22 @@ void CCritSec::Lock()
     }
 }
 
+BOOL CCritSec::TryLock()
+{
+    if (!TryEnterCriticalSection(&m_CritSec)) {
+        return FALSE;
+    }
+    if (0 == m_lockCount++) {
+        // we now own it for the first time.  Set owner information
+        m_currentOwner = GetCurrentThreadId();
+
+        if (m_fTrace) {
+            DbgLog((LOG_LOCKING, 3, TEXT("Thread %d now owns lock %x"), m_currentOwner, &m_CritSec));
+        }
+    }
+    return TRUE;
+}
+
 void CCritSec::Unlock() {
     if (0 == --m_lockCount) {
         // about to be unowned
@@ -33,6 +33,7 @@ public:
     CCritSec();
     ~CCritSec();
     void Lock();
+    BOOL TryLock();
     void Unlock();
 #else
 
@@ -49,6 +50,10 @@ public:
         EnterCriticalSection(&m_CritSec);
     };
 
+    BOOL TryLock() {
+        return TryEnterCriticalSection(&m_CritSec);
+    };
+
     void Unlock() {
         LeaveCriticalSection(&m_CritSec);
     };
@@ -102,6 +107,29 @@ public:
     };
 };
 
+// unlocks a critical section which was locked beforehand,
+// typically with TryLock, when it goes out of scope
+class CAutoUnlock {
+
+    // make copy constructor and assignment operator inaccessible
+
+    CAutoUnlock(const CAutoUnlock &refAutoUnlock);
+    CAutoUnlock &operator=(const CAutoUnlock &refAutoUnlock);
+
+protected:
+    CCritSec * m_pLock;
+
+public:
+    CAutoUnlock(CCritSec * plock)
+    {
+        m_pLock = plock;
+    };
+
+    ~CAutoUnlock() {
+        m_pLock->Unlock();
+    };
+};
+
 
 
 // wrapper for event objects